@@ -4,5 +4,5 @@
 
 USER_OBJS :=
 
-LIBS := -lfftw3 -lfftw3f
+LIBS := -lfftw3f_threads -lfftw3 -lfftw3f -lz -llzma -lpthread -lrt
 
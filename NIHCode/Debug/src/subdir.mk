@@ -4,13 +4,58 @@
 
 # Add inputs and outputs from these tool invocations to the build variables 
 CPP_SRCS += \
-../src/NIHCode.cpp 
+../src/FrameIndex.cpp \
+../src/FramePipeline.cpp \
+../src/FrameRing.cpp \
+../src/FrameSource.cpp \
+../src/FrameTrace.cpp \
+../src/InputFile.cpp \
+../src/LiveResults.cpp \
+../src/NIHCode.cpp \
+../src/NumberReader.cpp \
+../src/PerfCounters.cpp \
+../src/QData.cpp \
+../src/QuantizedTrajectory.cpp \
+../src/ResourcePlan.cpp \
+../src/SpectrumAnalyzer.cpp \
+../src/SyntheticMembrane.cpp \
+../src/TaskPool.cpp 
 
 OBJS += \
-./src/NIHCode.o 
+./src/FrameIndex.o \
+./src/FramePipeline.o \
+./src/FrameRing.o \
+./src/FrameSource.o \
+./src/FrameTrace.o \
+./src/InputFile.o \
+./src/LiveResults.o \
+./src/NIHCode.o \
+./src/NumberReader.o \
+./src/PerfCounters.o \
+./src/QData.o \
+./src/QuantizedTrajectory.o \
+./src/ResourcePlan.o \
+./src/SpectrumAnalyzer.o \
+./src/SyntheticMembrane.o \
+./src/TaskPool.o 
 
 CPP_DEPS += \
-./src/NIHCode.d 
+./src/FrameIndex.d \
+./src/FramePipeline.d \
+./src/FrameRing.d \
+./src/FrameSource.d \
+./src/FrameTrace.d \
+./src/InputFile.d \
+./src/LiveResults.d \
+./src/NIHCode.d \
+./src/NumberReader.d \
+./src/PerfCounters.d \
+./src/QData.d \
+./src/QuantizedTrajectory.d \
+./src/ResourcePlan.d \
+./src/SpectrumAnalyzer.d \
+./src/SyntheticMembrane.d \
+./src/TaskPool.d 
 
 
 # Each subdirectory must supply rules for building sources it contributes
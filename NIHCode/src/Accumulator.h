@@ -0,0 +1,202 @@
+/*
+ * Accumulator.h
+ *
+ * Long-run sums.  The per-frame spectra are computed in single precision,
+ * but adding hundreds of thousands of frames into a float loses the low
+ * order bits of every contribution once the sum is large.  The summation
+ * policy is a template parameter of the accumulation kernels:
+ *
+ *   FloatSum  - plain float, as the code always did
+ *   KahanSum  - float with Kahan compensation; twice the memory of FloatSum
+ *   DoubleSum - double precision
+ *
+ * KahanSum relies on strict IEEE evaluation; do not build with -ffast-math.
+ */
+
+#ifndef ACCUMULATOR_H_
+#define ACCUMULATOR_H_
+
+#include <vector>
+#include <string>
+#include <stddef.h>
+
+
+enum AccumulatorPolicy{ ACCUM_FLOAT, ACCUM_KAHAN, ACCUM_DOUBLE };
+
+struct FloatSum{
+    FloatSum() : s(0) {}
+    void add(float x){ s += x; }
+    double value() const { return s; }
+    float s;
+};
+
+struct KahanSum{
+    KahanSum() : s(0), c(0) {}
+    void add(float x){
+        float y = x - c;
+        float t = s + y;
+        c = (t - s) - y; // the low order part of y that was lost
+        s = t;
+    }
+    double value() const { return (double) s - c; } // less what rounding has added to s
+    float s, c;
+};
+
+struct DoubleSum{
+    DoubleSum() : s(0) {}
+    void add(double x){ s += x; }
+    double value() const { return s; }
+    double s;
+};
+
+
+/**
+ * @brief The accumulation kernel: sums[i] += x[i]
+ * @param sums - the running sums
+ * @param x - this frame's contribution
+ * @param n - the number of elements
+ */
+template <typename Sum>
+inline void accumulate(Sum *sums, const float *x, int n)
+{
+    for(int i=0; i<n; i++)
+        sums[i].add(x[i]);
+}
+
+
+/**
+ * A set of nobs running sums of n elements each, with the policy chosen at run time.
+ */
+class SpectrumSums{
+public:
+    virtual ~SpectrumSums() {}
+    /**
+     * @brief Adds one frame's contribution to an observable
+     * @param obs - the observable
+     * @param x - n contiguous values
+     */
+    virtual void add(int obs, const float *x) = 0;
+    /**
+     * @brief Copies the sums of an observable out as floats
+     * @param obs - the observable
+     * @param out - n contiguous values
+     */
+    virtual void get(int obs, float *out) const = 0;
+    /**
+     * @brief The running sum of one element of an observable
+     */
+    virtual double value(int obs, int i) const = 0;
+    /**
+     * @brief Adds the sums of another set of the same size, e.g. over a later chunk of the frames
+     */
+    virtual void merge(const SpectrumSums &other) = 0;
+    virtual size_t bytes() const = 0;
+};
+
+template <typename Sum>
+class SpectrumSumsT : public SpectrumSums{
+public:
+    SpectrumSumsT(int nobs, int n) : n_(n), sums_((size_t) nobs*n) {}
+    void add(int obs, const float *x){ accumulate(&sums_[(size_t) obs*n_], x, n_); }
+    void get(int obs, float *out) const
+    {
+        for(int i=0; i<n_; i++)
+            out[i] = sums_[(size_t) obs*n_+i].value();
+    }
+    double value(int obs, int i) const { return sums_[(size_t) obs*n_+i].value(); }
+    void merge(const SpectrumSums &other)
+    {
+        for(size_t j=0; j<sums_.size(); j++)
+            sums_[j].add(other.value(j/n_, j%n_));
+    }
+    size_t bytes() const { return sums_.size()*sizeof(Sum); }
+private:
+    int n_;
+    std::vector<Sum> sums_;
+};
+
+/**
+ * @brief Creates the running sums for a policy
+ * @param policy - the summation policy
+ * @param nobs - the number of observables
+ * @param n - the number of elements of each observable
+ * @return the new sums, to be deleted by the caller
+ */
+inline SpectrumSums *make_spectrum_sums(AccumulatorPolicy policy, int nobs, int n)
+{
+    switch(policy){
+    case ACCUM_FLOAT: return new SpectrumSumsT<FloatSum>(nobs, n);
+    case ACCUM_KAHAN: return new SpectrumSumsT<KahanSum>(nobs, n);
+    default:          return new SpectrumSumsT<DoubleSum>(nobs, n);
+    }
+}
+
+
+/**
+ * @brief The memory make_spectrum_sums() would allocate, without allocating it
+ */
+inline size_t spectrum_sums_bytes(AccumulatorPolicy policy, int nobs, int n)
+{
+    switch(policy){
+    case ACCUM_FLOAT: return (size_t) nobs*n*sizeof(FloatSum);
+    case ACCUM_KAHAN: return (size_t) nobs*n*sizeof(KahanSum);
+    default:          return (size_t) nobs*n*sizeof(DoubleSum);
+    }
+}
+
+
+/**
+ * A single running sum, e.g. the average thickness, with the policy chosen at run time.
+ */
+class RunningSum{
+public:
+    RunningSum(AccumulatorPolicy policy=ACCUM_DOUBLE) : policy_(policy) {}
+    void add(double x)
+    {
+        switch(policy_){
+        case ACCUM_FLOAT: f_.add(x); break;
+        case ACCUM_KAHAN: k_.add(x); break;
+        default:          d_.add(x); break;
+        }
+    }
+    RunningSum &operator+=(double x){ add(x); return *this; }
+    double value() const
+    {
+        switch(policy_){
+        case ACCUM_FLOAT: return f_.value();
+        case ACCUM_KAHAN: return k_.value();
+        default:          return d_.value();
+        }
+    }
+private:
+    AccumulatorPolicy policy_;
+    FloatSum f_;
+    KahanSum k_;
+    DoubleSum d_;
+};
+
+
+inline const char *accumulator_name(AccumulatorPolicy policy)
+{
+    switch(policy){
+    case ACCUM_FLOAT: return "float";
+    case ACCUM_KAHAN: return "kahan";
+    default:          return "double";
+    }
+}
+
+/**
+ * @brief Parses a policy name
+ * @param name - one of float, kahan or double
+ * @param policy - set to the policy
+ * @return false if the name is not recognized
+ */
+inline bool parse_accumulator(const std::string &name, AccumulatorPolicy &policy)
+{
+    if(name == "float") { policy = ACCUM_FLOAT; return true; }
+    if(name == "kahan") { policy = ACCUM_KAHAN; return true; }
+    if(name == "double"){ policy = ACCUM_DOUBLE; return true; }
+    return false;
+}
+
+#endif /* ACCUMULATOR_H_ */
@@ -0,0 +1,168 @@
+/*
+ * BlockAverage.h
+ *
+ * Streaming Flyvbjerg-Petersen block averaging.  Level k holds the running
+ * statistics of the series blocked into averages of 2^k consecutive samples;
+ * each level only needs to remember one unpaired sample, so the memory per
+ * observable is O(log T) and the full time series is never stored.  The
+ * per-level statistics use Welford updates in double precision.
+ *
+ * Flyvbjerg & Petersen, J. Chem. Phys. 91, 461 (1989)
+ * Lee, Kent, Needs & Rios, Phys. Rev. E 84, 066706 (2011) for the choice of block size
+ */
+
+#ifndef BLOCKAVERAGE_H_
+#define BLOCKAVERAGE_H_
+
+#include <vector>
+#include <cmath>
+
+
+class BlockAverager{
+public:
+    BlockAverager() {}
+
+    /**
+     * @brief Adds the next sample of the time series.
+     * @param x - the value at the current frame
+     */
+    void add(double x)
+    {
+        size_t k = 0;
+        while(true){
+            if(k == levels_.size())
+                levels_.push_back(Level());
+            Level &lvl = levels_[k];
+
+            lvl.n++;
+            double delta = x - lvl.mean;
+            lvl.mean += delta/lvl.n;
+            lvl.m2 += delta*(x - lvl.mean);
+
+            if(!lvl.has_pending){
+                lvl.pending = x;
+                lvl.has_pending = true;
+                return;
+            }
+            x = 0.5*(lvl.pending + x); // the pair forms one sample of the next level
+            lvl.has_pending = false;
+            k++;
+        }
+    }
+
+    /**
+     * @brief Adds the samples of another averager as if they had followed ours.  Each level's statistics are
+     * combined exactly (Chan et al.).  Level k is the same as if the samples had been added one by one as long
+     * as no level below it holds an unpaired sample here; otherwise the block that sample would have formed with
+     * the first of the later samples is missing from the levels above it.
+     * @param later - the averager of the samples that follow
+     */
+    void merge(const BlockAverager &later)
+    {
+        if(later.levels_.size() > levels_.size())
+            levels_.resize(later.levels_.size());
+        for(size_t k=0; k<later.levels_.size(); k++){
+            Level &a = levels_[k];
+            const Level &b = later.levels_[k];
+            if(b.n == 0)
+                continue;
+            long n = a.n + b.n;
+            double delta = b.mean - a.mean;
+            a.mean += delta*b.n/n;
+            a.m2 += b.m2 + delta*delta*((double) a.n*b.n/n);
+            a.n = n;
+            a.pending = b.pending;
+            a.has_pending = b.has_pending;
+        }
+    }
+
+    long samples() const { return levels_.empty() ? 0 : levels_[0].n; }
+    int nlevels() const { return (int) levels_.size(); }
+
+    /**
+     * @brief The mean of the series, accumulated without blocking
+     */
+    double mean() const { return levels_.empty() ? 0 : levels_[0].mean; }
+
+    /**
+     * @brief The naive standard error of the mean obtained at a given blocking level
+     * @param k - the level; blocks of 2^k samples
+     * @return the standard error, or zero when the level holds fewer than two blocks
+     */
+    double error(int k) const
+    {
+        if(k >= (int) levels_.size() || levels_[k].n < 2)
+            return 0;
+        const Level &lvl = levels_[k];
+        return sqrt(lvl.m2/(lvl.n - 1)/lvl.n);
+    }
+
+    /**
+     * @brief The smallest blocking level at which the blocks can be considered independent,
+     *        using the criterion of Lee et al., 2^(3k) > 2 N (err_k/err_0)^4.
+     * @return the level, or the deepest level with at least two blocks if none qualifies
+     */
+    int optimal_level() const
+    {
+        long n = samples();
+        double err0 = error(0);
+        int last = 0;
+        for(int k=0; k<(int) levels_.size(); k++){
+            if(levels_[k].n < 2)
+                break;
+            last = k;
+            if(err0 <= 0)
+                return k;
+            double ratio = error(k)/err0;
+            if(pow(2.0, 3*k) > 2.0*n*ratio*ratio*ratio*ratio)
+                return k;
+        }
+        return last;
+    }
+
+    /**
+     * @brief The standard error of the mean, corrected for time correlations
+     */
+    double error() const { return error(optimal_level()); }
+
+    /**
+     * @brief The statistical inefficiency, (err/err_0)^2; roughly twice the integrated
+     *        correlation time in samples.  It is one for uncorrelated data.
+     */
+    double inefficiency() const
+    {
+        double err0 = error(0);
+        if(err0 <= 0)
+            return 1;
+        double ratio = error()/err0;
+        return ratio*ratio;
+    }
+
+    /**
+     * @brief The memory of an averager once it has been given a number of samples: a level per doubling,
+     *        in a vector that grows by doubling
+     */
+    static size_t bytes(long samples)
+    {
+        size_t levels = 1, capacity = 1;
+        for(long n=samples; n > 1; n /= 2)
+            levels++;
+        while(capacity < levels)
+            capacity *= 2;
+        return sizeof(BlockAverager) + capacity*sizeof(Level);
+    }
+
+private:
+    struct Level{
+        Level() : n(0), mean(0), m2(0), pending(0), has_pending(false) {}
+        long n;
+        double mean;
+        double m2;        // sum of squared deviations from the mean
+        double pending;   // sample waiting for a partner to form the next block
+        bool has_pending;
+    };
+
+    std::vector<Level> levels_;
+};
+
+#endif /* BLOCKAVERAGE_H_ */
@@ -0,0 +1,173 @@
+/*
+ * FrameIndex.cpp
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "FrameIndex.h"
+
+using namespace std;
+
+static const char index_magic[8] = "NIHIDX1";
+
+
+/*
+ * One thread's share of the scan: the numbers starting in [begin, end) of the mapped file.
+ */
+struct ScanChunk{
+    const char *data;
+    size_t begin, end;
+    long long per_frame;
+    long long first;                // the index of the first number in the chunk, set between the passes
+    long long count;                // numbers starting in the chunk, from the first pass
+    std::vector<int64_t> offsets;   // frame starts in the chunk, from the second pass
+    bool record;                    // false for the first pass, true for the second
+};
+
+
+static inline bool starts_number(const char *data, size_t i)
+{
+    return !isspace((unsigned char) data[i]) && (i == 0 || isspace((unsigned char) data[i-1]));
+}
+
+
+static void *scan_chunk(void *arg)
+{
+    ScanChunk &c = *(ScanChunk *) arg;
+    if(!c.record){
+        long long n = 0;
+        for(size_t i=c.begin; i<c.end; i++)
+            n += starts_number(c.data, i);
+        c.count = n;
+    }
+    else{
+        long long n = c.first;
+        for(size_t i=c.begin; i<c.end; i++){
+            if(starts_number(c.data, i)){
+                if(n % c.per_frame == 0)
+                    c.offsets.push_back(i);
+                n++;
+            }
+        }
+    }
+    return NULL;
+}
+
+
+/**
+ * @brief Runs scan_chunk on every chunk, one thread each
+ */
+static void scan_all(vector<ScanChunk> &chunks)
+{
+    vector<pthread_t> threads(chunks.size());
+    vector<bool> started(chunks.size(), false);
+    for(size_t t=1; t<chunks.size(); t++)
+        started[t] = (pthread_create(&threads[t], NULL, scan_chunk, &chunks[t]) == 0);
+    scan_chunk(&chunks[0]);
+    for(size_t t=1; t<chunks.size(); t++){
+        if(started[t]) pthread_join(threads[t], NULL);
+        else scan_chunk(&chunks[t]);
+    }
+}
+
+
+bool FrameIndex::scan(const string &path, long long per_frame, vector<int64_t> &offsets, long long &total)
+{
+    offsets.clear();
+    total = 0;
+    int fd = ::open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) != 0){
+        if(fd >= 0) close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    if(size == 0){
+        close(fd);
+        return true;
+    }
+    void *mem = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mem == MAP_FAILED)
+        return false;
+    madvise(mem, size, MADV_SEQUENTIAL);
+
+    long ncores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t nchunks = (ncores > 0 ? ncores : 1);
+    const size_t min_chunk = 1 << 20;
+    if(size/nchunks < min_chunk) nchunks = size/min_chunk + 1;
+
+    vector<ScanChunk> chunks(nchunks);
+    for(size_t t=0; t<nchunks; t++){
+        chunks[t].data = (const char *) mem;
+        chunks[t].begin = size*t/nchunks;
+        chunks[t].end = size*(t+1)/nchunks;
+        chunks[t].per_frame = per_frame;
+        chunks[t].record = false;
+    }
+    scan_all(chunks);
+
+    for(size_t t=0; t<nchunks; t++){
+        chunks[t].first = total;
+        chunks[t].record = true;
+        total += chunks[t].count;
+    }
+    scan_all(chunks);
+    munmap(mem, size);
+
+    // only complete frames are indexed
+    long long complete = total/per_frame;
+    for(size_t t=0; t<nchunks; t++)
+        offsets.insert(offsets.end(), chunks[t].offsets.begin(), chunks[t].offsets.end());
+    offsets.resize(complete);
+    return true;
+}
+
+
+bool FrameIndex::open(const string &path, long long per_frame)
+{
+    struct stat st;
+    if(stat(path.c_str(), &st) != 0)
+        return false;
+    int64_t key[3] = {(int64_t) st.st_size, (int64_t) st.st_mtime, per_frame};
+
+    string sidecar = path + ".idx";
+    FILE *fp = fopen(sidecar.c_str(), "rb");
+    if(fp){
+        char magic[8];
+        int64_t saved[3], n;
+        bool ok = (fread(magic, 1, 8, fp) == 8 && memcmp(magic, index_magic, 8) == 0
+                   && fread(saved, sizeof(int64_t), 3, fp) == 3 && memcmp(saved, key, sizeof(key)) == 0
+                   && fread(&n, sizeof(int64_t), 1, fp) == 1 && n >= 0);
+        if(ok){
+            offsets_.resize(n);
+            ok = (n == 0 || fread(&offsets_[0], sizeof(int64_t), n, fp) == (size_t) n);
+        }
+        fclose(fp);
+        if(ok)
+            return true;
+    }
+
+    long long total;
+    if(!scan(path, per_frame, offsets_, total))
+        return false;
+
+    // not being able to write the sidecar only costs the next run another scan
+    fp = fopen(sidecar.c_str(), "wb");
+    if(fp){
+        int64_t n = offsets_.size();
+        fwrite(index_magic, 1, 8, fp);
+        fwrite(key, sizeof(int64_t), 3, fp);
+        fwrite(&n, sizeof(int64_t), 1, fp);
+        if(n) fwrite(&offsets_[0], sizeof(int64_t), n, fp);
+        fclose(fp);
+    }
+    return true;
+}
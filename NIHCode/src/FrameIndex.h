@@ -0,0 +1,58 @@
+/*
+ * FrameIndex.h
+ *
+ * The byte offset at which each frame starts in a text trajectory file, so
+ * that a frame can be read without parsing the ones before it.  A frame is a
+ * fixed count of whitespace separated numbers (2*nl in LipidX.out), so the
+ * index is built by counting where numbers start: the file is split into one
+ * chunk per core, each thread counts the numbers in its chunk, and after a
+ * prefix sum over the chunks each thread records the offsets of the numbers
+ * that begin a frame.
+ *
+ * The index is kept next to the file in path.idx:
+ *
+ *   char[8]  "NIHIDX1"
+ *   int64    size and modification time of the file when it was indexed
+ *   int64    numbers per frame
+ *   int64    the number of complete frames nframes
+ *   int64    the offset of each of the nframes frames
+ *
+ * and is rebuilt whenever the file or the frame size no longer match.
+ */
+
+#ifndef FRAMEINDEX_H_
+#define FRAMEINDEX_H_
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+
+class FrameIndex{
+public:
+    /**
+     * @brief Loads the index of a file from its sidecar, or builds it and saves the sidecar.
+     * @param path - the file
+     * @param per_frame - the numbers in each frame
+     * @return false if the file cannot be read
+     */
+    bool open(const std::string &path, long long per_frame);
+
+    long long nframes() const { return offsets_.size(); }
+    long long offset(long long frame) const { return offsets_[frame]; }
+
+    /**
+     * @brief Builds the index by scanning the file in parallel
+     * @param path - the file
+     * @param per_frame - the numbers in each frame
+     * @param offsets - set to the offset of each complete frame
+     * @param total - set to the number of numbers in the file
+     * @return false if the file cannot be read
+     */
+    static bool scan(const std::string &path, long long per_frame, std::vector<int64_t> &offsets, long long &total);
+
+private:
+    std::vector<int64_t> offsets_;
+};
+
+#endif /* FRAMEINDEX_H_ */
@@ -0,0 +1,569 @@
+/*
+ * FramePipeline.cpp
+ */
+
+#include <stdio.h>
+#include <sched.h>
+#include <time.h>
+
+#include "FramePipeline.h"
+
+using namespace std;
+
+static const char *stage_names[] = {"read", "preprocess", "bin", "transform", "accumulate"};
+static const char *queue_names[] = {"", "queue preprocess", "queue bin", "queue transform", "queue accumulate"};
+
+// the threads in the trace, in the order of the stages
+static const int serial_tid = 1, reader_tid = 1, first_worker_tid = 2;
+
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+
+/**
+ * @brief Waits a little longer each time a queue is found empty or full: spinning at first, then yielding,
+ * then sleeping for 50 us at a time
+ * @param spins - the number of times the queue has been tried so far, 0 the first time
+ */
+static void backoff(int &spins)
+{
+    spins++;
+    if(spins < 64)
+        return;
+    if(spins < 128){
+        sched_yield();
+        return;
+    }
+    struct timespec ts = {0, 50000};
+    nanosleep(&ts, NULL);
+}
+
+
+FramePipeline::FramePipeline(SpectrumAnalyzer &analyzer, FrameSource &source, const PipelineConfig &config)
+    : analyzer_(analyzer), source_(source), config_(config), stride_(1), next_frame_(0), free_(NULL),
+      first_(0), end_(0), shutdown_(0), reader_done_(0), frames_read_(0),
+      schedule_seq_(0), schedule_next_(0), schedule_stride_(1)
+{
+    for(int s=0; s<NSTAGES; s++)
+        queue_[s] = NULL;
+    if(!config_.parallel()){
+        workspaces_.push_back(new FrameWorkspace(analyzer_.config().ngrid));
+        items_.resize(1);
+        items_[0].w = workspaces_[0];
+        if(config_.trace)
+            config_.trace->name_thread(serial_tid, "serial");
+        return;
+    }
+
+    threads_[STAGE_READ] = 1;
+    threads_[STAGE_PREPROCESS] = max(config_.preprocess_threads, 1);
+    threads_[STAGE_BIN] = max(config_.bin_threads, 1);
+    threads_[STAGE_TRANSFORM] = max(config_.transform_threads, 1);
+    threads_[STAGE_ACCUMULATE] = 1;
+    if(config_.trace){
+        int tid = reader_tid;
+        config_.trace->name_thread(tid++, stage_names[STAGE_READ]);
+        for(int s=STAGE_PREPROCESS; s<=STAGE_TRANSFORM; s++){
+            for(int t=0; t<threads_[s]; t++){
+                char name[64];
+                snprintf(name, sizeof(name), "%s %d", stage_names[s], t);
+                config_.trace->name_thread(tid++, name);
+            }
+        }
+        config_.trace->name_thread(tid, stage_names[STAGE_ACCUMULATE]);
+    }
+
+    size_t depth = max(config_.depth, 1);
+    for(int s=STAGE_PREPROCESS; s<NSTAGES; s++)
+        queue_[s] = new StageQueue<Item>(depth, threads_[s-1] == 1 && threads_[s] == 1);
+    size_t nitems = workspaces(config_);
+    free_ = new StageQueue<Item>(nitems, true);
+
+    items_.resize(nitems);
+    workspaces_.resize(nitems);
+    int ngrid = analyzer_.config().ngrid;
+    for(size_t i=0; i<nitems; i++){
+        workspaces_[i] = new FrameWorkspace(ngrid);
+        items_[i].w = workspaces_[i];
+    }
+}
+
+
+int FramePipeline::workspaces(const PipelineConfig &config)
+{
+    if(!config.parallel())
+        return 1;
+    // every queue holds depth frames, and every thread one more that it is working on, and the reader one
+    int threads[NSTAGES] = {1, max(config.preprocess_threads, 1), max(config.bin_threads, 1),
+                            max(config.transform_threads, 1), 1};
+    int depth = queue_capacity(max(config.depth, 1));
+    int n = 1;
+    for(int s=STAGE_PREPROCESS; s<NSTAGES; s++)
+        n += depth + threads[s];
+    return n;
+}
+
+
+FramePipeline::~FramePipeline()
+{
+    for(size_t i=0; i<workspaces_.size(); i++)
+        delete workspaces_[i];
+    for(int s=0; s<NSTAGES; s++)
+        delete queue_[s];
+    delete free_;
+}
+
+
+long FramePipeline::run(long first, long end, int stride, PipelineSink &sink)
+{
+    first_ = first;
+    stride_ = stride;
+    next_frame_ = first;
+    return (config_.parallel() ? run_parallel(end, sink) : run_serial(end, sink));
+}
+
+
+bool FramePipeline::add_branch(SpectrumAnalyzer &analyzer, const SpectrumAnalyzer *finer)
+{
+    int ngrid = analyzer.config().ngrid;
+    int from = -1;
+    if(finer){
+        if(finer == &analyzer_)
+            from = 0;
+        for(size_t b=0; b<branches_.size(); b++){
+            if(finer == branches_[b])
+                from = b+1;
+        }
+        if(from < 0 || finer->config().ngrid != 2*ngrid || finer->config().area || analyzer.config().area
+           || finer->config().assign != ASSIGN_NGP || analyzer.config().assign != ASSIGN_NGP)
+            return false;
+    }
+
+    branches_.push_back(&analyzer);
+    finer_.push_back(from);
+    for(size_t i=0; i<items_.size(); i++){
+        FrameWorkspace *w = new FrameWorkspace(ngrid);
+        workspaces_.push_back(w);
+        items_[i].branches.push_back(w);
+        if(from >= 0)
+            (from == 0 ? items_[i].w : items_[i].branches[from-1])->keep_sums = true;
+    }
+    return true;
+}
+
+
+/**
+ * @brief Runs a stage after read on a frame, for the analyzer and then for every branch
+ */
+void FramePipeline::run_stage(Stage stage, Item &item)
+{
+    for(size_t b=0; b<=branches_.size(); b++){
+        SpectrumAnalyzer &a = (b == 0 ? analyzer_ : *branches_[b-1]);
+        FrameWorkspace &w = (b == 0 ? *item.w : *item.branches[b-1]);
+        switch(stage){
+        case STAGE_PREPROCESS:
+            if(b == 0) a.preprocess(w);
+            else w.borrow(*item.w);
+            break;
+        case STAGE_BIN:
+            if(b > 0 && finer_[b-1] >= 0)
+                a.reduce(w, (finer_[b-1] == 0 ? *item.w : *item.branches[finer_[b-1]-1]));
+            else
+                a.bin(w);
+            break;
+        case STAGE_TRANSFORM: a.transform(w); break;
+        case STAGE_ACCUMULATE: a.accumulate(w); break;
+        default: break;
+        }
+    }
+}
+
+
+void FramePipeline::set_stride(long frame, int stride)
+{
+    stride_ = stride;
+    next_frame_ = frame + stride;
+    if(!config_.parallel())
+        return;
+
+    // a sequence lock, since the reader must see the two values together
+    __atomic_add_fetch(&schedule_seq_, 1, __ATOMIC_ACQ_REL);
+    schedule_next_ = next_frame_;
+    schedule_stride_ = stride;
+    __atomic_add_fetch(&schedule_seq_, 1, __ATOMIC_ACQ_REL);
+}
+
+
+//---------------------------------------------------------------------------------------------------------------
+//SERIAL/////////////////////////////////////////////////////////////////////////////////////////////////////////
+//---------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief Records a stage of a frame run serially as a slice from mark to now, and moves mark to now
+ */
+static void trace_lap(FrameTrace *trace, FramePipeline::Stage stage, long frame, uint64_t &mark)
+{
+    if(!trace)
+        return;
+    uint64_t t = profile_ticks();
+    trace->slice(serial_tid, stage_names[stage], frame, mark, t);
+    mark = t;
+}
+
+long FramePipeline::run_serial(long end, PipelineSink &sink)
+{
+    long analyzed = 0;
+    int nl = source_.nlipids();
+    for(long frame_num=0; end == 0 || frame_num < end; frame_num++){
+
+        if(frame_num < next_frame_){ // before the first frame, or skipped by the stride
+            if(end > 0 && next_frame_ >= end)
+                break;
+            if(source_.seek(next_frame_)){
+                frame_num = next_frame_-1;
+                continue;
+            }
+            if(!source_.skip())
+                break;
+            continue;
+        }
+        FrameTrace *trace = config_.trace;
+        uint64_t c0 = (trace ? profile_ticks() : 0);
+        StageTimes read;
+        NIH_PROFILE_START(read);
+        if(!source_.next())
+            break;
+        NIH_PROFILE_LAP(read, PROF_READ);
+        next_frame_ = frame_num + stride_;
+
+        // the stages of push_frame(), on a workspace of our own so that the read is timed with the frame
+        Item &item = items_[0];
+        analyzer_.load(*item.w, source_.head(), source_.tail(), nl, source_.box());
+        item.w->times.add(read);
+        trace_lap(trace, STAGE_READ, frame_num, c0);
+        for(int s=STAGE_PREPROCESS; s<NSTAGES; s++){
+            run_stage((Stage) s, item);
+            trace_lap(trace, (Stage) s, frame_num, c0);
+        }
+        analyzed++;
+        if(!sink.frame_done(frame_num))
+            break;
+    }
+    return analyzed;
+}
+
+
+//---------------------------------------------------------------------------------------------------------------
+//PARALLEL///////////////////////////////////////////////////////////////////////////////////////////////////////
+//---------------------------------------------------------------------------------------------------------------
+
+long FramePipeline::run_parallel(long end, PipelineSink &sink)
+{
+    end_ = end;
+    shutdown_ = 0;
+    reader_done_ = 0;
+    frames_read_ = 0;
+    schedule_next_ = first_;
+    schedule_stride_ = stride_;
+    for(size_t i=0; i<items_.size(); i++)
+        free_->push(&items_[i]);
+
+    Worker reader;
+    reader.pipeline = this;
+    reader.stage = STAGE_READ;
+    reader.tid = reader_tid;
+    workers_.clear();
+    for(int s=STAGE_PREPROCESS; s<=STAGE_TRANSFORM; s++){
+        for(int t=0; t<threads_[s]; t++){
+            Worker w;
+            w.pipeline = this;
+            w.stage = (Stage) s;
+            w.tid = first_worker_tid + workers_.size();
+            workers_.push_back(w);
+        }
+    }
+    pthread_create(&reader.thread, NULL, reader_main, &reader);
+    for(size_t t=0; t<workers_.size(); t++)
+        pthread_create(&workers_[t].thread, NULL, worker_main, &workers_[t]);
+
+    // the frames come out of the transform stage in any order, and are put back in order by seq
+    vector<Item *> pending(items_.size(), (Item *) NULL);
+    ThreadMetrics &m = accumulate_metrics_;
+    FrameTrace *trace = config_.trace;
+    int tid = first_worker_tid + workers_.size();
+    long seq = 0, analyzed = 0;
+    int spins = 0;
+    while(true){
+        Item *item = pending[seq % pending.size()];
+        if(item && item->seq == seq){
+            pending[seq % pending.size()] = NULL;
+            seq++;
+            // frames read ahead with a stride that has since been changed are dropped
+            bool keep_going = true;
+            if(item->frame >= next_frame_){
+                double t0 = now();
+                uint64_t c0 = (trace ? profile_ticks() : 0);
+                run_stage(STAGE_ACCUMULATE, *item);
+                if(trace)
+                    trace->slice(tid, stage_names[STAGE_ACCUMULATE], item->frame, c0, profile_ticks());
+                m.busy += now() - t0;
+                m.frames++;
+                analyzed++;
+                next_frame_ = item->frame + stride_;
+                keep_going = sink.frame_done(item->frame);
+            }
+            free_->push(item);
+            if(!keep_going)
+                break;
+            continue;
+        }
+        size_t depth = queue_[STAGE_ACCUMULATE]->size();
+        if(queue_[STAGE_ACCUMULATE]->pop(item)){
+            m.depth_sum += depth;
+            m.depth_max = max(m.depth_max, depth);
+            if(trace)
+                trace->counter(queue_names[STAGE_ACCUMULATE], depth, profile_ticks());
+            pending[item->seq % pending.size()] = item;
+            spins = 0;
+            continue;
+        }
+        if(__atomic_load_n(&reader_done_, __ATOMIC_ACQUIRE) && seq == frames_read_)
+            break;
+        double t0 = now();
+        backoff(spins);
+        m.starved += now() - t0;
+    }
+
+    __atomic_store_n(&shutdown_, 1, __ATOMIC_RELEASE);
+    pthread_join(reader.thread, NULL);
+    for(size_t t=0; t<workers_.size(); t++)
+        pthread_join(workers_[t].thread, NULL);
+    read_metrics_ = reader.metrics;
+
+    // empty the queues for another run
+    Item *item;
+    for(int s=STAGE_PREPROCESS; s<NSTAGES; s++)
+        while(queue_[s]->pop(item)) {}
+    while(free_->pop(item)) {}
+    return analyzed;
+}
+
+
+void *FramePipeline::reader_main(void *arg)
+{
+    Worker &w = *(Worker *) arg;
+    w.pipeline->read_frames(w.tid, w.metrics);
+    return NULL;
+}
+
+
+void *FramePipeline::worker_main(void *arg)
+{
+    Worker &w = *(Worker *) arg;
+    w.pipeline->work(w.stage, w.tid, w.metrics);
+    return NULL;
+}
+
+
+/**
+ * @brief Takes an item from the input queue of a stage, waiting for one if it is empty
+ * @return false if the pipeline is shutting down
+ */
+bool FramePipeline::take(Stage stage, Item *&item, ThreadMetrics &m)
+{
+    StageQueue<Item> &q = *queue_[stage];
+    size_t depth = q.size();
+    if(q.pop(item)){
+        m.depth_sum += depth;
+        m.depth_max = max(m.depth_max, depth);
+        if(config_.trace)
+            config_.trace->counter(queue_names[stage], depth, profile_ticks());
+        return true;
+    }
+    double t0 = now();
+    int spins = 0;
+    bool got = false;
+    while(!__atomic_load_n(&shutdown_, __ATOMIC_ACQUIRE)){
+        if(q.pop(item)){
+            got = true;
+            break;
+        }
+        backoff(spins);
+    }
+    m.starved += now() - t0;
+    if(got && config_.trace)
+        config_.trace->counter(queue_names[stage], 0, profile_ticks());
+    return got;
+}
+
+
+/**
+ * @brief Puts an item on a queue, waiting for room if it is full
+ * @return false if the pipeline is shutting down
+ */
+bool FramePipeline::give(StageQueue<Item> &q, Item *item, ThreadMetrics &m)
+{
+    if(q.push(item))
+        return true;
+    double t0 = now();
+    int spins = 0;
+    bool done = false;
+    while(!__atomic_load_n(&shutdown_, __ATOMIC_ACQUIRE)){
+        if(q.push(item)){
+            done = true;
+            break;
+        }
+        backoff(spins);
+    }
+    m.blocked += now() - t0;
+    return done;
+}
+
+
+/**
+ * @brief The read stage: reads the frames to analyze, as selected by first_, end_ and the stride, and skips
+ * or seeks over the rest
+ */
+void FramePipeline::read_frames(int tid, ThreadMetrics &m)
+{
+    int nl = source_.nlipids();
+    long frame_num = 0;     // the frame the source reads next
+    long want = first_;     // the next frame to analyze
+    int stride = schedule_stride_;
+    unsigned seen = 0;
+    long seq = 0;
+    while(!__atomic_load_n(&shutdown_, __ATOMIC_ACQUIRE)){
+        // a new stride takes over from the frame the accumulating side will want next
+        unsigned s = __atomic_load_n(&schedule_seq_, __ATOMIC_ACQUIRE);
+        if(s != seen && s % 2 == 0){
+            long next = schedule_next_;
+            int new_stride = schedule_stride_;
+            if(__atomic_load_n(&schedule_seq_, __ATOMIC_ACQUIRE) == s){
+                seen = s;
+                stride = new_stride;
+                if(want <= next)
+                    want = next;
+                else
+                    want = next + (want - next + stride - 1)/stride*stride;
+            }
+        }
+
+        if(end_ > 0 && want >= end_)
+            break;
+        if(frame_num < want){
+            if(source_.seek(want))
+                frame_num = want;
+            else if(source_.skip())
+                frame_num++;
+            else
+                break;
+            continue;
+        }
+
+        Item *item;
+        double t0 = now();
+        bool got = free_->pop(item);
+        for(int spins=0; !got && !__atomic_load_n(&shutdown_, __ATOMIC_ACQUIRE); ){
+            backoff(spins);
+            got = free_->pop(item);
+        }
+        m.blocked += now() - t0;
+        if(!got)
+            break;
+
+        t0 = now();
+        uint64_t c0 = (config_.trace ? profile_ticks() : 0);
+        StageTimes read;
+        NIH_PROFILE_START(read);
+        if(!source_.next()){
+            free_->push(item);
+            break;
+        }
+        NIH_PROFILE_LAP(read, PROF_READ);
+        analyzer_.load(*item->w, source_.head(), source_.tail(), nl, source_.box());
+        item->w->times.add(read);
+        if(config_.trace)
+            config_.trace->slice(tid, stage_names[STAGE_READ], frame_num, c0, profile_ticks());
+        m.busy += now() - t0;
+        m.frames++;
+        item->frame = frame_num;
+        item->seq = seq++;
+        frame_num++;
+        want = item->frame + stride;
+        if(!give(*queue_[STAGE_PREPROCESS], item, m))
+            break;
+    }
+    frames_read_ = seq;
+    __atomic_store_n(&reader_done_, 1, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * @brief One thread of the preprocess, bin or transform stage
+ */
+void FramePipeline::work(Stage stage, int tid, ThreadMetrics &m)
+{
+    StageQueue<Item> &out = *queue_[stage+1];
+    Item *item;
+    while(take(stage, item, m)){
+        double t0 = now();
+        uint64_t c0 = (config_.trace ? profile_ticks() : 0);
+        run_stage(stage, *item);
+        if(config_.trace)
+            config_.trace->slice(tid, stage_names[stage], item->frame, c0, profile_ticks());
+        m.busy += now() - t0;
+        m.frames++;
+        if(!give(out, item, m))
+            break;
+    }
+}
+
+
+/**
+ * @brief The metrics of the threads of a stage, added up
+ */
+FramePipeline::ThreadMetrics FramePipeline::totals(Stage stage) const
+{
+    if(stage == STAGE_READ)
+        return read_metrics_;
+    if(stage == STAGE_ACCUMULATE)
+        return accumulate_metrics_;
+    ThreadMetrics total;
+    for(size_t t=0; t<workers_.size(); t++){
+        if(workers_[t].stage != stage) continue;
+        const ThreadMetrics &m = workers_[t].metrics;
+        total.frames += m.frames;
+        total.busy += m.busy;
+        total.starved += m.starved;
+        total.blocked += m.blocked;
+        total.depth_sum += m.depth_sum;
+        total.depth_max = max(total.depth_max, m.depth_max);
+    }
+    return total;
+}
+
+
+void FramePipeline::print_metrics(ostream &out) const
+{
+    if(!config_.parallel())
+        return;
+    char line[160];
+    out << "Pipeline stage   threads   frames    busy(s)  starved(s)  blocked(s)  queue avg/max/capacity" << endl;
+    for(int s=0; s<NSTAGES; s++){
+        ThreadMetrics total = totals((Stage) s);
+        if(s == STAGE_READ)
+            snprintf(line, sizeof(line), "  %-14s %7d %8ld %10.3f %11.3f %11.3f", stage_names[s], threads_[s],
+                     total.frames, total.busy, total.starved, total.blocked);
+        else
+            snprintf(line, sizeof(line), "  %-14s %7d %8ld %10.3f %11.3f %11.3f  %8.2f/%zu/%zu%s", stage_names[s], threads_[s],
+                     total.frames, total.busy, total.starved, total.blocked,
+                     (total.frames ? total.depth_sum/total.frames : 0.0), total.depth_max, queue_[s]->capacity(),
+                     (queue_[s]->single() ? " spsc" : " mpmc"));
+        out << line << endl;
+    }
+}
@@ -0,0 +1,211 @@
+/*
+ * FramePipeline.h
+ *
+ * Drives a SpectrumAnalyzer through the frames of a FrameSource, either on
+ * the calling thread, one frame at a time, or as a pipeline of stages that
+ * each work on a different frame:
+ *
+ *   read        1 thread      the next frame from the source, into a free workspace (load)
+ *   preprocess  n threads     wrapping, directors and leaflets
+ *   bin         n threads     the height, thickness and density grids
+ *   transform   n threads     the FFTs and the decomposition of the spectra
+ *   accumulate  the caller    the sums over frames, in frame order
+ *
+ * The stages are connected by bounded lock-free queues (see LockFreeQueue),
+ * single producer single consumer between stages of one thread each and
+ * multi-producer multi-consumer otherwise.  A fixed pool of FrameWorkspaces
+ * circulates through them, so the frames in flight are bounded by the pool
+ * and a slow stage holds up the ones before it instead of letting frames pile
+ * up.  Frames may leave the threaded stages out of order; the last stage puts
+ * them back in order before accumulating, so the results are the same as when
+ * run serially, whatever the thread counts.
+ *
+ * Other analyzers can be fed the same frames as branches (add_branch()), e.g.
+ * the surface normals besides the tilt, or other cutoff angles.  Each frame
+ * is still read and preprocessed once; every branch then bins, transforms and
+ * accumulates it in a workspace of its own that borrows the preprocessed
+ * lipids.  The branches of a frame run one after the other on the thread that
+ * holds the frame, so with more bin and transform threads the branches of
+ * different frames run at the same time.  A branch on a grid half as fine as
+ * an analyzer before it can be reduced from that analyzer's grid instead of
+ * binning the lipids (SpectrumAnalyzer::reduce), so a chain of them gives a
+ * pyramid of resolutions from a single binning.
+ *
+ * Each stage keeps the time its threads spent working, waiting for input
+ * (starved) and waiting for room in the next queue (blocked), and how full its
+ * input queue was, which show where to add threads.  Given a FrameTrace, the
+ * pipeline also records when each thread worked on each frame, and how full
+ * the queues were over time.
+ */
+
+#ifndef FRAMEPIPELINE_H_
+#define FRAMEPIPELINE_H_
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <pthread.h>
+
+#include "SpectrumAnalyzer.h"
+#include "FrameSource.h"
+#include "LockFreeQueue.h"
+#include "FrameTrace.h"
+
+
+struct PipelineConfig{
+    PipelineConfig() : preprocess_threads(0), bin_threads(0), transform_threads(0), depth(4), trace(NULL) {}
+
+    // threads of each stage; all 0 to analyze the frames serially on the calling thread
+    int preprocess_threads, bin_threads, transform_threads;
+    int depth;  // frames each queue between two stages holds
+    FrameTrace *trace; // records when each thread worked on each frame, or NULL
+
+    bool parallel() const { return preprocess_threads > 0 || bin_threads > 0 || transform_threads > 0; }
+};
+
+
+/*
+ * Receives each analyzed frame once it has been accumulated, in frame order, on the thread that called
+ * FramePipeline::run().
+ */
+class PipelineSink{
+public:
+    virtual ~PipelineSink() {}
+
+    /**
+     * @brief Called after a frame has been accumulated
+     * @param frame - the frame, counting from 0
+     * @return false to stop the analysis after this frame
+     */
+    virtual bool frame_done(long frame) = 0;
+};
+
+
+class FramePipeline{
+public:
+    enum Stage{ STAGE_READ, STAGE_PREPROCESS, STAGE_BIN, STAGE_TRANSFORM, STAGE_ACCUMULATE, NSTAGES };
+
+    /**
+     * @brief Sets up the stages; the threads are started by run().  A stage given no threads gets one
+     * when any stage has more.
+     */
+    FramePipeline(SpectrumAnalyzer &analyzer, FrameSource &source, const PipelineConfig &config);
+    ~FramePipeline();
+
+    /**
+     * @brief Analyzes the frames first, first+stride, ... that come before end
+     * @param first - the first frame, counting from 0
+     * @param end - the frame after the last one, or 0 for the end of the source
+     * @param stride - frames between those analyzed
+     * @param sink - told about every analyzed frame
+     * @return the number of frames analyzed
+     */
+    long run(long first, long end, int stride, PipelineSink &sink);
+
+    /**
+     * @brief Feeds every frame to another analyzer as well, after the first one; called before run()
+     * @param analyzer - an analyzer with the same lx_ref, since the frames are preprocessed once for all of them
+     * @param finer - NULL to bin the lipids, or the analyzer, or a branch added before, whose grid is reduced
+     * 2x2 to ours; it must have twice our ngrid, and both nearest grid point assignment and no area
+     * @return false, adding nothing, if finer does not fit
+     */
+    bool add_branch(SpectrumAnalyzer &analyzer, const SpectrumAnalyzer *finer = NULL);
+
+    /**
+     * @brief Changes the stride from within PipelineSink::frame_done().  The pipeline may already have read
+     * frames ahead with the old stride, which are then dropped, so the new stride must be a multiple of it.
+     * @param frame - the frame just accumulated
+     * @param stride - the frames between it and the next one analyzed, and between those after
+     */
+    void set_stride(long frame, int stride);
+
+    int stride() const { return stride_; }
+    bool parallel() const { return config_.parallel(); }
+
+    /**
+     * @brief Prints the time each stage spent working and waiting, and how full its queue was
+     */
+    void print_metrics(std::ostream &out) const;
+
+    /**
+     * @brief The time the threads of a stage spent working, summed over them, in seconds; 0 when run serially
+     */
+    double busy(Stage stage) const { return (config_.parallel() ? totals(stage).busy : 0); }
+
+    /**
+     * @brief The threads of a stage when run in parallel
+     */
+    int threads(Stage stage) const { return threads_[stage]; }
+
+    /**
+     * @brief The FrameWorkspaces a pipeline with this configuration allocates, one for each frame in flight
+     */
+    static int workspaces(const PipelineConfig &config);
+
+private:
+    FramePipeline(const FramePipeline &);
+    FramePipeline &operator=(const FramePipeline &);
+
+    // a frame in flight
+    struct Item{
+        FrameWorkspace *w;
+        std::vector<FrameWorkspace *> branches; // one for each branch, borrowing the lipids of w
+        long frame;     // in the source
+        long seq;       // the order in which it was read
+    };
+
+    // what one thread of a stage did
+    struct ThreadMetrics{
+        ThreadMetrics() : frames(0), busy(0), starved(0), blocked(0), depth_sum(0), depth_max(0) {}
+        long frames;
+        double busy, starved, blocked; // seconds
+        double depth_sum;              // the size of the input queue each time a frame was taken from it
+        size_t depth_max;
+    };
+
+    struct Worker{
+        FramePipeline *pipeline;
+        Stage stage;
+        int tid;    // in the trace
+        ThreadMetrics metrics;
+        pthread_t thread;
+    };
+
+    ThreadMetrics totals(Stage stage) const;
+    long run_serial(long end, PipelineSink &sink);
+    long run_parallel(long end, PipelineSink &sink);
+    static void *reader_main(void *arg);
+    static void *worker_main(void *arg);
+    void read_frames(int tid, ThreadMetrics &m);
+    void work(Stage stage, int tid, ThreadMetrics &m);
+    bool take(Stage stage, Item *&item, ThreadMetrics &m);
+    bool give(StageQueue<Item> &q, Item *item, ThreadMetrics &m);
+    void run_stage(Stage stage, Item &item);
+
+    SpectrumAnalyzer &analyzer_;
+    std::vector<SpectrumAnalyzer *> branches_;
+    std::vector<int> finer_;    // of each branch: what it is reduced from, 0 for analyzer_ and b for branch b-1, or -1
+    FrameSource &source_;
+    PipelineConfig config_;
+    int threads_[NSTAGES];
+
+    int stride_;
+    long next_frame_;           // the next frame to analyze, as decided by the caller's side
+
+    // the parallel pipeline
+    std::vector<Item> items_;   // one of them when run serially
+    std::vector<FrameWorkspace *> workspaces_; // of the items and their branches
+    StageQueue<Item> *free_;    // from accumulate back to read
+    StageQueue<Item> *queue_[NSTAGES]; // the input of each stage after read
+    std::vector<Worker> workers_;
+    ThreadMetrics read_metrics_, accumulate_metrics_;
+    long first_, end_;
+    volatile int shutdown_;     // set by the caller to stop every thread
+    volatile int reader_done_;  // set by the reader once it has read its last frame
+    volatile long frames_read_; // valid once reader_done_ is set
+    volatile unsigned schedule_seq_; // odd while set_stride() is changing the two below
+    volatile long schedule_next_;
+    volatile int schedule_stride_;
+};
+
+#endif /* FRAMEPIPELINE_H_ */
@@ -0,0 +1,225 @@
+/*
+ * FrameRing.cpp
+ */
+
+#include <iostream>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "FrameRing.h"
+
+using namespace std;
+
+static const char ring_magic[8] = "NIHRING";
+static const size_t slot_align = 64; // bytes; keeps every slot on its own cache lines
+
+
+/**
+ * @brief Sleeps while *addr == val, for at most 0.2 s
+ */
+static void futex_wait(volatile uint32_t *addr, uint32_t val)
+{
+    struct timespec timeout = {0, 200000000};
+    syscall(SYS_futex, (uint32_t *) addr, FUTEX_WAIT, val, &timeout, NULL, 0);
+}
+
+
+static void futex_wake(volatile uint32_t *addr)
+{
+    syscall(SYS_futex, (uint32_t *) addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+
+static bool alive(pid_t pid)
+{
+    return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+
+static size_t header_bytes()
+{
+    return (sizeof(RingHeader) + slot_align - 1) / slot_align * slot_align;
+}
+
+
+FrameRing::FrameRing(const string &name, RingHeader *hdr, size_t bytes, bool owner)
+    : name_(name), hdr_(hdr), bytes_(bytes), owner_(owner) {}
+
+
+FrameRing *FrameRing::create(const string &name, int nl, int nslots)
+{
+    uint32_t n = 1;
+    while(n < (uint32_t) nslots) n *= 2;
+    size_t slot_floats = (4 + 6*(size_t) nl + slot_align/sizeof(float) - 1) / (slot_align/sizeof(float)) * (slot_align/sizeof(float));
+    size_t bytes = header_bytes() + n*slot_floats*sizeof(float);
+
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(fd < 0 || ftruncate(fd, bytes) != 0){
+        cout << "Could not create the shared memory segment " << name << ": " << strerror(errno) << endl;
+        if(fd >= 0) ::close(fd);
+        return NULL;
+    }
+    void *mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(mem == MAP_FAILED){
+        cout << "Could not map " << name << ": " << strerror(errno) << endl;
+        shm_unlink(name.c_str());
+        return NULL;
+    }
+
+    RingHeader *hdr = (RingHeader *) mem;
+    hdr->nl = nl;
+    hdr->nslots = n;
+    hdr->slot_floats = slot_floats;
+    hdr->producer = getpid();
+    hdr->reader = 0;
+    hdr->written = 0;
+    hdr->read = 0;
+    hdr->closed = 0;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(hdr->magic, ring_magic, sizeof(ring_magic));
+    return new FrameRing(name, hdr, bytes, true);
+}
+
+
+FrameRing *FrameRing::attach(const string &name)
+{
+    bool told = false;
+    int fd;
+    struct stat st;
+    RingHeader *hdr = NULL;
+    while(true){
+        fd = shm_open(name.c_str(), O_RDWR, 0);
+        if(fd >= 0 && fstat(fd, &st) == 0 && (size_t) st.st_size >= header_bytes()){
+            void *mem = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if(mem == MAP_FAILED){
+                cout << "Could not map " << name << ": " << strerror(errno) << endl;
+                ::close(fd);
+                return NULL;
+            }
+            hdr = (RingHeader *) mem;
+            if(memcmp((const char *) hdr->magic, ring_magic, sizeof(ring_magic)) == 0)
+                break;
+            munmap(mem, st.st_size);
+        }
+        if(fd >= 0) ::close(fd);
+        if(!told){
+            cout << "Waiting for a producer on " << name << endl;
+            told = true;
+        }
+        usleep(100000);
+    }
+    ::close(fd);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    if(alive(hdr->reader)){
+        cout << name << " already has a reader, process " << hdr->reader << endl;
+        munmap(hdr, st.st_size);
+        return NULL;
+    }
+    hdr->reader = getpid();
+    return new FrameRing(name, hdr, st.st_size, false);
+}
+
+
+FrameRing::~FrameRing()
+{
+    if(owner_){
+        close();
+        hdr_->producer = 0;
+        shm_unlink(name_.c_str());
+    }
+    else{
+        hdr_->reader = -1;
+        futex_wake(&hdr_->read);
+    }
+    munmap(hdr_, bytes_);
+}
+
+
+float *FrameRing::slot(uint32_t frame) const
+{
+    return (float *) ((char *) hdr_ + header_bytes()) + (size_t) (frame & (hdr_->nslots-1))*hdr_->slot_floats;
+}
+
+
+float *FrameRing::acquire(bool wait)
+{
+    uint32_t w = hdr_->written;
+    while(true){
+        uint32_t r = __atomic_load_n(&hdr_->read, __ATOMIC_ACQUIRE);
+        if(w - r < hdr_->nslots)
+            return slot(w);
+        if(!wait)
+            return NULL;
+        if(hdr_->reader && !alive(hdr_->reader)){
+            cout << "The reader of " << name_ << " has gone" << endl;
+            return NULL;
+        }
+        futex_wait(&hdr_->read, r);
+    }
+}
+
+
+void FrameRing::publish()
+{
+    __atomic_store_n(&hdr_->written, hdr_->written+1, __ATOMIC_RELEASE);
+    futex_wake(&hdr_->written);
+}
+
+
+void FrameRing::close()
+{
+    __atomic_store_n(&hdr_->closed, 1, __ATOMIC_RELEASE);
+    futex_wake(&hdr_->written);
+}
+
+
+void FrameRing::drain()
+{
+    while(true){
+        uint32_t r = __atomic_load_n(&hdr_->read, __ATOMIC_ACQUIRE);
+        if(r == hdr_->written || (hdr_->reader && !alive(hdr_->reader)))
+            return;
+        futex_wait(&hdr_->read, r);
+    }
+}
+
+
+const float *FrameRing::next()
+{
+    uint32_t r = hdr_->read;
+    while(true){
+        uint32_t w = __atomic_load_n(&hdr_->written, __ATOMIC_ACQUIRE);
+        if(w != r)
+            return slot(r);
+        if(__atomic_load_n(&hdr_->closed, __ATOMIC_ACQUIRE)){
+            // the last frames may have been published just before the ring was closed
+            if(__atomic_load_n(&hdr_->written, __ATOMIC_ACQUIRE) != r)
+                continue;
+            return NULL;
+        }
+        if(!alive(hdr_->producer)){
+            cout << "The producer of " << name_ << " has gone" << endl;
+            return NULL;
+        }
+        futex_wait(&hdr_->written, w);
+    }
+}
+
+
+void FrameRing::release()
+{
+    __atomic_store_n(&hdr_->read, hdr_->read+1, __ATOMIC_RELEASE);
+    futex_wake(&hdr_->read);
+}
@@ -0,0 +1,128 @@
+/*
+ * FrameRing.h
+ *
+ * A ring of frames in POSIX shared memory, through which a running
+ * simulation hands its coordinates to NIHCode without going through the
+ * disk.  The producer fills a slot with the box and the head and tail
+ * coordinates of every lipid and publishes it; the reader copies the slot
+ * into the analyzer's workspace and releases it when it takes the next
+ * frame.  When every slot is in use the producer waits, so a slow analysis
+ * throttles the simulation instead of losing frames (or the producer may
+ * ask not to wait and skip the frame).
+ *
+ * The segment /name holds a RingHeader followed by nslots slots of
+ *
+ *   float box[4]      lx, ly, lz and one unused value
+ *   float head[3*nl]  x y z of the head of each lipid
+ *   float tail[3*nl]  and of its tail
+ *
+ * Two 32-bit counters in the header, the frames published and the frames
+ * released, are each advanced by one side only; slot c % nslots holds frame
+ * c.  A side that finds the ring full (or empty) sleeps on the other side's
+ * counter with a futex, and wakes every few tenths of a second to check that
+ * the other process is still alive.
+ */
+
+#ifndef FRAMERING_H_
+#define FRAMERING_H_
+
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+
+struct RingHeader{
+    char magic[8];              // "NIHRING", written last
+    uint32_t nl;                // lipids per frame
+    uint32_t nslots;            // a power of two
+    uint64_t slot_floats;       // floats per slot
+    pid_t producer, reader;     // 0 until attached; the reader is -1 once it has detached
+    volatile uint32_t written;  // frames published
+    volatile uint32_t read;     // frames released
+    volatile uint32_t closed;   // =1 once the producer has published its last frame
+};
+
+
+class FrameRing{
+public:
+    /**
+     * @brief Creates the segment, replacing any stale one of the same name.  Called by the producer.
+     * @param name - the segment name, e.g. "/nihcode"
+     * @param nl - the number of lipids per frame
+     * @param nslots - the number of slots; rounded up to a power of two
+     * @return the ring, or NULL with an error printed
+     */
+    static FrameRing *create(const std::string &name, int nl, int nslots);
+
+    /**
+     * @brief Attaches to a segment made by create(), waiting for the producer if it does not exist yet.
+     * @param name - the segment name
+     * @return the ring, or NULL with an error printed
+     */
+    static FrameRing *attach(const std::string &name);
+
+    ~FrameRing();
+
+    int nlipids() const { return hdr_->nl; }
+    int nslots() const { return hdr_->nslots; }
+
+    // producer side
+
+    /**
+     * @brief The slot the next frame is to be written to
+     * @param wait - whether to wait for the reader when every slot is in use
+     * @return the slot, or NULL if the ring is full and wait is false, or the reader has gone
+     */
+    float *acquire(bool wait = true);
+
+    /**
+     * @brief Publishes the frame written to the slot returned by acquire()
+     */
+    void publish();
+
+    /**
+     * @brief Marks the end of the trajectory; the reader stops once it has read every published frame
+     */
+    void close();
+
+    /**
+     * @brief Waits until the reader has released every published frame, or has gone
+     */
+    void drain();
+
+    // reader side
+
+    /**
+     * @brief The oldest published frame that has not been released, waiting for one if needed
+     * @return the slot, or NULL once the producer has closed the ring (or died) and every frame has been read
+     */
+    const float *next();
+
+    /**
+     * @brief Hands the slot returned by next() back to the producer
+     */
+    void release();
+
+    // the parts of a slot
+    static float *box(float *slot) { return slot; }
+    float *head(float *slot) const { return slot + 4; }
+    float *tail(float *slot) const { return slot + 4 + 3*hdr_->nl; }
+    static const float *box(const float *slot) { return slot; }
+    const float *head(const float *slot) const { return slot + 4; }
+    const float *tail(const float *slot) const { return slot + 4 + 3*hdr_->nl; }
+
+private:
+    FrameRing(const std::string &name, RingHeader *hdr, size_t bytes, bool owner);
+    FrameRing(const FrameRing &);
+    FrameRing &operator=(const FrameRing &);
+
+    float *slot(uint32_t frame) const;
+
+    std::string name_;
+    RingHeader *hdr_;
+    size_t bytes_;
+    bool owner_; // the producer, which unlinks the segment
+};
+
+#endif /* FRAMERING_H_ */
@@ -0,0 +1,504 @@
+/*
+ * FrameSource.cpp
+ */
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#include "FrameSource.h"
+#include "InputFile.h"
+#include "Matrix.h"
+
+using namespace std;
+
+
+/**
+ * @brief The name of a trajectory file, which may be overridden by an environment variable
+ * @param envname - the environment variable
+ * @param fallback - the default file name, in the working directory
+ * @param dir - the directory to find the default file name in instead, ignoring the environment, or empty
+ */
+static string input_name(const char *envname, const char *fallback, const string &dir)
+{
+    if(!dir.empty())
+        return dir + "/" + (fallback + 2);
+    const char *envvar = getenv(envname);
+    return (envvar ? envvar : fallback);
+}
+
+
+//---------------------------------------------------------------------------------------------------------------
+//TEXT FILES/////////////////////////////////////////////////////////////////////////////////////////////////////
+//---------------------------------------------------------------------------------------------------------------
+
+TextFrameSource::TextFrameSource(int frames, int nl, bool follow, const volatile sig_atomic_t *stop, const string &dir)
+    : frames_(frames), nl_(nl), follow_(follow), frame_(-1), pending_(false), failed_(false),
+      lboxpx_(NULL), lboxpy_(NULL), lboxpz_(NULL), indexed_(0)
+{
+    Box zero = {0, 0, 0};
+    box_ = zero;
+
+    // box cell dimension files
+    NumberReader *boxx = new NumberReader(input_name("WBCELLX", "./boxsizeX.out", dir), follow, stop);
+    NumberReader *boxy = new NumberReader(input_name("WBCELLY", "./boxsizeY.out", dir), follow, stop);
+    NumberReader *boxz = new NumberReader(input_name("WBCELLZ", "./boxsizeZ.out", dir), follow, stop);
+    if(follow){
+        lboxpx_ = boxx;
+        lboxpy_ = boxy;
+        lboxpz_ = boxz;
+    }
+    else{
+        // every box is read, whatever the number of frames asked for, since they also tell the
+        // length of the trajectory
+        float l;
+        while(boxx->read(&l, 1)) lx_.push_back(l);
+        while(boxy->read(&l, 1)) ly_.push_back(l);
+        while(boxz->read(&l, 1)) lz_.push_back(l);
+        if(boxx->failed() || boxy->failed() || boxz->failed())
+            exit(1);
+        delete boxx;
+        delete boxy;
+        delete boxz;
+
+        int total = min(lx_.size(), min(ly_.size(), lz_.size()));
+        if(frames_ == 0)
+            frames_ = total;
+        else if(frames_ > total){
+            cout << "The box files hold only " << total << " frames" << endl;
+            frames_ = total;
+        }
+        if(frames_ == 0){
+            cout << endl << "The box files are empty" << endl;
+            exit(1);
+        }
+
+        if(nl_ == 0){
+            string name = input_name("WBLIPIDX", "./LipidX.out", dir);
+            long long n = NumberReader::count(name);
+            if(n <= 0 || n % (2LL*total) != 0){
+                cout << endl << "Could not work out the number of lipids: " << name << " holds " << n
+                     << " numbers for the " << total << " frames of the box files; give it with -l" << endl;
+                exit(1);
+            }
+            nl_ = n/(2*total);
+        }
+    }
+
+    lipidx_ = init_matrix<float>(2*nl_);
+    lipidy_ = init_matrix<float>(2*nl_);
+    lipidz_ = init_matrix<float>(2*nl_);
+
+    // lipid vector files
+    lipidxp_ = new NumberReader(input_name("WBLIPIDX", "./LipidX.out", dir), follow, stop);
+    lipidyp_ = new NumberReader(input_name("WBLIPIDY", "./LipidY.out", dir), follow, stop);
+    lipidzp_ = new NumberReader(input_name("WBLIPIDZ", "./LipidZ.out", dir), follow, stop);
+}
+
+
+TextFrameSource::~TextFrameSource()
+{
+    delete lipidxp_;
+    delete lipidyp_;
+    delete lipidzp_;
+    delete lboxpx_;
+    delete lboxpy_;
+    delete lboxpz_;
+    delete [] lipidx_;
+    delete [] lipidy_;
+    delete [] lipidz_;
+}
+
+
+bool TextFrameSource::reference_box(Box &box, long first, long end, int stride)
+{
+    if(follow_){
+        // the first frame, which next() then hands out
+        if(frame_ < 0 && !pending_)
+            pending_ = read_frame();
+        box = box_;
+        return false;
+    }
+
+    if(end <= 0 || end > frames_)
+        end = frames_;
+    float lx_av=0, ly_av=0, lz_av=0;
+    int n = 0;
+    for(long f=first; f<end; f+=stride, n++){
+        lx_av += lx_[f];
+        ly_av += ly_[f];
+        lz_av += lz_[f];
+    }
+    if(n == 0){
+        box.lx = box.ly = box.lz = 0;
+        return false;
+    }
+    box.lx = lx_av/n;
+    box.ly = ly_av/n;
+    box.lz = lz_av/n;
+    return true;
+}
+
+
+bool TextFrameSource::next()
+{
+    if(frames_ > 0 && frame_+1 >= frames_)
+        return false;
+    if(pending_)
+        pending_ = false;
+    else if(!read_frame())
+        return false;
+    frame_++;
+    if(!follow_){
+        box_.lx = lx_[frame_];
+        box_.ly = ly_[frame_];
+        box_.lz = lz_[frame_];
+    }
+    return true;
+}
+
+
+bool TextFrameSource::seek(long frame)
+{
+    if(follow_ || frame < 0 || frame >= frames_)
+        return false;
+    if(indexed_ == 0 && (lipidxp_->compressed() || lipidyp_->compressed() || lipidzp_->compressed()))
+        indexed_ = -1; // frames are found by reading through them
+    if(indexed_ == 0){
+        long long per_frame = 2LL*nl_;
+        bool ok = (indexx_.open(lipidxp_->path(), per_frame) && indexy_.open(lipidyp_->path(), per_frame)
+                   && indexz_.open(lipidzp_->path(), per_frame));
+        indexed_ = (ok ? 1 : -1);
+        if(!ok)
+            cout << "Could not index the lipid files; frames will be skipped by reading them" << endl;
+    }
+    if(indexed_ < 0 || frame >= indexx_.nframes() || frame >= indexy_.nframes() || frame >= indexz_.nframes())
+        return false;
+
+    lipidxp_->seek(indexx_.offset(frame));
+    lipidyp_->seek(indexy_.offset(frame));
+    lipidzp_->seek(indexz_.offset(frame));
+    frame_ = frame-1;
+    pending_ = false;
+    return true;
+}
+
+
+/**
+ * @brief Reads the coordinates, and when following the box, of the frame after frame_
+ * @return false if the files end first, one of them cannot be read (which sets failed_), or the wait for the
+ * frame was stopped
+ */
+bool TextFrameSource::read_frame()
+{
+    if(follow_){
+        if(!lboxpx_->read(&box_.lx, 1) || !lboxpy_->read(&box_.ly, 1) || !lboxpz_->read(&box_.lz, 1)){
+            failed_ = (lboxpx_->failed() || lboxpy_->failed() || lboxpz_->failed());
+            if(failed_)
+                cout << "Could not read frame " << frame_+2 << endl;
+            return false;
+        }
+    }
+    if(!lipidxp_->read(lipidx_, 2*nl_) || !lipidyp_->read(lipidy_, 2*nl_) || !lipidzp_->read(lipidz_, 2*nl_)){
+        failed_ = (lipidxp_->failed() || lipidyp_->failed() || lipidzp_->failed());
+        if(failed_)
+            cout << "Could not read frame " << frame_+2 << endl;
+        else if(!follow_)
+            cout << "The lipid files end in frame " << frame_+2 << endl;
+        return false;
+    }
+    return true;
+}
+
+
+Coordinates TextFrameSource::head() const
+{
+    Coordinates c;
+    c.x = lipidx_;
+    c.y = lipidy_;
+    c.z = lipidz_;
+    c.stride = 2*sizeof(float);
+    return c;
+}
+
+
+Coordinates TextFrameSource::tail() const
+{
+    Coordinates c;
+    c.x = lipidx_+1;
+    c.y = lipidy_+1;
+    c.z = lipidz_+1;
+    c.stride = 2*sizeof(float);
+    return c;
+}
+
+
+//---------------------------------------------------------------------------------------------------------------
+//QUANTIZED TRAJECTORY///////////////////////////////////////////////////////////////////////////////////////////
+//---------------------------------------------------------------------------------------------------------------
+
+QuantizedFrameSource::QuantizedFrameSource(const string &path, int frames)
+    : path_(path), frame_(-1), failed_(false), scanned_(0)
+{
+    Box zero = {0, 0, 0};
+    box_ = zero;
+
+    Compression compression;
+    fp_ = open_input(path, &compression);
+    if(!fp_){
+        cout << endl << "Could not open " << path << endl;
+        exit(1);
+    }
+    compressed_ = (compression != COMPRESSION_NONE);
+    if(fread(&header_, sizeof(header_), 1, fp_) != 1
+       || memcmp(header_.magic, quantized_magic, sizeof(header_.magic)) != 0){
+        cout << endl << path << " is not a quantized trajectory" << endl;
+        exit(1);
+    }
+    if(header_.nl <= 0 || header_.nframes <= 0 || !(header_.precision > 0)){
+        cout << endl << path << " holds no frames; it may not have been closed" << endl;
+        exit(1);
+    }
+
+    frames_ = header_.nframes;
+    if(frames > frames_)
+        cout << path << " holds only " << frames_ << " frames" << endl;
+    else if(frames > 0)
+        frames_ = frames;
+    xyz_.resize(6*header_.nl);
+}
+
+
+QuantizedFrameSource::~QuantizedFrameSource()
+{
+    fclose(fp_);
+}
+
+
+bool QuantizedFrameSource::reference_box(Box &box, long first, long end, int stride)
+{
+    if(end <= 0 || end > frames_)
+        end = frames_;
+    if(first == 0 && stride == 1 && end == header_.nframes){
+        box.lx = header_.lx_av;
+        box.ly = header_.ly_av;
+        box.lz = header_.lz_av;
+        return true;
+    }
+
+    // averaged in the same way as the box files, over the frames analyzed
+    if(scanned_ == 0)
+        scanned_ = (scan() ? 1 : -1);
+    if(scanned_ < 0){
+        box.lx = box.ly = box.lz = 0;
+        return false;
+    }
+    float lx_av=0, ly_av=0, lz_av=0;
+    int n = 0;
+    for(long f=first; f<end; f+=stride, n++){
+        lx_av += boxes_[f].lx;
+        ly_av += boxes_[f].ly;
+        lz_av += boxes_[f].lz;
+    }
+    if(n == 0){
+        box.lx = box.ly = box.lz = 0;
+        return false;
+    }
+    box.lx = lx_av/n;
+    box.ly = ly_av/n;
+    box.lz = lz_av/n;
+    return true;
+}
+
+
+bool QuantizedFrameSource::read_size(uint32_t &size)
+{
+    if(frame_+1 >= frames_)
+        return false;
+    if(fread(&size, sizeof(size), 1, fp_) != 1){
+        cout << path_ << " ends in frame " << frame_+2 << endl;
+        return false;
+    }
+    return true;
+}
+
+
+bool QuantizedFrameSource::next()
+{
+    uint32_t size;
+    if(!read_size(size))
+        return false;
+    data_.resize(size);
+    if(fread(&data_[0], 1, size, fp_) != size){
+        cout << path_ << " ends in frame " << frame_+2 << endl;
+        return false;
+    }
+    float *const xyz[6] = {&xyz_[0], &xyz_[header_.nl], &xyz_[2*header_.nl],
+                           &xyz_[3*header_.nl], &xyz_[4*header_.nl], &xyz_[5*header_.nl]};
+    if(!dequantize_frame(&data_[0], size, header_.nl, header_.precision, xyz, box_)){
+        cout << "Frame " << frame_+2 << " of " << path_ << " is corrupt" << endl;
+        failed_ = true;
+        return false;
+    }
+    frame_++;
+    return true;
+}
+
+
+bool QuantizedFrameSource::skip()
+{
+    uint32_t size;
+    if(!read_size(size))
+        return false;
+    bool ok;
+    if(compressed_){
+        data_.resize(size);
+        ok = (fread(&data_[0], 1, size, fp_) == size);
+    }
+    else
+        ok = (fseeko(fp_, size, SEEK_CUR) == 0);
+    if(!ok){
+        cout << path_ << " ends in frame " << frame_+2 << endl;
+        return false;
+    }
+    frame_++;
+    return true;
+}
+
+
+bool QuantizedFrameSource::seek(long frame)
+{
+    if(compressed_ || frame < 0 || frame >= frames_)
+        return false;
+    if(scanned_ == 0)
+        scanned_ = (scan() ? 1 : -1);
+    if(scanned_ < 0 || fseeko(fp_, offsets_[frame], SEEK_SET) != 0)
+        return false;
+    frame_ = frame-1;
+    return true;
+}
+
+
+/**
+ * @brief Reads the box and the offset of each of the frames_ frames from a second handle on the file,
+ * skipping over the coordinates
+ * @return false if the file is shorter than its header says
+ */
+bool QuantizedFrameSource::scan()
+{
+    FILE *fp = open_input(path_);
+    if(!fp)
+        return false;
+    vector<uint8_t> skipped;
+    long long offset = sizeof(QuantizedHeader);
+    QuantizedHeader header;
+    bool ok = (fread(&header, sizeof(header), 1, fp) == 1);
+    for(int f=0; ok && f<frames_; f++){
+        uint32_t size;
+        float b[3];
+        ok = (fread(&size, sizeof(size), 1, fp) == 1 && size >= sizeof(b) && fread(b, sizeof(float), 3, fp) == 3);
+        if(!ok)
+            break;
+        if(compressed_){
+            skipped.resize(size - sizeof(b) + 1);
+            ok = (fread(&skipped[0], 1, size - sizeof(b), fp) == size - sizeof(b));
+        }
+        else
+            ok = (fseeko(fp, size - sizeof(b), SEEK_CUR) == 0);
+        Box box = {b[0], b[1], b[2]};
+        boxes_.push_back(box);
+        offsets_.push_back(offset);
+        offset += sizeof(size) + size;
+    }
+    fclose(fp);
+    if(!ok)
+        cout << path_ << " is shorter than its header says" << endl;
+    return ok;
+}
+
+
+Coordinates QuantizedFrameSource::head() const
+{
+    Coordinates c;
+    c.x = &xyz_[0];
+    c.y = &xyz_[header_.nl];
+    c.z = &xyz_[2*header_.nl];
+    c.stride = sizeof(float);
+    return c;
+}
+
+
+Coordinates QuantizedFrameSource::tail() const
+{
+    Coordinates c;
+    c.x = &xyz_[3*header_.nl];
+    c.y = &xyz_[4*header_.nl];
+    c.z = &xyz_[5*header_.nl];
+    c.stride = sizeof(float);
+    return c;
+}
+
+
+//---------------------------------------------------------------------------------------------------------------
+//SHARED MEMORY RING/////////////////////////////////////////////////////////////////////////////////////////////
+//---------------------------------------------------------------------------------------------------------------
+
+RingFrameSource::RingFrameSource(const string &name)
+    : slot_(NULL)
+{
+    ring_ = FrameRing::attach(name);
+    if(!ring_)
+        exit(1);
+}
+
+
+RingFrameSource::~RingFrameSource()
+{
+    delete ring_;
+}
+
+
+bool RingFrameSource::reference_box(Box &box, long, long, int)
+{
+    // the first frame stays in the ring until next() moves past it
+    const float *first = (slot_ ? slot_ : ring_->next());
+    if(!first){
+        box.lx = box.ly = box.lz = 0;
+        return false;
+    }
+    const float *b = FrameRing::box(first);
+    box.lx = b[0];
+    box.ly = b[1];
+    box.lz = b[2];
+    return false;
+}
+
+
+bool RingFrameSource::next()
+{
+    if(slot_)
+        ring_->release();
+    slot_ = ring_->next();
+    return slot_ != NULL;
+}
+
+
+Coordinates RingFrameSource::head() const
+{
+    return Coordinates(ring_->head(slot_));
+}
+
+
+Coordinates RingFrameSource::tail() const
+{
+    return Coordinates(ring_->tail(slot_));
+}
+
+
+Box RingFrameSource::box() const
+{
+    const float *b = FrameRing::box(slot_);
+    Box box = {b[0], b[1], b[2]};
+    return box;
+}
@@ -0,0 +1,217 @@
+/*
+ * FrameSource.h
+ *
+ * Where the frames come from: the text trajectories written by the
+ * extraction scripts (LipidX.out, boxsizeX.out and friends), the same
+ * converted to a QuantizedTrajectory, or a shared memory ring filled by a
+ * running simulation.  Each source hands out the
+ * head and tail coordinates of the current frame as views into its own
+ * buffers, which stay valid until the next call to next() or skip().
+ */
+
+#ifndef FRAMESOURCE_H_
+#define FRAMESOURCE_H_
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "SpectrumAnalyzer.h"
+#include "FrameRing.h"
+#include "NumberReader.h"
+#include "FrameIndex.h"
+#include "QuantizedTrajectory.h"
+
+
+class FrameSource{
+public:
+    virtual ~FrameSource() {}
+
+    /**
+     * @brief The number of lipids in every frame
+     */
+    virtual int nlipids() const = 0;
+
+    /**
+     * @brief The number of frames, or 0 if that is not known up front
+     */
+    virtual int nframes() const { return 0; }
+
+    /**
+     * @brief The box used for the q values before any frame has been analyzed
+     * @param box - set to the average over the frames analyzed if those are known up front, else the first
+     * frame's box
+     * @param first - the first frame analyzed, counting from 0
+     * @param end - one past the last frame analyzed, or 0 for all of them
+     * @param stride - the step between the frames analyzed
+     * @return true if box is the average over the frames analyzed
+     */
+    virtual bool reference_box(Box &box, long first = 0, long end = 0, int stride = 1) = 0;
+
+    /**
+     * @brief Moves to the next frame
+     * @return false at the end of the trajectory
+     */
+    virtual bool next() = 0;
+
+    /**
+     * @brief Moves past the next frame without making its coordinates available
+     * @return false at the end of the trajectory
+     */
+    virtual bool skip() { return next(); }
+
+    /**
+     * @brief Moves straight to a frame, without reading the ones in between
+     * @param frame - the frame the next call to next() returns, counting from 0
+     * @return false if the source cannot seek, in which case it has not moved
+     */
+    virtual bool seek(long) { return false; }
+
+    /**
+     * @brief Whether next() or skip() last returned false because a frame could not be read, e.g. it holds
+     * something that is not a number or is corrupt, rather than at the end of the trajectory
+     */
+    virtual bool failed() const { return false; }
+
+    // the current frame
+    virtual Coordinates head() const = 0;
+    virtual Coordinates tail() const = 0;
+    virtual Box box() const = 0;
+};
+
+
+/*
+ * The text trajectories: the heads and tails alternate in LipidX.out, LipidY.out and LipidZ.out, and
+ * boxsizeX.out etc. hold one box length per frame.  The environment variables WBLIPIDX, WBCELLX etc.
+ * override the file names, and any of the files may be compressed (see InputFile).  The first seek() indexes
+ * the lipid files (see FrameIndex), unless they are compressed.  When following, the files may still be being
+ * written: each frame is read once all six files hold it, and the box is read along with it rather than all
+ * up front.
+ */
+class TextFrameSource : public FrameSource{
+public:
+    /**
+     * @brief Opens the files and, unless following, reads the box of every frame; exits if the number
+     * of lipids cannot be worked out.
+     * @param frames - the number of frames to read, or 0 for all of them (when following, until stop is set)
+     * @param nl - the number of lipids per frame, or 0 to work it out from the sizes of LipidX.out and
+     * boxsizeX.out (not when following)
+     * @param follow - whether to wait for frames that have not been written yet
+     * @param stop - when following, stops the wait for the next frame once nonzero
+     * @param dir - the directory holding the files under their default names, or empty for the working
+     * directory and the environment variables
+     */
+    TextFrameSource(int frames, int nl, bool follow = false, const volatile sig_atomic_t *stop = NULL,
+                    const std::string &dir = "");
+    ~TextFrameSource();
+
+    int nlipids() const { return nl_; }
+    int nframes() const { return (follow_ ? 0 : frames_); }
+    bool reference_box(Box &box, long first = 0, long end = 0, int stride = 1);
+    bool next();
+    bool seek(long frame);
+    bool failed() const { return failed_; }
+    Coordinates head() const;
+    Coordinates tail() const;
+    Box box() const { return box_; }
+
+private:
+    TextFrameSource(const TextFrameSource &);
+    TextFrameSource &operator=(const TextFrameSource &);
+
+    bool read_frame();
+
+    int frames_, nl_;
+    bool follow_;
+    int frame_;                     // the current frame, -1 before the first
+    bool pending_;                  // the frame after frame_ has already been read, by reference_box()
+    bool failed_;                   // a frame could not be read
+    Box box_;                       // of the current frame
+    std::vector<float> lx_, ly_, lz_; // the box dimensions at each frame, unless following
+    float *lipidx_, *lipidy_, *lipidz_; // heads and tails of the current frame, alternating
+    NumberReader *lipidxp_, *lipidyp_, *lipidzp_;
+    NumberReader *lboxpx_, *lboxpy_, *lboxpz_; // while following
+    int indexed_;                   // 1 once the frame indices of the lipid files are loaded, -1 if that failed
+    FrameIndex indexx_, indexy_, indexz_;
+};
+
+
+/*
+ * A QuantizedTrajectory file, which may be compressed.  Each frame is decoded into separate x, y and z arrays
+ * of the heads and tails, which head() and tail() describe for the analyzer to gather from.  The first seek()
+ * finds where each frame starts by hopping from one frame's size to the next, unless the file is compressed.
+ */
+class QuantizedFrameSource : public FrameSource{
+public:
+    /**
+     * @brief Opens the file and reads its header; exits if it is not a quantized trajectory.
+     * @param path - the file
+     * @param frames - the number of frames to read, or 0 for all of them
+     */
+    QuantizedFrameSource(const std::string &path, int frames);
+    ~QuantizedFrameSource();
+
+    int nlipids() const { return header_.nl; }
+    int nframes() const { return frames_; }
+    float precision() const { return header_.precision; }
+    bool reference_box(Box &box, long first = 0, long end = 0, int stride = 1);
+    bool next();
+    bool skip();
+    bool seek(long frame);
+    bool failed() const { return failed_; }
+    Coordinates head() const;
+    Coordinates tail() const;
+    Box box() const { return box_; }
+
+private:
+    QuantizedFrameSource(const QuantizedFrameSource &);
+    QuantizedFrameSource &operator=(const QuantizedFrameSource &);
+
+    bool read_size(uint32_t &size);
+    bool scan();
+
+    std::string path_;
+    FILE *fp_;
+    bool compressed_;
+    QuantizedHeader header_;
+    int frames_;
+    int frame_;                     // the current frame, -1 before the first
+    bool failed_;                   // a frame is corrupt
+    Box box_;
+    std::vector<uint8_t> data_;     // the encoded current frame
+    std::vector<float> xyz_;        // head x, y, z and tail x, y, z of the current frame, nl each
+    int scanned_;                   // 1 once boxes_ and offsets_ are known, -1 if that failed
+    std::vector<Box> boxes_;        // of each of the first frames_ frames
+    std::vector<long long> offsets_; // and where each starts
+};
+
+
+/*
+ * The frames published into a FrameRing by a running simulation.  The analyzer copies the current frame out
+ * of its slot into its workspace, and the slot is released on the next call to next().
+ */
+class RingFrameSource : public FrameSource{
+public:
+    /**
+     * @brief Attaches to the ring, waiting for the producer if needed; exits if that fails.
+     * @param name - the shared memory segment
+     */
+    RingFrameSource(const std::string &name);
+    ~RingFrameSource();
+
+    int nlipids() const { return ring_->nlipids(); }
+    bool reference_box(Box &box, long first = 0, long end = 0, int stride = 1);
+    bool next();
+    Coordinates head() const;
+    Coordinates tail() const;
+    Box box() const;
+
+private:
+    RingFrameSource(const RingFrameSource &);
+    RingFrameSource &operator=(const RingFrameSource &);
+
+    FrameRing *ring_;
+    const float *slot_; // the current frame, or NULL
+};
+
+#endif /* FRAMESOURCE_H_ */
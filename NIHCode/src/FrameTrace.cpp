@@ -0,0 +1,57 @@
+/*
+ * FrameTrace.cpp
+ */
+
+#include <stdio.h>
+#include <algorithm>
+
+#include "FrameTrace.h"
+#include "StageTimer.h"
+
+using namespace std;
+
+// slices and queue counters per frame: one of each stage, and one of each queue after the read stage
+static const int events_per_frame = 9;
+
+
+FrameTrace::FrameTrace(long frames) : events_(max(frames, 1L)*events_per_frame), next_(0)
+{
+    profile_tick_seconds(); // calibrated now rather than while the pipeline runs
+    origin_ = profile_ticks();
+}
+
+
+void FrameTrace::name_thread(int tid, const string &name)
+{
+    threads_.push_back(make_pair(tid, name));
+}
+
+
+bool FrameTrace::write(const string &path) const
+{
+    FILE *fp = fopen(path.c_str(), "w");
+    if(!fp)
+        return false;
+    double us = 1e6*profile_tick_seconds();
+    fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"otherData\": {\"dropped_events\": %zu}, \"traceEvents\": [\n", dropped());
+    fprintf(fp, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"NIHCode\"}}");
+    for(size_t i=0; i<threads_.size(); i++){
+        fprintf(fp, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                threads_[i].first, threads_[i].second.c_str());
+        fprintf(fp, ",\n{\"name\": \"thread_sort_index\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"sort_index\": %d}}",
+                threads_[i].first, threads_[i].first);
+    }
+    size_t n = recorded();
+    for(size_t i=0; i<n; i++){
+        const Event &e = events_[i];
+        double ts = us*(double) (int64_t) (e.begin - origin_);
+        if(e.tid < 0)
+            fprintf(fp, ",\n{\"name\": \"%s\", \"ph\": \"C\", \"ts\": %.3f, \"pid\": 1, \"args\": {\"frames\": %ld}}",
+                    e.name, ts, e.frame);
+        else
+            fprintf(fp, ",\n{\"name\": \"%s\", \"cat\": \"stage\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, "
+                    "\"tid\": %d, \"args\": {\"frame\": %ld}}", e.name, ts, us*(double) (e.end - e.begin), e.tid, e.frame+1);
+    }
+    fprintf(fp, "\n]}\n");
+    return fclose(fp) == 0;
+}
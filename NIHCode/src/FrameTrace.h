@@ -0,0 +1,106 @@
+/*
+ * FrameTrace.h
+ *
+ * A timeline of the frames as they go through the stages of a FramePipeline,
+ * written in the Chrome trace event format, which Perfetto
+ * (ui.perfetto.dev) and chrome://tracing open offline: a slice for each
+ * stage of each frame on the thread that ran it, and counters of how full
+ * each stage's input queue was whenever the stage took a frame from it.
+ *
+ * The events are recorded into a buffer allocated up front, each thread
+ * claiming the next slot with an atomic increment, so recording takes no
+ * lock and allocates nothing.  Once the buffer is full, later events are
+ * dropped and counted.  The buffer must not be written out while a pipeline
+ * is still recording into it.
+ */
+
+#ifndef FRAMETRACE_H_
+#define FRAMETRACE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+
+class FrameTrace{
+public:
+    /**
+     * @brief Allocates the buffer
+     * @param frames - the number of frames it has room for, at a slice per stage and a counter per queue each
+     */
+    FrameTrace(long frames);
+
+    /**
+     * @brief Names a thread in the timeline; not thread safe, so called before the threads start
+     * @param tid - the thread, as passed to slice()
+     */
+    void name_thread(int tid, const std::string &name);
+
+    /**
+     * @brief Records that a thread worked on a frame
+     * @param name - the stage; must outlive the trace
+     * @param begin, end - from profile_ticks()
+     */
+    void slice(int tid, const char *name, long frame, uint64_t begin, uint64_t end)
+    {
+        Event *e = claim();
+        if(!e)
+            return;
+        e->name = name;
+        e->begin = begin;
+        e->end = end;
+        e->frame = frame;
+        e->tid = tid;
+    }
+
+    /**
+     * @brief Records the value of a counter, e.g. the frames waiting in a queue
+     * @param name - the counter; must outlive the trace
+     */
+    void counter(const char *name, long value, uint64_t when)
+    {
+        Event *e = claim();
+        if(!e)
+            return;
+        e->name = name;
+        e->begin = when;
+        e->end = 0;
+        e->frame = value;
+        e->tid = -1;
+    }
+
+    /**
+     * @brief Writes the trace event JSON
+     * @return false if the file cannot be written
+     */
+    bool write(const std::string &path) const;
+
+    size_t recorded() const { return std::min(next_, events_.size()); }
+    size_t dropped() const { return (next_ > events_.size() ? next_ - events_.size() : 0); }
+
+private:
+    FrameTrace(const FrameTrace &);
+    FrameTrace &operator=(const FrameTrace &);
+
+    struct Event{
+        const char *name;
+        uint64_t begin, end; // end is 0 for a counter
+        long frame;          // or the value of a counter
+        int tid;             // -1 for a counter
+    };
+
+    Event *claim()
+    {
+        size_t i = __atomic_fetch_add(&next_, 1, __ATOMIC_RELAXED);
+        return (i < events_.size() ? &events_[i] : NULL);
+    }
+
+    std::vector<Event> events_;
+    size_t next_;           // the next free slot; past the end once full
+    uint64_t origin_;       // profile_ticks() when the trace was made
+    std::vector<std::pair<int, std::string> > threads_;
+};
+
+#endif /* FRAMETRACE_H_ */
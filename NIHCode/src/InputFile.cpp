@@ -0,0 +1,428 @@
+/*
+ * InputFile.cpp
+ */
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <lzma.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "InputFile.h"
+
+using namespace std;
+
+static const size_t read_chunk = 1 << 20; // compressed bytes read from the file at a time
+
+
+static int ncores()
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0 ? n : 1);
+}
+
+
+//---------------------------------------------------------------------------------------------------------------
+//GZIP///////////////////////////////////////////////////////////////////////////////////////////////////////////
+//---------------------------------------------------------------------------------------------------------------
+
+static ssize_t gzip_read(void *cookie, char *buf, size_t size)
+{
+    int got = gzread((gzFile) cookie, buf, (unsigned) min(size, (size_t) INT_MAX));
+    if(got < 0){
+        int err;
+        cout << "Could not decompress: " << gzerror((gzFile) cookie, &err) << endl;
+        errno = EIO;
+        return -1;
+    }
+    return got;
+}
+
+
+static int gzip_close(void *cookie)
+{
+    return (gzclose((gzFile) cookie) == Z_OK ? 0 : EOF);
+}
+
+
+static FILE *open_gzip(const string &path)
+{
+    gzFile gz = gzopen(path.c_str(), "rb");
+    if(!gz)
+        return NULL;
+    gzbuffer(gz, read_chunk);
+    cookie_io_functions_t io = {gzip_read, NULL, NULL, gzip_close};
+    FILE *fp = fopencookie(gz, "r", io);
+    if(!fp)
+        gzclose(gz);
+    return fp;
+}
+
+
+//---------------------------------------------------------------------------------------------------------------
+//XZ/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//---------------------------------------------------------------------------------------------------------------
+
+struct XzInput{
+    FILE *fp;
+    lzma_stream strm;
+    vector<uint8_t> in;
+    bool in_eof;    // all of the file has been handed to the decoder
+    bool done;      // and all of it has been decompressed
+};
+
+
+static ssize_t xz_read(void *cookie, char *buf, size_t size)
+{
+    XzInput &xz = *(XzInput *) cookie;
+    xz.strm.next_out = (uint8_t *) buf;
+    xz.strm.avail_out = size;
+    while(xz.strm.avail_out > 0 && !xz.done){
+        if(xz.strm.avail_in == 0 && !xz.in_eof){
+            xz.strm.next_in = &xz.in[0];
+            xz.strm.avail_in = fread(&xz.in[0], 1, xz.in.size(), xz.fp);
+            xz.in_eof = (xz.strm.avail_in == 0);
+        }
+        lzma_ret ret = lzma_code(&xz.strm, xz.in_eof ? LZMA_FINISH : LZMA_RUN);
+        if(ret == LZMA_STREAM_END)
+            xz.done = true;
+        else if(ret != LZMA_OK){
+            cout << "Could not decompress: " << (ret == LZMA_BUF_ERROR ? "the file is truncated" : "the data is corrupt")
+                 << " (liblzma error " << ret << ")" << endl;
+            errno = EIO;
+            return -1;
+        }
+    }
+    return size - xz.strm.avail_out;
+}
+
+
+static int xz_close(void *cookie)
+{
+    XzInput *xz = (XzInput *) cookie;
+    lzma_end(&xz->strm);
+    int ret = fclose(xz->fp);
+    delete xz;
+    return ret;
+}
+
+
+static FILE *open_xz(const string &path)
+{
+    FILE *raw = fopen(path.c_str(), "rb");
+    if(!raw)
+        return NULL;
+    XzInput *xz = new XzInput;
+    xz->fp = raw;
+    lzma_stream init = LZMA_STREAM_INIT;
+    xz->strm = init;
+    xz->in.resize(read_chunk);
+    xz->in_eof = false;
+    xz->done = false;
+
+    // files written by xz -T are made of independent blocks, which the threaded decoder spreads over the
+    // cores; a file of a single block is decoded on one of them either way
+#if LZMA_VERSION >= 50040002
+    lzma_mt mt;
+    memset(&mt, 0, sizeof(mt));
+    mt.flags = LZMA_CONCATENATED;
+    mt.threads = ncores();
+    mt.memlimit_threading = lzma_physmem()/4;
+    mt.memlimit_stop = UINT64_MAX;
+    lzma_ret ret = lzma_stream_decoder_mt(&xz->strm, &mt);
+#else
+    lzma_ret ret = lzma_stream_decoder(&xz->strm, UINT64_MAX, LZMA_CONCATENATED);
+#endif
+    if(ret != LZMA_OK){
+        cout << "Could not start decompressing " << path << " (liblzma error " << ret << ")" << endl;
+        fclose(raw);
+        delete xz;
+        return NULL;
+    }
+
+    cookie_io_functions_t io = {xz_read, NULL, NULL, xz_close};
+    FILE *fp = fopencookie(xz, "r", io);
+    if(!fp)
+        xz_close(xz);
+    return fp;
+}
+
+
+//---------------------------------------------------------------------------------------------------------------
+//ZSTD///////////////////////////////////////////////////////////////////////////////////////////////////////////
+//---------------------------------------------------------------------------------------------------------------
+
+#ifdef HAVE_ZSTD
+
+static const size_t zstd_unit = 4 << 20; // compressed bytes decompressed by one thread at a time, at least
+
+/*
+ * A run of whole zstd frames, which decompresses independently of the others.
+ */
+struct ZstdUnit{
+    const uint8_t *data;
+    size_t size;
+    vector<char> out;
+    bool ok;
+};
+
+
+static void *zstd_decompress_unit(void *arg)
+{
+    ZstdUnit &u = *(ZstdUnit *) arg;
+    u.out.clear();
+    u.ok = true;
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    ZSTD_inBuffer in = {u.data, u.size, 0};
+    size_t ret = 0;
+    while(in.pos < in.size){
+        if(u.out.capacity() - u.out.size() < ZSTD_DStreamOutSize())
+            u.out.reserve(max(2*u.out.capacity(), u.out.size() + ZSTD_DStreamOutSize()));
+        size_t used = u.out.size();
+        u.out.resize(u.out.capacity());
+        ZSTD_outBuffer out = {&u.out[0], u.out.size(), used};
+        ret = ZSTD_decompressStream(dctx, &out, &in);
+        u.out.resize(out.pos);
+        if(ZSTD_isError(ret)){
+            u.ok = false;
+            break;
+        }
+    }
+    ZSTD_freeDCtx(dctx);
+    return NULL;
+}
+
+
+/*
+ * The file is mapped whole.  A file of one frame is decompressed as a stream; otherwise the frames are grouped
+ * into units of at least zstd_unit bytes, and the next batch of one unit per core is decompressed in parallel
+ * once the reader has used up the previous one.
+ */
+struct ZstdInput{
+    const uint8_t *data;
+    size_t size;
+    ZSTD_DCtx *dctx;                // for a file of one frame
+    ZSTD_inBuffer in;
+    size_t last_ret;                // what the last call to ZSTD_decompressStream returned
+    vector<ZstdUnit> units;         // for a file of several frames
+    size_t next_unit;               // the first unit not yet decompressed
+    size_t batch_begin, batch_end;  // the units decompressed in the current batch
+    size_t current, pos;            // the unit being read, and the next byte of it
+};
+
+
+static void zstd_decompress_batch(ZstdInput &z)
+{
+    // the previous batch has been read, so its buffers can go
+    for(size_t u=z.batch_begin; u<z.batch_end; u++)
+        vector<char>().swap(z.units[u].out);
+
+    z.batch_begin = z.next_unit;
+    z.batch_end = min(z.units.size(), z.next_unit + ncores());
+    size_t n = z.batch_end - z.batch_begin;
+    vector<pthread_t> threads(n);
+    vector<bool> started(n, false);
+    for(size_t t=1; t<n; t++)
+        started[t] = (pthread_create(&threads[t], NULL, zstd_decompress_unit, &z.units[z.batch_begin+t]) == 0);
+    zstd_decompress_unit(&z.units[z.batch_begin]);
+    for(size_t t=1; t<n; t++){
+        if(started[t]) pthread_join(threads[t], NULL);
+        else zstd_decompress_unit(&z.units[z.batch_begin+t]);
+    }
+    z.next_unit = z.batch_end;
+}
+
+
+static ssize_t zstd_read(void *cookie, char *buf, size_t size)
+{
+    ZstdInput &z = *(ZstdInput *) cookie;
+    if(z.dctx){
+        ZSTD_outBuffer out = {buf, size, 0};
+        while(out.pos < out.size && !(z.in.pos == z.in.size && z.last_ret == 0)){
+            size_t in_before = z.in.pos, out_before = out.pos;
+            z.last_ret = ZSTD_decompressStream(z.dctx, &out, &z.in);
+            if(ZSTD_isError(z.last_ret)){
+                cout << "Could not decompress: " << ZSTD_getErrorName(z.last_ret) << endl;
+                errno = EIO;
+                return -1;
+            }
+            if(z.in.pos == in_before && out.pos == out_before){
+                if(out.pos > 0)
+                    break; // reported on the next call
+                cout << "Could not decompress: the file is truncated" << endl;
+                errno = EIO;
+                return -1;
+            }
+        }
+        return out.pos;
+    }
+
+    size_t got = 0;
+    while(got < size){
+        if(z.current < z.next_unit && z.pos < z.units[z.current].out.size()){
+            size_t n = min(size-got, z.units[z.current].out.size() - z.pos);
+            memcpy(buf+got, &z.units[z.current].out[z.pos], n);
+            got += n;
+            z.pos += n;
+            continue;
+        }
+        if(z.current < z.next_unit){
+            z.current++;
+            z.pos = 0;
+            continue;
+        }
+        if(z.next_unit == z.units.size())
+            break;
+        zstd_decompress_batch(z);
+        for(size_t u=z.batch_begin; u<z.batch_end; u++){
+            if(!z.units[u].ok){
+                cout << "Could not decompress: the data is corrupt" << endl;
+                errno = EIO;
+                return -1;
+            }
+        }
+    }
+    return got;
+}
+
+
+static int zstd_close(void *cookie)
+{
+    ZstdInput *z = (ZstdInput *) cookie;
+    if(z->dctx) ZSTD_freeDCtx(z->dctx);
+    if(z->size) munmap((void *) z->data, z->size);
+    delete z;
+    return 0;
+}
+
+
+static FILE *open_zstd(const string &path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) != 0){
+        if(fd >= 0) close(fd);
+        return NULL;
+    }
+    ZstdInput *z = new ZstdInput;
+    z->size = st.st_size;
+    z->data = (const uint8_t *) mmap(NULL, z->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(z->data == MAP_FAILED){
+        delete z;
+        return NULL;
+    }
+    madvise((void *) z->data, z->size, MADV_SEQUENTIAL);
+    z->dctx = NULL;
+    z->last_ret = 0;
+    z->next_unit = z->batch_begin = z->batch_end = z->current = z->pos = 0;
+
+    // find the frames, and group them
+    size_t nframes = 0, unit_begin = 0;
+    for(size_t off=0; off<z->size; nframes++){
+        size_t len = ZSTD_findFrameCompressedSize(z->data + off, z->size - off);
+        if(ZSTD_isError(len)){
+            if(nframes > 0){
+                cout << "Could not decompress " << path << ": " << ZSTD_getErrorName(len) << endl;
+                zstd_close(z);
+                return NULL;
+            }
+            break; // a single frame that may be truncated, which the stream reports once it gets there
+        }
+        off += len;
+        if(off - unit_begin >= zstd_unit || off == z->size){
+            ZstdUnit u;
+            u.data = z->data + unit_begin;
+            u.size = off - unit_begin;
+            u.ok = true;
+            z->units.push_back(u);
+            unit_begin = off;
+        }
+    }
+    if(nframes <= 1){
+        z->units.clear();
+        z->dctx = ZSTD_createDCtx();
+        ZSTD_inBuffer in = {z->data, z->size, 0};
+        z->in = in;
+    }
+
+    cookie_io_functions_t io = {zstd_read, NULL, NULL, zstd_close};
+    FILE *fp = fopencookie(z, "r", io);
+    if(!fp)
+        zstd_close(z);
+    return fp;
+}
+
+#endif
+
+
+//---------------------------------------------------------------------------------------------------------------
+
+FILE *open_input(const string &path, Compression *compression)
+{
+    FILE *fp = fopen(path.c_str(), "rb");
+    if(!fp)
+        return NULL;
+    unsigned char magic[6] = {0};
+    size_t got = fread(magic, 1, sizeof(magic), fp);
+
+    Compression c = COMPRESSION_NONE;
+    if(got >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+        c = COMPRESSION_GZIP;
+    else if(got >= 6 && memcmp(magic, "\xfd" "7zXZ\0", 6) == 0)
+        c = COMPRESSION_XZ;
+    else if(got >= 4 && memcmp(magic, "\x28\xb5\x2f\xfd", 4) == 0)
+        c = COMPRESSION_ZSTD;
+    if(compression)
+        *compression = c;
+
+    if(c == COMPRESSION_NONE){
+        rewind(fp);
+        return fp;
+    }
+    fclose(fp);
+
+    switch(c){
+    case COMPRESSION_GZIP:
+        fp = open_gzip(path);
+        break;
+    case COMPRESSION_XZ:
+        fp = open_xz(path);
+        break;
+    case COMPRESSION_ZSTD:
+#ifdef HAVE_ZSTD
+        fp = open_zstd(path);
+#else
+        cout << path << " is compressed with zstd, which this build cannot read; build it with make ZSTD=1" << endl;
+        return NULL;
+#endif
+        break;
+    default:
+        break;
+    }
+    if(fp)
+        setvbuf(fp, NULL, _IOFBF, read_chunk);
+    return fp;
+}
+
+
+const char *compression_name(Compression compression)
+{
+    switch(compression){
+    case COMPRESSION_GZIP: return "gzip";
+    case COMPRESSION_XZ: return "xz";
+    case COMPRESSION_ZSTD: return "zstd";
+    default: return "none";
+    }
+}
@@ -0,0 +1,42 @@
+/*
+ * InputFile.h
+ *
+ * Opens a trajectory file that may be compressed, so that the archives can
+ * be read as they are instead of being decompressed to scratch first.  The
+ * format is told from the first bytes of the file, not its name:
+ *
+ *   gzip   1f 8b           decompressed by zlib, on the reading thread
+ *   xz     fd 37 7a 58 5a  decompressed by liblzma, with one thread per core
+ *                          for files written in blocks (xz -T)
+ *   zstd   28 b5 2f fd     with HAVE_ZSTD only; files of several frames
+ *                          (pzstd, or zstd --block-size) are decompressed one
+ *                          run of frames per core at a time
+ *
+ * and anything else is read as it is.  A compressed file is handed out as an
+ * ordinary FILE* that decompresses as it is read, so it cannot be seeked.
+ */
+
+#ifndef INPUTFILE_H_
+#define INPUTFILE_H_
+
+#include <stdio.h>
+#include <string>
+
+
+enum Compression{COMPRESSION_NONE, COMPRESSION_GZIP, COMPRESSION_XZ, COMPRESSION_ZSTD};
+
+/**
+ * @brief Opens a file for reading, decompressing it on the fly if it is compressed
+ * @param path - the file
+ * @param compression - if not NULL, set to the compression of the file
+ * @return the stream, to be closed with fclose, or NULL if the file cannot be opened or its compression
+ * is not supported by this build (which is printed)
+ */
+FILE *open_input(const std::string &path, Compression *compression = NULL);
+
+/**
+ * @brief The name of a compression format, as printed in messages
+ */
+const char *compression_name(Compression compression);
+
+#endif /* INPUTFILE_H_ */
@@ -0,0 +1,81 @@
+/*
+ * LiveResults.cpp
+ */
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "LiveResults.h"
+
+using namespace std;
+
+
+LiveResults::LiveResults(const string &path, int uniq_Ny, int tilt, int area)
+    : uniq_Ny_(uniq_Ny)
+{
+    for(int k=0; k<NOBS; k++)
+        if(obs_enabled(k, tilt, area)) obs_.push_back(k);
+    int nspec = obs_.size();
+    bytes_ = sizeof(Header) + uniq_Ny*sizeof(float) + nspec*16 + 2*(size_t) nspec*uniq_Ny*sizeof(float);
+
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0 || ftruncate(fd, bytes_) != 0){
+        cout << endl << "Could not create " << path << ": " << strerror(errno) << endl;
+        exit(1);
+    }
+    void *mem = mmap(NULL, bytes_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mem == MAP_FAILED){
+        cout << endl << "Could not map " << path << ": " << strerror(errno) << endl;
+        exit(1);
+    }
+
+    map_ = (char *) mem;
+    hdr_ = (Header *) map_;
+    q_ = (float *) (map_ + sizeof(Header));
+    char *names = (char *) (q_ + uniq_Ny);
+    spectra_ = (float *) (names + nspec*16);
+    errors_ = spectra_ + (size_t) nspec*uniq_Ny;
+
+    memcpy(hdr_->magic, "NIHLIVE", 8);
+    hdr_->uniq_Ny = uniq_Ny;
+    hdr_->nspec = nspec;
+    hdr_->sequence = 0;
+    hdr_->nframes = 0;
+    for(int s=0; s<nspec; s++)
+        strncpy(names + 16*s, obs_names[obs_[s]], 15);
+}
+
+
+LiveResults::~LiveResults()
+{
+    msync(map_, bytes_, MS_SYNC);
+    munmap(map_, bytes_);
+}
+
+
+void LiveResults::update(const SpectrumResult &res)
+{
+    __atomic_store_n(&hdr_->sequence, hdr_->sequence+1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    hdr_->nframes = res.nframes;
+    for(int i=0; i<uniq_Ny_; i++)
+        q_[i] = 10*res.q_Ny[i];
+    for(size_t s=0; s<obs_.size(); s++){
+        const vector<float> &spec = res.spectra[obs_[s]];
+        const vector<double> &err = res.errors[obs_[s]];
+        for(int i=0; i<uniq_Ny_; i++){
+            spectra_[s*uniq_Ny_+i] = spec[i];
+            errors_[s*uniq_Ny_+i] = err[i];
+        }
+    }
+
+    __atomic_store_n(&hdr_->sequence, hdr_->sequence+1, __ATOMIC_RELEASE);
+    msync(map_, bytes_, MS_ASYNC);
+}
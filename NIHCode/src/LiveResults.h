@@ -0,0 +1,70 @@
+/*
+ * LiveResults.h
+ *
+ * The spectra of the frames analyzed so far, kept in a memory-mapped file
+ * that is rewritten in place every few frames, so that a plotting script can
+ * watch them converge while the trajectory is still being read.  The layout
+ * is fixed for the whole run:
+ *
+ *   char[8]  "NIHLIVE"
+ *   int32    uniq_Ny, the number of spectra nspec
+ *   uint32   sequence number, odd while an update is being written
+ *   int32    the number of frames analyzed
+ *   float    10*q for each of the uniq_Ny bins, in the order of the q data
+ *   char[16] the name of each of the nspec spectra
+ *   float    nspec*uniq_Ny spectra, scaled as in the printed output
+ *   float    nspec*uniq_Ny block averaged standard errors of the same
+ *
+ * A reader copies what it needs and keeps the copy only if the sequence
+ * number was even and unchanged before and after.
+ */
+
+#ifndef LIVERESULTS_H_
+#define LIVERESULTS_H_
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "SpectrumAnalyzer.h"
+
+
+class LiveResults{
+public:
+    /**
+     * @brief Creates the file for the observables enabled in an analysis; exits if that fails.
+     * @param path - the file
+     * @param uniq_Ny - the number of q bins
+     * @param tilt - whether the tilt spectra are computed
+     * @param area - whether the number density spectra are computed
+     */
+    LiveResults(const std::string &path, int uniq_Ny, int tilt, int area);
+    ~LiveResults();
+
+    /**
+     * @brief Overwrites the file with newer spectra
+     * @param res - the spectra so far
+     */
+    void update(const SpectrumResult &res);
+
+private:
+    LiveResults(const LiveResults &);
+    LiveResults &operator=(const LiveResults &);
+
+    struct Header{
+        char magic[8];
+        int32_t uniq_Ny, nspec;
+        volatile uint32_t sequence;
+        int32_t nframes;
+    };
+
+    std::vector<int> obs_;  // the observables written, in order
+    int uniq_Ny_;
+    size_t bytes_;
+    char *map_;
+    Header *hdr_;
+    float *q_, *spectra_, *errors_;
+};
+
+#endif /* LIVERESULTS_H_ */
@@ -0,0 +1,181 @@
+/*
+ * LockFreeQueue.h
+ *
+ * Bounded queues of pointers between the threads of a FramePipeline, built
+ * on the GCC __atomic builtins.  SpscQueue serves one producer and one
+ * consumer with a ring and two counters, each written by one side only.
+ * MpmcQueue serves any number of either with a sequence number per cell
+ * (Vyukov's bounded queue): a cell whose sequence equals the position being
+ * pushed is free, and one whose sequence is one past the position being
+ * popped is full, so both sides claim positions with a single compare and
+ * swap and never wait on each other except when the queue is full or empty.
+ *
+ * Neither queue blocks: push() and pop() return false instead, and the
+ * caller decides how to wait.  The capacity is rounded up to a power of 2, and
+ * is at least 2.
+ */
+
+#ifndef LOCKFREEQUEUE_H_
+#define LOCKFREEQUEUE_H_
+
+#include <vector>
+#include <stddef.h>
+
+
+static inline size_t queue_capacity(size_t n)
+{
+    size_t c = 2; // a single cell would look free to a push one lap ahead of the item it holds
+    while(c < n) c <<= 1;
+    return c;
+}
+
+
+template <typename T>
+class SpscQueue{
+public:
+    SpscQueue(size_t capacity)
+        : cells_(queue_capacity(capacity)), mask_(cells_.size()-1), head_(0), tail_(0) {}
+
+    bool push(T *item)
+    {
+        size_t t = __atomic_load_n(&tail_, __ATOMIC_RELAXED);
+        if(t - __atomic_load_n(&head_, __ATOMIC_ACQUIRE) == cells_.size())
+            return false;
+        cells_[t & mask_] = item;
+        __atomic_store_n(&tail_, t+1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    bool pop(T *&item)
+    {
+        size_t h = __atomic_load_n(&head_, __ATOMIC_RELAXED);
+        if(h == __atomic_load_n(&tail_, __ATOMIC_ACQUIRE))
+            return false;
+        item = cells_[h & mask_];
+        __atomic_store_n(&head_, h+1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    /**
+     * @brief The number of items queued, which may be out of date by the time it returns
+     */
+    size_t size() const
+    {
+        return __atomic_load_n(&tail_, __ATOMIC_ACQUIRE) - __atomic_load_n(&head_, __ATOMIC_ACQUIRE);
+    }
+
+    size_t capacity() const { return cells_.size(); }
+
+private:
+    std::vector<T *> cells_;
+    size_t mask_;
+    char pad0_[64];
+    size_t head_;   // written by the consumer
+    char pad1_[64];
+    size_t tail_;   // written by the producer
+    char pad2_[64];
+};
+
+
+template <typename T>
+class MpmcQueue{
+public:
+    MpmcQueue(size_t capacity)
+        : cells_(queue_capacity(capacity)), mask_(cells_.size()-1), head_(0), tail_(0)
+    {
+        for(size_t i=0; i<cells_.size(); i++)
+            cells_[i].sequence = i;
+    }
+
+    bool push(T *item)
+    {
+        size_t pos = __atomic_load_n(&tail_, __ATOMIC_RELAXED);
+        while(true){
+            Cell &cell = cells_[pos & mask_];
+            size_t seq = __atomic_load_n(&cell.sequence, __ATOMIC_ACQUIRE);
+            ptrdiff_t diff = (ptrdiff_t) seq - (ptrdiff_t) pos;
+            if(diff == 0){
+                if(__atomic_compare_exchange_n(&tail_, &pos, pos+1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+                    cell.item = item;
+                    __atomic_store_n(&cell.sequence, pos+1, __ATOMIC_RELEASE);
+                    return true;
+                }
+            }
+            else if(diff < 0)
+                return false; // full
+            else
+                pos = __atomic_load_n(&tail_, __ATOMIC_RELAXED);
+        }
+    }
+
+    bool pop(T *&item)
+    {
+        size_t pos = __atomic_load_n(&head_, __ATOMIC_RELAXED);
+        while(true){
+            Cell &cell = cells_[pos & mask_];
+            size_t seq = __atomic_load_n(&cell.sequence, __ATOMIC_ACQUIRE);
+            ptrdiff_t diff = (ptrdiff_t) seq - (ptrdiff_t) (pos+1);
+            if(diff == 0){
+                if(__atomic_compare_exchange_n(&head_, &pos, pos+1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+                    item = cell.item;
+                    __atomic_store_n(&cell.sequence, pos+mask_+1, __ATOMIC_RELEASE);
+                    return true;
+                }
+            }
+            else if(diff < 0)
+                return false; // empty
+            else
+                pos = __atomic_load_n(&head_, __ATOMIC_RELAXED);
+        }
+    }
+
+    size_t size() const
+    {
+        size_t t = __atomic_load_n(&tail_, __ATOMIC_ACQUIRE), h = __atomic_load_n(&head_, __ATOMIC_ACQUIRE);
+        return (t > h ? t - h : 0);
+    }
+
+    size_t capacity() const { return cells_.size(); }
+
+private:
+    struct Cell{
+        size_t sequence;
+        T *item;
+    };
+
+    std::vector<Cell> cells_;
+    size_t mask_;
+    char pad0_[64];
+    size_t head_;
+    char pad1_[64];
+    size_t tail_;
+    char pad2_[64];
+};
+
+
+/*
+ * The queue between two stages: single producer single consumer when each side has one thread, else
+ * multi-producer multi-consumer.
+ */
+template <typename T>
+class StageQueue{
+public:
+    StageQueue(size_t capacity, bool single)
+        : spsc_(single ? new SpscQueue<T>(capacity) : NULL), mpmc_(single ? NULL : new MpmcQueue<T>(capacity)) {}
+    ~StageQueue() { delete spsc_; delete mpmc_; }
+
+    bool push(T *item) { return spsc_ ? spsc_->push(item) : mpmc_->push(item); }
+    bool pop(T *&item) { return spsc_ ? spsc_->pop(item) : mpmc_->pop(item); }
+    size_t size() const { return spsc_ ? spsc_->size() : mpmc_->size(); }
+    size_t capacity() const { return spsc_ ? spsc_->capacity() : mpmc_->capacity(); }
+    bool single() const { return spsc_ != NULL; }
+
+private:
+    StageQueue(const StageQueue &);
+    StageQueue &operator=(const StageQueue &);
+
+    SpscQueue<T> *spsc_;
+    MpmcQueue<T> *mpmc_;
+};
+
+#endif /* LOCKFREEQUEUE_H_ */
@@ -0,0 +1,96 @@
+/*
+ * Matrix.h
+ *
+ * Allocation of the contiguous 1D, 2D and 3D arrays used throughout the
+ * analysis.  The 2D and 3D forms are arrays of row pointers into a single
+ * block, so mat[0] (or mat[0][0]) can be handed to FFTW or memset directly.
+ */
+
+#ifndef MATRIX_H_
+#define MATRIX_H_
+
+#include <string.h>
+
+
+/**
+ * @brief Allocates a 1D matrix (array), zeroing out the values.
+ * @param nrow - the row dimension
+ * @return the new array
+ */
+template <typename T>
+inline T* init_matrix(int nrow)
+{
+    T* arr = new T[nrow];
+    ::memset(arr, 0, nrow*sizeof(T));
+    return arr;
+}
+
+
+/**
+ * @brief Allocates a 2D matrix, zeroing out the values and guaranteeing contiguous data.
+ * @param nrow - the row dimension
+ * @param ncol - the column dimension
+ * @return the new nrow by ncol matrix
+ */
+template <typename T>
+inline T** init_matrix(int nrow, int ncol)
+{
+    T** mat = new T*[nrow];
+    mat[0] = new T[nrow*ncol];
+    ::memset((void *)mat[0], 0, nrow*ncol*sizeof(T));
+    for(int r=1; r<nrow; ++r)
+        mat[r] = mat[r-1] + ncol;
+    return mat;
+}
+
+
+/**
+ * @brief Allocates a 3D matrix, zeroing out the values and guaranteeing contiguous data.
+ * @param dim1 - the first dimension
+ * @param dim2 - the second dimension
+ * @param dim3 - the third dimension
+ * @return the new dim1*dim2*dim3 tensor
+ */
+template <typename T>
+inline T*** init_matrix(int dim1, int dim2, int dim3)
+{
+    T*** mat = new T**[dim1];
+    for(int d1=0; d1<dim1; ++d1)
+        mat[d1] = new T*[dim2];
+    mat[0][0] = new T[dim1*dim2*dim3];
+    ::memset((void*)mat[0][0], 0, dim1*dim2*dim3*sizeof(T));
+    for(int d1=0; d1<dim1; ++d1)
+        for(int d2=0; d2<dim2; ++d2)
+            if(d1 || d2)
+                mat[d1][d2] = &mat[0][0][d1*dim2*dim3 + d2*dim3];
+    return mat;
+}
+
+
+/**
+ * @brief Frees the memory for a matrix allocated by init_matrix.
+ * @param mat - the matrix to free
+ */
+template <typename T>
+void free_matrix(T** mat)
+{
+    delete [] mat[0];
+    delete [] mat;
+}
+
+
+/**
+ * @brief Frees the memory for a 3D matrix allocated by init_matrix.
+ * @param mat - the matrix to free
+ * @param dim1 - its first dimension
+ */
+template <typename T>
+void free_matrix(T*** mat, int dim1)
+{
+    delete [] mat[0][0];
+    for(int d1=0; d1<dim1; ++d1)
+        delete [] mat[d1];
+    delete [] mat;
+}
+
+#endif /* MATRIX_H_ */
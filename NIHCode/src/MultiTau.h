@@ -0,0 +1,152 @@
+/*
+ * MultiTau.h
+ *
+ * An online multi-tau (logarithmic block) correlator.  Each level keeps a
+ * short shift register of P samples; every M samples entering a level are
+ * averaged and passed on to the next level, so level k resolves lags of
+ * j*M^k frames.  Levels are created as the run grows, so the memory per mode
+ * is O(P log T) and each new sample costs O(P) amortized over all levels.
+ *
+ * Ramirez, Sukumaran, Vorselaars & Likhtman, J. Chem. Phys. 133, 154103 (2010)
+ */
+
+#ifndef MULTITAU_H_
+#define MULTITAU_H_
+
+#include <vector>
+
+
+class MultiTauCorrelator{
+public:
+    /**
+     * @brief Creates an empty correlator.
+     * @param p - number of lags resolved per level (must be divisible by m)
+     * @param m - averaging factor between consecutive levels
+     */
+    MultiTauCorrelator(int p=16, int m=2) : p_(p), m_(m), sum_(0), nsample_(0) {}
+
+    /**
+     * @brief Adds the next sample of the time series.
+     * @param x - the value at the current frame
+     */
+    void add(double x)
+    {
+        sum_ += x;
+        nsample_++;
+        add_to_level(x, 0);
+    }
+
+    /**
+     * @brief Lists the lags and autocorrelations accumulated so far.
+     * @param lags - filled with the lag, in frames, of each point
+     * @param corr - filled with <x(t)x(t+lag)>, the raw correlation
+     */
+    void result(std::vector<double> &lags, std::vector<double> &corr) const
+    {
+        lags.clear();
+        corr.clear();
+        long stride = 1;
+        for(size_t k=0; k<levels_.size(); k++){
+            const Level &lvl = levels_[k];
+            for(int j=(k ? p_/m_ : 0); j<p_; j++){
+                if(lvl.ncorr[j] == 0)
+                    continue;
+                lags.push_back((double) j*stride);
+                corr.push_back(lvl.corr[j]/lvl.ncorr[j]);
+            }
+            stride *= m_;
+        }
+    }
+
+    /**
+     * @brief The normalized autocorrelation of the fluctuations,
+     *        (<x(t)x(t+lag)> - <x>^2)/(<x^2> - <x>^2).
+     * @param lags - filled with the lag, in frames, of each point
+     * @param acf - filled with the normalized autocorrelation at each lag
+     */
+    void normalized(std::vector<double> &lags, std::vector<double> &acf) const
+    {
+        result(lags, acf);
+        if(acf.empty())
+            return;
+        double mean = sum_/nsample_;
+        double var = acf[0] - mean*mean;
+        for(size_t i=0; i<acf.size(); i++)
+            acf[i] = (var > 0 ? (acf[i] - mean*mean)/var : 0);
+    }
+
+    long samples() const { return nsample_; }
+    double mean() const { return nsample_ ? sum_/nsample_ : 0; }
+
+    /**
+     * @brief The memory of a correlator once it has been given a number of samples: a level, with its three
+     *        registers of p values, for every factor of m, in a vector that grows by doubling
+     */
+    static size_t bytes(long samples, int p=16, int m=2)
+    {
+        size_t levels = 1, capacity = 1;
+        for(long n=samples; n >= m; n /= m)
+            levels++;
+        while(capacity < levels)
+            capacity *= 2;
+        return sizeof(MultiTauCorrelator) + capacity*sizeof(Level) + levels*p*(2*sizeof(double) + sizeof(long));
+    }
+
+private:
+    struct Level{
+        std::vector<double> shift;  // circular buffer of the last p samples at this level
+        std::vector<double> corr;   // sum of x(t)x(t+j)
+        std::vector<long> ncorr;    // number of products summed into corr[j]
+        double accum;               // running sum of samples to be averaged into the next level
+        int naccum;
+        int insert;                 // position of the newest sample in shift
+        int nfilled;                // number of valid entries in shift
+    };
+
+    void add_to_level(double x, size_t k)
+    {
+        if(k == levels_.size()){
+            Level lvl;
+            lvl.shift.assign(p_, 0.0);
+            lvl.corr.assign(p_, 0.0);
+            lvl.ncorr.assign(p_, 0);
+            lvl.accum = 0;
+            lvl.naccum = 0;
+            lvl.insert = -1;
+            lvl.nfilled = 0;
+            levels_.push_back(lvl);
+        }
+        Level &lvl = levels_[k];
+
+        lvl.insert = (lvl.insert + 1) % p_;
+        lvl.shift[lvl.insert] = x;
+        if(lvl.nfilled < p_)
+            lvl.nfilled++;
+
+        // lags below p/m are already resolved more finely by the previous level
+        int jmin = (k ? p_/m_ : 0);
+        for(int j=jmin; j<lvl.nfilled; j++){
+            int idx = lvl.insert - j;
+            if(idx < 0)
+                idx += p_;
+            lvl.corr[j] += x*lvl.shift[idx];
+            lvl.ncorr[j]++;
+        }
+
+        lvl.accum += x;
+        lvl.naccum++;
+        if(lvl.naccum == m_){
+            double avg = lvl.accum/m_;
+            lvl.accum = 0;
+            lvl.naccum = 0;
+            add_to_level(avg, k+1); // note: may reallocate levels_, so lvl is not used after this
+        }
+    }
+
+    int p_, m_;
+    double sum_;
+    long nsample_;
+    std::vector<Level> levels_;
+};
+
+#endif /* MULTITAU_H_ */
@@ -0,0 +1,195 @@
+/*
+ * NumberReader.cpp
+ */
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "NumberReader.h"
+#include "InputFile.h"
+
+using namespace std;
+
+static const size_t read_chunk = 1 << 20; // bytes read from the file at a time
+
+
+NumberReader::NumberReader(const string &path, bool follow, const volatile sig_atomic_t *stop)
+    : path_(path), follow_(follow), stop_(stop), notify_fd_(-1),
+      buf_(read_chunk+1), begin_(0), end_(0), buf_offset_(0), eof_(false), failed_(false)
+{
+    Compression compression;
+    fp_ = open_input(path, &compression);
+    if(!fp_){
+        cout << endl << "Could not open " << path << endl;
+        exit(1);
+    }
+    compressed_ = (compression != COMPRESSION_NONE);
+    if(follow_ && compressed_){
+        cout << endl << "Cannot follow " << path << ", which is compressed with " << compression_name(compression) << endl;
+        exit(1);
+    }
+    buf_[0] = 0;
+
+    // without inotify, wait() falls back to polling the file
+    if(follow_){
+        notify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if(notify_fd_ >= 0 && inotify_add_watch(notify_fd_, path.c_str(), IN_MODIFY | IN_CLOSE_WRITE) < 0){
+            close(notify_fd_);
+            notify_fd_ = -1;
+        }
+    }
+}
+
+
+NumberReader::~NumberReader()
+{
+    if(notify_fd_ >= 0) close(notify_fd_);
+    fclose(fp_);
+}
+
+
+bool NumberReader::read(float *out, int n)
+{
+    for(int k=0; k<n; ){
+        while(begin_ < end_ && isspace((unsigned char) buf_[begin_])) begin_++;
+        size_t e = begin_;
+        while(e < end_ && !isspace((unsigned char) buf_[e])) e++;
+
+        // a number is complete once the whitespace after it has been read, or at the real end of the file
+        if(e > begin_ && (e < end_ || eof_)){
+            char *parsed;
+            out[k] = strtof(&buf_[begin_], &parsed);
+            if(parsed != &buf_[e]){
+                cout << "Bad number '" << string(&buf_[begin_], e-begin_) << "' in " << path_ << endl;
+                failed_ = true;
+                return false;
+            }
+            begin_ = e;
+            k++;
+            continue;
+        }
+        if(!fill())
+            return false;
+    }
+    return true;
+}
+
+
+void NumberReader::seek(long long offset)
+{
+    // short jumps, e.g. over a frame or two, stay within the buffer
+    if(offset >= buf_offset_ && offset <= buf_offset_ + (long long) end_){
+        begin_ = offset - buf_offset_;
+        return;
+    }
+    fseeko(fp_, offset, SEEK_SET);
+    buf_offset_ = offset;
+    begin_ = end_ = 0;
+    eof_ = false;
+}
+
+
+/**
+ * @brief Reads more of the file after what is left in the buffer, waiting for it when following
+ * @return false at the end of the file, on an error, or once stop is set
+ */
+bool NumberReader::fill()
+{
+    // keep the unread part, which may be the start of a number
+    if(begin_ > 0){
+        memmove(&buf_[0], &buf_[begin_], end_-begin_);
+        end_ -= begin_;
+        buf_offset_ += begin_;
+        begin_ = 0;
+    }
+    if(buf_.size() - end_ < read_chunk/2)
+        buf_.resize(end_ + read_chunk + 1);
+
+    while(true){
+        if(ferror(fp_)){ // also reported by the decompression, see InputFile
+            cout << "Could not read " << path_ << endl;
+            failed_ = true;
+            return false;
+        }
+        size_t got = fread(&buf_[end_], 1, buf_.size()-1-end_, fp_);
+        if(got > 0){
+            end_ += got;
+            buf_[end_] = 0;
+            return true;
+        }
+        if(!follow_){
+            if(eof_) return false;
+            eof_ = true; // lets the last number through if the file does not end with a newline
+            return true;
+        }
+        clearerr(fp_);
+        if(stop_ && *stop_) return false;
+        wait();
+    }
+}
+
+
+/**
+ * @brief Waits for the file to be written to, for at most half a second
+ */
+void NumberReader::wait()
+{
+    if(notify_fd_ < 0){
+        usleep(200000);
+        return;
+    }
+    struct pollfd pfd = {notify_fd_, POLLIN, 0};
+    if(poll(&pfd, 1, 500) > 0){
+        char events[4096];
+        while(::read(notify_fd_, events, sizeof(events)) > 0) {}
+    }
+}
+
+
+long long NumberReader::count(const string &path)
+{
+    struct stat st;
+    if(stat(path.c_str(), &st) != 0)
+        return -1;
+
+    string sidecar = path + ".count";
+    FILE *fp = fopen(sidecar.c_str(), "r");
+    if(fp){
+        long long size, mtime, n;
+        int got = fscanf(fp, "%lld %lld %lld", &size, &mtime, &n);
+        fclose(fp);
+        if(got == 3 && size == (long long) st.st_size && mtime == (long long) st.st_mtime)
+            return n;
+    }
+
+    // a number starts wherever a non-whitespace character follows whitespace
+    fp = open_input(path);
+    if(!fp)
+        return -1;
+    vector<char> buf(read_chunk);
+    long long n = 0;
+    bool in_space = true;
+    size_t got;
+    while((got = fread(&buf[0], 1, buf.size(), fp)) > 0){
+        for(size_t i=0; i<got; i++){
+            bool space = isspace((unsigned char) buf[i]);
+            n += (in_space && !space);
+            in_space = space;
+        }
+    }
+    fclose(fp);
+
+    // not being able to write the sidecar only costs the next run another pass
+    fp = fopen(sidecar.c_str(), "w");
+    if(fp){
+        fprintf(fp, "%lld %lld %lld\n", (long long) st.st_size, (long long) st.st_mtime, n);
+        fclose(fp);
+    }
+    return n;
+}
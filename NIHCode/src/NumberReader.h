@@ -0,0 +1,86 @@
+/*
+ * NumberReader.h
+ *
+ * Reads whitespace separated numbers from a text file, such as LipidX.out,
+ * through a large buffer instead of one fscanf call per number.  In follow
+ * mode the file is taken to be still growing: a number counts only once the
+ * whitespace after it has been written, and at the end of the file the
+ * reader waits for more instead of stopping, so a frame that is half written
+ * is never half read.  Compressed files are decompressed as they are read
+ * (see InputFile), but then can be neither followed nor seeked.
+ */
+
+#ifndef NUMBERREADER_H_
+#define NUMBERREADER_H_
+
+#include <stdio.h>
+#include <signal.h>
+#include <string>
+#include <vector>
+
+
+class NumberReader{
+public:
+    /**
+     * @brief Opens a file; exits if it cannot be opened.
+     * @param path - the file
+     * @param follow - whether to wait for the file to grow at its end
+     * @param stop - while following, reading gives up once this becomes nonzero; may be NULL
+     */
+    NumberReader(const std::string &path, bool follow = false, const volatile sig_atomic_t *stop = NULL);
+    ~NumberReader();
+
+    /**
+     * @brief Reads the next n numbers
+     * @param out - n values
+     * @param n - the number of values
+     * @return false if the file ends first, if it cannot be read (see failed()) or, when following, if stop
+     * was set while waiting
+     */
+    bool read(float *out, int n);
+
+    /**
+     * @brief Whether a read stopped at something other than the end of the file: a token that is not a
+     * number, or an error from the file or its decompression
+     */
+    bool failed() const { return failed_; }
+
+    /**
+     * @brief Continues reading from a byte offset in the file, such as the start of a frame; not for
+     * compressed files
+     * @param offset - the offset
+     */
+    void seek(long long offset);
+
+    const std::string &path() const { return path_; }
+    bool compressed() const { return compressed_; }
+
+    /**
+     * @brief Counts the numbers in a file.  The count is kept in path.count next to the file, and reused
+     * for as long as the file's size and modification time are unchanged.
+     * @param path - the file
+     * @return the count, or -1 if the file cannot be read
+     */
+    static long long count(const std::string &path);
+
+private:
+    NumberReader(const NumberReader &);
+    NumberReader &operator=(const NumberReader &);
+
+    bool fill();
+    void wait();
+
+    std::string path_;
+    FILE *fp_;
+    bool compressed_;
+    bool follow_;
+    const volatile sig_atomic_t *stop_;
+    int notify_fd_;         // inotify instance watching the file while following, or -1 to poll
+    std::vector<char> buf_;
+    size_t begin_, end_;    // the unread part of buf_
+    long long buf_offset_;  // the offset in the file of buf_[0]
+    bool eof_;
+    bool failed_;
+};
+
+#endif /* NUMBERREADER_H_ */
@@ -0,0 +1,183 @@
+/*
+ * PerfCounters.cpp
+ */
+
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "PerfCounters.h"
+
+using namespace std;
+
+volatile int perf_on = 0;
+
+static const int max_flop_events = 4;
+
+struct EventSpec{
+    uint32_t type;
+    uint64_t config;
+    int event;      // the PerfEvent it counts towards
+    double weight;  // times its count
+};
+
+static vector<EventSpec> groups[3]; // the events of each group, in the order above
+static volatile int opened[NPERF];  // set once any thread has counted the event
+
+
+/*
+ * The counters of one thread: a file descriptor per event, the first of each group its leader, -1 for the
+ * events that could not be opened.
+ */
+struct ThreadCounters{
+    vector<int> fds[3];
+    int leader[3];      // the index of the leader in fds, or -1 if the group has no event open
+};
+
+static pthread_key_t thread_key;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+
+
+static void close_counters(void *p)
+{
+    ThreadCounters *c = (ThreadCounters *) p;
+    for(int g=0; g<3; g++){
+        for(size_t i=0; i<c->fds[g].size(); i++){
+            if(c->fds[g][i] >= 0)
+                close(c->fds[g][i]);
+        }
+    }
+    delete c;
+}
+
+
+static void make_key()
+{
+    pthread_key_create(&thread_key, close_counters);
+}
+
+
+bool perf_enable(const string &flops)
+{
+    for(int g=0; g<3; g++)
+        groups[g].clear();
+    EventSpec core[3] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, PERF_CYCLES, 1},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, PERF_INSTRUCTIONS, 1},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, PERF_BRANCH_MISSES, 1}
+    };
+    EventSpec mem[2] = {
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                             | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16), PERF_L1D_MISSES, 1},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, PERF_LLC_MISSES, 1}
+    };
+    groups[0].assign(core, core+3);
+    groups[1].assign(mem, mem+2);
+
+    // r<hex>[:weight], comma separated
+    size_t start = 0;
+    while(start < flops.size()){
+        size_t end = flops.find(',', start);
+        if(end == string::npos) end = flops.size();
+        string item = flops.substr(start, end-start);
+        EventSpec e = {PERF_TYPE_RAW, 0, PERF_FLOPS, 1};
+        char *p;
+        if(item.size() < 2 || item[0] != 'r')
+            return false;
+        e.config = strtoull(item.c_str()+1, &p, 16);
+        if(p == item.c_str()+1)
+            return false;
+        if(*p == ':'){
+            char *q;
+            e.weight = strtod(p+1, &q);
+            if(q == p+1 || *q || !(e.weight > 0))
+                return false;
+        }
+        else if(*p)
+            return false;
+        groups[2].push_back(e);
+        start = end+1;
+    }
+    if(groups[2].size() > (size_t) max_flop_events)
+        return false;
+
+    pthread_once(&key_once, make_key);
+    __atomic_store_n(&perf_on, 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+
+static int open_event(const EventSpec &e, int group_fd)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = e.type;
+    attr.config = e.config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0); // this thread, on any CPU
+}
+
+
+/**
+ * @brief Opens the counters of the calling thread; an event that cannot be opened is left out of its group,
+ * and the first one that can leads it
+ */
+static ThreadCounters *open_counters()
+{
+    ThreadCounters *c = new ThreadCounters;
+    for(int g=0; g<3; g++){
+        c->leader[g] = -1;
+        for(size_t i=0; i<groups[g].size(); i++){
+            int fd = open_event(groups[g][i], (c->leader[g] < 0 ? -1 : c->fds[g][c->leader[g]]));
+            c->fds[g].push_back(fd);
+            if(fd < 0)
+                continue;
+            if(c->leader[g] < 0)
+                c->leader[g] = i;
+            opened[groups[g][i].event] = 1;
+        }
+    }
+    pthread_setspecific(thread_key, c);
+    return c;
+}
+
+
+void perf_read(uint64_t *values)
+{
+    memset(values, 0, NPERF*sizeof(uint64_t));
+    ThreadCounters *c = (ThreadCounters *) pthread_getspecific(thread_key);
+    if(!c)
+        c = open_counters();
+
+    for(int g=0; g<3; g++){
+        if(c->leader[g] < 0)
+            continue;
+        // nr, time enabled, time running, then the value of each open event of the group in the order opened
+        uint64_t buf[3 + 8];
+        if(read(c->fds[g][c->leader[g]], buf, sizeof(buf)) < (ssize_t) (3*sizeof(uint64_t)))
+            continue;
+        double scale = (buf[2] > 0 ? (double) buf[1]/buf[2] : 0);
+        uint64_t k = 0;
+        for(size_t i=0; i<groups[g].size() && k<buf[0]; i++){
+            if(c->fds[g][i] < 0)
+                continue;
+            const EventSpec &e = groups[g][i];
+            values[e.event] += (uint64_t) (e.weight*scale*buf[3+k]);
+            k++;
+        }
+    }
+}
+
+
+bool perf_available(int event)
+{
+    return opened[event];
+}
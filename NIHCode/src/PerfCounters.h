@@ -0,0 +1,69 @@
+/*
+ * PerfCounters.h
+ *
+ * Hardware event counts for the stage timers (see StageTimer.h), through
+ * perf_event_open.  Once perf_enable() has been called, every thread opens
+ * its own counters the first time it marks a stage, and each mark reads
+ * them, so that the counts are charged to the same stages as the time.
+ * Counters of the calling thread are used rather than ones inherited from
+ * the main thread, since an inherited counter only holds the total over all
+ * threads and cannot be read where a worker moves from one stage to the
+ * next.
+ *
+ * The events are counted in user space only, in three groups, each
+ * scheduled on the PMU as a whole:
+ *
+ *   cycles, instructions, branch misses
+ *   L1 data cache read misses, last level cache misses
+ *   the FLOP events
+ *
+ * There is no generic FLOP event, so FLOPs are counted only if the raw
+ * events of the CPU are given, each with the FLOPs per event, e.g. on
+ * Skylake and later Xeons (FP_ARITH_INST_RETIRED, single precision
+ * scalar, 128 and 256 bit packed)
+ *
+ *     r02c7:1,r08c7:4,r20c7:8
+ *
+ * and on Zen (RETIRED_SSE_AVX_FLOPS, which counts FLOPs already) rff03.
+ * When the PMU has fewer counters than the events, the kernel multiplexes
+ * the groups, and the counts are scaled up by the time each group was not
+ * counting.  Events the CPU or the kernel (see
+ * /proc/sys/kernel/perf_event_paranoid) does not allow read as zero, and are
+ * reported as unavailable.
+ */
+
+#ifndef PERFCOUNTERS_H_
+#define PERFCOUNTERS_H_
+
+#include <stdint.h>
+#include <string>
+
+
+enum PerfEvent{ PERF_CYCLES, PERF_INSTRUCTIONS, PERF_BRANCH_MISSES, PERF_L1D_MISSES, PERF_LLC_MISSES, PERF_FLOPS,
+                NPERF };
+
+static const char *const perf_event_names[NPERF] = {
+    "cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses", "flops"
+};
+
+extern volatile int perf_on; // set by perf_enable()
+
+/**
+ * @brief Switches the counters on for the stages marked from now on, by any thread
+ * @param flops - the raw FLOP events and the FLOPs each counts, as r<hex>[:flops],..., or empty for none
+ * @return false if flops cannot be parsed or has more than 4 events
+ */
+bool perf_enable(const std::string &flops);
+
+/**
+ * @brief Reads the counters of the calling thread, opening them the first time
+ * @param values - set to the NPERF counts since they were opened
+ */
+void perf_read(uint64_t *values);
+
+/**
+ * @brief Whether an event has been counted by any thread
+ */
+bool perf_available(int event);
+
+#endif /* PERFCOUNTERS_H_ */
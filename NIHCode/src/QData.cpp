@@ -0,0 +1,93 @@
+/*
+ * QData.cpp
+ */
+
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+
+#include "QData.h"
+
+using namespace std;
+
+
+/*
+ * A helper class to allow us to store, sort, and output data.
+ */
+struct OutputEntry{
+    //
+    float q2_uniq_ny;
+    float umparq2_uniq;
+    float umperq2_uniq;
+    float hq2_uniq;
+    float tq2_uniq;
+    float dpparq2_uniq;
+    float dpperq2_uniq;
+    float dmparq2_uniq;
+    float dmperq2_uniq;
+
+    // Define comparison operators, for automagic sorting later
+    bool operator<(const OutputEntry &rhs) const{
+        return q2_uniq_ny < rhs.q2_uniq_ny;
+    }
+    bool operator>(const OutputEntry &rhs) const{
+        return q2_uniq_ny > rhs.q2_uniq_ny;
+    }
+    bool operator==(const OutputEntry &rhs) const{
+        return q2_uniq_ny == rhs.q2_uniq_ny;
+    }
+};
+
+
+/**
+ * @brief One column of the spectra or of their error bars, as floats
+ */
+static float column(const SpectrumResult &res, int obs, int i, bool errors)
+{
+    return (errors ? res.errors[obs][i] : res.spectra[obs][i]);
+}
+
+
+bool write_qdata(const SpectrumResult &res, const string &path, bool errors)
+{
+    int uniq_Ny = res.uniq_Ny;
+    vector<OutputEntry> outputdata; // A container for the qdatafile dump
+    for(int i=0; i<uniq_Ny; i++){
+        OutputEntry entry;
+        entry.q2_uniq_ny = 10.0*res.q_Ny[i];
+        entry.umparq2_uniq = column(res, OBS_UMPARQ2, i, errors);
+        entry.umperq2_uniq = column(res, OBS_UMPERQ2, i, errors);
+        entry.hq2_uniq = column(res, OBS_HQ2, i, errors);
+        entry.tq2_uniq = column(res, OBS_TQ2, i, errors);
+        entry.dpparq2_uniq = column(res, OBS_DPPARQ2, i, errors);
+        entry.dpperq2_uniq = column(res, OBS_DPPERQ2, i, errors);
+        entry.dmparq2_uniq = column(res, OBS_DMPARQ2, i, errors);
+        entry.dmperq2_uniq = column(res, OBS_DMPERQ2, i, errors);
+        outputdata.push_back(entry);
+    }
+    // Sort the data, using the built-in STL function
+    sort(outputdata.begin(), outputdata.end());
+
+    FILE* qdump = fopen(path.c_str(), "w");
+    if(!qdump)
+        return false;
+    const char *suffix = (errors ? "err" : "uniq");
+    char names[8][24];
+    const char *stems[8] = {"umparq2", "umperq2", "hq2", "tq2", "dpparq2", "dpperq2", "dmparq2", "dmperq2"};
+    for(int c=0; c<8; c++)
+        snprintf(names[c], sizeof(names[c]), "%s_%s", stems[c], suffix);
+    fprintf(qdump, "%16s %16s %16s %16s %16s %16s %16s %16s %16s\n",
+            "10*q2_uniq_ny", names[0], names[1], names[2], names[3], names[4], names[5], names[6], names[7]);
+    for(int i=0; i<uniq_Ny; i++)
+        fprintf(qdump, "%16.8f %16.8f %16.8f %16.8f %16.8f %16.8f %16.8f %16.8f %16.8f\n",
+                outputdata[i].q2_uniq_ny,
+                outputdata[i].umparq2_uniq,
+                outputdata[i].umperq2_uniq,
+                outputdata[i].hq2_uniq,
+                outputdata[i].tq2_uniq,
+                outputdata[i].dpparq2_uniq,
+                outputdata[i].dpperq2_uniq,
+                outputdata[i].dmparq2_uniq,
+                outputdata[i].dmperq2_uniq);
+    return fclose(qdump) == 0;
+}
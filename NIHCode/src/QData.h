@@ -0,0 +1,30 @@
+/*
+ * QData.h
+ *
+ * The q data file written by NIHCode --qdata: one row per q bin, sorted by q,
+ * with the columns
+ *
+ *   10*q2_uniq_ny  umparq2  umperq2  hq2  tq2  dpparq2  dpperq2  dmparq2  dmperq2
+ *
+ * either the spectra or their block averaged error bars, which NIHCode writes
+ * to err<qdata>.
+ */
+
+#ifndef QDATA_H_
+#define QDATA_H_
+
+#include <string>
+
+#include "SpectrumAnalyzer.h"
+
+
+/**
+ * @brief Writes the q data file of a result
+ * @param res - the spectra
+ * @param path - the file
+ * @param errors - true for the error bars, false for the spectra
+ * @return false if the file cannot be written
+ */
+bool write_qdata(const SpectrumResult &res, const std::string &path, bool errors);
+
+#endif /* QDATA_H_ */
@@ -0,0 +1,209 @@
+/*
+ * QuantizedTrajectory.cpp
+ */
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "QuantizedTrajectory.h"
+
+using namespace std;
+
+const char quantized_magic[8] = "NIHQTR1";
+
+static const size_t frame_fixed = 3*sizeof(float) + 6*sizeof(int32_t) + 8; // box, column minima, bit widths
+static const size_t frame_pad = 8;  // so that every value can be read with one 8 byte load
+static const double quantize_limit = 1 << 30;
+
+
+static inline double coordinate(const void *c, ptrdiff_t stride, CoordType type, int i)
+{
+    const char *p = (const char *) c + i*stride;
+    return (type == COORD_DOUBLE ? *(const double *) p : *(const float *) p);
+}
+
+
+bool quantize_frame(const Coordinates &head, const Coordinates &tail, int nl, Box box, float precision,
+                    vector<uint8_t> &out)
+{
+    const double inv = 1.0/precision;
+    const Coordinates *group[2] = {&head, &tail};
+    vector<int32_t> q(6*nl);
+    for(int c=0; c<6; c++){
+        const Coordinates &g = *group[c/3];
+        const void *x = (c%3 == 0 ? g.x : c%3 == 1 ? g.y : g.z);
+        int32_t *col = &q[c*nl];
+        for(int i=0; i<nl; i++){
+            double v = coordinate(x, g.stride, g.type, i)*inv;
+            if(!(fabs(v) < quantize_limit))
+                return false;
+            col[i] = (int32_t) lround(v);
+        }
+    }
+    // the tails relative to their heads; both are below 2^30 in magnitude, so the difference fits
+    for(int i=0; i<3*nl; i++)
+        q[3*nl+i] -= q[i];
+
+    int32_t base[6];
+    uint8_t bits[8] = {0};
+    size_t total_bits = 0;
+    for(int c=0; c<6; c++){
+        int32_t lo = q[c*nl], hi = q[c*nl];
+        for(int i=1; i<nl; i++){
+            lo = min(lo, q[c*nl+i]);
+            hi = max(hi, q[c*nl+i]);
+        }
+        uint32_t range = (uint32_t) hi - (uint32_t) lo;
+        while(bits[c] < 32 && (range >> bits[c]) != 0)
+            bits[c]++;
+        base[c] = lo;
+        total_bits += (size_t) bits[c]*nl;
+    }
+
+    out.assign(frame_fixed + (total_bits+7)/8 + frame_pad, 0);
+    uint8_t *p = &out[0];
+    float b[3] = {box.lx, box.ly, box.lz};
+    memcpy(p, b, sizeof(b));
+    memcpy(p + sizeof(b), base, sizeof(base));
+    memcpy(p + sizeof(b) + sizeof(base), bits, sizeof(bits));
+    p += frame_fixed;
+
+    uint64_t acc = 0;
+    int nacc = 0;
+    for(int c=0; c<6; c++){
+        for(int i=0; i<nl; i++){
+            acc |= (uint64_t) ((uint32_t) q[c*nl+i] - (uint32_t) base[c]) << nacc;
+            nacc += bits[c];
+            while(nacc >= 8){
+                *p++ = acc & 0xff;
+                acc >>= 8;
+                nacc -= 8;
+            }
+        }
+    }
+    if(nacc > 0)
+        *p = acc & 0xff;
+    return true;
+}
+
+
+/**
+ * @brief The value of a given width starting at a given bit of a packed frame
+ */
+static inline uint32_t unpack(const uint8_t *packed, uint64_t bit, uint64_t mask)
+{
+    uint64_t word;
+    memcpy(&word, packed + (bit >> 3), sizeof(word));
+    return (word >> (bit & 7)) & mask;
+}
+
+
+bool dequantize_frame(const uint8_t *frame, size_t size, int nl, float precision, float *const xyz[6], Box &box)
+{
+    if(size < frame_fixed + frame_pad)
+        return false;
+    float b[3];
+    int32_t base[6];
+    uint8_t bits[8];
+    memcpy(b, frame, sizeof(b));
+    memcpy(base, frame + sizeof(b), sizeof(base));
+    memcpy(bits, frame + sizeof(b) + sizeof(base), sizeof(bits));
+    box.lx = b[0];
+    box.ly = b[1];
+    box.lz = b[2];
+
+    uint64_t start[6], total_bits = 0;
+    for(int c=0; c<6; c++){
+        if(bits[c] > 32)
+            return false;
+        start[c] = total_bits;
+        total_bits += (uint64_t) bits[c]*nl;
+    }
+    if(size < frame_fixed + (total_bits+7)/8 + frame_pad)
+        return false;
+    const uint8_t *packed = frame + frame_fixed;
+
+    // one column at a time, each a loop of fixed-width loads and shifts without branches
+    const double spacing = precision;
+    for(int c=0; c<3; c++){
+        const uint64_t mask = (1ULL << bits[c]) - 1;
+        float *out = xyz[c];
+        for(int i=0; i<nl; i++)
+            out[i] = (float) ((base[c] + (int32_t) unpack(packed, start[c] + (uint64_t) i*bits[c], mask))*spacing);
+    }
+    for(int c=3; c<6; c++){
+        const uint64_t hmask = (1ULL << bits[c-3]) - 1, mask = (1ULL << bits[c]) - 1;
+        float *out = xyz[c];
+        for(int i=0; i<nl; i++){
+            int32_t h = base[c-3] + (int32_t) unpack(packed, start[c-3] + (uint64_t) i*bits[c-3], hmask);
+            int32_t d = base[c] + (int32_t) unpack(packed, start[c] + (uint64_t) i*bits[c], mask);
+            out[i] = (float) ((double) (h + d)*spacing);
+        }
+    }
+    return true;
+}
+
+
+//---------------------------------------------------------------------------------------------------------------
+
+QuantizedWriter::QuantizedWriter(const string &path, int nl, float precision)
+    : path_(path), lx_sum_(0), ly_sum_(0), lz_sum_(0), bytes_(0)
+{
+    memset(&header_, 0, sizeof(header_));
+    memcpy(header_.magic, quantized_magic, sizeof(header_.magic));
+    header_.nl = nl;
+    header_.precision = precision;
+
+    fp_ = fopen(path.c_str(), "wb");
+    if(!fp_ || fwrite(&header_, sizeof(header_), 1, fp_) != 1){
+        cout << endl << "Could not create " << path << endl;
+        exit(1);
+    }
+    bytes_ = sizeof(header_);
+}
+
+
+QuantizedWriter::~QuantizedWriter()
+{
+    close();
+}
+
+
+void QuantizedWriter::write(const Coordinates &head, const Coordinates &tail, Box box)
+{
+    if(!quantize_frame(head, tail, header_.nl, box, header_.precision, frame_)){
+        cout << endl << "Frame " << header_.nframes+1 << " has coordinates too large to store to a precision of "
+             << header_.precision << endl;
+        exit(1);
+    }
+    uint32_t size = frame_.size();
+    if(fwrite(&size, sizeof(size), 1, fp_) != 1 || fwrite(&frame_[0], 1, size, fp_) != size){
+        cout << endl << "Could not write to " << path_ << endl;
+        exit(1);
+    }
+    bytes_ += sizeof(size) + size;
+    header_.nframes++;
+    lx_sum_ += box.lx;
+    ly_sum_ += box.ly;
+    lz_sum_ += box.lz;
+}
+
+
+void QuantizedWriter::close()
+{
+    if(!fp_)
+        return;
+    if(header_.nframes > 0){
+        header_.lx_av = lx_sum_/header_.nframes;
+        header_.ly_av = ly_sum_/header_.nframes;
+        header_.lz_av = lz_sum_/header_.nframes;
+    }
+    rewind(fp_);
+    bool ok = (fwrite(&header_, sizeof(header_), 1, fp_) == 1);
+    ok = (fclose(fp_) == 0) && ok;
+    fp_ = NULL;
+    if(!ok)
+        cout << "Could not complete " << path_ << endl;
+}
@@ -0,0 +1,125 @@
+/*
+ * QuantizedTrajectory.h
+ *
+ * A compact binary trajectory, in the spirit of XTC: every coordinate is
+ * rounded to a multiple of a chosen precision (0.001 Angstrom by default,
+ * far below what the spectra can resolve), stored as an integer relative to
+ * the smallest value in its frame, and bit-packed with as few bits as the
+ * frame needs.  Tails are stored relative to their own heads, which takes a
+ * few bits less than their positions in the box.  A frame takes about 12
+ * bytes per lipid, against 24 as floats and some 55 as text.
+ *
+ * The file, little-endian, is a header
+ *
+ *   char[8]  "NIHQTR1"
+ *   int32    nl, the number of lipids in every frame
+ *   int32    nframes
+ *   float    precision, in Angstrom
+ *   float    lx, ly, lz averaged over the frames
+ *   int32    unused
+ *
+ * followed by nframes frames, each
+ *
+ *   uint32   the bytes in the rest of the frame
+ *   float    lx, ly, lz
+ *   int32    the smallest value of each of the six columns: head x y z, tail - head x y z
+ *   uint8    the bits per value of each column, and two unused bytes
+ *   uint8    the six columns of nl values each, packed one after the other from the lowest bit
+ *            of the first byte on, and padded with eight zero bytes
+ *
+ * Every frame decodes on its own, so the frames can be skipped or read in
+ * any order.  Since the files are read through open_input, they may also be
+ * compressed as a whole.
+ */
+
+#ifndef QUANTIZEDTRAJECTORY_H_
+#define QUANTIZEDTRAJECTORY_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "SpectrumAnalyzer.h"
+
+
+struct QuantizedHeader{
+    char magic[8];
+    int32_t nl;
+    int32_t nframes;
+    float precision;
+    float lx_av, ly_av, lz_av;
+    int32_t unused;
+};
+
+extern const char quantized_magic[8];
+const float default_precision = 0.001;
+
+
+/**
+ * @brief Encodes one frame, without its leading size
+ * @param head - the head coordinates
+ * @param tail - the tail coordinates
+ * @param nl - the number of lipids
+ * @param box - the box
+ * @param precision - the spacing of the quantized values
+ * @param out - set to the encoded frame
+ * @return false if a coordinate is too large to quantize at this precision
+ */
+bool quantize_frame(const Coordinates &head, const Coordinates &tail, int nl, Box box, float precision,
+                    std::vector<uint8_t> &out);
+
+/**
+ * @brief Decodes one frame into six arrays of nl floats
+ * @param frame - the encoded frame, without its leading size
+ * @param size - its bytes
+ * @param nl - the number of lipids
+ * @param precision - the spacing of the quantized values
+ * @param xyz - head x, y, z and tail x, y, z
+ * @param box - set to the box
+ * @return false if the frame is too short for its bit widths
+ */
+bool dequantize_frame(const uint8_t *frame, size_t size, int nl, float precision, float *const xyz[6], Box &box);
+
+
+/*
+ * Writes a quantized trajectory frame by frame.  The number of frames and the average box are filled in
+ * when the file is closed.
+ */
+class QuantizedWriter{
+public:
+    /**
+     * @brief Creates the file; exits if that fails.
+     * @param path - the file
+     * @param nl - the number of lipids in every frame
+     * @param precision - the spacing of the quantized values, in Angstrom
+     */
+    QuantizedWriter(const std::string &path, int nl, float precision = default_precision);
+    ~QuantizedWriter();
+
+    /**
+     * @brief Appends a frame; exits if it cannot be written.
+     */
+    void write(const Coordinates &head, const Coordinates &tail, Box box);
+
+    /**
+     * @brief Completes the header and closes the file
+     */
+    void close();
+
+    int nframes() const { return header_.nframes; }
+    long long bytes() const { return bytes_; }
+
+private:
+    QuantizedWriter(const QuantizedWriter &);
+    QuantizedWriter &operator=(const QuantizedWriter &);
+
+    std::string path_;
+    FILE *fp_;
+    QuantizedHeader header_;
+    float lx_sum_, ly_sum_, lz_sum_; // summed in float, as TextFrameSource averages the box files
+    std::vector<uint8_t> frame_;
+    long long bytes_;
+};
+
+#endif /* QUANTIZEDTRAJECTORY_H_ */
@@ -0,0 +1,294 @@
+/*
+ * ResourcePlan.cpp
+ */
+
+#include <fstream>
+#include <algorithm>
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "ResourcePlan.h"
+#include "Accumulator.h"
+#include "BlockAverage.h"
+#include "MultiTau.h"
+#include "SlidingWindow.h"
+
+using namespace std;
+
+static const char *stage_names[] = {"read", "preprocess", "bin", "transform", "accumulate"};
+
+// a result of nihbench
+struct BenchResult{
+    std::string kernel;
+    int ngrid, nl;
+    double median; // ns
+};
+
+
+/**
+ * @brief The FLOPs of a real to complex (or complex to real) FFT of an ngrid x ngrid grid
+ */
+static double fft_flops(int ngrid)
+{
+    double n = (double) ngrid*ngrid;
+    return 2.5*n*log2(n);
+}
+
+
+ResourcePlan::ResourcePlan(const AnalyzerConfig &config, int nl, long frames, SourceKind source,
+                           const PipelineConfig &pipeline)
+    : config_(config), pipeline_(pipeline), nl_(nl), frames_(frames)
+{
+    int ngrid = config.ngrid;
+    double n2 = (double) ngrid*ngrid;
+    int uniq_Ny = ngrid*(ngrid+2)/8;
+    int tilt = config.tilt;
+
+    //----------------------------------------------------------------------------------------------
+    // memory, in the order it is allocated
+    //----------------------------------------------------------------------------------------------
+    Part part;
+    if(source == SOURCE_TEXT){
+        // a frame of heads and tails in each of x, y and z, the boxes and the offsets of the frames in the index
+        part.name = "text trajectory";
+        part.bytes = 3*2.0*nl*sizeof(float) + frames*(3*sizeof(float) + 3*sizeof(int64_t));
+    }
+    else if(source == SOURCE_QUANTIZED){
+        // the encoded frame, about 12 bytes a lipid, its decoded coordinates and the box and offset of each frame
+        part.name = "quantized trajectory";
+        part.bytes = 12.0*nl + 6.0*nl*sizeof(float) + frames*(sizeof(Box) + sizeof(long long));
+    }
+    else{
+        part.name = "shared memory ring";
+        part.bytes = 0; // the producer's
+    }
+    parts_.push_back(part);
+
+    // the q tables, the real space sums and the workspace of push_frame, which holds no lipids here
+    part.name = "analyzer grids";
+    part.bytes = n2*(2*sizeof(int) + 2*sizeof(float) + 2*sizeof(int) + 5*sizeof(float))
+                 + FrameWorkspace::bytes(ngrid, 0);
+    parts_.push_back(part);
+
+    int nworkspaces = FramePipeline::workspaces(pipeline);
+    char name[64];
+    snprintf(name, sizeof(name), "frame workspaces (%d)", nworkspaces);
+    part.name = name;
+    part.bytes = (double) nworkspaces*FrameWorkspace::bytes(ngrid, nl);
+    parts_.push_back(part);
+
+    part.name = "sums over frames";
+    part.bytes = spectrum_sums_bytes(config.accum, NOBS, ngrid*ngrid);
+    parts_.push_back(part);
+
+    part.name = "block averages";
+    part.bytes = (double) NOBS*uniq_Ny*BlockAverager::bytes(frames);
+    parts_.push_back(part);
+
+    if(config.keep_series){
+        part.name = "time series";
+        part.bytes = (double) NSERIES*frames*uniq_Ny*sizeof(float);
+        parts_.push_back(part);
+    }
+    if(config.acf){
+        part.name = "autocorrelations";
+        part.bytes = (double) NSERIES*uniq_Ny*MultiTauCorrelator::bytes(frames);
+        parts_.push_back(part);
+    }
+    if(config.window_width > 0){
+        part.name = "sliding window";
+        part.bytes = SlidingWindow::bytes(config.window_width, NOBS*uniq_Ny) + NOBS*uniq_Ny*sizeof(float);
+        parts_.push_back(part);
+    }
+    part.name = "frame list";
+    part.bytes = frames*sizeof(int);
+    parts_.push_back(part);
+
+    //----------------------------------------------------------------------------------------------
+    // the kernels of a frame, as timed by nihbench, and their FLOPs counted from the source
+    //----------------------------------------------------------------------------------------------
+    typedef FramePipeline P;
+    if(source == SOURCE_TEXT)
+        add_kernel("parse_text", P::STAGE_READ, SCALE_LIPIDS, 0);
+    else if(source == SOURCE_QUANTIZED)
+        add_kernel("parse_quant", P::STAGE_READ, SCALE_LIPIDS, 0);
+    add_kernel("wrap", P::STAGE_PREPROCESS, SCALE_LIPIDS, 15.0*nl);
+    add_kernel("leaflets", P::STAGE_PREPROCESS, SCALE_LIPIDS, 4.0*nl);
+    double area = (config.area ? 60.0*nl*ngrid*(ngrid/2+1) : 0); // the direct transforms of the densities
+    // with CIC or TSC, the stencils and a weight and the sums for each patch of a cloud, and the window divided
+    // out of the transforms
+    int cloud = (config.assign == ASSIGN_TSC ? 9 : (config.assign == ASSIGN_CIC ? 4 : 0));
+    double deconvolve = (cloud ? 2*(tilt ? 14 : 2)*n2 : 0);
+    add_kernel("bin", P::STAGE_BIN, SCALE_LIPIDS, 10.0*nl + (cloud ? 24.0 + 4*cloud : 0)*nl + area);
+    add_kernel("fill_empty", P::STAGE_BIN, SCALE_GRID, 4*n2);
+    if(tilt){
+        add_kernel("normals", P::STAGE_TRANSFORM, SCALE_FFT, 6*fft_flops(ngrid) + 20*n2);
+        add_kernel("tilt", P::STAGE_TRANSFORM, SCALE_LIPIDS, 12.0*nl + 12.0*cloud*nl + 20*n2);
+    }
+    add_kernel("r2c", P::STAGE_TRANSFORM, SCALE_FFT, (tilt ? 12 : 2)*fft_flops(ngrid) + deconvolve);
+    add_kernel("full_arrays", P::STAGE_TRANSFORM, SCALE_GRID, 2*(tilt ? 12 : 2)*n2);
+    if(tilt)
+        add_kernel("decompose", P::STAGE_TRANSFORM, SCALE_GRID, 48*n2);
+    add_kernel("power", P::STAGE_TRANSFORM, SCALE_GRID, 3*NOBS*n2);
+    add_kernel("accumulate", P::STAGE_ACCUMULATE, SCALE_GRID, (config.accum == ACCUM_KAHAN ? 5 : 2)*NOBS*n2);
+}
+
+
+void ResourcePlan::add_kernel(const char *name, FramePipeline::Stage stage, Scaling scaling, double flops)
+{
+    Kernel k = {name, stage, scaling, flops, -1};
+    kernels_.push_back(k);
+}
+
+
+/**
+ * @brief The size a kernel's time is taken to be proportional to
+ */
+double ResourcePlan::size(Scaling scaling, int ngrid, int nl) const
+{
+    double n2 = (double) ngrid*ngrid;
+    switch(scaling){
+    case SCALE_LIPIDS: return nl;
+    case SCALE_GRID: return n2;
+    default: return n2*log2(n2);
+    }
+}
+
+
+bool ResourcePlan::calibrate(const string &benchfile)
+{
+    ifstream in(benchfile.c_str());
+    if(!in)
+        return false;
+
+    // one per line
+    vector<BenchResult> results;
+    string line;
+    while(getline(in, line)){
+        char name[64];
+        BenchResult r;
+        long reps;
+        double min_ns;
+        if(sscanf(line.c_str(), " {\"kernel\": \"%63[^\"]\", \"ngrid\": %d, \"nl\": %d, \"reps\": %ld, \"min_ns\": %lf, "
+                  "\"median_ns\": %lf", name, &r.ngrid, &r.nl, &reps, &min_ns, &r.median) == 6){
+            r.kernel = name;
+            results.push_back(r);
+        }
+    }
+    if(results.empty())
+        return false;
+
+    // the nearest size benchmarked, in the logs of the grid and the lipids, scaled to ours; the kernels that
+    // depend only on the lipids are benchmarked with no grid, and those that depend only on the grid with no lipids
+    for(size_t k=0; k<kernels_.size(); k++){
+        Kernel &kernel = kernels_[k];
+        const BenchResult *best = NULL;
+        double best_distance = 0;
+        for(size_t i=0; i<results.size(); i++){
+            const BenchResult &r = results[i];
+            if(r.kernel != kernel.name || size(kernel.scaling, r.ngrid, r.nl) <= 0)
+                continue;
+            double dg = (r.ngrid > 0 ? log((double) r.ngrid/config_.ngrid) : 0);
+            double dl = (r.nl > 0 ? log((double) r.nl/max(nl_, 1)) : 0);
+            double distance = dg*dg + dl*dl;
+            if(!best || distance < best_distance){
+                best = &r;
+                best_distance = distance;
+            }
+        }
+        if(!best)
+            continue;
+        // the direct transforms of the densities, with area, are not benchmarked
+        if(config_.area && string(kernel.name) == "bin")
+            continue;
+        kernel.seconds = 1e-9*best->median*size(kernel.scaling, config_.ngrid, nl_)
+                         /size(kernel.scaling, best->ngrid, best->nl);
+    }
+    return true;
+}
+
+
+double ResourcePlan::bytes() const
+{
+    double total = 0;
+    for(size_t i=0; i<parts_.size(); i++)
+        total += parts_[i].bytes;
+    return total;
+}
+
+
+double ResourcePlan::physical_memory()
+{
+    long pages = sysconf(_SC_PHYS_PAGES), page = sysconf(_SC_PAGE_SIZE);
+    return (pages > 0 && page > 0 ? (double) pages*page : 0);
+}
+
+
+void ResourcePlan::print(ostream &out) const
+{
+    char line[160];
+    const double mib = 1024.0*1024.0;
+
+    out << "Memory                               MiB" << endl;
+    for(size_t i=0; i<parts_.size(); i++){
+        snprintf(line, sizeof(line), "  %-28s %10.2f", parts_[i].name.c_str(), parts_[i].bytes/mib);
+        out << line << endl;
+    }
+    snprintf(line, sizeof(line), "  %-28s %10.2f", "total", bytes()/mib);
+    out << line << endl;
+    double physical = physical_memory();
+    if(physical > 0){
+        snprintf(line, sizeof(line), "  %-28s %10.2f%s", "physical memory", physical/mib,
+                 (bytes() > physical ? "  (too little)" : ""));
+        out << line << endl;
+    }
+
+    out << endl << "Per frame     stage             MFLOP        ms" << endl;
+    double flops = 0, seconds = 0, stage_seconds[FramePipeline::NSTAGES] = {0};
+    bool calibrated = true;
+    for(size_t k=0; k<kernels_.size(); k++){
+        const Kernel &kernel = kernels_[k];
+        flops += kernel.flops;
+        if(kernel.seconds >= 0){
+            seconds += kernel.seconds;
+            stage_seconds[kernel.stage] += kernel.seconds;
+            snprintf(line, sizeof(line), "  %-11s %-12s %10.3f %9.3f", kernel.name, stage_names[kernel.stage],
+                     1e-6*kernel.flops, 1e3*kernel.seconds);
+        }
+        else{
+            calibrated = false;
+            snprintf(line, sizeof(line), "  %-11s %-12s %10.3f %9s", kernel.name, stage_names[kernel.stage],
+                     1e-6*kernel.flops, "-");
+        }
+        out << line << endl;
+    }
+    if(seconds > 0)
+        snprintf(line, sizeof(line), "  %-24s %10.3f %9.3f%s", "total", 1e-6*flops, 1e3*seconds, (calibrated ? "" : "+"));
+    else
+        snprintf(line, sizeof(line), "  %-24s %10.3f %9s", "total", 1e-6*flops, "-");
+    out << line << endl;
+    snprintf(line, sizeof(line), "  %-24s %10.3f", "run", 1e-9*flops*frames_);
+    out << line << " GFLOP over " << frames_ << " frames" << endl;
+    out << endl;
+
+    if(seconds == 0){
+        out << "No kernel times; give the results of nihbench --out to estimate the time of the run" << endl;
+        return;
+    }
+    if(!pipeline_.parallel()){
+        out << "Expected time: " << (calibrated ? "" : "at least ") << seconds*frames_ << " s, serially" << endl;
+        return;
+    }
+    // the frames go by at the rate of the slowest stage
+    int threads[FramePipeline::NSTAGES] = {1, max(pipeline_.preprocess_threads, 1), max(pipeline_.bin_threads, 1),
+                                           max(pipeline_.transform_threads, 1), 1};
+    int slowest = 0;
+    for(int s=1; s<FramePipeline::NSTAGES; s++){
+        if(stage_seconds[s]/threads[s] > stage_seconds[slowest]/threads[slowest])
+            slowest = s;
+    }
+    out << "Expected time: " << (calibrated ? "" : "at least ") << stage_seconds[slowest]/threads[slowest]*frames_
+        << " s, limited by the " << stage_names[slowest] << " stage (" << threads[slowest] << " threads)" << endl;
+}
@@ -0,0 +1,102 @@
+/*
+ * ResourcePlan.h
+ *
+ * What a run will take before it starts: the memory of each part of the
+ * analysis, and the floating point operations and time of each kernel per
+ * frame, worked out from the grid, the lipids, the frames and the spectra
+ * asked for without reading any input.  Memory grows with ngrid^2 for every
+ * frame in flight, with the frames times the q bins for the time series,
+ * and with the lipids for the coordinates.
+ *
+ * The FLOPs are counted from the source of the kernels and the usual
+ * 2.5 N log2 N of a real FFT of N points, so they are estimates.  The times
+ * come from the results of nihbench (see tools/nihbench.cpp) on the same
+ * machine: each kernel takes the time of the nearest size benchmarked,
+ * scaled by the lipids, the grid points or the FFT work.  With the pipeline
+ * the frames go by at the rate of its slowest stage, divided by its
+ * threads; serially at the sum of the kernels.
+ */
+
+#ifndef RESOURCEPLAN_H_
+#define RESOURCEPLAN_H_
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "SpectrumAnalyzer.h"
+#include "FramePipeline.h"
+
+
+enum SourceKind{ SOURCE_TEXT, SOURCE_QUANTIZED, SOURCE_RING };
+
+
+class ResourcePlan{
+public:
+    /**
+     * @brief Works out the memory and the FLOPs of a run
+     * @param config - the analysis
+     * @param nl - the lipids per frame
+     * @param frames - the frames to analyze
+     * @param source - where the frames come from
+     * @param pipeline - the threads of each stage
+     */
+    ResourcePlan(const AnalyzerConfig &config, int nl, long frames, SourceKind source, const PipelineConfig &pipeline);
+
+    /**
+     * @brief Reads the kernel times from the JSON written by nihbench --out
+     * @return false if the file cannot be read or holds no results
+     */
+    bool calibrate(const std::string &benchfile);
+
+    /**
+     * @brief Prints the memory of each part, the FLOPs and time of each kernel and the expected time of the run
+     */
+    void print(std::ostream &out) const;
+
+    /**
+     * @brief The memory of the whole run, in bytes
+     */
+    double bytes() const;
+
+    /**
+     * @brief The frames the time series and the frame list make room for
+     */
+    long frames() const { return frames_; }
+
+    /**
+     * @brief The physical memory of the machine, in bytes, or 0 if unknown
+     */
+    static double physical_memory();
+
+private:
+    ResourcePlan(const ResourcePlan &);
+    ResourcePlan &operator=(const ResourcePlan &);
+
+    enum Scaling{ SCALE_LIPIDS, SCALE_GRID, SCALE_FFT };
+
+    struct Part{
+        std::string name;
+        double bytes;
+    };
+
+    struct Kernel{
+        const char *name;       // as in nihbench
+        FramePipeline::Stage stage;
+        Scaling scaling;
+        double flops;           // per frame
+        double seconds;         // per frame, or < 0 if not calibrated
+    };
+
+    void add_kernel(const char *name, FramePipeline::Stage stage, Scaling scaling, double flops);
+    double size(Scaling scaling, int ngrid, int nl) const;
+
+    AnalyzerConfig config_;
+    PipelineConfig pipeline_;
+    int nl_;
+    long frames_;
+    std::vector<Part> parts_;
+    std::vector<Kernel> kernels_;
+};
+
+#endif /* RESOURCEPLAN_H_ */
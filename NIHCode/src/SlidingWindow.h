@@ -0,0 +1,89 @@
+/*
+ * SlidingWindow.h
+ *
+ * Sums over the last W frames of a per-frame vector, e.g. the q-averaged
+ * contributions of every spectrum.  The frames are kept in a ring buffer;
+ * each new frame is added to the sums and the one leaving the window is
+ * subtracted, so an update costs O(n) regardless of W.  To stop round-off
+ * from building up through the subtractions, the sums are recomputed from
+ * the ring every W frames, which keeps the amortized cost per frame O(n).
+ */
+
+#ifndef SLIDINGWINDOW_H_
+#define SLIDINGWINDOW_H_
+
+#include <vector>
+#include <string.h>
+
+
+class SlidingWindow{
+public:
+    /**
+     * @brief Creates an empty window.
+     * @param width - the number of frames in the window
+     * @param n - the number of values per frame
+     */
+    SlidingWindow(int width, int n)
+        : width_(width), n_(n), count_(0), oldest_(0), since_refresh_(0),
+          ring_((size_t) width*n, 0.0f), sums_(n, 0.0) {}
+
+    /**
+     * @brief Adds a frame, dropping the oldest one once the window is full.
+     * @param x - the n values of this frame
+     */
+    void push(const float *x)
+    {
+        float *slot = &ring_[(size_t) oldest_*n_];
+        if(count_ == width_){
+            for(int i=0; i<n_; i++)
+                sums_[i] += (double) x[i] - slot[i];
+        }
+        else{
+            for(int i=0; i<n_; i++)
+                sums_[i] += x[i];
+            count_++;
+        }
+        memcpy(slot, x, n_*sizeof(float));
+        oldest_ = (oldest_ + 1) % width_;
+
+        if(++since_refresh_ == width_){
+            refresh();
+            since_refresh_ = 0;
+        }
+    }
+
+    bool full() const { return count_ == width_; }
+    int count() const { return count_; }
+    int width() const { return width_; }
+
+    /**
+     * @brief The sums over the frames in the window
+     */
+    const double *sums() const { return &sums_[0]; }
+
+    /**
+     * @brief The memory of a window of width frames of n values
+     */
+    static size_t bytes(int width, int n) { return sizeof(SlidingWindow) + (size_t) width*n*sizeof(float) + n*sizeof(double); }
+
+private:
+    void refresh()
+    {
+        for(int i=0; i<n_; i++)
+            sums_[i] = 0;
+        for(int f=0; f<count_; f++){
+            const float *slot = &ring_[(size_t) f*n_];
+            for(int i=0; i<n_; i++)
+                sums_[i] += slot[i];
+        }
+    }
+
+    int width_, n_;
+    int count_;          // frames currently in the window
+    int oldest_;         // ring slot of the oldest frame, which the next frame replaces
+    int since_refresh_;
+    std::vector<float> ring_;
+    std::vector<double> sums_;
+};
+
+#endif /* SLIDINGWINDOW_H_ */
@@ -0,0 +1,2215 @@
+/*
+ * SpectrumAnalyzer.cpp
+ *
+ * The per-frame analysis, split into the stages described in SpectrumAnalyzer.h.
+ */
+
+#include <iostream>
+#include <string.h>
+#include <cmath>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "SpectrumAnalyzer.h"
+#include "Matrix.h"
+
+#define pi 3.1415926535897932385
+
+using namespace std;
+
+const float twoPi=2*pi;
+
+const char *obs_names[NOBS] = {
+    "hq2", "tq2",
+    "t1xq2", "t1yq2", "dpq2", "dmq2", "dpparq2", "dpperq2", "dmparq2", "dmperq2",
+    "Im(hdmpar)", "Im(tdppar)", "umparq2", "umperq2", "upparq2", "upperq2", "Real(dum_par)", "Real(dup_par)",
+    "rhoSigq2", "rhoDelq2"
+};
+const int obs_group[NOBS] = {
+    GROUP_HEIGHT, GROUP_HEIGHT,
+    GROUP_TILT, GROUP_TILT, GROUP_TILT, GROUP_TILT, GROUP_TILT, GROUP_TILT, GROUP_TILT, GROUP_TILT,
+    GROUP_TILT, GROUP_TILT, GROUP_TILT, GROUP_TILT, GROUP_TILT, GROUP_TILT, GROUP_TILT, GROUP_TILT,
+    GROUP_AREA, GROUP_AREA
+};
+
+
+/**
+ * @brief Allocates a zeroed array for FFTW.  All arrays passed to the plans come from here,
+ *        so that they share the alignment of the arrays the plans were made with.
+ * @param n - the number of elements
+ * @return the new array, to be released with fftwf_free
+ */
+template <typename T>
+static T *fft_alloc(int n)
+{
+    T *arr = (T *) fftwf_malloc(n*sizeof(T));
+    memset(arr, 0, n*sizeof(T));
+    return arr;
+}
+
+
+/*
+ * The FFTW plans are shared by every analyzer with the same grid and FFT threads, and kept until the program
+ * exits, so that many analyzers, e.g. the jobs of a batch, plan each grid size once.  The FFTW planner is not
+ * thread safe, so plans are only made under planner_lock; running them is, and every analyzer runs them on its
+ * own arrays with the new-array execute functions.
+ */
+struct SharedPlans{
+    int ngrid, nthreads;
+    fftwf_plan spectrum, inverse;
+};
+static vector<SharedPlans> shared_plans;
+static pthread_mutex_t planner_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**
+ * @brief The plans for a grid, made on a workspace's arrays the first time the grid is asked for
+ */
+static SharedPlans get_plans(int ngrid, int nthreads, FrameWorkspace &w)
+{
+    pthread_mutex_lock(&planner_lock);
+    for(size_t p=0; p<shared_plans.size(); p++){
+        if(shared_plans[p].ngrid == ngrid && shared_plans[p].nthreads == nthreads){
+            SharedPlans found = shared_plans[p];
+            pthread_mutex_unlock(&planner_lock);
+            return found;
+        }
+    }
+
+    static bool threads_initialized = false;
+    if(nthreads > 1 && !threads_initialized)
+        threads_initialized = fftwf_init_threads();
+    if(threads_initialized)
+        fftwf_plan_with_nthreads(nthreads);
+    const int m[2]={ngrid,ngrid};
+    SharedPlans plans;
+    plans.ngrid = ngrid;
+    plans.nthreads = nthreads;
+    plans.spectrum = fftwf_plan_many_dft_r2c(2, m, 1,
+                                             w.h1D, NULL, 1, 0,
+                                             w.hqS, NULL, 1, 0, FFTW_MEASURE);
+    plans.inverse = fftwf_plan_many_dft_c2r(2, m, 1,
+                                            w.dz1xqS, NULL, 1, 0,
+                                            w.dz1x1D, NULL, 1, 0, FFTW_MEASURE);
+    shared_plans.push_back(plans);
+    pthread_mutex_unlock(&planner_lock);
+    return plans;
+}
+
+
+bool SpectrumAnalyzer::import_wisdom(const string &path)
+{
+    pthread_mutex_lock(&planner_lock);
+    bool ok = fftwf_import_wisdom_from_filename(path.c_str());
+    pthread_mutex_unlock(&planner_lock);
+    return ok;
+}
+
+
+bool SpectrumAnalyzer::export_wisdom(const string &path)
+{
+    pthread_mutex_lock(&planner_lock);
+    bool ok = fftwf_export_wisdom_to_filename(path.c_str());
+    pthread_mutex_unlock(&planner_lock);
+    return ok;
+}
+
+
+AnalyzerConfig::AnalyzerConfig()
+    : ngrid(0), cutang(cos(90*pi/180)), calctilt(1.0), t0in(17.97264862), phi0in(0.01588405482),
+      tilt(1), area(0), area_tail(0), accum(ACCUM_DOUBLE), assign(ASSIGN_NGP), lx_ref(0), ly_ref(0),
+      keep_series(0), acf(0), window_width(0), window_step(1), nthreads(1) {}
+
+
+//---------------------------------------------------------------------------------------------------------------
+//FRAME WORKSPACE//////////////////////////////////////////////////////////////////////////////////
+//---------------------------------------------------------------------------------------------------------------
+
+FrameWorkspace::FrameWorkspace(int N)
+    : ngrid(N), nl(0), capacity(0), borrowed(false), keep_sums(false), reduced(false), head(NULL), endc(NULL), dir(NULL), good(NULL), xj(NULL), yj(NULL),
+      sx(NULL), sy(NULL), wx(NULL), wy(NULL)
+{
+    int ngridpair = ngrid*(ngrid/2+1);
+    int uniq_Ny = ngrid*(ngrid+2)/8;
+
+    z1 = init_matrix<float>(ngrid, ngrid);
+    z2 = init_matrix<float>(ngrid, ngrid);
+    h = init_matrix<float>(ngrid, ngrid);
+    t = init_matrix<float>(ngrid, ngrid);
+    nlg1 = init_matrix<int>(ngrid, ngrid);
+    nlg2 = init_matrix<int>(ngrid, ngrid);
+    nlt1 = init_matrix<int>(ngrid, ngrid);
+    nlt2 = init_matrix<int>(ngrid, ngrid);
+    nlb1 = init_matrix<int>(ngrid, ngrid);
+    nlb2 = init_matrix<int>(ngrid, ngrid);
+    psiRU = init_matrix<float>(ngrid, ngrid);
+    psiIU = init_matrix<float>(ngrid, ngrid);
+    psiRD = init_matrix<float>(ngrid, ngrid);
+    psiID = init_matrix<float>(ngrid, ngrid);
+    h_real = init_matrix<float>(ngrid, ngrid);
+    h_imag = init_matrix<float>(ngrid, ngrid);
+    t1 = init_matrix<float>(ngrid, ngrid, 3);
+    t2 = init_matrix<float>(ngrid, ngrid, 3);
+    dm = init_matrix<float>(ngrid, ngrid, 2);
+    dp = init_matrix<float>(ngrid, ngrid, 2);
+    n1 = init_matrix<float>(ngrid, ngrid, 2);
+    n2 = init_matrix<float>(ngrid, ngrid, 2);
+    um = init_matrix<float>(ngrid, ngrid, 2);
+    up = init_matrix<float>(ngrid, ngrid, 2);
+    z1sum = init_matrix<float>(ngrid, ngrid);
+    z2sum = init_matrix<float>(ngrid, ngrid);
+    dsum1 = init_matrix<float>(ngrid, ngrid, 3);
+    dsum2 = init_matrix<float>(ngrid, ngrid, 3);
+    wg1 = init_matrix<float>(ngrid, ngrid);
+    wg2 = init_matrix<float>(ngrid, ngrid);
+    wt1 = init_matrix<float>(ngrid, ngrid);
+    wt2 = init_matrix<float>(ngrid, ngrid);
+
+    float **reals[] = { &h1D, &t1D, &z1_1D, &z2_1D, &t1x1D, &t1y1D,
+                        &dmx1D, &dmy1D, &dpx1D, &dpy1D, &umx1D, &umy1D, &upx1D, &upy1D,
+                        &dz1x1D, &dz1y1D, &dz2x1D, &dz2y1D };
+    for(size_t a=0; a<sizeof(reals)/sizeof(reals[0]); a++)
+        *reals[a] = fft_alloc<float>(ngrid*ngrid);
+    norm_1 = init_matrix<float>(ngrid*ngrid, 3);
+    norm_2 = init_matrix<float>(ngrid*ngrid, 3);
+
+    fftwf_complex **complexes[] = { &hqS, &tqS, &z1qS, &z2qS, &dz1xqS, &dz1yqS, &dz2xqS, &dz2yqS,
+                                    &t1xqS, &t1yqS, &dmxqS, &dmyqS, &dpxqS, &dpyqS,
+                                    &umxqS, &umyqS, &upxqS, &upyqS };
+    for(size_t a=0; a<sizeof(complexes)/sizeof(complexes[0]); a++)
+        *complexes[a] = fft_alloc<fftwf_complex>(ngridpair);
+
+    float ***fulls[] = { &hqR, &hqI, &tqR, &tqI, &t1xR, &t1xI, &t1yR, &t1yI,
+                         &dmxR, &dmxI, &dmyR, &dmyI, &dpxR, &dpxI, &dpyR, &dpyI,
+                         &umxR, &umxI, &umyR, &umyI, &upxR, &upxI, &upyR, &upyI,
+                         &dmparR, &dmparI, &dmperR, &dmperI, &dpparR, &dpparI, &dpperR, &dpperI,
+                         &umparR, &umparI, &umperR, &umperI, &upparR, &upparI, &upperR, &upperI };
+    for(size_t a=0; a<sizeof(fulls)/sizeof(fulls[0]); a++)
+        *fulls[a] = init_matrix<float>(ngrid, ngrid);
+
+    fq2 = init_matrix<float>(NOBS, ngrid, ngrid);
+    fq2_uniq = init_matrix<float>(NOBS, uniq_Ny); // contiguous, as the sliding window takes all of it
+}
+
+
+FrameWorkspace::~FrameWorkspace()
+{
+    release_lipids();
+
+    free_matrix(z1);    free_matrix(z2);    free_matrix(h);     free_matrix(t);
+    free_matrix(nlg1);  free_matrix(nlg2);  free_matrix(nlt1);  free_matrix(nlt2);
+    free_matrix(nlb1);  free_matrix(nlb2);
+    free_matrix(psiRU); free_matrix(psiIU); free_matrix(psiRD); free_matrix(psiID);
+    free_matrix(h_real); free_matrix(h_imag);
+    free_matrix(t1, ngrid); free_matrix(t2, ngrid);
+    free_matrix(dm, ngrid); free_matrix(dp, ngrid);
+    free_matrix(n1, ngrid); free_matrix(n2, ngrid);
+    free_matrix(um, ngrid); free_matrix(up, ngrid);
+    free_matrix(z1sum); free_matrix(z2sum);
+    free_matrix(dsum1, ngrid); free_matrix(dsum2, ngrid);
+    free_matrix(wg1);   free_matrix(wg2);   free_matrix(wt1);   free_matrix(wt2);
+
+    float *reals[] = { h1D, t1D, z1_1D, z2_1D, t1x1D, t1y1D, dmx1D, dmy1D, dpx1D, dpy1D,
+                       umx1D, umy1D, upx1D, upy1D, dz1x1D, dz1y1D, dz2x1D, dz2y1D };
+    for(size_t a=0; a<sizeof(reals)/sizeof(reals[0]); a++)
+        fftwf_free(reals[a]);
+    free_matrix(norm_1);
+    free_matrix(norm_2);
+
+    fftwf_complex *complexes[] = { hqS, tqS, z1qS, z2qS, dz1xqS, dz1yqS, dz2xqS, dz2yqS,
+                                   t1xqS, t1yqS, dmxqS, dmyqS, dpxqS, dpyqS, umxqS, umyqS, upxqS, upyqS };
+    for(size_t a=0; a<sizeof(complexes)/sizeof(complexes[0]); a++)
+        fftwf_free(complexes[a]);
+
+    float **fulls[] = { hqR, hqI, tqR, tqI, t1xR, t1xI, t1yR, t1yI,
+                        dmxR, dmxI, dmyR, dmyI, dpxR, dpxI, dpyR, dpyI,
+                        umxR, umxI, umyR, umyI, upxR, upxI, upyR, upyI,
+                        dmparR, dmparI, dmperR, dmperI, dpparR, dpparI, dpperR, dpperI,
+                        umparR, umparI, umperR, umperI, upparR, upparI, upperR, upperI };
+    for(size_t a=0; a<sizeof(fulls)/sizeof(fulls[0]); a++)
+        free_matrix(fulls[a]);
+
+    free_matrix(fq2, NOBS);
+    free_matrix(fq2_uniq);
+}
+
+
+size_t FrameWorkspace::bytes(int ngrid, int nl)
+{
+    // as allocated by the constructor and reserve(); the row pointers of the matrices are left out
+    size_t n2 = (size_t) ngrid*ngrid;
+    size_t ngridpair = ngrid*(ngrid/2+1);
+    size_t uniq_Ny = ngrid*(ngrid+2)/8;
+    size_t fields = 16 + 6*3 + 6*2 + 2 + 2*3 + 4; // z1 ... h_imag, t1 and t2, dm ... up, z1sum ... wt2
+    size_t reals = 18 + 2*3;            // h1D ... dz2y1D, norm_1 and norm_2
+    size_t fulls = 40;                  // hqR ... upperI
+    return (fields + reals + fulls + NOBS)*n2*sizeof(float) + 18*ngridpair*sizeof(fftwf_complex)
+           + NOBS*uniq_Ny*sizeof(float) + (size_t) nl*(3*3*sizeof(float) + 3*sizeof(int) + 2*3*(sizeof(int) + sizeof(float)));
+}
+
+
+void FrameWorkspace::release_lipids()
+{
+    if(!capacity)
+        return;
+    if(!borrowed){
+        free_matrix(head);
+        free_matrix(endc);
+        free_matrix(dir);
+    }
+    delete [] good;
+    delete [] xj;
+    delete [] yj;
+    free_matrix(sx);    free_matrix(sy);
+    free_matrix(wx);    free_matrix(wy);
+    capacity = 0;
+}
+
+
+void FrameWorkspace::borrow(const FrameWorkspace &from)
+{
+    if(!borrowed){
+        release_lipids();
+        borrowed = true;
+    }
+    reserve(from.nl);
+    head = from.head;
+    endc = from.endc;
+    dir = from.dir;
+    nl = from.nl;
+    box = from.box;
+
+    // what leaflets() found
+    zavg = from.zavg;
+    z1avg = from.z1avg;     z2avg = from.z2avg;
+    nl1 = from.nl1;         nl2 = from.nl2;
+    nswu = from.nswu;       nswd = from.nswd;
+    phi0_frame = from.phi0_frame;
+    times.clear();
+}
+
+
+void FrameWorkspace::reserve(int n)
+{
+    if(n <= capacity)
+        return;
+    release_lipids();
+    if(!borrowed){
+        head = init_matrix<float>(n, 3);
+        endc = init_matrix<float>(n, 3);
+        dir = init_matrix<float>(n, 3);
+    }
+    good = init_matrix<int>(n);
+    xj = init_matrix<int>(n);
+    yj = init_matrix<int>(n);
+    sx = init_matrix<int>(3, n);
+    sy = init_matrix<int>(3, n);
+    wx = init_matrix<float>(3, n);
+    wy = init_matrix<float>(3, n);
+    capacity = n;
+}
+
+
+//---------------------------------------------------------------------------------------------------------------
+//SETUP//////////////////////////////////////////////////////////////////////////////////
+//---------------------------------------------------------------------------------------------------------------
+
+SpectrumAnalyzer::SpectrumAnalyzer(const AnalyzerConfig &config)
+    : config_(config), ngrid(config.ngrid), finalized_(false), nframes_(0), nlipids_(0), lx_sum_(0), ly_sum_(0),
+      t0(config.accum), tq0(config.accum), phi0(config.accum), dot_cum(config.accum),
+      z1sq_av(config.accum), z2sq_av(config.accum), empty_tot(0), nswu(0), nswd(0), accum_time(0), window_(NULL)
+{
+    int i, j;
+    float mag;
+
+    ngridpair = ngrid*(ngrid/2+1);
+    uniq = (ngrid+4)*(ngrid+2)/8;
+    uniq_Ny = ngrid*(ngrid+2)/8;
+    init_qbins();
+
+    //constuct q matrix
+    q = init_matrix<int>(ngrid, ngrid, 2);
+    cosq = init_matrix<float>(ngrid, ngrid);
+    sinq = init_matrix<float>(ngrid, ngrid);
+    for(i=0; i<ngrid; i++){
+        for(j=0; j<ngrid; j++){
+
+            q[i][j][0] =((i < ngrid/2) ? i : i-ngrid);
+            q[i][j][1] =((j < ngrid/2) ? j : j-ngrid);
+
+            if(i==0 && j==0){cosq[i][j]=0; sinq[i][j]=0;}
+            else{
+
+                mag=1.0/sqrt(q[i][j][0]*q[i][j][0] + q[i][j][1]*q[i][j][1]);
+
+                cosq[i][j]=q[i][j][0]*mag; // x is the column and
+                sinq[i][j]=q[i][j][1]*mag;} // y is the row
+        }
+    }
+
+    for(i=0; i<NOBS; i++){
+        if(obs_group[i]==GROUP_AREA) obs_scale[i]=400*config_.phi0in*config_.phi0in;
+        else obs_scale[i]=400;
+    }
+    obs_scale[OBS_HQ2]=40000;	obs_scale[OBS_TQ2]=40000;
+    obs_scale[OBS_T1XQ2]=100;	obs_scale[OBS_T1YQ2]=100;
+    obs_scale[OBS_HDMPAR]=4000;	obs_scale[OBS_TDPPAR]=4000;
+
+    // the window of CIC and TSC is the patch, sinc(pi m/N) along each axis for the wave number m, convolved
+    // with itself once or twice; ordered as the output of the r2c transforms
+    if(config_.assign != ASSIGN_NGP){
+        int order = (config_.assign == ASSIGN_TSC ? 3 : 2);
+        deconv_.resize(ngridpair);
+        for(i=0; i<ngrid; i++){
+            for(j=0; j<ngrid/2+1; j++){
+                double ax = pi*q[i][0][0]/ngrid, ay = pi*j/ngrid;
+                double window = (ax ? sin(ax)/ax : 1)*(ay ? sin(ay)/ay : 1);
+                deconv_[i*(ngrid/2+1)+j] = 1/pow(window, order);
+            }
+        }
+    }
+
+    // the plans of a new grid are made on the arrays of push_frame's workspace; every workspace is transformed
+    // with the new-array execute functions
+    work_ = new FrameWorkspace(ngrid);
+    SharedPlans plans = get_plans(ngrid, (config_.nthreads > 1 ? config_.nthreads : 1), *work_);
+    spectrum_plan = plans.spectrum;
+    inv_plan = plans.inverse;
+
+    obs_sums = make_spectrum_sums(config_.accum, NOBS, ngrid*ngrid);
+    obs_blocks.resize(NOBS*uniq_Ny);
+
+    t1xR_cum = init_matrix<float>(ngrid, ngrid);
+    t1xI_cum = init_matrix<float>(ngrid, ngrid);
+    t1yR_cum = init_matrix<float>(ngrid, ngrid);
+    t1yI_cum = init_matrix<float>(ngrid, ngrid);
+    hq2Ed = init_matrix<float>(ngrid, ngrid);
+    memset(ty_cum, 0, sizeof(ty_cum));
+
+    if(config_.acf){
+        for(int s=0; s<NSERIES; s++)
+            acf_[s].resize(uniq_Ny);
+    }
+    if(config_.window_width > 0)
+        window_ = new SlidingWindow(config_.window_width, NOBS*uniq_Ny);
+}
+
+
+SpectrumAnalyzer::~SpectrumAnalyzer()
+{
+    delete work_;
+    delete obs_sums;
+    delete window_;
+    delete [] qbin;
+    delete [] qbin_Ny;
+    free_matrix(q, ngrid);
+    free_matrix(cosq);
+    free_matrix(sinq);
+    free_matrix(t1xR_cum);
+    free_matrix(t1xI_cum);
+    free_matrix(t1yR_cum);
+    free_matrix(t1yI_cum);
+    free_matrix(hq2Ed);
+}
+
+
+void SpectrumAnalyzer::push_frame(const float *head, const float *tail, size_t nl, Box box)
+{
+    push_frame(Coordinates(head), Coordinates(tail), nl, box);
+}
+
+
+void SpectrumAnalyzer::push_frame(const Coordinates &head, const Coordinates &tail, size_t nl, Box box)
+{
+    if(finalized_){
+        cout << "SpectrumAnalyzer: frame pushed after finalize() is ignored" << endl;
+        return;
+    }
+    load(*work_, head, tail, nl, box);
+    preprocess(*work_);
+    bin(*work_);
+    transform(*work_);
+    accumulate(*work_);
+}
+
+
+/**
+ * @brief Copies one group of caller-owned coordinates into a workspace array
+ * @param in - the coordinates
+ * @param nl - the number of lipids
+ * @param out - nl*3 values
+ */
+template <typename T>
+static void gather(const Coordinates &in, size_t nl, float **out)
+{
+    const char *comp[3] = {(const char *) in.x, (const char *) in.y, (const char *) in.z};
+    for(int c=0; c<3; c++){
+        const char *p = comp[c];
+        for(size_t i=0; i<nl; i++, p += in.stride)
+            out[i][c] = *(const T *) p;
+    }
+}
+
+
+void SpectrumAnalyzer::load(FrameWorkspace &w, const Coordinates &head, const Coordinates &tail, size_t nl, Box box) const
+{
+    w.times.clear();
+    NIH_PROFILE_START(w.times);
+    w.reserve(nl);
+    w.nl = nl;
+    w.box = box;
+    if(head.type == COORD_DOUBLE) gather<double>(head, nl, w.head);
+    else gather<float>(head, nl, w.head);
+    if(tail.type == COORD_DOUBLE) gather<double>(tail, nl, w.endc);
+    else gather<float>(tail, nl, w.endc);
+    NIH_PROFILE_LAP(w.times, PROF_LOAD);
+}
+
+
+//---------------------------------------------------------------------------------------------------------------
+//WRAPPING AND LEAFLETS//////////////////////////////////////////////////////////////////////////////////
+//---------------------------------------------------------------------------------------------------------------
+
+void SpectrumAnalyzer::preprocess(FrameWorkspace &w) const
+{
+    NIH_PROFILE_START(w.times);
+    wrap(w);
+    NIH_PROFILE_LAP(w.times, PROF_WRAP);
+    leaflets(w);
+    NIH_PROFILE_LAP(w.times, PROF_LEAFLETS);
+}
+
+
+void SpectrumAnalyzer::wrap(FrameWorkspace &w) const
+{
+    int i;
+    int nl = w.nl;
+    float **head = w.head, **endc = w.endc, **dir = w.dir;
+    float lx = w.box.lx, ly = w.box.ly;
+    float lx_ref = (config_.lx_ref > 0 ? config_.lx_ref : lx);
+    float mag;
+
+    for(i=0; i< nl; i++){
+
+        // make sure the interface beads are within the box in terms of xy
+
+        if(head[i][0] > lx || head[i][0] == lx){
+            head[i][0] = head[i][0] - lx;
+            endc[i][0] = endc[i][0] - lx;
+        }
+
+        if(head[i][1] > ly || head[i][1] == ly){
+            head[i][1] = head[i][1] - ly;
+            endc[i][1] = endc[i][1] - ly;
+        }
+
+        if(head[i][0] < 0){
+            head[i][0] = head[i][0] + lx;
+            endc[i][0] = endc[i][0] + lx;
+        }
+
+        if(head[i][1] < 0){
+            head[i][1] = head[i][1] + ly;
+            endc[i][1] = endc[i][1] + ly;
+        }
+
+        //fix the tail beads which were carried to the other side of the box
+
+        if(fabs(head[i][0]-endc[i][0])>0.5*lx_ref){
+            endc[i][0]=(head[i][0]>endc[i][0] ? endc[i][0]+lx : endc[i][0] -lx );
+        }
+
+        if(fabs(head[i][1]-endc[i][1])>0.5*lx_ref){
+            endc[i][1]=(head[i][1]>endc[i][1] ? endc[i][1]+ly : endc[i][1] -ly );
+        }
+
+        //director fields
+        dir[i][0]=endc[i][0]-head[i][0];
+        dir[i][1]=endc[i][1]-head[i][1];
+        dir[i][2]=endc[i][2]-head[i][2];
+
+        mag=1.0/sqrt(dir[i][0]*dir[i][0] + dir[i][1]*dir[i][1] + dir[i][2]*dir[i][2]);
+
+        dir[i][0] *= mag;
+        dir[i][1] *= mag; // normalize the director
+        dir[i][2] *= mag;
+    }
+}
+
+
+void SpectrumAnalyzer::leaflets(FrameWorkspace &w) const
+{
+    int i;
+    int nl = w.nl;
+    float **head = w.head, **endc = w.endc, **dir = w.dir;
+    float lx = w.box.lx, ly = w.box.ly, lz = w.box.lz;
+    float zbox;
+
+    w.z1avg=0;	w.z2avg=0;
+    w.nl1=0;	w.nl2=0;
+    w.nswu=0;	w.nswd=0;
+    w.zavg=0;
+
+    for(i=0; i< nl; i++){
+
+        if(dir[i][2]<0){
+            w.z1avg += head[i][2];
+            w.nl1++;
+        }
+
+        if(dir[i][2]>0){
+            w.z2avg += head[i][2];
+            w.nl2++;
+        }
+
+    } // loop over nl
+
+    // check if molecules were carried to other size in z
+
+    zbox = 0.6 * lz;  // fraction of box height
+    for(i=0; i<nl; i++){
+
+        if(dir[i][2]<0 && fabs(head[i][2]-w.z1avg/w.nl1)>zbox){ // stray molecule belongs in top monolayer
+
+            head[i][2] += lz;
+            endc[i][2] += lz;
+            w.nswu += 1;
+        }
+
+        if(dir[i][2]>0 && fabs(head[i][2]-w.z2avg/w.nl2)>zbox){ // stray molecule belongs in bottom monolayer
+
+            head[i][2] -= lz;
+            endc[i][2] -= lz;
+            w.nswd += 1;
+        }
+
+    }
+
+    for(i=0; i<nl; i++){ // calculate zavg after the lipids have been fixed
+
+        w.zavg += head[i][2];
+    }
+
+    w.zavg /= nl;
+
+    w.phi0_frame= 0.5*(w.nl1+w.nl2)/lx/ly;
+}
+
+
+//---------------------------------------------------------------------------------------------------------------
+//NUMBER DENSITIES, HEIGHT & THICKNESS//////////////////////////////////////////////////////////////////////////////////
+//---------------------------------------------------------------------------------------------------------------
+
+void SpectrumAnalyzer::bin(FrameWorkspace &w) const
+{
+    NIH_PROFILE_START(w.times);
+    w.reduced = false;
+    bin_lipids(w);
+    NIH_PROFILE_LAP(w.times, PROF_BIN);
+    fill_empty(w);
+    NIH_PROFILE_LAP(w.times, PROF_FILL_EMPTY);
+    height_thickness(w);
+    NIH_PROFILE_LAP(w.times, PROF_BIN);
+}
+
+
+void SpectrumAnalyzer::reduce(FrameWorkspace &w, const FrameWorkspace &finer) const
+{
+    NIH_PROFILE_START(w.times);
+    w.reduced = true;
+    reduce_sums(w, finer);
+    NIH_PROFILE_LAP(w.times, PROF_BIN);
+    fill_empty(w);
+    NIH_PROFILE_LAP(w.times, PROF_FILL_EMPTY);
+    height_thickness(w);
+    NIH_PROFILE_LAP(w.times, PROF_BIN);
+}
+
+
+void SpectrumAnalyzer::height_thickness(FrameWorkspace &w) const
+{
+    int i, j;
+    float **z1 = w.z1, **z2 = w.z2;
+    float lx = w.box.lx;
+
+    w.t0_frame=0;
+    w.tq0_frame=0;
+
+    for(i=0; i<ngrid; i++){
+        for(j=0; j<ngrid; j++){
+
+            w.h[i][j]=z1[i][j]+z2[i][j];
+            w.t[i][j]=z1[i][j]-z2[i][j];
+
+            /////////////calculate average thickness quantities
+
+            w.t0_frame += w.t[i][j];
+            w.tq0_frame += (w.t[i][j]-2*config_.t0in);
+
+        }
+    }  // two for loops over (i,j)
+
+    w.t0_frame = 0.5*w.t0_frame/(ngrid*ngrid);
+
+    w.tq0_frame = lx*w.tq0_frame; // multiply by .25 at the end
+
+    w.tq0_frame *=w.tq0_frame;
+}
+
+
+void SpectrumAnalyzer::reduce_sums(FrameWorkspace &w, const FrameWorkspace &finer) const
+{
+    int i, j, di, dj, c;
+
+    // the per lipid scalars of bin_lipids(), which do not depend on the grid
+    w.z1sq_av_frame = finer.z1sq_av_frame;
+    w.z2sq_av_frame = finer.z2sq_av_frame;
+    w.out_of_range = finer.out_of_range;
+
+    // patch (i,j) covers patches 2i, 2i+1 by 2j, 2j+1 of the finer grid
+    for(i=0; i<ngrid; i++){
+        for(j=0; j<ngrid; j++){
+            w.z1sum[i][j]=0;	w.z2sum[i][j]=0;
+            w.nlg1[i][j]=0;	w.nlg2[i][j]=0;
+            w.nlb1[i][j]=0;	w.nlb2[i][j]=0;
+            for(c=0; c<3; c++){
+                w.dsum1[i][j][c]=0;	w.dsum2[i][j][c]=0;
+            }
+            for(di=2*i; di<2*i+2; di++){
+                for(dj=2*j; dj<2*j+2; dj++){
+                    w.z1sum[i][j] += finer.z1sum[di][dj];
+                    w.z2sum[i][j] += finer.z2sum[di][dj];
+                    w.nlg1[i][j] += finer.nlg1[di][dj];
+                    w.nlg2[i][j] += finer.nlg2[di][dj];
+                    w.nlb1[i][j] += finer.nlb1[di][dj];
+                    w.nlb2[i][j] += finer.nlb2[di][dj];
+                    for(c=0; c<3; c++){
+                        w.dsum1[i][j][c] += finer.dsum1[di][dj][c];
+                        w.dsum2[i][j][c] += finer.dsum2[di][dj][c];
+                    }
+                }
+            }
+
+            w.z1[i][j] = (w.nlg1[i][j]>0 ? w.z1sum[i][j]/w.nlg1[i][j] : 0);
+            w.z2[i][j] = (w.nlg2[i][j]>0 ? w.z2sum[i][j]/w.nlg2[i][j] : 0);
+        }
+    }
+}
+
+
+void SpectrumAnalyzer::bin_lipids(FrameWorkspace &w) const
+{
+    int i, j, k;
+    int nl = w.nl;
+    float **head = w.head, **endc = w.endc, **dir = w.dir;
+    int *good = w.good, *xj = w.xj, *yj = w.yj;
+    float **z1 = w.z1, **z2 = w.z2;
+    int **nlg1 = w.nlg1, **nlg2 = w.nlg2;
+    float lx = w.box.lx, ly = w.box.ly;
+    float invLx=1/lx;
+    float invLy=1/ly;
+    float invLxy=1/sqrt(lx*ly);
+    float Lxy=sqrt(lx*ly);
+    float dlx=lx/ngrid; // the widths of each patch
+    float dly=ly/ngrid;
+    float qx, qy; //  wave numbers used when calculating the phiXX's
+    float xx, yy; // xy coordinates of the portion of each lipid used to measure area fluctuations
+    int xi, yi; // patch coordinates of a single lipid
+
+    w.z1sq_av_frame=0;	w.z2sq_av_frame=0;
+    w.out_of_range=0;
+
+    // the lipids within the cutoff angle; chosen here rather than in preprocess, so that analyses with
+    // different cutoffs can share a preprocessed frame
+    for(i=0; i<nl; i++)
+        good[i] = (fabs(dir[i][2]) > config_.cutang ? 1 : 0);
+
+    for(j=0; j<ngrid; j++){
+        for(k=0; k<ngrid; k++){
+            z1[j][k]=0;		z2[j][k]=0;
+            nlg1[j][k]=0;	nlg2[j][k]=0;
+            w.nlb1[j][k]=0;	w.nlb2[j][k]=0;
+        }
+    }
+
+    //----------------------------------------------------------------------------------------------
+    //CALCULATE NUMBER DENSITIES////////////////////////////////////////////////////////////////////////////
+    //-------------------------------------------------------------------------------
+    // find phi_q, which is the sum over e^(iqx)
+    if(config_.area){
+        float **psiRU = w.psiRU, **psiIU = w.psiIU, **psiRD = w.psiRD, **psiID = w.psiID;
+
+        for(j=0; j<ngrid; j++){
+            for(k=0; k<ngrid; k++){
+                psiRU[j][k]=0;		psiIU[j][k]=0;	psiRD[j][k]=0;	psiID[j][k]=0;
+                w.h_real[j][k]=0;	w.h_imag[j][k]=0;
+            }
+        }
+
+        for(i=0; i<nl; i++){
+            for(j=0; j<ngrid/2+1; j++){ // only take the upper half of the complex plane
+                for(k=0; k<ngrid; k++){// and use symmetries later
+
+                    qx = twoPi*q[j][k][0]*invLx;
+                    qy = twoPi*q[j][k][1]*invLy;
+                    // same as qmat but divided by the appropriate L
+
+                    if(config_.area_tail){
+
+                        xx=endc[i][0];
+                        yy=endc[i][1];
+                    }
+                    else{
+                        xx=head[i][0];
+                        yy=head[i][1];
+                    }
+
+                    w.h_real[j][k] += (head[i][2]-w.zavg)*cos(qx*xx + qy*yy);
+                    w.h_imag[j][k] -= (head[i][2]-w.zavg)*sin(qx*xx + qy*yy);
+
+                    if(dir[i][2]<0 && good[i]){ // upper monolayer
+
+                        if(j==0 && k==0){ // treat q=0 separately
+                            psiRU[j][k] += 0;
+                            psiIU[j][k] += 0;}
+
+                        else{		psiRU[j][k] += cos(qx*xx + qy*yy);  // divide by phi0in at the end
+                            psiIU[j][k] -= sin(qx*xx + qy*yy);}
+                    }
+
+                    if(dir[i][2]>0 && good[i]){ // lower monolayer
+
+                        if(j==0 && k==0){ // treat q=0 separately for real part
+                            psiRD[j][k] += 0;
+                            psiID[j][k] += 0;}
+
+                        else{		psiRD[j][k] += cos(qx*xx + qy*yy);
+                            psiID[j][k] -= sin(qx*xx + qy*yy);}
+                    }
+
+                }// 2 for loops
+            } // 2 for loops
+
+        } // loop over nl
+
+        for(j=0; j<ngrid; j++){ // multiply by 1/L for correct dimensions
+            for(k=0; k<ngrid; k++){ // and take care of q=0 mode
+
+                if(j==0 && k==0){
+                    psiRU[j][k]=w.nl1*invLxy - config_.phi0in*Lxy; // (1/L) integral (phi-phi0in) dx dy
+                    psiIU[j][k]=0;
+                    psiRD[j][k]=w.nl2*invLxy - config_.phi0in*Lxy; // =nl1/L-phi0in*L
+                    psiID[j][k]=0;
+                }
+                else{
+                    psiRU[j][k] *= invLxy;	psiIU[j][k] *= invLxy; // for dimensions in Edholm paper
+                    psiRD[j][k] *= invLxy;	psiID[j][k] *= invLxy;} // didn't worry about q=0
+            }						// was *= invLxy for Seifert
+        }
+    } // if (AREA)
+
+    //----------------------------------------------------------------------------------------------
+    //HEIGHT & THICKNESS////////////////////////////////////////////////////////////////////////////
+    //----------------------------------------------------------------------------------------------
+
+    ////////assign the lipids to coarse-grained fields
+    ////////and calculate average height and thickness
+
+    for(i=0; i<nl; i++){
+
+        xj[i]= (int) floor(head[i][0]/dlx);
+        yj[i]= (int) floor(head[i][1]/dly);
+
+        if(xj[i]>ngrid-1){
+
+            if(head[i][0]==lx){xj[i]=ngrid-1;} // this got through the wrapping filter because -1e-14<x<0
+            // and x+lx is stored as lx
+            if(head[i][0]!=lx){
+                w.out_of_range++;
+                cout<<" xi>N-1 -> xi=" <<xj[i]<<" for x= " <<head[i][0]<<" lx= "<<lx<<" i= "<<i<<endl;
+            }
+        }
+
+        if(yj[i]>ngrid-1){
+
+            if(head[i][1]==ly){yj[i]=ngrid-1;} 	// this got through the wrapping filter because -1e-14<y<0
+            // and y+ly is stored as ly
+            if(head[i][1]!=ly){
+                w.out_of_range++;
+                cout<<" yi>N-1 -> yi=" <<yj[i]<<" N= "<<ngrid<<" for y= " <<head[i][1]<<" ly= "<<ly<<" i= "<<i<<endl;
+            }
+        }
+
+        if(xj[i]<0){w.out_of_range++; cout<<" xi<0 -> xi= "<< xj[i] <<" for x= "<< head[i][0] << " i= " << i <<endl;}
+        if(yj[i]<0){w.out_of_range++; cout<<" yi<0 -> yi= "<< yj[i] <<" for y= "<< head[i][1] << " i= " << i <<endl;}
+
+        xi=xj[i];
+        yi=yj[i];
+
+        if(dir[i][2] < 0){  // upper monolayer
+            if(good[i]){
+                z1[xi][yi] += head[i][2]-w.zavg;
+                w.z1sq_av_frame += (head[i][2]-w.zavg)*(head[i][2]-w.zavg);
+                nlg1[xi][yi]++;
+            }
+            else{w.nlb1[xi][yi]++;}
+        }
+
+
+        if(dir[i][2] > 0){ //lower monolayer
+            if(good[i]){
+                z2[xi][yi] += head[i][2]-w.zavg;
+                w.z2sq_av_frame += (head[i][2]-w.zavg)*(head[i][2]-w.zavg);
+                nlg2[xi][yi]++;
+            }
+            else{w.nlb2[xi][yi]++;}
+        }
+
+    } // loop over nl
+
+    w.z1sq_av_frame /=w.nl1;
+    w.z2sq_av_frame /=w.nl2;
+
+    // the counts stay those of the patch each lipid is in, and the heights become the averages of the clouds
+    if(config_.assign != ASSIGN_NGP){
+        assign_heights(w);
+        return;
+    }
+
+    // the sums a coarser grid is reduced from, with the directors of all the lipids of each monolayer
+    if(w.keep_sums){
+        for(i=0; i<ngrid; i++){
+            for(j=0; j<ngrid; j++){
+                w.z1sum[i][j]=z1[i][j];	w.z2sum[i][j]=z2[i][j];
+                for(k=0; k<3; k++){
+                    w.dsum1[i][j][k]=0;	w.dsum2[i][j][k]=0;
+                }
+            }
+        }
+        for(i=0; i<nl; i++){
+            float *dsum = (dir[i][2] < 0 ? w.dsum1 : w.dsum2)[xj[i]][yj[i]];
+            if(dir[i][2] != 0){
+                dsum[0] += dir[i][0];	dsum[1] += dir[i][1];	dsum[2] += dir[i][2];
+            }
+        }
+    }
+
+    for(i=0; i<ngrid; i++){
+        for(j=0; j<ngrid; j++){
+
+            if(nlg1[i][j]>0){z1[i][j] /= nlg1[i][j];}
+            if(nlg2[i][j]>0){z2[i][j] /= nlg2[i][j];}
+        }
+    }
+}
+
+
+/**
+ * @brief The patches of the cloud of every lipid along one axis, and their weights, for CIC or TSC.  Written
+ * without branches or calls so that the compiler can vectorize it.
+ * @param pos - the coordinates of the lipids, 3 floats apart
+ * @param inv_d - 1/the width of a patch
+ * @param order - 2 for CIC, 3 for TSC
+ * @param s, wt - the patches and the weights, [k][lipid] for k<3; k=2 has no weight with CIC
+ */
+static void cloud_stencil(const float *pos, int nl, float inv_d, int ngrid, int order, int **s, float **wt)
+{
+    int *s0 = s[0], *s1 = s[1], *s2 = s[2];
+    float *w0 = wt[0], *w1 = wt[1], *w2 = wt[2];
+
+    if(order == 2){
+        // the patches whose centres are either side of the lipid, weighted by the overlap of a patch wide cloud
+        for(int i=0; i<nl; i++){
+            float u = pos[3*i]*inv_d - 0.5f;    // >= -0.5 for wrapped coordinates
+            int k = (int) (u + 1.0f) - 1;       // floor(u)
+            float f = u - k;
+            int lo = (k < 0 ? k + ngrid : k), hi = (k + 1 >= ngrid ? k + 1 - ngrid : k + 1);
+            s0[i] = lo;     s1[i] = hi;     s2[i] = hi;
+            w0[i] = 1 - f;  w1[i] = f;      w2[i] = 0;
+        }
+    }
+    else{
+        // the patch the lipid is in and its two neighbours, weighted by a triangle two patches wide
+        for(int i=0; i<nl; i++){
+            float u = pos[3*i]*inv_d;
+            int k = (int) u;
+            k = (k > ngrid-1 ? ngrid-1 : k);    // x == lx
+            float d = u - k - 0.5f;
+            s0[i] = (k > 0 ? k - 1 : ngrid - 1);
+            s1[i] = k;
+            s2[i] = (k < ngrid-1 ? k + 1 : 0);
+            w0[i] = 0.5f*(0.5f - d)*(0.5f - d);
+            w1[i] = 0.75f - d*d;
+            w2[i] = 0.5f*(0.5f + d)*(0.5f + d);
+        }
+    }
+}
+
+
+void SpectrumAnalyzer::assign_heights(FrameWorkspace &w) const
+{
+    int i, j, a, b;
+    int order = (config_.assign == ASSIGN_TSC ? 3 : 2);
+
+    cloud_stencil(&w.head[0][0], w.nl, ngrid/w.box.lx, ngrid, order, w.sx, w.wx);
+    cloud_stencil(&w.head[0][1], w.nl, ngrid/w.box.ly, ngrid, order, w.sy, w.wy);
+
+    for(i=0; i<ngrid; i++){
+        for(j=0; j<ngrid; j++){
+            w.z1[i][j]=0;	w.z2[i][j]=0;
+            w.wg1[i][j]=0;	w.wg2[i][j]=0;
+        }
+    }
+    for(i=0; i<w.nl; i++){
+        if(!w.good[i] || w.dir[i][2] == 0)
+            continue;
+        float **z = (w.dir[i][2] < 0 ? w.z1 : w.z2), **wg = (w.dir[i][2] < 0 ? w.wg1 : w.wg2);
+        float height = w.head[i][2]-w.zavg;
+        for(a=0; a<order; a++){
+            int x = w.sx[a][i];
+            for(b=0; b<order; b++){
+                int y = w.sy[b][i];
+                float f = w.wx[a][i]*w.wy[b][i];
+                z[x][y] += f*height;
+                wg[x][y] += f;
+            }
+        }
+    }
+    for(i=0; i<ngrid; i++){
+        for(j=0; j<ngrid; j++){
+            if(w.wg1[i][j]>0){w.z1[i][j] /= w.wg1[i][j];}
+            if(w.wg2[i][j]>0){w.z2[i][j] /= w.wg2[i][j];}
+        }
+    }
+}
+
+
+/**
+ * @brief Interpolates the empty patches of both monolayers from their neighbours, weighted by what is in them:
+ * the lipids (int) or the weights of their clouds (float)
+ */
+template <typename T>
+static void fill_patches(FrameWorkspace &w, T **nlg1, T **nlg2)
+{
+    int i, j;
+    int ngrid = w.ngrid;
+    float **z1 = w.z1, **z2 = w.z2;
+    int i1, i2, j1, j2; // neighboring cordinates to patch [i][j], used for interpolation
+
+    w.empty=0;
+
+    /////if a patch is empty, interpolate
+    for(i=0; i<ngrid; i++){
+        for(j=0; j<ngrid; j++){
+
+            i1 = ((i>0) ? (i-1) : (ngrid-1));  i2 = ((i<ngrid-1) ? (i+1) : 0); // periodic boundaries
+            j1 = ((j>0) ? (j-1) : (ngrid-1));  j2 = ((j<ngrid-1) ? (j+1) : 0);
+
+            if(nlg1[i][j]==0){
+
+                if(nlg1[i1][j]==0 || nlg1[i2][j]==0 || nlg1[i][j1]==0 || nlg1[i][j2]==0 ){
+                    w.empty++;}
+
+                T nn= nlg1[i][j1] + nlg1[i][j2] + nlg1[i1][j] + nlg1[i2][j];
+
+                z1[i][j] = (nlg1[i][j1]*z1[i][j1] + nlg1[i][j2]*z1[i][j2]
+                            + nlg1[i1][j]*z1[i1][j] + nlg1[i2][j]*z1[i2][j])/nn;
+            }
+
+            if(nlg2[i][j]==0){
+
+                if(nlg1[i1][j]==0 || nlg1[i2][j]==0 || nlg1[i][j1]==0 || nlg1[i][j2]==0 ){
+                    w.empty++;}
+
+                T nn= nlg2[i][j1] + nlg2[i][j2] + nlg2[i1][j] + nlg2[i2][j];
+
+                z2[i][j] = (nlg2[i][j1]*z2[i][j1] + nlg2[i][j2]*z2[i][j2]
+                            + nlg2[i1][j]*z2[i1][j] + nlg2[i2][j]*z2[i2][j])/nn;
+            }
+
+
+        }
+    } // two for loops over (i,j)
+}
+
+
+void SpectrumAnalyzer::fill_empty(FrameWorkspace &w) const
+{
+    if(config_.assign == ASSIGN_NGP)
+        fill_patches(w, w.nlg1, w.nlg2);
+    else
+        fill_patches(w, w.wg1, w.wg2);
+}
+
+
+//---------------------------------------------------------------------------------------------------------------
+//NORMALS, TILT AND FOURIER TRANSFORMS//////////////////////////////////////////////////////////////////////////////////
+//---------------------------------------------------------------------------------------------------------------
+
+void SpectrumAnalyzer::transform(FrameWorkspace &w) const
+{
+    NIH_PROFILE_START(w.times);
+    if(config_.tilt){
+        normals(w);
+        NIH_PROFILE_LAP(w.times, PROF_NORMALS);
+        tilt_fields(w);
+        NIH_PROFILE_LAP(w.times, PROF_TILT);
+    }
+    forward_transforms(w);
+    NIH_PROFILE_LAP(w.times, PROF_FFT_FIELDS);
+    full_arrays(w);
+    NIH_PROFILE_LAP(w.times, PROF_FULL_ARRAYS);
+    if(config_.tilt){
+        decompose(w);
+        NIH_PROFILE_LAP(w.times, PROF_DECOMPOSE);
+    }
+    power(w);
+    NIH_PROFILE_LAP(w.times, PROF_POWER);
+}
+
+
+void SpectrumAnalyzer::normals(FrameWorkspace &w) const
+{
+    int i, j, k;
+    float lx = w.box.lx, ly = w.box.ly;
+    float twoPiLx=2*pi/lx;
+    float twoPiLy=2*pi/lx;
+    float invLx=1/lx;
+    float invLy=1/ly;
+    float calctilt = config_.calctilt;
+    float *dz1x1D = w.dz1x1D, *dz1y1D = w.dz1y1D, *dz2x1D = w.dz2x1D, *dz2y1D = w.dz2y1D;
+    float **norm_1 = w.norm_1, **norm_2 = w.norm_2;
+    int qi, qj; // used when calculating derivatives in Fourier space
+    float root_ginv1, root_ginv2; // 1/sqrt(1+(grad z)^2) for the top and bottom monolayers
+
+
+    //----------------------------------------------------------------------------------------------
+    //CALCULATE NORMAL VECTORS//////////////////////////////////////////////////////////////////////
+    //----------------------------------------------------------------------------------------------
+
+    for(i=0; i<ngrid; i++){
+        for(j=0; j<ngrid; j++) {
+
+            w.z1_1D[i*ngrid+j]=w.z1[i][j];
+            w.z2_1D[i*ngrid+j]=w.z2[i][j];
+        }
+    }
+
+    NIH_PROFILE_LAP(w.times, PROF_NORMALS);
+    fftwf_execute_dft_r2c(spectrum_plan, w.z1_1D, w.z1qS);
+    fftwf_execute_dft_r2c(spectrum_plan, w.z2_1D, w.z2qS);
+    if(!deconv_.empty()){
+        deconvolve(w.z1qS);
+        deconvolve(w.z2qS);
+    }
+    NIH_PROFILE_LAP(w.times, PROF_FFT_NORMALS);
+
+    //set wave vector: (2\pi/L){0, 1,..., N/2-1, -N/2,..., -1}
+    //                  index: (0, 1,..., N/2-1,  N/2,... ,N-1}
+
+    fftwf_complex *z1qS = w.z1qS, *z2qS = w.z2qS;
+    for(i=0; i<ngrid; i++) {
+        for( j=0; j<ngrid/2+1; j++) {
+
+            qi=q[i][j][0];
+            qj=q[i][j][1];
+
+            k = i*(ngrid/2+1) + j;
+            // handle Nyquist element (aliased between -N/2 and N/2
+            // => set the N/2 term of the derivative to 0)
+
+            if(i==ngrid/2) {qi=0;}
+            if(j==ngrid/2) {qj=0;}
+
+            w.dz1xqS[k][0] = -qi*z1qS[k][1]*twoPiLx;    w.dz1xqS[k][1] =  qi*z1qS[k][0]*twoPiLx;
+            w.dz1yqS[k][0] = -qj*z1qS[k][1]*twoPiLy;    w.dz1yqS[k][1] =  qj*z1qS[k][0]*twoPiLy;
+            //
+            w.dz2xqS[k][0] = -qi*z2qS[k][1]*twoPiLx;    w.dz2xqS[k][1] =  qi*z2qS[k][0]*twoPiLx;
+            w.dz2yqS[k][0] = -qj*z2qS[k][1]*twoPiLy;    w.dz2yqS[k][1] =  qj*z2qS[k][0]*twoPiLy;
+        }
+    }
+
+    // backward transform to get derivatives in real space
+    NIH_PROFILE_LAP(w.times, PROF_NORMALS);
+    fftwf_execute_dft_c2r(inv_plan, w.dz1xqS, dz1x1D);
+    fftwf_execute_dft_c2r(inv_plan, w.dz1yqS, dz1y1D);
+    fftwf_execute_dft_c2r(inv_plan, w.dz2xqS, dz2x1D);
+    fftwf_execute_dft_c2r(inv_plan, w.dz2yqS, dz2y1D);
+    NIH_PROFILE_LAP(w.times, PROF_FFT_NORMALS);
+
+    // normalize: f = (1/L) Sum f_q exp(iq.r)
+    for(i=0; i<ngrid; i++) {
+        for(j=0; j<ngrid; j++) {
+
+            k = i*ngrid + j;
+
+            dz1x1D[k] *= invLx; dz1y1D[k] *= invLy;
+            dz2x1D[k] *= invLx; dz2y1D[k] *= invLy;
+
+            // calctilt = 1.0 for tilt calc, 0.0 for unnormalized surface normal
+            if ( calctilt > 0.0 ) {
+               root_ginv1=1.0/sqrt(1.0 + dz1x1D[k]*dz1x1D[k] + dz1y1D[k]*dz1y1D[k]);
+               root_ginv2=1.0/sqrt(1.0 + dz2x1D[k]*dz2x1D[k] + dz2y1D[k]*dz2y1D[k]);
+               }
+            else {
+               root_ginv1=1.0;
+               root_ginv2=1.0;
+               }
+
+            norm_1[k][0]= dz1x1D[k]*root_ginv1;
+            norm_1[k][1]= dz1y1D[k]*root_ginv1;
+            norm_1[k][2]= -root_ginv1;
+
+            norm_2[k][0]= -dz2x1D[k]*root_ginv2;
+            norm_2[k][1]= -dz2y1D[k]*root_ginv2; // signs are reversed
+            norm_2[k][2]= root_ginv2;
+        }
+
+    }
+}
+
+
+/**
+ * @brief Averages the tilt and director sums over each patch and interpolates the empty patches from their
+ * neighbours, weighted by what is in them: the lipids (int) or the weights of their clouds (float)
+ */
+template <typename T>
+static void average_tilt(FrameWorkspace &w, T **nlt1, T **nlt2)
+{
+    int i, j, k;
+    int ngrid = w.ngrid;
+    float ***t1 = w.t1, ***t2 = w.t2, ***n1 = w.n1, ***n2 = w.n2;
+    int i1, i2, j1, j2;
+    float nn; // 1.0/(the total number of lipids in the neighboring patches)
+
+    //average over each patch
+    for(i=0; i<ngrid; i++) {
+        for(j=0; j<ngrid; j++) {
+
+            if(nlt1[i][j]>0) {t1[i][j][0] /= nlt1[i][j]; t1[i][j][1] /= nlt1[i][j];
+                n1[i][j][0] /= nlt1[i][j]; n1[i][j][1] /= nlt1[i][j];}
+
+            if(nlt2[i][j]>0) {t2[i][j][0] /= nlt2[i][j]; t2[i][j][1] /= nlt2[i][j];
+                n2[i][j][0] /= nlt2[i][j]; n2[i][j][1] /= nlt2[i][j];}
+        }
+    }
+
+
+    ///////////  if a patch is empty, interpolate
+    for(i=0; i<ngrid; i++){
+        for(j=0; j<ngrid; j++){
+
+            i1 = ((i>0) ? (i-1) : (ngrid-1));  i2 = ((i<ngrid-1) ? (i+1) : 0); // periodic boundaries
+            j1 = ((j>0) ? (j-1) : (ngrid-1));  j2 = ((j<ngrid-1) ? (j+1) : 0);
+
+            for(k=0; k<2; k++){ //  loop over {0,1}
+
+                if(nlt1[i][j]==0){
+                    nn= 1.0/(nlt1[i][j1] + nlt1[i][j2] + nlt1[i1][j] + nlt1[i2][j]);
+
+                    t1[i][j][k] = (nlt1[i][j1]*t1[i][j1][k] + nlt1[i][j2]*t1[i][j2][k]
+                                   + nlt1[i1][j]*t1[i1][j][k] + nlt1[i2][j]*t1[i2][j][k])*nn;
+
+                    n1[i][j][k] = (nlt1[i][j1]*n1[i][j1][k] + nlt1[i][j2]*n1[i][j2][k]
+                                   + nlt1[i1][j]*n1[i1][j][k] + nlt1[i2][j]*n1[i2][j][k])*nn;
+                }
+
+                if(nlt2[i][j]==0){
+                    nn= 1.0/(nlt2[i][j1] + nlt2[i][j2] + nlt2[i1][j] + nlt2[i2][j]);
+
+                    t2[i][j][k] = (nlt2[i][j1]*t2[i][j1][k] + nlt2[i][j2]*t2[i][j2][k]
+                                   + nlt2[i1][j]*t2[i1][j][k] + nlt2[i2][j]*t2[i2][j][k])*nn;
+
+                    n2[i][j][k] = (nlt2[i][j1]*n2[i][j1][k] + nlt2[i][j2]*n2[i][j2][k]
+                                   + nlt2[i1][j]*n2[i1][j][k] + nlt2[i2][j]*n2[i2][j][k])*nn;
+                }
+
+            }
+        } // interpolation
+    }  	// loops
+}
+
+
+void SpectrumAnalyzer::tilt_fields(FrameWorkspace &w) const
+{
+    int i, j, k;
+    int nl = w.nl;
+    float **dir = w.dir;
+    float ***t1 = w.t1, ***t2 = w.t2, ***n1 = w.n1, ***n2 = w.n2;
+    int **nlt1 = w.nlt1, **nlt2 = w.nlt2;
+    float **norm_1 = w.norm_1, **norm_2 = w.norm_2;
+    int xi, yi;
+    float dot1, dot2; // (n.N)
+    float t1mol[3], t2mol[3]; //the tilt vector of an individual lipid
+    float tmag;
+    float calctilt = config_.calctilt;
+
+    w.nt1=0;	w.nt2=0;
+    w.dot_frame=0;
+    memset(w.tmag_hist, 0, sizeof(w.tmag_hist));
+    if(w.reduced)
+        reduced_tilt(w);
+    else{
+        for(j=0; j<ngrid; j++){
+            for(k=0; k<ngrid; k++){
+                nlt1[j][k]=0;		nlt2[j][k]=0;
+                t1[j][k][0]=0;		t1[j][k][1]=0;		t1[j][k][2]=0;
+                t2[j][k][0]=0;		t2[j][k][1]=0;		t2[j][k][2]=0;
+                n1[j][k][0]=0;		n1[j][k][1]=0;
+                n2[j][k][0]=0;		n2[j][k][1]=0;
+            }
+        }
+
+
+        //----------------------------------------------------------------------------------------------
+        //CALCULATE TILT VECTORS////////////////////////////////////////////////////////////////////////////
+        //----------------------------------------------------------------------------------------------
+
+        for(i=0; i<nl; i++) {
+
+            xi= w.xj[i];
+            yi= w.yj[i];
+
+            k = xi*ngrid + yi;
+
+            // tilt vector m = n/(n.N) - N
+
+            if(dir[i][2] < 0) { // upper monolayer
+
+                dot1=dir[i][0]*norm_1[k][0] + dir[i][1]*norm_1[k][1] + dir[i][2]*norm_1[k][2];
+
+                w.dot_frame += dot1;
+
+                nlt1[xi][yi]++;
+                w.nt1++;
+                //accumulate
+
+                for(j=0; j<3; j++){
+
+                    t1mol[j]=dir[i][j]*calctilt - norm_1[k][j]; //no denom; calctilt is 1 for tilt, 0 for normal
+
+                    t1[xi][yi][j] += t1mol[j];
+                }
+
+                n1[xi][yi][0] += dir[i][0];
+                n1[xi][yi][1] += dir[i][1];
+
+                tmag=t1mol[0]*t1mol[0] + t1mol[1]*t1mol[1] + t1mol[2]*t1mol[2];
+
+                if(sqrt(tmag)<1){
+                    w.tmag_hist[ (int)floor(100*abs(sqrt(tmag))) ]++;
+                }
+
+            }
+
+
+            if(dir[i][2] > 0) { // lower monolayer
+
+                dot2=dir[i][0]*norm_2[k][0] + dir[i][1]*norm_2[k][1] + dir[i][2]*norm_2[k][2];
+
+                w.dot_frame += dot2;
+
+                nlt2[xi][yi]++;
+                w.nt2++;
+                //accumulate
+
+                for(j=0; j<3; j++){
+
+                    t2mol[j]=dir[i][j]*calctilt - norm_2[k][j]; // no denom
+
+                    t2[xi][yi][j] += t2mol[j];
+                }
+
+                n2[xi][yi][0] += dir[i][0];
+                n2[xi][yi][1] += dir[i][1];
+            }
+
+        } // nl loop
+    }
+
+    // with CIC or TSC the counts stay those of the patch each lipid is in, and the fields become the averages
+    // of the clouds
+    if(!w.reduced && config_.assign != ASSIGN_NGP){
+        assign_tilt(w);
+        average_tilt(w, w.wt1, w.wt2);
+    }
+    else
+        average_tilt(w, nlt1, nlt2);
+
+    for(i=0; i<ngrid; i++) {
+        for(j=0; j<ngrid; j++) {
+
+            w.dp[i][j][0] = t1[i][j][0] + t2[i][j][0]; // m1 + m2
+            w.dp[i][j][1] = t1[i][j][1] + t2[i][j][1];
+            w.dm[i][j][0] = t1[i][j][0] - t2[i][j][0]; // m1 - m2
+            w.dm[i][j][1] = t1[i][j][1] - t2[i][j][1]; // factors of two are added at the end
+
+            w.up[i][j][0] = n1[i][j][0] + n2[i][j][0];
+            w.up[i][j][1] = n1[i][j][1] + n2[i][j][1];
+            w.um[i][j][0] = n1[i][j][0] - n2[i][j][0];
+            w.um[i][j][1] = n1[i][j][1] - n2[i][j][1]; // factors of two are added at the end
+        }
+    }
+}
+
+
+/**
+ * @brief The sums of tilt_fields() from the director sums of a reduced grid.  The normal is the same for every
+ * lipid of a patch, so the tilts of a patch sum to calctilt*(the directors) - (the lipids)*N, and their (n.N)
+ * to (the directors).N.  The tilt magnitude of each lipid is not known, so its histogram is left empty.
+ */
+void SpectrumAnalyzer::reduced_tilt(FrameWorkspace &w) const
+{
+    int i, j, c;
+    float calctilt = config_.calctilt;
+
+    for(i=0; i<ngrid; i++){
+        for(j=0; j<ngrid; j++){
+            const float *norm1 = w.norm_1[i*ngrid+j], *norm2 = w.norm_2[i*ngrid+j];
+            const float *dsum1 = w.dsum1[i][j], *dsum2 = w.dsum2[i][j];
+
+            // every lipid of the monolayer, within the cutoff or not
+            w.nlt1[i][j] = w.nlg1[i][j] + w.nlb1[i][j];
+            w.nlt2[i][j] = w.nlg2[i][j] + w.nlb2[i][j];
+            w.nt1 += w.nlt1[i][j];
+            w.nt2 += w.nlt2[i][j];
+            w.dot_frame += dsum1[0]*norm1[0] + dsum1[1]*norm1[1] + dsum1[2]*norm1[2];
+            w.dot_frame += dsum2[0]*norm2[0] + dsum2[1]*norm2[1] + dsum2[2]*norm2[2];
+
+            for(c=0; c<3; c++){
+                w.t1[i][j][c] = dsum1[c]*calctilt - w.nlt1[i][j]*norm1[c];
+                w.t2[i][j][c] = dsum2[c]*calctilt - w.nlt2[i][j]*norm2[c];
+            }
+            for(c=0; c<2; c++){
+                w.n1[i][j][c] = dsum1[c];
+                w.n2[i][j][c] = dsum2[c];
+            }
+        }
+    }
+}
+
+
+void SpectrumAnalyzer::assign_tilt(FrameWorkspace &w) const
+{
+    int i, j, a, b, c;
+    int order = (config_.assign == ASSIGN_TSC ? 3 : 2);
+    float calctilt = config_.calctilt;
+
+    for(i=0; i<ngrid; i++){
+        for(j=0; j<ngrid; j++){
+            for(c=0; c<3; c++){
+                w.t1[i][j][c]=0;	w.t2[i][j][c]=0;
+            }
+            w.n1[i][j][0]=0;	w.n1[i][j][1]=0;
+            w.n2[i][j][0]=0;	w.n2[i][j][1]=0;
+            w.wt1[i][j]=0;	w.wt2[i][j]=0;
+        }
+    }
+
+    // the tilt of each lipid against the normal of the patch it is in, spread over its cloud
+    for(i=0; i<w.nl; i++){
+        const float *dir = w.dir[i];
+        if(dir[2] == 0)
+            continue;
+        bool upper = dir[2] < 0;
+        const float *norm = (upper ? w.norm_1 : w.norm_2)[w.xj[i]*ngrid + w.yj[i]];
+        float ***t = (upper ? w.t1 : w.t2), ***n = (upper ? w.n1 : w.n2);
+        float **wt = (upper ? w.wt1 : w.wt2);
+        float tmol[3];
+        for(c=0; c<3; c++)
+            tmol[c] = dir[c]*calctilt - norm[c];
+
+        for(a=0; a<order; a++){
+            int x = w.sx[a][i];
+            for(b=0; b<order; b++){
+                int y = w.sy[b][i];
+                float f = w.wx[a][i]*w.wy[b][i];
+                for(c=0; c<3; c++)
+                    t[x][y][c] += f*tmol[c];
+                n[x][y][0] += f*dir[0];
+                n[x][y][1] += f*dir[1];
+                wt[x][y] += f;
+            }
+        }
+    }
+}
+
+
+void SpectrumAnalyzer::deconvolve(fftwf_complex *f) const
+{
+    const float *d = &deconv_[0];
+    for(int i=0; i<ngridpair; i++){
+        f[i][0] *= d[i];
+        f[i][1] *= d[i];
+    }
+}
+
+
+void SpectrumAnalyzer::forward_transforms(FrameWorkspace &w) const
+{
+    int i, j;
+    int TILT = config_.tilt;
+
+    //----------------------------------------------------------------------------------------------
+    //FOURIER TRANSFORMS////////////////////////////////////////////////////////////////////////////
+    //----------------------------------------------------------------------------------------------
+
+    for(i=0; i<ngrid; i++){
+        for(j=0; j<ngrid; j++) {
+
+            w.h1D[i*ngrid+j]=w.h[i][j];
+            w.t1D[i*ngrid+j]=w.t[i][j];
+
+            if(TILT){
+
+                w.t1x1D[i*ngrid+j]=w.t1[i][j][0];
+                w.t1y1D[i*ngrid+j]=w.t1[i][j][1];
+
+                w.dpx1D[i*ngrid+j]=w.dp[i][j][0];
+                w.dpy1D[i*ngrid+j]=w.dp[i][j][1];
+                w.dmx1D[i*ngrid+j]=w.dm[i][j][0];
+                w.dmy1D[i*ngrid+j]=w.dm[i][j][1];
+
+                w.upx1D[i*ngrid+j]=w.up[i][j][0];
+                w.upy1D[i*ngrid+j]=w.up[i][j][1];
+                w.umx1D[i*ngrid+j]=w.um[i][j][0];
+                w.umy1D[i*ngrid+j]=w.um[i][j][1];}
+        }
+    }
+
+    fftwf_execute_dft_r2c(spectrum_plan, w.h1D, w.hqS);
+    fftwf_execute_dft_r2c(spectrum_plan, w.t1D, w.tqS);
+
+    if(TILT){
+        fftwf_execute_dft_r2c(spectrum_plan, w.t1x1D, w.t1xqS);
+        fftwf_execute_dft_r2c(spectrum_plan, w.t1y1D, w.t1yqS);
+
+        fftwf_execute_dft_r2c(spectrum_plan, w.dpx1D, w.dpxqS);
+        fftwf_execute_dft_r2c(spectrum_plan, w.dpy1D, w.dpyqS);
+        fftwf_execute_dft_r2c(spectrum_plan, w.dmx1D, w.dmxqS);
+        fftwf_execute_dft_r2c(spectrum_plan, w.dmy1D, w.dmyqS);
+
+        fftwf_execute_dft_r2c(spectrum_plan, w.upx1D, w.upxqS);
+        fftwf_execute_dft_r2c(spectrum_plan, w.upy1D, w.upyqS);
+        fftwf_execute_dft_r2c(spectrum_plan, w.umx1D, w.umxqS);
+        fftwf_execute_dft_r2c(spectrum_plan, w.umy1D, w.umyqS);
+    }
+
+    if(!deconv_.empty()){
+        fftwf_complex *fields[] = { w.hqS, w.tqS, w.t1xqS, w.t1yqS, w.dpxqS, w.dpyqS, w.dmxqS, w.dmyqS,
+                                    w.upxqS, w.upyqS, w.umxqS, w.umyqS };
+        for(int f=0; f<(TILT ? 12 : 2); f++)
+            deconvolve(fields[f]);
+    }
+}
+
+
+void SpectrumAnalyzer::full_arrays(FrameWorkspace &w) const
+{
+    int i, j;
+    float Lxy=sqrt(w.box.lx*w.box.ly);
+
+    fullArray(w.hqR,w.hqI,w.hqS,Lxy); // multiply by lx/N^2 factor inside
+    fullArray(w.tqR,w.tqI,w.tqS,Lxy);
+
+    if(config_.area){ // similar to 'fullArray,' use h_{-q}=h*_q to fill in the lower half of the complex plane
+
+        for(i=1; i<ngrid/2; i++){
+            for(j=0; j<ngrid; j++){
+
+                w.psiRU[ngrid-i][j]=w.psiRU[i][j];		w.psiIU[ngrid-i][j]= -w.psiIU[i][j];
+                w.psiRD[ngrid-i][j]=w.psiRD[i][j];		w.psiID[ngrid-i][j]= -w.psiID[i][j];
+                w.h_real[ngrid-i][j]=w.h_real[i][j];		w.h_imag[ngrid-i][j]=w.h_imag[i][j];
+            }
+        }
+    } // if(config_.area)
+
+    if(config_.tilt){
+        fullArray(w.t1xR,w.t1xI,w.t1xqS,Lxy);
+        fullArray(w.t1yR,w.t1yI,w.t1yqS,Lxy);
+
+        fullArray(w.dpxR,w.dpxI,w.dpxqS,Lxy);
+        fullArray(w.dpyR,w.dpyI,w.dpyqS,Lxy);
+        fullArray(w.dmxR,w.dmxI,w.dmxqS,Lxy);
+        fullArray(w.dmyR,w.dmyI,w.dmyqS,Lxy);
+
+        fullArray(w.upxR,w.upxI,w.upxqS,Lxy);
+        fullArray(w.upyR,w.upyI,w.upyqS,Lxy);
+        fullArray(w.umxR,w.umxI,w.umxqS,Lxy);
+        fullArray(w.umyR,w.umyI,w.umyqS,Lxy);
+    }
+}
+
+
+void SpectrumAnalyzer::decompose(FrameWorkspace &w) const
+{
+    int i, j;
+
+    ////// decompose into parallel and perpendicular components
+
+    for(i=0; i<ngrid; i++){
+        for(j=0; j<ngrid; j++){
+
+            if(i==0 && j==0){ // the perp and par components are not defined at q=0
+
+                w.dmparR[i][j] = 0.0; w.dmperR[i][j] = 0.0;
+                w.dpparR[i][j] = 0.0; w.dpperR[i][j] = 0.0;
+                w.dmparI[i][j] = 0.0; w.dmperI[i][j] = 0.0;
+                w.dpparI[i][j] = 0.0; w.dpperI[i][j] = 0.0;
+
+                w.umparR[i][j] = 0.0; w.umperR[i][j] = 0.0;
+                w.upparR[i][j] = 0.0; w.upperR[i][j] = 0.0;
+                w.umparI[i][j] = 0.0; w.umperI[i][j] = 0.0;
+                w.upparI[i][j] = 0.0; w.upperI[i][j] = 0.0;
+            }
+            else{
+                w.dmparR[i][j]=  w.dmxR[i][j]*cosq[i][j] + w.dmyR[i][j]*sinq[i][j];
+                w.dmperR[i][j]= -w.dmxR[i][j]*sinq[i][j] + w.dmyR[i][j]*cosq[i][j];
+                w.dmparI[i][j]=  w.dmxI[i][j]*cosq[i][j] + w.dmyI[i][j]*sinq[i][j];
+                w.dmperI[i][j]= -w.dmxI[i][j]*sinq[i][j] + w.dmyI[i][j]*cosq[i][j];
+
+                w.dpparR[i][j]=  w.dpxR[i][j]*cosq[i][j] + w.dpyR[i][j]*sinq[i][j];
+                w.dpperR[i][j]= -w.dpxR[i][j]*sinq[i][j] + w.dpyR[i][j]*cosq[i][j];
+                w.dpparI[i][j]=  w.dpxI[i][j]*cosq[i][j] + w.dpyI[i][j]*sinq[i][j];
+                w.dpperI[i][j]= -w.dpxI[i][j]*sinq[i][j] + w.dpyI[i][j]*cosq[i][j];
+
+                w.umparR[i][j]=  w.umxR[i][j]*cosq[i][j] + w.umyR[i][j]*sinq[i][j];
+                w.umperR[i][j]= -w.umxR[i][j]*sinq[i][j] + w.umyR[i][j]*cosq[i][j];
+                w.umparI[i][j]=  w.umxI[i][j]*cosq[i][j] + w.umyI[i][j]*sinq[i][j];
+                w.umperI[i][j]= -w.umxI[i][j]*sinq[i][j] + w.umyI[i][j]*cosq[i][j];
+
+                w.upparR[i][j]=  w.upxR[i][j]*cosq[i][j] + w.upyR[i][j]*sinq[i][j];
+                w.upperR[i][j]= -w.upxR[i][j]*sinq[i][j] + w.upyR[i][j]*cosq[i][j];
+                w.upparI[i][j]=  w.upxI[i][j]*cosq[i][j] + w.upyI[i][j]*sinq[i][j];
+                w.upperI[i][j]= -w.upxI[i][j]*sinq[i][j] + w.upyI[i][j]*cosq[i][j];
+            }
+        }
+    }
+}
+
+
+void SpectrumAnalyzer::power(FrameWorkspace &w) const
+{
+    int i, j;
+    int TILT = config_.tilt, AREA = config_.area;
+
+    float ***fq2 = w.fq2;
+    for(i=0; i<ngrid; i++){
+        for(j=0; j<ngrid; j++){
+
+            fq2[OBS_HQ2][i][j] = w.hqR[i][j]*w.hqR[i][j] + w.hqI[i][j]*w.hqI[i][j];
+            fq2[OBS_TQ2][i][j] = w.tqR[i][j]*w.tqR[i][j] + w.tqI[i][j]*w.tqI[i][j];
+
+            if(TILT){
+
+                fq2[OBS_T1XQ2][i][j] = w.t1xR[i][j]*w.t1xR[i][j] + w.t1xI[i][j]*w.t1xI[i][j];
+                fq2[OBS_T1YQ2][i][j] = w.t1yR[i][j]*w.t1yR[i][j] + w.t1yI[i][j]*w.t1yI[i][j];
+
+                fq2[OBS_DPQ2][i][j] = w.dpxR[i][j]*w.dpxR[i][j] + w.dpxI[i][j]*w.dpxI[i][j] + w.dpyR[i][j]*w.dpyR[i][j] + w.dpyI[i][j]*w.dpyI[i][j];
+                fq2[OBS_DMQ2][i][j] = w.dmxR[i][j]*w.dmxR[i][j] + w.dmxI[i][j]*w.dmxI[i][j] + w.dmyR[i][j]*w.dmyR[i][j] + w.dmyI[i][j]*w.dmyI[i][j];
+
+                fq2[OBS_DPPARQ2][i][j] = w.dpparR[i][j]*w.dpparR[i][j] + w.dpparI[i][j]*w.dpparI[i][j];
+                fq2[OBS_DPPERQ2][i][j] = w.dpperR[i][j]*w.dpperR[i][j] + w.dpperI[i][j]*w.dpperI[i][j];
+
+                fq2[OBS_DMPARQ2][i][j] = w.dmparR[i][j]*w.dmparR[i][j] + w.dmparI[i][j]*w.dmparI[i][j];
+                fq2[OBS_DMPERQ2][i][j] = w.dmperR[i][j]*w.dmperR[i][j] + w.dmperI[i][j]*w.dmperI[i][j];
+
+                fq2[OBS_HDMPAR][i][j] = -w.dmparI[i][j]*w.hqR[i][j] + w.dmparR[i][j]*w.hqI[i][j];
+                fq2[OBS_TDPPAR][i][j] = -w.dpparI[i][j]*w.tqR[i][j] + w.dpparR[i][j]*w.tqI[i][j];
+
+                // these are the imaginary components of the cross correlations
+                // I checked that the real parts are virtually zero
+
+                fq2[OBS_UPPARQ2][i][j] = w.upparR[i][j]*w.upparR[i][j] + w.upparI[i][j]*w.upparI[i][j];
+                fq2[OBS_UPPERQ2][i][j] = w.upperR[i][j]*w.upperR[i][j] + w.upperI[i][j]*w.upperI[i][j];
+
+                fq2[OBS_UMPARQ2][i][j] = w.umparR[i][j]*w.umparR[i][j] + w.umparI[i][j]*w.umparI[i][j];
+                fq2[OBS_UMPERQ2][i][j] = w.umperR[i][j]*w.umperR[i][j] + w.umperI[i][j]*w.umperI[i][j];
+
+                fq2[OBS_DUM_PAR][i][j] = w.dmparR[i][j]*w.umparR[i][j] + w.dmparI[i][j]*w.umparI[i][j];
+                fq2[OBS_DUP_PAR][i][j] = w.dpparR[i][j]*w.upparR[i][j] + w.dpparI[i][j]*w.upparI[i][j];
+                // real parts
+
+            }
+
+            if(AREA){
+                float **psiRU = w.psiRU, **psiIU = w.psiIU, **psiRD = w.psiRD, **psiID = w.psiID;
+
+                fq2[OBS_RHOSIGQ2][i][j] = (psiRD[i][j]+psiRU[i][j])*(psiRD[i][j]+psiRU[i][j]) + (psiID[i][j]+psiIU[i][j])*(psiID[i][j]+psiIU[i][j]);
+                fq2[OBS_RHODELQ2][i][j] = (psiRD[i][j]-psiRU[i][j])*(psiRD[i][j]-psiRU[i][j]) + (psiID[i][j]-psiIU[i][j])*(psiID[i][j]-psiIU[i][j]);
+            }
+
+        }
+    }
+}
+
+
+//---------------------------------------------------------------------------------------------------------------
+//ACCUMULATE SPECTRA//////////////////////////////////////////////////////////////////////////////////
+//---------------------------------------------------------------------------------------------------------------
+
+void SpectrumAnalyzer::accumulate(FrameWorkspace &w)
+{
+    int i, j, k;
+    int TILT = config_.tilt, AREA = config_.area;
+    float **fq2_uniq = w.fq2_uniq;
+
+    NIH_PROFILE_START(w.times);
+    nlipids_ += w.nl;
+    lx_sum_ += w.box.lx;
+    ly_sum_ += w.box.ly;
+    nswu += w.nswu;
+    nswd += w.nswd;
+    empty_tot += w.empty;
+    phi0 += w.phi0_frame;
+    z1sq_av += w.z1sq_av_frame;
+    z2sq_av += w.z2sq_av_frame;
+    t0 += w.t0_frame;
+    tq0 += w.tq0_frame;
+
+    if(TILT){
+        dot_cum += w.dot_frame;
+        for(i=0; i<100; i++){ty_cum[i] += w.tmag_hist[i];}
+
+        for(i=0; i<ngrid; i++) {
+            for(j=0; j<ngrid; j++) {
+
+                // accumulate real space orientations
+                t1xR_cum[i][j] += w.nlg1[i][j];
+                t1xI_cum[i][j] += w.nlg2[i][j];
+                t1yR_cum[i][j] += w.n1[i][j][0] - w.n2[i][j][0];
+                t1yI_cum[i][j] += w.n1[i][j][1] - w.n2[i][j][1];
+            }
+        }
+    }
+
+    if(AREA){
+        for(i=0; i<ngrid; i++){
+            for(j=0; j<ngrid; j++){
+                hq2Ed[i][j] += (w.h_real[i][j])*(w.h_real[i][j]) + (w.h_imag[i][j])*(w.h_imag[i][j]);
+            }
+        }
+    }
+
+    struct timespec accum_start, accum_end;
+    clock_gettime(CLOCK_MONOTONIC, &accum_start);
+    for(k=0; k<NOBS; k++){
+        if(enabled(k)) obs_sums->add(k, w.fq2[k][0]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &accum_end);
+    accum_time += (accum_end.tv_sec - accum_start.tv_sec) + 1e-9*(accum_end.tv_nsec - accum_start.tv_nsec);
+
+    // average snapshot to 1D and store; note scaling (400, 40000)
+    for(k=0; k<NOBS; k++){
+        if(!enabled(k)) continue;
+        memset(fq2_uniq[k], 0, uniq_Ny*sizeof(float));
+        qav(w.fq2[k], fq2_uniq[k], 0);
+    }
+    if(config_.keep_series || config_.acf){
+        int nseries = (TILT ? NSERIES : 1);
+        vector<float> row(NSERIES*uniq_Ny);
+        for(i=0;i<uniq_Ny; i++)
+            row[SERIES_HQ2*uniq_Ny+i] = fq2_uniq[OBS_HQ2][i]/40000;
+        if(TILT){
+            for(i=0;i<uniq_Ny; i++){
+                row[SERIES_UMPARQ2*uniq_Ny+i] = fq2_uniq[OBS_UMPARQ2][i]/400;
+                row[SERIES_UMPERQ2*uniq_Ny+i] = fq2_uniq[OBS_UMPERQ2][i]/400;
+            }
+        }
+        for(int s=0; s<NSERIES; s++){
+            if(config_.keep_series)
+                series_[s].insert(series_[s].end(), row.begin()+s*uniq_Ny, row.begin()+(s+1)*uniq_Ny);
+            if(config_.acf && s<nseries){
+                for(i=0;i<uniq_Ny; i++)
+                    acf_[s][i].add(row[s*uniq_Ny+i]);
+            }
+        }
+    }
+
+    // use the same q=0 values as the printed averages, and feed the block averaging
+    fq2_uniq[OBS_TQ2][0] = w.tq0_frame/((float) ngrid*ngrid*ngrid*ngrid);
+    if(TILT){
+        fq2_uniq[OBS_DPPARQ2][0] = fq2_uniq[OBS_DPPERQ2][0] = 0.5*fq2_uniq[OBS_DPQ2][0];
+        fq2_uniq[OBS_DMPARQ2][0] = fq2_uniq[OBS_DMPERQ2][0] = 0.5*fq2_uniq[OBS_DMQ2][0];
+        fq2_uniq[OBS_UMPARQ2][0] = fq2_uniq[OBS_UMPERQ2][0] = 0.5*fq2_uniq[OBS_DMQ2][0];
+        fq2_uniq[OBS_UPPARQ2][0] = fq2_uniq[OBS_UPPERQ2][0] = 0.5*fq2_uniq[OBS_DPQ2][0];
+        fq2_uniq[OBS_DUM_PAR][0] *= 0.5;
+        fq2_uniq[OBS_DUP_PAR][0] *= 0.5;
+    }
+    for(k=0; k<NOBS; k++){
+        if(!enabled(k)) continue;
+        for(i=0;i<uniq_Ny; i++)
+            obs_blocks[k*uniq_Ny+i].add(fq2_uniq[k][i]/obs_scale[k]);
+    }
+
+    // add this frame to the sliding window, dropping the oldest
+    if(window_)
+        window_->push(fq2_uniq[0]);
+
+    info_.box = w.box;
+    info_.zavg = w.zavg;
+    info_.z1avg = w.z1avg/w.nl1;
+    info_.z2avg = w.z2avg/w.nl2;
+    info_.t0 = w.t0_frame;
+    info_.nt1 = (TILT ? w.nt1 : 0);
+    info_.nt2 = (TILT ? w.nt2 : 0);
+    info_.nl1 = w.nl1;
+    info_.nl2 = w.nl2;
+    info_.empty = w.empty;
+    info_.nswu = w.nswu;
+    info_.nswd = w.nswd;
+    info_.out_of_range = w.out_of_range;
+
+    nframes_++;
+    NIH_PROFILE_LAP(w.times, PROF_ACCUMULATE);
+    info_.times = w.times;
+}
+
+
+//---------------------------------------------------------------------------------------------------------------
+//RESULTS//////////////////////////////////////////////////////////////////////////////////
+//---------------------------------------------------------------------------------------------------------------
+
+SpectrumResult SpectrumAnalyzer::snapshot() const
+{
+    int i, k;
+    int n = (nframes_ > 0 ? nframes_ : 1); // with no frames every sum is 0, and so is every average
+    float phi0in = config_.phi0in;
+    SpectrumResult res;
+
+    res.nframes = nframes_;
+    res.ngrid = ngrid;
+    res.uniq = uniq;
+    res.uniq_Ny = uniq_Ny;
+    res.lx_av = average_lx();
+    res.ly_av = average_ly();
+    res.q.resize(uniq);
+    res.q_Ny.resize(uniq_Ny);
+    qvalues(res.lx_av, &res.q[0], 1);
+    qvalues(res.lx_av, &res.q_Ny[0], 0);
+
+    // q average the sums, using the same q=0 values as the block averaging in accumulate()
+    float **sum2d = init_matrix<float>(ngrid, ngrid);
+    float **uq = init_matrix<float>(NOBS, uniq);
+    for(k=0; k<NOBS; k++){
+        if(!enabled(k)) continue;
+        obs_sums->get(k, sum2d[0]);
+        qav(sum2d, uq[k], 0);
+    }
+
+    uq[OBS_TQ2][0]=tq0.value()/((float) ngrid*ngrid*ngrid*ngrid);
+    if(config_.tilt){
+        uq[OBS_DPPARQ2][0] = 0.5*uq[OBS_DPQ2][0];
+        uq[OBS_DPPERQ2][0] = 0.5*uq[OBS_DPQ2][0];
+        uq[OBS_DMPARQ2][0] = 0.5*uq[OBS_DMQ2][0];
+        uq[OBS_DMPERQ2][0] = 0.5*uq[OBS_DMQ2][0];
+        uq[OBS_UMPARQ2][0] = 0.5*uq[OBS_DMQ2][0];
+        uq[OBS_UMPERQ2][0] = 0.5*uq[OBS_DMQ2][0];
+        uq[OBS_UPPARQ2][0] = 0.5*uq[OBS_DPQ2][0];
+        uq[OBS_UPPERQ2][0] = 0.5*uq[OBS_DPQ2][0];
+        uq[OBS_DUM_PAR][0] *= 0.5;
+        uq[OBS_DUP_PAR][0] *= 0.5;
+    }
+
+    // when printing results, divide by the number of frames analyzed, and divide by 4 for symmetric and antisymmetric quantities
+    for(k=0; k<NOBS; k++){
+        res.spectra[k].assign(uniq_Ny, 0.0f);
+        res.errors[k].assign(uniq_Ny, 0.0);
+        if(!enabled(k)) continue;
+        for(i=0; i<uniq_Ny; i++){
+            if(obs_group[k]==GROUP_AREA)
+                res.spectra[k][i] = uq[k][i]/400/n/phi0in/phi0in;
+            else
+                res.spectra[k][i] = uq[k][i]/obs_scale[k]/n;
+            res.errors[k][i] = obs_blocks[k*uniq_Ny+i].error();
+        }
+    }
+
+    if(config_.area){
+        float *hq2Ed_uniq = init_matrix<float>(uniq);
+        int nl = nlipids_/n;
+        qav(hq2Ed,hq2Ed_uniq,0);
+        res.hq2_edholm.assign(uniq_Ny, 0.0f);
+        for(i=0; nl>1 && i<uniq_Ny; i++){
+
+            float Srho=(nl/2)/phi0in/phi0in*(z1sq_av.value()+z2sq_av.value())/(2*n)*(uq[OBS_RHOSIGQ2][i]/4/n/(res.lx_av*res.ly_av)); // in Angstroms
+
+            res.hq2_edholm[i] = (hq2Ed_uniq[i]/(4*n*nl/2) -Srho)/(phi0.value()/n)/10000;
+        }
+        delete [] hq2Ed_uniq;
+
+        float *rho[2] = {NULL, NULL};
+        res.rhoSigq2.resize(ngrid*ngrid);
+        res.rhoDelq2.resize(ngrid*ngrid);
+        rho[0] = &res.rhoSigq2[0];
+        rho[1] = &res.rhoDelq2[0];
+        for(int s=0; s<2; s++){
+            obs_sums->get(OBS_RHOSIGQ2+s, sum2d[0]);
+            for(i=0; i<ngrid*ngrid; i++)
+                rho[s][i] = sum2d[0][i]/400/n/phi0in/phi0in;
+        }
+    }
+
+    free_matrix(sum2d);
+    free_matrix(uq);
+
+    if(config_.tilt){
+        res.lipids_up.resize(ngrid*ngrid);
+        res.lipids_down.resize(ngrid*ngrid);
+        res.umx.resize(ngrid*ngrid);
+        res.umy.resize(ngrid*ngrid);
+        for(i=0; i<ngrid*ngrid; i++){
+            res.lipids_up[i] = t1xR_cum[0][i]/n;
+            res.lipids_down[i] = t1xI_cum[0][i]/n;
+            res.umx[i] = t1yR_cum[0][i]/n;
+            res.umy[i] = t1yI_cum[0][i]/n;
+        }
+        res.tmag_hist.assign(ty_cum, ty_cum+100);
+    }
+
+    res.empty_tot = empty_tot;
+    res.nswu = nswu;
+    res.nswd = nswd;
+    res.z1sq_av = z1sq_av.value()/n;
+    res.z2sq_av = z2sq_av.value()/n;
+    res.phi0 = phi0.value()/n;
+    res.t0 = t0.value()/n;
+    res.nN = dot_cum.value()/((double) nlipids_);
+    res.accum_time = accum_time;
+    res.accum_bytes = obs_sums->bytes();
+    return res;
+}
+
+
+SpectrumResult SpectrumAnalyzer::finalize()
+{
+    finalized_ = true;
+    return snapshot();
+}
+
+
+bool SpectrumAnalyzer::merge(const SpectrumAnalyzer &later)
+{
+    const AnalyzerConfig &c = later.config_;
+    if(finalized_ || c.ngrid != config_.ngrid || c.cutang != config_.cutang || c.calctilt != config_.calctilt
+       || c.t0in != config_.t0in || c.phi0in != config_.phi0in || c.tilt != config_.tilt || c.area != config_.area
+       || c.area_tail != config_.area_tail || c.accum != config_.accum || c.assign != config_.assign
+       || c.lx_ref != config_.lx_ref || c.ly_ref != config_.ly_ref || c.keep_series != config_.keep_series
+       || config_.acf || c.acf || window_ || later.window_)
+        return false;
+    if(later.nframes_ == 0)
+        return true;
+
+    nlipids_ += later.nlipids_;
+    lx_sum_ += later.lx_sum_;
+    ly_sum_ += later.ly_sum_;
+    nswu += later.nswu;
+    nswd += later.nswd;
+    empty_tot += later.empty_tot;
+    phi0 += later.phi0.value();
+    z1sq_av += later.z1sq_av.value();
+    z2sq_av += later.z2sq_av.value();
+    t0 += later.t0.value();
+    tq0 += later.tq0.value();
+    dot_cum += later.dot_cum.value();
+    for(int i=0; i<100; i++){ty_cum[i] += later.ty_cum[i];}
+    for(int i=0; i<ngrid*ngrid; i++){
+        t1xR_cum[0][i] += later.t1xR_cum[0][i];
+        t1xI_cum[0][i] += later.t1xI_cum[0][i];
+        t1yR_cum[0][i] += later.t1yR_cum[0][i];
+        t1yI_cum[0][i] += later.t1yI_cum[0][i];
+        hq2Ed[0][i] += later.hq2Ed[0][i];
+    }
+
+    obs_sums->merge(*later.obs_sums);
+    for(size_t b=0; b<obs_blocks.size(); b++)
+        obs_blocks[b].merge(later.obs_blocks[b]);
+    accum_time += later.accum_time;
+    for(int s=0; s<NSERIES; s++)
+        series_[s].insert(series_[s].end(), later.series_[s].begin(), later.series_[s].end());
+
+    info_ = later.info_;
+    nframes_ += later.nframes_;
+    return true;
+}
+
+
+float SpectrumAnalyzer::average_lx() const
+{
+    if(config_.lx_ref > 0) return config_.lx_ref;
+    return (nframes_ ? lx_sum_/nframes_ : 0);
+}
+
+
+float SpectrumAnalyzer::average_ly() const
+{
+    if(config_.ly_ref > 0) return config_.ly_ref;
+    return (nframes_ ? ly_sum_/nframes_ : 0);
+}
+
+
+void SpectrumAnalyzer::qvalues(float lx, float *out, int Ny) const
+{
+    float **q2 = init_matrix<float>(ngrid, ngrid); // full matrix of the magnitude of q
+    for(int i=0; i<ngrid; i++){
+        for(int j=0; j<ngrid; j++){
+            q2[i][j]=(2*pi)*sqrt( pow(q[i][j][0]/lx,2) + pow(q[i][j][1]/lx,2));
+        }
+    }
+    memset(out, 0, (Ny ? uniq : uniq_Ny)*sizeof(float));
+    qav(q2, out, Ny);
+    free_matrix(q2);
+}
+
+
+void SpectrumAnalyzer::autocorrelation(int s, int bin, vector<double> &lags, vector<double> &acf) const
+{
+    if(acf_[s].empty()){
+        lags.clear();
+        acf.clear();
+        return;
+    }
+    acf_[s][bin].normalized(lags, acf);
+}
+
+
+void SpectrumAnalyzer::reset_autocorrelation()
+{
+    for(int s=0; s<NSERIES; s++){
+        if(!acf_[s].empty())
+            acf_[s].assign(uniq_Ny, MultiTauCorrelator());
+    }
+}
+
+
+void SpectrumAnalyzer::reserve_series(long frames)
+{
+    if(!config_.keep_series || frames <= 0)
+        return;
+    for(int s=0; s<NSERIES; s++)
+        series_[s].reserve((size_t) frames*uniq_Ny);
+}
+
+
+bool SpectrumAnalyzer::converged(double tol, const vector<int> &obs, int nbins) const
+{
+    for(size_t m=0; m<obs.size(); m++){
+        for(int i=0; i<nbins && i<uniq_Ny; i++){
+            const BlockAverager &blk = obs_blocks[obs[m]*uniq_Ny+i];
+            if(blk.mean() == 0) continue; // e.g. q=0 of the cross correlations
+            if(blk.error() > tol*fabs(blk.mean())) return false;
+        }
+    }
+    return true;
+}
+
+
+double SpectrumAnalyzer::inefficiency(const vector<int> &obs, int nbins) const
+{
+    double ineff = 0;
+    for(size_t m=0; m<obs.size(); m++){
+        for(int i=0; i<nbins && i<uniq_Ny; i++){
+            const BlockAverager &blk = obs_blocks[obs[m]*uniq_Ny+i];
+            if(blk.mean() == 0) continue;
+            if(ineff == 0 || blk.inefficiency() < ineff) ineff = blk.inefficiency();
+        }
+    }
+    return ineff;
+}
+
+
+bool SpectrumAnalyzer::window_ready() const
+{
+    return window_ && window_->full() && (nframes_ - window_->width()) % config_.window_step == 0;
+}
+
+
+void SpectrumAnalyzer::window_spectra(float *out) const
+{
+    int width = window_->width();
+    for(int k=0; k<NOBS; k++){
+        if(!enabled(k)) continue;
+        for(int i=0; i<uniq_Ny; i++)
+            *out++ = window_->sums()[k*uniq_Ny+i]/width/obs_scale[k];
+    }
+}
+
+
+int SpectrumAnalyzer::nspectra() const
+{
+    int nspec = 0;
+    for(int k=0; k<NOBS; k++){
+        if(enabled(k)) nspec++;
+    }
+    return nspec;
+}
+
+
+//---------------------------------------------------------------------------------------------------------------
+//DEFINE FUNCTIONS//////////////////////////////////////////////////////////////////////////////////
+//---------------------------------------------------------------------------------------------------------------
+
+void SpectrumAnalyzer::fullArray( float **array1R, float **array1I, fftwf_complex *array2, float lxy) const
+{ // filling the right half of the full array
+    // using the property h_{-q}=h*_{q}=h_{N-q}. This was checked against MATLAB
+    int a,b,c;
+
+    float factor=lxy/(ngrid*ngrid); // lx[frame_num]/N^2 prefactor allowing the FT to have the correct units
+
+    for(c=0; c<ngridpair; c++){
+        array2[c][0] *= factor;  array2[c][1] *= factor;
+    }
+
+    for(a=0; a<ngrid; a++){
+        for(b=0; b<ngrid; b++){
+
+
+            if(a==0){// top row
+                if(b <= ngrid/2){
+                    array1R[a][b]=array2[a*(ngrid/2+1) + b][0];
+                    array1I[a][b]=array2[a*(ngrid/2+1) + b][1];
+                }
+                else{array1R[a][b]=  array2[a*(ngrid/2+1) + (ngrid-b)][0];
+                    array1I[a][b]= -array2[a*(ngrid/2+1) + (ngrid-b)][1];
+                }
+            }
+
+            if(a !=0 && b==0){  // leftmost column
+                array1R[a][b]=array2[a*(ngrid/2+1) + b][0];
+                array1I[a][b]=array2[a*(ngrid/2+1) + b][1];
+            }
+
+            if(a>0 && b>0){ // rest of the array
+
+                if(b<=ngrid/2){ // b= 0...N/2 portion of block
+                    array1R[a][b]=array2[a*(ngrid/2+1) + b][0];
+                    array1I[a][b]=array2[a*(ngrid/2+1) + b][1];
+                }
+
+                else{ // b=N/2+1...N portion of block
+                    array1R[a][b]=  array2[(ngrid-a)*(ngrid/2+1) + (ngrid-b)][0];
+                    array1I[a][b]= -array2[(ngrid-a)*(ngrid/2+1) + (ngrid-b)][1];
+                }
+
+            }
+
+        } // two for loops
+    }
+
+
+} // end of function
+//////////////////////////////////////////////////////
+void SpectrumAnalyzer::init_qbins()
+// finds, once, which element of the q-averaged arrays each [ngrid][ngrid] Fourier component contributes to,
+// so that qav is a single pass over the array.  The unique values of |q| are enumerated in the same order as before:
+// pairs (a1,a2) with a1 <= a2, and (b1,b2) belongs to (a1,a2) when its |qx|,|qy| match them in either order
+{
+    int a1,a2,b1,b2;
+    int *maps[2];
+
+    qbin = new int[ngrid*ngrid];
+    qbin_Ny = new int[ngrid*ngrid];
+    maps[0] = qbin_Ny;
+    maps[1] = qbin;
+
+    for(int Ny=0; Ny<2; Ny++){
+
+        int nq = ngrid/2+Ny;
+        int **index = init_matrix<int>(nq, nq);
+        int count_out=0;
+
+        for(a1=0; a1<nq; a1++){
+            for(a2=a1; a2<nq; a2++){
+                index[a1][a2]=count_out;
+                index[a2][a1]=count_out;
+                count_out++;
+            }
+        }
+
+        if((Ny==0) && count_out != uniq_Ny){cout << "count_out != uniq_Ny " << count_out << " "<< uniq_Ny <<endl;}
+
+        for(b1=0; b1<ngrid; b1++){
+            for(b2=0; b2<ngrid; b2++){
+
+                a1=((b1 < ngrid/2) ? b1 : ngrid-b1); // |qx| and |qy|; the Nyquist value is ngrid/2
+                a2=((b2 < ngrid/2) ? b2 : ngrid-b2);
+
+                if(a1<nq && a2<nq){maps[Ny][b1*ngrid+b2]=index[a1][a2];}
+                else{maps[Ny][b1*ngrid+b2]=-1;} // toss Nyquist values
+            }
+        }
+
+        free_matrix(index);
+    }
+}
+//////////////////////////////////////////////////////
+void SpectrumAnalyzer::qav(float **array2D, float *array1D_uniq, int Ny) const
+// takes the full 2D Fourier transform array
+// and averages the components which have the same magnitude of q
+// the argument array1D_uniq should be initialized to zero
+// after this function is called, array1D_uniq will contain
+// the values in array2D averaged over each value of q
+// when array2D is of dimension NxN, array1D is of [1][(N+4)*(N+2)/8]
+{
+    int b1,b2,c;
+    int *map = (Ny ? qbin : qbin_Ny);
+    int nout = (Ny ? uniq : uniq_Ny);
+
+    int *count_in = (int *) calloc(nout,sizeof(int)); // the arrays are initialized to zero
+
+    for(b1=0; b1<ngrid; b1++){
+        for(b2=0; b2<ngrid; b2++){
+
+            c=map[b1*ngrid+b2];
+            if(c<0) continue;
+
+            array1D_uniq[c] += array2D[b1][b2];
+            count_in[c]++;
+        }
+    }
+
+    for(c=0; c<nout; c++){array1D_uniq[c] /= count_in[c];}
+
+    free(count_in);
+} // end of function
+//////////////////////////////////////////////////////
+bool obs_enabled(int obs, int tilt, int area)
+// whether an observable is computed, given the TILT and AREA switches
+{
+    if(obs_group[obs]==GROUP_TILT){return tilt;}
+    if(obs_group[obs]==GROUP_AREA){return area;}
+    return true;
+}
+//////////////////////////////////////////////////////
+const char *assignment_name(Assignment assign)
+{
+    switch(assign){
+    case ASSIGN_CIC: return "cic";
+    case ASSIGN_TSC: return "tsc";
+    default:         return "ngp";
+    }
+}
+
+
+bool parse_assignment(const string &name, Assignment &assign)
+{
+    if(name == "ngp"){ assign = ASSIGN_NGP; return true; }
+    if(name == "cic"){ assign = ASSIGN_CIC; return true; }
+    if(name == "tsc"){ assign = ASSIGN_TSC; return true; }
+    return false;
+}
+
+
+int find_observable(const string &name)
+// the index of a spectrum given its printed name; the Im() and Real() of the cross correlations are optional
+{
+    for(int obs=0; obs<NOBS; obs++){
+        string full(obs_names[obs]);
+        if(name == full){return obs;}
+        size_t open = full.find('(');
+        if(open != string::npos && name == full.substr(open+1, full.size()-open-2)){return obs;}
+    }
+    return -1;
+} // end of function
+//////////////////////////////////////////////////////
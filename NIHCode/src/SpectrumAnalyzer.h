@@ -0,0 +1,507 @@
+/*
+ * SpectrumAnalyzer.h
+ *
+ * The height, thickness, tilt and director spectra of a bilayer, computed
+ * frame by frame.  A SpectrumAnalyzer is configured once and then fed one
+ * frame at a time with push_frame(); the accumulated spectra can be read at
+ * any point with snapshot() and at the end with finalize().
+ *
+ * Each frame goes through the stages
+ *
+ *   preprocess - wrap the heads into the box, unwrap the tails, directors,
+ *                leaflet assignment and the lipids carried across the box in z
+ *   bin        - the lipids within the cutoff angle, height and thickness
+ *                fields on the grid, interpolating empty patches, and the
+ *                number densities when AREA is on
+ *   transform  - surface normals, tilt and director fields, the FFTs and the
+ *                decomposition into parallel and perpendicular components
+ *   accumulate - the sums over frames, q-averaging, block averages, the time
+ *                series and the sliding window
+ *
+ * All per-frame data lives in a FrameWorkspace.  The first three stages only
+ * read the analyzer, so different frames may be in different stages at once,
+ * each in its own workspace; accumulate() must see the frames in order.
+ * Preprocessing depends on nothing in the configuration but lx_ref, so
+ * analyzers that differ otherwise can share a preprocessed frame: their own
+ * workspaces borrow its lipids (FrameWorkspace::borrow) and go on from bin.
+ *
+ * A grid half as fine can be had without binning the lipids again: reduce()
+ * adds up the patch sums and counts of the finer grid 2x2, and the coarser
+ * grid is interpolated and transformed as usual, so a run on the finest grid
+ * gives a pyramid of resolutions.  A lipid then falls in the patch that holds
+ * its patch of the finest grid.  This is for nearest grid point assignment
+ * only, since the clouds of CIC and TSC depend on the grid.
+ */
+
+#ifndef SPECTRUMANALYZER_H_
+#define SPECTRUMANALYZER_H_
+
+#include <vector>
+#include <string>
+#include <stddef.h>
+#include <fftw3.h>
+
+#include "MultiTau.h"
+#include "BlockAverage.h"
+#include "Accumulator.h"
+#include "SlidingWindow.h"
+#include "StageTimer.h"
+
+
+/*
+ * The spectra accumulated over the run.  Each frame's q-averaged contribution is also fed to a block
+ * averaging analysis, which gives the error bars.  The names match the printed output.
+ */
+enum Observable{
+    OBS_HQ2, OBS_TQ2,
+    OBS_T1XQ2, OBS_T1YQ2, OBS_DPQ2, OBS_DMQ2, OBS_DPPARQ2, OBS_DPPERQ2, OBS_DMPARQ2, OBS_DMPERQ2,
+    OBS_HDMPAR, OBS_TDPPAR, OBS_UMPARQ2, OBS_UMPERQ2, OBS_UPPARQ2, OBS_UPPERQ2, OBS_DUM_PAR, OBS_DUP_PAR,
+    OBS_RHOSIGQ2, OBS_RHODELQ2,
+    NOBS
+};
+enum ObservableGroup{ GROUP_HEIGHT, GROUP_TILT, GROUP_AREA };
+extern const char *obs_names[NOBS];
+extern const int obs_group[NOBS];
+
+/*
+ * The per-frame time series kept when AnalyzerConfig::keep_series is set, and autocorrelated when
+ * AnalyzerConfig::acf is set.
+ */
+enum Series{ SERIES_HQ2, SERIES_UMPARQ2, SERIES_UMPERQ2, NSERIES };
+
+bool obs_enabled(int obs, int tilt, int area);
+int find_observable(const std::string &name);
+
+/*
+ * How the lipids are assigned to the patches of the grid: each to the patch it is in (nearest grid point), or
+ * spread with weights over the nearest 2x2 (cloud in cell) or 3x3 (triangular shaped cloud) patches.  The
+ * smoother clouds alias less, and their window, sinc^2 or sinc^3 of q in grid units, is divided out of the
+ * transforms, so a coarser grid does as well as a finer one with nearest grid point assignment.
+ */
+enum Assignment{ ASSIGN_NGP, ASSIGN_CIC, ASSIGN_TSC };
+const char *assignment_name(Assignment assign);
+bool parse_assignment(const std::string &name, Assignment &assign);
+
+
+/*
+ * The simulation cell of one frame.  The heads are wrapped into [0,lx) x [0,ly).
+ */
+struct Box{
+    float lx, ly, lz;
+};
+
+
+/*
+ * Caller-owned coordinates of one group (head or tail) of every lipid, which load() gathers into the
+ * workspace.  Component c of lipid i is at (char *) x + i*stride, and likewise for y and z, so
+ * interleaved xyz, separate x, y and z arrays, or every other entry of a head/tail array can all be
+ * described without the caller rearranging them first.
+ */
+enum CoordType{ COORD_FLOAT, COORD_DOUBLE };
+
+struct Coordinates{
+    Coordinates() : x(NULL), y(NULL), z(NULL), stride(0), type(COORD_FLOAT) {}
+    /**
+     * @brief Describes n*3 contiguous x y z floats
+     */
+    Coordinates(const float *xyz)
+        : x(xyz), y(xyz+1), z(xyz+2), stride(3*sizeof(float)), type(COORD_FLOAT) {}
+
+    const void *x, *y, *z;
+    ptrdiff_t stride;  // bytes between consecutive lipids
+    CoordType type;
+};
+
+
+struct AnalyzerConfig{
+    AnalyzerConfig();
+
+    int ngrid;       // size of sq. grid in 1 dim. It must be even.
+    float cutang;    // lipids whose director makes a larger angle with the z axis than acos(cutang) are discarded
+    float calctilt;  // 1 for the tilt, 0 for the surface normal
+    float t0in;      // average thickness which is used to find the q=0 mode
+    float phi0in;    // lipid number density used to find the q=0 mode
+    int tilt;        // =1 if the tilt spectra are to be calculated
+    int area;        // =1 if the FT of the number densities is to be calculated
+    int area_tail;   // when area==1, the area fluctuations are measured at the tails instead of the interfaces
+    AccumulatorPolicy accum; // precision of the sums over frames
+    Assignment assign;       // of the lipids to the patches
+
+    // box lengths used to decide whether a tail was carried to the other side of the box (lx_ref only),
+    // and for the q values of the results; 0 to use each frame's own box and the average over the frames
+    float lx_ref, ly_ref;
+
+    int keep_series;  // =1 to keep the q-averaged hq2, umparq2 and umperq2 of every frame
+    int acf;          // =1 to autocorrelate the same series with multi-tau correlators
+    int window_width; // the number of frames in each time-resolved spectrum; 0 for none
+    int window_step;  // frames between consecutive windows
+    int nthreads;     // threads used by each FFT
+};
+
+
+/*
+ * A few numbers describing the last frame, as printed by the command line program.
+ */
+struct FrameInfo{
+    Box box;
+    float zavg;      // mean height of the heads
+    float z1avg;     // mean height of the upper monolayer
+    float z2avg;     // mean height of the lower monolayer
+    float t0;        // average monolayer thickness
+    int nt1, nt2;    // lipids used for the tilt of each monolayer
+    int nl1, nl2;    // lipids in each monolayer
+    int empty;       // empty neighbouring patches
+    int nswu, nswd;  // lipids moved to the upper and lower monolayer
+    int out_of_range; // lipids that fell outside the grid after wrapping
+    StageTimes times; // where the frame's time went, with NIH_PROFILE
+};
+
+
+/*
+ * The spectra averaged over the frames analyzed so far.  All q-averaged arrays have uniq_Ny elements,
+ * in the order of the q values, and are scaled as printed: divided by 40000 (hq2, tq2), 100 (t1xq2, t1yq2),
+ * 4000 (Im(hdmpar), Im(tdppar)), 400*phi0in^2 (rhoSigq2, rhoDelq2) or 400 (the rest).
+ */
+struct SpectrumResult{
+    int nframes;
+    int ngrid, uniq, uniq_Ny;
+    float lx_av, ly_av;                // box size used for the q values
+    std::vector<float> q;              // |q| of each of the uniq bins, including the Nyquist frequency, in 1/Angstrom
+    std::vector<float> q_Ny;           // |q| of each of the uniq_Ny bins
+    std::vector<float> spectra[NOBS];  // zero for the observables that are not enabled
+    std::vector<double> errors[NOBS];  // block averaged standard errors of the above
+    std::vector<float> hq2_edholm;     // height spectrum from the non-grid based transform, when area is on
+    std::vector<float> rhoSigq2, rhoDelq2; // the same two spectra on the full ngrid*ngrid grid, when area is on
+
+    // real space averages over frames of ngrid*ngrid patches, when tilt is on
+    std::vector<float> lipids_up;      // lipids in each patch of the upper monolayer
+    std::vector<float> lipids_down;    // and of the lower one
+    std::vector<float> umx, umy;       // n1 - n2
+    std::vector<float> tmag_hist;      // histogram of the tilt magnitude of the upper monolayer, bins of 0.01
+
+    int empty_tot;          // the number of instances where two neighboring patches are empty
+    int nswu, nswd;         // lipids moved to the upper and lower monolayer
+    double z1sq_av, z2sq_av;
+    double phi0;            // average number density
+    double t0;              // average monolayer thickness
+    double nN;              // average (n.N)
+    double accum_time;      // seconds spent in the accumulation kernels
+    size_t accum_bytes;     // memory of the sums over frames
+};
+
+
+/*
+ * The data of a single frame as it passes through the stages.
+ */
+class FrameWorkspace{
+public:
+    FrameWorkspace(int ngrid);
+    ~FrameWorkspace();
+
+    /**
+     * @brief Makes room for the lipids of a frame.
+     * @param nl - the number of lipids
+     */
+    void reserve(int nl);
+
+    /**
+     * @brief Takes the lipids of a preprocessed frame from another workspace, in place, to go on from bin with
+     * a different analyzer.  The other workspace must keep the frame until this one is done with it.
+     * @param from - a workspace that has been through preprocess
+     */
+    void borrow(const FrameWorkspace &from);
+
+    /**
+     * @brief The memory of a workspace for a grid once it has made room for nl lipids
+     */
+    static size_t bytes(int ngrid, int nl);
+
+    int ngrid;
+    int nl;
+    int capacity;
+    bool borrowed;        // head, endc and dir belong to another workspace (see borrow())
+    bool keep_sums;       // bin also keeps the sums below, for a coarser grid to be reduced from
+    bool reduced;         // the grids were reduced from a finer workspace rather than binned from the lipids
+    Box box;
+
+    // per lipid
+    float **head, **endc; // each group has its 3 spatial components
+    float **dir;          // the director for each molecule
+    int *good;            // =0 if the lipid is tilted too much, =1 if it's okay; set by bin
+    int *xj, *yj;         // patch coordinates of each lipid
+    int **sx, **sy;       // with CIC or TSC, the patches of each lipid's cloud along x and y, [k][lipid] for k<3
+    float **wx, **wy;     //   and their weights
+
+    // per frame scalars
+    float zavg;           // the average z coordinate of the bilayer
+    float z1avg, z2avg;   // sums of the head heights of each monolayer
+    int nl1, nl2;         // the number of lipids within each monolayer
+    int nt1, nt2;         // number of lipids witin each monolayer that aren't too tilted
+    float t0_frame;       // average monolayer thickness
+    float tq0_frame;      // |t_q|^2 at q=0
+    float phi0_frame;
+    float z1sq_av_frame, z2sq_av_frame;
+    double dot_frame;     // sum of (n.N)
+    int empty;            // the number of empty neighboring patches
+    int nswu, nswd;       // lipids carried across the box in z
+    int out_of_range;     // lipids whose patch is outside the grid
+    int tmag_hist[100];
+    StageTimes times;     // of this frame so far, with NIH_PROFILE (see StageTimer.h)
+
+    // binned quantities in real space
+    float **z1, **z2;     // coarse grained height field of each monolayer
+    float **h, **t;       // height and thickness
+    int **nlg1, **nlg2;   // number of lipids within each patch
+    int **nlt1, **nlt2;   // number of lipids used for tilt calculations
+    int **nlb1, **nlb2;   // number of bad lipids per patch
+    float **z1sum, **z2sum; // the heights of each monolayer summed over each patch, with keep_sums
+    float ***dsum1, ***dsum2; // the directors of all the lipids of each monolayer, likewise
+    float **wg1, **wg2;   // with CIC or TSC, the weights of the good lipids of each monolayer in each patch
+    float **wt1, **wt2;   //   and of all of them, for the tilt
+    float **psiRU, **psiIU, **psiRD, **psiID; // FT of the number density of each monolayer "Up" & "Down"
+    float **h_real, **h_imag;  // non-grid based Fourier transform of the height field
+    float ***t1, ***t2;   // top and bottom tilt vector
+    float ***dm, ***dp;   // d vectors
+    float ***n1, ***n2;   // top and bottom binned director field
+    float ***um, ***up;   // u vectors
+
+    // 1D real quantities passed to fftw
+    float *h1D, *t1D, *z1_1D, *z2_1D, *t1x1D, *t1y1D;
+    float *dmx1D, *dmy1D, *dpx1D, *dpy1D, *umx1D, *umy1D, *upx1D, *upy1D;
+    float *dz1x1D, *dz1y1D, *dz2x1D, *dz2y1D; // derivatives passed from fftw
+    float **norm_1, **norm_2; // top and bottom normal vector
+
+    // the upper half of the complex Fourier transforms; 'S' stands for 'small' since the output is not N*N
+    fftwf_complex *hqS, *tqS, *z1qS, *z2qS;
+    fftwf_complex *dz1xqS, *dz1yqS, *dz2xqS, *dz2yqS;
+    fftwf_complex *t1xqS, *t1yqS, *dmxqS, *dmyqS, *dpxqS, *dpyqS, *umxqS, *umyqS, *upxqS, *upyqS;
+
+    // real and imaginary parts of the full Fourier transforms
+    float **hqR, **hqI, **tqR, **tqI;
+    float **t1xR, **t1xI, **t1yR, **t1yI;
+    float **dmxR, **dmxI, **dmyR, **dmyI, **dpxR, **dpxI, **dpyR, **dpyI;
+    float **umxR, **umxI, **umyR, **umyI, **upxR, **upxI, **upyR, **upyI;
+    float **dmparR, **dmparI, **dmperR, **dmperI, **dpparR, **dpparI, **dpperR, **dpperI;
+    float **umparR, **umparI, **umperR, **umperI, **upparR, **upparI, **upperR, **upperI;
+
+    // the contribution of this frame to the accumulated spectra, and its q average
+    float ***fq2;
+    float **fq2_uniq;
+
+private:
+    FrameWorkspace(const FrameWorkspace &);
+    FrameWorkspace &operator=(const FrameWorkspace &);
+
+    void release_lipids();
+};
+
+
+class SpectrumAnalyzer{
+public:
+    SpectrumAnalyzer(const AnalyzerConfig &config);
+    ~SpectrumAnalyzer();
+
+    /**
+     * @brief Analyzes one frame.
+     * @param head - nl*3 head coordinates, x y z for each lipid
+     * @param tail - nl*3 tail coordinates
+     * @param nl - the number of lipids
+     * @param box - the simulation cell
+     */
+    void push_frame(const float *head, const float *tail, size_t nl, Box box);
+
+    /**
+     * @brief Analyzes one frame, gathering the coordinates through the views.
+     * @param head - the head coordinates
+     * @param tail - the tail coordinates
+     * @param nl - the number of lipids
+     * @param box - the simulation cell
+     */
+    void push_frame(const Coordinates &head, const Coordinates &tail, size_t nl, Box box);
+
+    /**
+     * @brief The spectra averaged over the frames pushed so far; the analysis can go on.
+     */
+    SpectrumResult snapshot() const;
+
+    /**
+     * @brief The spectra averaged over all frames.  No frames may be pushed afterwards.
+     */
+    SpectrumResult finalize();
+
+    /**
+     * @brief Adds the frames of another analyzer, as if they had been pushed here after ours, so that the
+     * chunks of a trajectory can be analyzed separately.  The sums are added, so they are rounded differently
+     * than when the frames are pushed one by one.  The block averages are the same up to the level of blocks
+     * of 2^k frames for the largest k that divides our frame count; above that the blocks that would straddle
+     * the two chunks are left out.
+     * @param later - an analyzer with the same configuration, given the frames after ours
+     * @return false, leaving this analyzer as it was, if the configurations differ in anything but the FFT
+     * threads, or either keeps autocorrelations or a sliding window, which cannot be merged
+     */
+    bool merge(const SpectrumAnalyzer &later);
+
+    /**
+     * @brief Loads FFTW wisdom from a file, which makes planning new grids fast; safe to call from any thread.
+     * @return false if the file cannot be read
+     */
+    static bool import_wisdom(const std::string &path);
+
+    /**
+     * @brief Saves the FFTW wisdom gathered so far, for import_wisdom() in later runs
+     * @return false if the file cannot be written
+     */
+    static bool export_wisdom(const std::string &path);
+
+    // the stages of push_frame, for callers that keep several frames in flight
+    void load(FrameWorkspace &w, const Coordinates &head, const Coordinates &tail, size_t nl, Box box) const;
+    void preprocess(FrameWorkspace &w) const;
+    void bin(FrameWorkspace &w) const;
+
+    /**
+     * @brief Bins a frame by reducing the patches of a grid twice as fine 2x2, instead of binning its lipids
+     * @param w - a workspace that borrowed the frame (FrameWorkspace::borrow)
+     * @param finer - the frame binned or reduced on a grid of twice our ngrid, with keep_sums
+     */
+    void reduce(FrameWorkspace &w, const FrameWorkspace &finer) const;
+    void transform(FrameWorkspace &w) const;
+    void accumulate(FrameWorkspace &w);
+
+    // the kernels the stages are made of, in the order they run; each reads what the ones before it left in
+    // the workspace.  Public for timing them one at a time (see tools/nihbench.cpp).
+    void wrap(FrameWorkspace &w) const;                 // preprocess: PBC wrapping and the directors
+    void leaflets(FrameWorkspace &w) const;             //   the monolayers and the stray lipids
+    void bin_lipids(FrameWorkspace &w) const;           // bin: the cutoff, the patch heights, the densities with area
+    void fill_empty(FrameWorkspace &w) const;           //   empty patches from their neighbors
+    void assign_heights(FrameWorkspace &w) const;       //   with CIC or TSC: the clouds of the heights
+    void height_thickness(FrameWorkspace &w) const;     //   h and t, and the average thickness
+    void reduce_sums(FrameWorkspace &w, const FrameWorkspace &finer) const; // reduce: the patches 2x2
+    void normals(FrameWorkspace &w) const;              // transform, with tilt: the normals by spectral derivatives
+    void tilt_fields(FrameWorkspace &w) const;          //   with tilt: the tilt and director fields
+    void reduced_tilt(FrameWorkspace &w) const;         //     their sums, on a reduced grid
+    void assign_tilt(FrameWorkspace &w) const;          //     their clouds, with CIC or TSC
+    void deconvolve(fftwf_complex *f) const;            //   with CIC or TSC: the window out of a transform
+    void forward_transforms(FrameWorkspace &w) const;   //   the r2c FFTs of the fields
+    void full_arrays(FrameWorkspace &w) const;          //   their full arrays, by fullArray()
+    void decompose(FrameWorkspace &w) const;            //   with tilt: the parallel and perpendicular parts
+    void power(FrameWorkspace &w) const;                //   the power spectra of the frame
+    void fullArray(float **array1R, float **array1I, fftwf_complex *array2, float lxy) const;
+    void qav(float **array2D, float *array1D_uniq, int Ny) const;
+
+    const AnalyzerConfig &config() const { return config_; }
+    int nframes() const { return nframes_; }
+    int num_uniq() const { return uniq; }
+    int num_uniq_Ny() const { return uniq_Ny; }
+    const FrameInfo &frame_info() const { return info_; }
+
+    /**
+     * @brief The magnitude of q of each q-averaged bin for a box length
+     * @param lx - the box length
+     * @param out - uniq (Ny=1) or uniq_Ny (Ny=0) values
+     * @param Ny - 1 to include the Nyquist frequency
+     */
+    void qvalues(float lx, float *out, int Ny) const;
+
+    /**
+     * @brief The stored time series of a spectrum; nframes() rows of uniq_Ny values.
+     */
+    const std::vector<float> &series(int s) const { return series_[s]; }
+
+    /**
+     * @brief The normalized autocorrelation of one q bin of a time series
+     * @param s - the series
+     * @param bin - the q bin
+     * @param lags - filled with the lag, in pushed frames, of each point
+     * @param acf - filled with the autocorrelation at each lag
+     */
+    void autocorrelation(int s, int bin, std::vector<double> &lags, std::vector<double> &acf) const;
+
+    /**
+     * @brief Restarts the autocorrelations, e.g. when the spacing of the pushed frames changes.
+     */
+    void reset_autocorrelation();
+
+    /**
+     * @brief Makes room for the time series of a number of frames up front, so that they are not copied as
+     * they grow; does nothing unless the series are kept.
+     */
+    void reserve_series(long frames);
+
+    /**
+     * @brief Whether the block averaged error of every given q bin, relative to its mean, is below tol
+     * @param tol - the tolerance
+     * @param obs - the monitored spectra
+     * @param nbins - the number of lowest-q bins monitored
+     */
+    bool converged(double tol, const std::vector<int> &obs, int nbins) const;
+
+    /**
+     * @brief The smallest statistical inefficiency among the given q bins, in frames
+     * @param obs - the monitored spectra
+     * @param nbins - the number of lowest-q bins monitored
+     */
+    double inefficiency(const std::vector<int> &obs, int nbins) const;
+
+    /**
+     * @brief Whether a new window of time-resolved spectra ended with the last frame
+     */
+    bool window_ready() const;
+
+    /**
+     * @brief The spectra averaged over the current window, scaled as in SpectrumResult
+     * @param out - uniq_Ny values for each enabled observable, in the order of Observable
+     */
+    void window_spectra(float *out) const;
+
+    /**
+     * @brief The number of enabled observables
+     */
+    int nspectra() const;
+
+private:
+    SpectrumAnalyzer(const SpectrumAnalyzer &);
+    SpectrumAnalyzer &operator=(const SpectrumAnalyzer &);
+
+    void init_qbins();
+    bool enabled(int obs) const { return obs_enabled(obs, config_.tilt, config_.area); }
+    float average_lx() const;
+    float average_ly() const;
+
+    AnalyzerConfig config_;
+    int ngrid;
+    int uniq;    // the number of unique values of the magnitude of q; used to be =(N+4)*(N+2)/8 when lx=ly
+    int uniq_Ny; // same as above, but excluding values at the Nyquist frequency; =N*(N+2)/8 when lx=ly
+    int ngridpair;
+    int *qbin;    // index into the q-averaged array for each element of an ngrid x ngrid array, or -1 if it is not used
+    int *qbin_Ny; // same as above, but excluding values at the Nyquist frequency
+    int ***q;     // full matrix of 2D q values
+    float **cosq, **sinq; // = qx/q, qy/q, used for calculating the parallel and perp components of dm, dp
+    float obs_scale[NOBS]; // the factors the accumulated spectra are divided by when printed
+    std::vector<float> deconv_; // 1/window of the assignment for each element of an r2c transform; empty for NGP
+
+    fftwf_plan spectrum_plan; // shared with the other analyzers of the same grid
+    fftwf_plan inv_plan;
+
+    FrameWorkspace *work_; // used by push_frame
+    FrameInfo info_;
+    bool finalized_;
+
+    // the sums over frames
+    int nframes_;
+    long nlipids_;
+    float lx_sum_, ly_sum_; // summed in float, as TextFrameSource averages the box files
+    SpectrumSums *obs_sums;
+    std::vector<BlockAverager> obs_blocks;
+    RunningSum t0, tq0, phi0, dot_cum, z1sq_av, z2sq_av;
+    int empty_tot, nswu, nswd;
+    float **t1xR_cum, **t1xI_cum, **t1yR_cum, **t1yI_cum; // accumulated real space orientations
+    float ty_cum[100];
+    float **hq2Ed;
+    double accum_time;
+
+    std::vector<float> series_[NSERIES];
+    std::vector<MultiTauCorrelator> acf_[NSERIES];
+    SlidingWindow *window_;
+};
+
+#endif /* SPECTRUMANALYZER_H_ */
@@ -0,0 +1,153 @@
+/*
+ * StageTimer.h
+ *
+ * Where the time of a frame goes.  Each frame carries a StageTimes in its
+ * workspace, and each stage charges the time since its last mark to one of
+ * the timers below as it moves from one kernel to the next:
+ *
+ *     NIH_PROFILE_START(w.times);        // at the start of a stage
+ *     wrap(w);
+ *     NIH_PROFILE_LAP(w.times, PROF_WRAP);
+ *
+ * so the timers never overlap, and the time a frame spends waiting between
+ * stages is not charged to any of them.  The marks read the time stamp
+ * counter on x86 and the monotonic clock elsewhere, and, once perf_enable()
+ * has been called, the hardware counters of the thread (see PerfCounters.h).
+ *
+ * The marks are only compiled in when NIH_PROFILE is defined (make
+ * PROFILE=1); otherwise they expand to nothing and the timers stay at zero.
+ * StageTimes itself is always there, so that objects built with and without
+ * NIH_PROFILE can be linked together.
+ */
+
+#ifndef STAGETIMER_H_
+#define STAGETIMER_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "PerfCounters.h"
+
+
+enum ProfileTimer{
+    PROF_READ,          // the next frame from the source
+    PROF_LOAD,          // its coordinates into the workspace
+    PROF_WRAP,          // PBC wrapping and the directors
+    PROF_LEAFLETS,      // the monolayers and the stray lipids
+    PROF_BIN,           // the lipids into patches, and h and t
+    PROF_FILL_EMPTY,    // empty patches from their neighbors
+    PROF_NORMALS,       // the surface normals, but for their FFTs
+    PROF_FFT_NORMALS,   // the FFTs of the normals: z1 and z2 forward, their gradients back
+    PROF_TILT,          // the tilt and director fields
+    PROF_FFT_FIELDS,    // the r2c FFTs of h, t and the tilt and director fields
+    PROF_FULL_ARRAYS,   // the full arrays of the transforms
+    PROF_DECOMPOSE,     // the parallel and perpendicular parts
+    PROF_POWER,         // the power spectra of the frame
+    PROF_ACCUMULATE,    // the sums over frames
+    PROF_OUTPUT,        // writing the results, once per run
+    NPROF
+};
+
+static const char *const profile_timer_names[NPROF] = {
+    "read", "load", "wrap", "leaflets", "bin", "fill_empty", "normals", "fft_normals", "tilt", "fft_fields",
+    "full_arrays", "decompose", "power", "accumulate", "output"
+};
+
+
+/**
+ * @brief A time stamp, in ticks of profile_tick_seconds()
+ */
+inline uint64_t profile_ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec*1000000000u + ts.tv_nsec;
+#endif
+}
+
+
+/**
+ * @brief The length of a tick; on x86 measured against the monotonic clock over 20 ms the first time
+ */
+inline double profile_tick_seconds()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    static double seconds = 0;
+    if(seconds == 0){
+        struct timespec t0, t1, pause = {0, 20000000};
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        uint64_t c0 = profile_ticks();
+        nanosleep(&pause, NULL);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        uint64_t c1 = profile_ticks();
+        seconds = ((t1.tv_sec - t0.tv_sec) + 1e-9*(t1.tv_nsec - t0.tv_nsec))/(double) (c1 - c0);
+    }
+    return seconds;
+#else
+    return 1e-9;
+#endif
+}
+
+
+struct StageTimes{
+    StageTimes() { clear(); }
+
+    void clear()
+    {
+        memset(ticks, 0, sizeof(ticks));
+        memset(counts, 0, sizeof(counts));
+        mark = 0;
+    }
+    void add(const StageTimes &other)
+    {
+        for(int i=0; i<NPROF; i++){
+            ticks[i] += other.ticks[i];
+            for(int e=0; e<NPERF; e++)
+                counts[i][e] += other.counts[i][e];
+        }
+    }
+    void start()
+    {
+        if(perf_on)
+            perf_read(perf_mark);
+        mark = profile_ticks();
+    }
+    void lap(ProfileTimer timer)
+    {
+        uint64_t t = profile_ticks();
+        ticks[timer] += t - mark;
+        if(perf_on){
+            uint64_t now[NPERF];
+            perf_read(now);
+            for(int e=0; e<NPERF; e++){
+                if(now[e] > perf_mark[e]) // scaled counts of multiplexed groups can step back
+                    counts[timer][e] += now[e] - perf_mark[e];
+                perf_mark[e] = now[e];
+            }
+            t = profile_ticks(); // the reads are not charged to the next timer
+        }
+        mark = t;
+    }
+
+    uint64_t ticks[NPROF];
+    uint64_t counts[NPROF][NPERF]; // hardware events, once perf_enable() has been called
+    uint64_t mark;      // the time of the last start() or lap()
+    uint64_t perf_mark[NPERF]; // and the counters then
+};
+
+
+#ifdef NIH_PROFILE
+#define NIH_PROFILE_ENABLED 1
+#define NIH_PROFILE_START(times) (times).start()
+#define NIH_PROFILE_LAP(times, timer) (times).lap(timer)
+#else
+#define NIH_PROFILE_ENABLED 0
+#define NIH_PROFILE_START(times) ((void) 0)
+#define NIH_PROFILE_LAP(times, timer) ((void) 0)
+#endif
+
+#endif /* STAGETIMER_H_ */
@@ -0,0 +1,294 @@
+/*
+ * SyntheticMembrane.cpp
+ */
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "SyntheticMembrane.h"
+
+using namespace std;
+
+
+SyntheticMembrane::SyntheticMembrane(const SynthConfig &config)
+    : config_(config), rng_(config.seed), fine_(4*config.ngrid), half_(fine_/2+1), box_(0)
+{
+    int n = config.ngrid/2;
+    for(int ny=0; ny<n; ny++){
+        for(int nx=-n+1; nx<n; nx++){
+            if(ny == 0 && nx <= 0)
+                continue;
+            Mode m;
+            m.nx = nx;
+            m.ny = ny;
+            for(int f=0; f<6; f++){
+                m.z[f][0] = M_SQRT1_2*rng_.gauss();
+                m.z[f][1] = M_SQRT1_2*rng_.gauss();
+            }
+            modes_.push_back(m);
+        }
+    }
+    box_ = rng_.gauss();
+
+    for(int f=0; f<NFIELDS; f++){
+        fq_[f] = (fftwf_complex *) fftwf_malloc(sizeof(fftwf_complex)*fine_*half_);
+        fr_[f] = (float *) fftwf_malloc(sizeof(float)*fine_*fine_);
+    }
+    plan_ = fftwf_plan_dft_c2r_2d(fine_, fine_, fq_[0], fr_[0], FFTW_ESTIMATE);
+
+    sx_.resize(config.nl);
+    sy_.resize(config.nl);
+    leaflet_.resize(config.nl);
+    for(int i=0; i<config.nl; i++){
+        sx_[i] = rng_.uniform();
+        sy_[i] = rng_.uniform();
+        leaflet_[i] = i % 2;
+    }
+}
+
+
+SyntheticMembrane::~SyntheticMembrane()
+{
+    fftwf_destroy_plan(plan_);
+    for(int f=0; f<NFIELDS; f++){
+        fftwf_free(fq_[f]);
+        fftwf_free(fr_[f]);
+    }
+}
+
+
+/**
+ * @brief Fills the fine grid with the fields of the current modes in a box of length lx
+ */
+void SyntheticMembrane::transform(double lx)
+{
+    double sh, st, sm = sqrt(config_.tilt_spectrum())/lx;
+    for(int f=0; f<NFIELDS; f++)
+        memset(fq_[f], 0, sizeof(fftwf_complex)*fine_*half_);
+
+    for(size_t k=0; k<modes_.size(); k++){
+        const Mode &m = modes_[k];
+        double qx = 2*M_PI*m.nx/lx, qy = 2*M_PI*m.ny/lx, q = sqrt(qx*qx + qy*qy);
+        double cosq = qx/q, sinq = qy/q;
+        sh = sqrt(config_.height_spectrum(q))/lx;
+        st = sqrt(config_.thickness_spectrum(q))/lx;
+
+        double v[NFIELDS][2];
+        for(int c=0; c<2; c++){
+            double h = sh*m.z[0][c], t = st*m.z[1][c];
+            double dppar = sm*m.z[2][c], dpper = sm*m.z[3][c], dmpar = sm*m.z[4][c], dmper = sm*m.z[5][c];
+            v[F_H][c] = h;
+            v[F_T][c] = t;
+            v[F_DPX][c] = cosq*dppar - sinq*dpper;
+            v[F_DPY][c] = sinq*dppar + cosq*dpper;
+            v[F_DMX][c] = cosq*dmpar - sinq*dmper;
+            v[F_DMY][c] = sinq*dmpar + cosq*dmper;
+        }
+        // the gradients: i q f_q
+        v[F_HX][0] = -qx*v[F_H][1];     v[F_HX][1] = qx*v[F_H][0];
+        v[F_HY][0] = -qy*v[F_H][1];     v[F_HY][1] = qy*v[F_H][0];
+        v[F_TX][0] = -qx*v[F_T][1];     v[F_TX][1] = qx*v[F_T][0];
+        v[F_TY][0] = -qy*v[F_T][1];     v[F_TY][1] = qy*v[F_T][0];
+
+        int i = (m.nx + fine_) % fine_;
+        for(int f=0; f<NFIELDS; f++){
+            fq_[f][i*half_ + m.ny][0] = v[f][0];
+            fq_[f][i*half_ + m.ny][1] = v[f][1];
+        }
+        if(m.ny == 0){ // the half-complex array holds both q and -q of the ny=0 column
+            int j = (fine_ - m.nx) % fine_;
+            for(int f=0; f<NFIELDS; f++){
+                fq_[f][j*half_][0] = v[f][0];
+                fq_[f][j*half_][1] = -v[f][1];
+            }
+        }
+    }
+
+    for(int f=0; f<NFIELDS; f++)
+        fftwf_execute_dft_c2r(plan_, fq_[f], fr_[f]);
+}
+
+
+/**
+ * @brief A field at a point, from the four corners of its cell of the fine grid
+ * @param w - the weights of the corners
+ * @param cell - their indices into the grid
+ */
+inline float SyntheticMembrane::interpolate(int f, const float *w, const int *cell) const
+{
+    const float *g = fr_[f];
+    return w[0]*g[cell[0]] + w[1]*g[cell[1]] + w[2]*g[cell[2]] + w[3]*g[cell[3]];
+}
+
+
+void SyntheticMembrane::frame(float *head, float *tail, Box &box)
+{
+    double a = (config_.tau > 0 ? exp(-1/config_.tau) : 0), b = sqrt(1 - a*a);
+
+    for(size_t k=0; k<modes_.size(); k++){
+        for(int f=0; f<6; f++){
+            relax(modes_[k].z[f][0], a, b*M_SQRT1_2);
+            relax(modes_[k].z[f][1], a, b*M_SQRT1_2);
+        }
+    }
+    relax(box_, a, b);
+
+    double l0 = config_.box_length();
+    double lx = l0*(1 + config_.box_fluct*box_);
+    double lz = 100*(l0/lx)*(l0/lx); // constant volume
+    box.lx = lx;
+    box.ly = lx;
+    box.lz = lz;
+    transform(lx);
+
+    double step = config_.step/lx;
+    double zc = 0.5*lz, t0 = config_.t0, len = config_.length;
+    for(int i=0; i<config_.nl; i++){
+        sx_[i] += step*rng_.gauss();
+        sy_[i] += step*rng_.gauss();
+        sx_[i] -= floor(sx_[i]);
+        sy_[i] -= floor(sy_[i]);
+        if(config_.flip > 0 && rng_.uniform() < config_.flip)
+            leaflet_[i] ^= 1;
+
+        // the cell of the fine grid, and the weights of its corners
+        float gx = sx_[i]*fine_, gy = sy_[i]*fine_;
+        int x0 = (int) gx, y0 = (int) gy;
+        float fx = gx - x0, fy = gy - y0;
+        x0 %= fine_;
+        y0 %= fine_;
+        int x1 = (x0 + 1) % fine_, y1 = (y0 + 1) % fine_;
+        int cell[4] = {x0*fine_ + y0, x0*fine_ + y1, x1*fine_ + y0, x1*fine_ + y1};
+        float w[4] = {(1-fx)*(1-fy), (1-fx)*fy, fx*(1-fy), fx*fy};
+
+        float h = interpolate(F_H, w, cell), t = interpolate(F_T, w, cell);
+        float hx = interpolate(F_HX, w, cell), hy = interpolate(F_HY, w, cell);
+        float tx = interpolate(F_TX, w, cell), ty = interpolate(F_TY, w, cell);
+        float dpx = interpolate(F_DPX, w, cell), dpy = interpolate(F_DPY, w, cell);
+        float dmx = interpolate(F_DMX, w, cell), dmy = interpolate(F_DMY, w, cell);
+
+        // the director: the unit normal of the monolayer's surface, pointing from head to tail, and the tilt
+        // along the surface, so that the director less the normal is the tilt as the analyzer measures it
+        float n[3], m[3], z;
+        if(leaflet_[i] == 0){
+            z = zc + t0 + h + t;
+            n[0] = hx + tx;     n[1] = hy + ty;     n[2] = -1;
+            m[0] = dpx + dmx;   m[1] = dpy + dmy;
+        }
+        else{
+            z = zc - t0 + h - t;
+            n[0] = -(hx - tx);  n[1] = -(hy - ty);  n[2] = 1;
+            m[0] = dpx - dmx;   m[1] = dpy - dmy;
+        }
+        float g = 1/sqrt(n[0]*n[0] + n[1]*n[1] + 1);
+        n[0] *= g;  n[1] *= g;  n[2] *= g;
+        float mn = m[0]*n[0] + m[1]*n[1];
+        m[0] -= mn*n[0];    m[1] -= mn*n[1];    m[2] = -mn*n[2];
+        float m2 = m[0]*m[0] + m[1]*m[1] + m[2]*m[2];
+        float along = (m2 < 1 ? sqrt(1 - m2) : 0);
+        float d[3];
+        for(int c=0; c<3; c++)
+            d[c] = len*(along*n[c] + m[c]);
+
+        float *p = head + 3*i, *r = tail + 3*i;
+        p[0] = sx_[i]*lx;
+        p[1] = sy_[i]*lx;
+        p[2] = z;
+        r[0] = p[0] + d[0];
+        r[1] = p[1] + d[1];
+        r[2] = p[2] + d[2];
+        r[0] -= lx*floor(r[0]/lx); // wrapped on its own, as MD codes do
+        r[1] -= lx*floor(r[1]/lx);
+    }
+}
+
+
+TextTrajectoryWriter::TextTrajectoryWriter(const string &dir) : bytes_(0)
+{
+    mkdir(dir.c_str(), 0755);
+    const char *axis = "XYZ";
+    for(int c=0; c<3; c++){
+        lipid_[c] = open(dir + "/Lipid" + axis[c] + ".out");
+        box_[c] = open(dir + "/boxsize" + axis[c] + ".out");
+    }
+}
+
+
+TextTrajectoryWriter::~TextTrajectoryWriter()
+{
+    for(int c=0; c<3; c++){
+        if(fclose(lipid_[c]) != 0 || fclose(box_[c]) != 0){
+            cout << "Could not finish writing the text trajectory" << endl;
+            exit(1);
+        }
+    }
+}
+
+
+FILE *TextTrajectoryWriter::open(const string &path)
+{
+    FILE *fp = fopen(path.c_str(), "w");
+    if(!fp){
+        cout << "Could not create " << path << endl;
+        exit(1);
+    }
+    return fp;
+}
+
+
+/**
+ * @brief Prints a number with a fixed number of decimals, faster than printf
+ * @return the end of the number
+ */
+static char *format_fixed(char *p, double v, int decimals)
+{
+    static const double scale[] = {1, 10, 100, 1000, 10000, 100000, 1000000};
+    long long n = llrint(v*scale[decimals]);
+    if(n < 0){
+        *p++ = '-';
+        n = -n;
+    }
+    char digits[24];
+    int nd = 0;
+    do{
+        digits[nd++] = '0' + n % 10;
+        n /= 10;
+    } while(n > 0 || nd <= decimals);
+    while(nd > 0){
+        if(nd == decimals)
+            *p++ = '.';
+        *p++ = digits[--nd];
+    }
+    *p++ = '\n';
+    return p;
+}
+
+
+void TextTrajectoryWriter::put(FILE *fp, const char *end)
+{
+    size_t n = end - &buf_[0];
+    if(fwrite(&buf_[0], 1, n, fp) != n){
+        cout << "Could not write the text trajectory" << endl;
+        exit(1);
+    }
+    bytes_ += n;
+}
+
+
+void TextTrajectoryWriter::write(const float *head, const float *tail, int nl, Box box)
+{
+    buf_.resize(2*(size_t) nl*24 + 64);
+    for(int c=0; c<3; c++){
+        char *p = &buf_[0];
+        for(int i=0; i<nl; i++){
+            p = format_fixed(p, head[3*i+c], 4);
+            p = format_fixed(p, tail[3*i+c], 4);
+        }
+        put(lipid_[c], p);
+    }
+    float l[3] = {box.lx, box.ly, box.lz};
+    for(int c=0; c<3; c++)
+        put(box_[c], format_fixed(&buf_[0], l[c], 5));
+}
@@ -0,0 +1,220 @@
+/*
+ * SyntheticMembrane.h
+ *
+ * A synthetic membrane whose spectra are known, for validating the analysis
+ * and benchmarking it on reproducible frames of any size (see nihsynth,
+ * nihbench and nihscale).
+ *
+ * The membrane is described by independent Gaussian fields, sampled in
+ * Fourier space on the modes the analyzer resolves on a grid of ngrid
+ * (|nx|, |ny| < ngrid/2, not q=0), with h(r) = (1/L) Sum_q h_q exp(iq.r):
+ *
+ *   height          <|h_q|^2>  = kT/(kappa q^4 + sigma q^2)
+ *   thickness       <|t_q|^2>  = kT/(K_t + kappa q^4)     (half the difference of the monolayers)
+ *   tilt            <|m_q|^2>  = kT/kappa_theta           (each of the parallel and perpendicular parts of
+ *                                                          the sum and difference of the monolayer tilts)
+ *
+ * so that, to first order, the q data file of NIHCode would read, in its units (nm),
+ *
+ *   hq2 = <|h_q|^2>   tq2 = <|t_q|^2>   umparq2 = q^2 <|h_q|^2> + kT/kappa_theta   umperq2 = kT/kappa_theta
+ *   dpparq2 = dpperq2 = dmparq2 = dmperq2 = kT/kappa_theta
+ *
+ * which is what --analytic of nihsynth writes.  NIHCode measures the fields from the lipids, and with the
+ * defaults (kappa = 10, 4000 lipids, ngrid = 16, about 8 lipids of each monolayer per patch) it reads
+ *
+ *   - every spectrum lowered towards the largest q by the average over each patch, by a factor
+ *     sinc^2(pi nx/ngrid) sinc^2(pi ny/ngrid) for the mode (nx, ny), down to 0.26 at the largest q; hq2
+ *     and tq2 less so, as the noise below adds to them.  hq2 is within 5% over the lowest bins.
+ *   - umparq2 12-19% low at low q, with CIC about as low: besides the patch average, the director's
+ *     in-plane part is grad h/sqrt(1 + |grad h|^2), which lowers it by about 2<|grad h|^2> (7% here, and
+ *     falling as 1/kappa).  The tilt spectra lose a few % the same way.
+ *   - tq2 20-37% high at low q: the patch height of each monolayer carries the spread of the heights of its
+ *     m lipids over a patch of width dl, which adds about <|grad h|^2> dl^4/(24 m) to every mode of tq2.
+ *   - dmparq2 (and less so dpparq2) far too high at low q, because SpectrumAnalyzer::normals() scales the
+ *     gradient of the patch heights by ngrid^2/L, with L the box length in A, and the tilt then keeps
+ *     (1 - ngrid^2/L) grad h; it is within 20% when ngrid^2 is close to L, e.g. 2080 lipids with ngrid = 16.
+ *
+ * None of these are corrected for in the analytic spectra.
+ *
+ * Each frame the fields are transformed to real space on a grid four times finer than ngrid, and every
+ * lipid takes them from there by bilinear interpolation: its head sits on its monolayer's surface, and its
+ * tail lies one lipid length along the director, the monolayer's normal plus its tilt.  The lipids diffuse
+ * in the plane, occasionally flip to the other monolayer, and are stored wrapped into the box one bead at
+ * a time, so tails are carried to the other side of the box as in an MD trajectory.  The box fluctuates at
+ * constant volume.  The Fourier modes and the box relax over tau frames (independent frames by default),
+ * which keeps the spectra above and gives the frames a time correlation.  The work per frame is linear in
+ * the number of lipids plus a few FFTs of the fine grid.
+ */
+
+#ifndef SYNTHETICMEMBRANE_H_
+#define SYNTHETICMEMBRANE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <fftw3.h>
+
+#include "SpectrumAnalyzer.h"
+
+
+/*
+ * xoroshiro128+, seeded through splitmix64, with normal deviates by the Box-Muller transform.
+ */
+class SynthRandom{
+public:
+    SynthRandom(uint64_t seed) : spare_(0), has_spare_(false)
+    {
+        s_[0] = splitmix(seed);
+        s_[1] = splitmix(seed);
+    }
+
+    uint64_t next()
+    {
+        uint64_t s0 = s_[0], s1 = s_[1], r = s0 + s1;
+        s1 ^= s0;
+        s_[0] = rotl(s0, 24) ^ s1 ^ (s1 << 16);
+        s_[1] = rotl(s1, 37);
+        return r;
+    }
+
+    /**
+     * @brief Uniform in [0, 1)
+     */
+    double uniform() { return (next() >> 11)*(1.0/9007199254740992.0); }
+
+    /**
+     * @brief Normal with zero mean and unit variance
+     */
+    double gauss()
+    {
+        if(has_spare_){
+            has_spare_ = false;
+            return spare_;
+        }
+        double u = 1.0 - uniform(), v = uniform();
+        double r = sqrt(-2*log(u));
+        spare_ = r*sin(2*M_PI*v);
+        has_spare_ = true;
+        return r*cos(2*M_PI*v);
+    }
+
+private:
+    static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64-k)); }
+    static uint64_t splitmix(uint64_t &x)
+    {
+        uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27))*0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    uint64_t s_[2];
+    double spare_;
+    bool has_spare_;
+};
+
+
+struct SynthConfig{
+    SynthConfig() : nl(0), frames(0), ngrid(0), kappa(10), sigma(0), ktilt(10), kthick(50), area(63), t0(18),
+                    length(15), box_fluct(0.005), tau(0), step(1), flip(1e-4), seed(1) {}
+
+    int nl, frames, ngrid;
+    double kappa;       // kT
+    double sigma;       // kT/nm^2
+    double ktilt;       // kT/nm^2
+    double kthick;      // kT/nm^4
+    double area, t0, length; // A^2, A, A
+    double box_fluct, tau, step, flip;
+    unsigned long seed;
+
+    // the spectra, with q in 1/A and the results in A^4 (height, thickness) or A^2 (tilt)
+    double height_spectrum(double q) const { return 1/(kappa*q*q*q*q + sigma*1e-2*q*q); }
+    double thickness_spectrum(double q) const { return 1/(kthick*1e-4 + kappa*q*q*q*q); }
+    double tilt_spectrum() const { return 1e2/ktilt; }
+
+    double box_length() const { return sqrt(0.5*nl*area); } // the average
+};
+
+
+/*
+ * The fields of one frame on the fine grid, and the lipids that follow them.  The same config and seed give
+ * the same frames.
+ */
+class SyntheticMembrane{
+public:
+    enum Field{ F_H, F_HX, F_HY, F_T, F_TX, F_TY, F_DPX, F_DPY, F_DMX, F_DMY, NFIELDS };
+
+    SyntheticMembrane(const SynthConfig &config);
+    ~SyntheticMembrane();
+
+    /**
+     * @brief Moves on to the next frame and places the lipids
+     * @param head - nl*3 floats, x y z of each head
+     * @param tail - the same of each tail
+     * @param box - set to the box of the frame
+     */
+    void frame(float *head, float *tail, Box &box);
+
+private:
+    SyntheticMembrane(const SyntheticMembrane &);
+    SyntheticMembrane &operator=(const SyntheticMembrane &);
+
+    // a mode with ny > 0, or ny == 0 and nx > 0; its partner at -q is the complex conjugate
+    struct Mode{
+        int nx, ny;
+        float z[6][2]; // unit variance complex deviates: height, thickness, and the parallel and
+                       // perpendicular parts of the sum and difference of the tilts
+    };
+
+    void relax(float &x, double a, double b) { x = a*x + b*rng_.gauss(); }
+    void transform(double lx);
+    float interpolate(int f, const float *w, const int *cell) const;
+
+    SynthConfig config_;
+    SynthRandom rng_;
+    int fine_, half_;               // the fine grid, and its complex width fine_/2+1
+    std::vector<Mode> modes_;
+    float box_;                     // the relative deviation of the box length, unit variance
+    fftwf_complex *fq_[NFIELDS];
+    float *fr_[NFIELDS];
+    fftwf_plan plan_;
+    std::vector<float> sx_, sy_;         // position of each lipid as a fraction of the box
+    std::vector<unsigned char> leaflet_; // 0 upper, 1 lower
+};
+
+
+/*
+ * Writes the text trajectories NIHCode reads: heads and tails alternating in LipidX.out, LipidY.out and
+ * LipidZ.out, one number per line, and one box length per frame in boxsizeX.out etc.
+ */
+class TextTrajectoryWriter{
+public:
+    /**
+     * @brief Creates the files in a directory, which is made if needed; exits if that fails.
+     */
+    TextTrajectoryWriter(const std::string &dir);
+    ~TextTrajectoryWriter();
+
+    /**
+     * @brief Appends a frame; exits if it cannot be written.
+     * @param head - nl*3 floats, x y z of each head
+     * @param tail - the same of each tail
+     */
+    void write(const float *head, const float *tail, int nl, Box box);
+    long long bytes() const { return bytes_; }
+
+private:
+    TextTrajectoryWriter(const TextTrajectoryWriter &);
+    TextTrajectoryWriter &operator=(const TextTrajectoryWriter &);
+
+    static FILE *open(const std::string &path);
+    void put(FILE *fp, const char *end);
+
+    FILE *lipid_[3], *box_[3];
+    std::vector<char> buf_;
+    long long bytes_;
+};
+
+#endif /* SYNTHETICMEMBRANE_H_ */
@@ -0,0 +1,180 @@
+/*
+ * TaskPool.cpp
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+
+#include "TaskPool.h"
+
+using namespace std;
+
+static __thread int current_worker = -1; // the index of the pool thread running this code, if any
+
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+
+TaskPool::TaskPool(int nthreads)
+    : queued_(0), outstanding_(0), shutdown_(false), next_(0)
+{
+    if(nthreads <= 0)
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if(nthreads <= 0)
+        nthreads = 1;
+    pthread_mutex_init(&lock_, NULL);
+    pthread_cond_init(&wake_, NULL);
+    pthread_cond_init(&done_, NULL);
+
+    workers_.resize(nthreads);
+    for(int t=0; t<nthreads; t++){
+        Worker *w = new Worker;
+        w->pool = this;
+        w->index = t;
+        w->ran = w->stolen = 0;
+        w->busy = w->idle = 0;
+        pthread_mutex_init(&w->lock, NULL);
+        workers_[t] = w;
+    }
+    for(int t=0; t<nthreads; t++)
+        pthread_create(&workers_[t]->thread, NULL, worker_main, workers_[t]);
+}
+
+
+TaskPool::~TaskPool()
+{
+    wait();
+    pthread_mutex_lock(&lock_);
+    shutdown_ = true;
+    pthread_cond_broadcast(&wake_);
+    pthread_mutex_unlock(&lock_);
+    for(size_t t=0; t<workers_.size(); t++){
+        pthread_join(workers_[t]->thread, NULL);
+        pthread_mutex_destroy(&workers_[t]->lock);
+        delete workers_[t];
+    }
+    pthread_cond_destroy(&done_);
+    pthread_cond_destroy(&wake_);
+    pthread_mutex_destroy(&lock_);
+}
+
+
+void TaskPool::submit(Task *task)
+{
+    pthread_mutex_lock(&lock_);
+    int t = current_worker;
+    if(t < 0 || t >= (int) workers_.size()){
+        t = next_;
+        next_ = (next_ + 1) % workers_.size();
+    }
+    outstanding_++;
+    pthread_mutex_unlock(&lock_);
+
+    Worker &w = *workers_[t];
+    pthread_mutex_lock(&w.lock);
+    w.tasks.push_back(task);
+    pthread_mutex_unlock(&w.lock);
+
+    pthread_mutex_lock(&lock_);
+    queued_++;
+    pthread_cond_signal(&wake_);
+    pthread_mutex_unlock(&lock_);
+}
+
+
+void TaskPool::wait()
+{
+    pthread_mutex_lock(&lock_);
+    while(outstanding_ > 0)
+        pthread_cond_wait(&done_, &lock_);
+    pthread_mutex_unlock(&lock_);
+}
+
+
+void *TaskPool::worker_main(void *arg)
+{
+    Worker &w = *(Worker *) arg;
+    current_worker = w.index;
+    w.pool->work(w);
+    return NULL;
+}
+
+
+/**
+ * @brief The newest task of a thread's own deque, else the oldest of another's, trying the others in turn
+ * from the next one on
+ * @return the task, or NULL if every deque is empty
+ */
+Task *TaskPool::find_task(Worker &w)
+{
+    Task *task = NULL;
+    pthread_mutex_lock(&w.lock);
+    if(!w.tasks.empty()){
+        task = w.tasks.back();
+        w.tasks.pop_back();
+    }
+    pthread_mutex_unlock(&w.lock);
+    for(size_t k=1; !task && k<workers_.size(); k++){
+        Worker &victim = *workers_[(w.index + k) % workers_.size()];
+        pthread_mutex_lock(&victim.lock);
+        if(!victim.tasks.empty()){
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            w.stolen++;
+        }
+        pthread_mutex_unlock(&victim.lock);
+    }
+    return task;
+}
+
+
+void TaskPool::work(Worker &w)
+{
+    while(true){
+        double t0 = now();
+        pthread_mutex_lock(&lock_);
+        while(queued_ == 0 && !shutdown_)
+            pthread_cond_wait(&wake_, &lock_);
+        if(queued_ == 0){ // shut down
+            pthread_mutex_unlock(&lock_);
+            return;
+        }
+        queued_--; // claims one of the queued tasks; every claim is matched by a task in some deque
+        pthread_mutex_unlock(&lock_);
+
+        Task *task = NULL;
+        while(!(task = find_task(w)))
+            sched_yield();
+        double t1 = now();
+        w.idle += t1 - t0;
+
+        task->run(*this);
+        delete task;
+        w.busy += now() - t1;
+        w.ran++;
+
+        pthread_mutex_lock(&lock_);
+        if(--outstanding_ == 0)
+            pthread_cond_broadcast(&done_);
+        pthread_mutex_unlock(&lock_);
+    }
+}
+
+
+void TaskPool::print_stats(ostream &out) const
+{
+    char line[120];
+    out << "Task thread   tasks   stolen    busy(s)    idle(s)" << endl;
+    for(size_t t=0; t<workers_.size(); t++){
+        const Worker &w = *workers_[t];
+        snprintf(line, sizeof(line), "  %9d %7ld %8ld %10.3f %10.3f", (int) t, w.ran, w.stolen, w.busy, w.idle);
+        out << line << endl;
+    }
+}
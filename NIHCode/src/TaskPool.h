@@ -0,0 +1,98 @@
+/*
+ * TaskPool.h
+ *
+ * A fixed set of threads running Tasks, with a deque of tasks per thread
+ * (work stealing).  A thread takes its own tasks newest first, and once it
+ * has none left it steals the oldest task of another thread, so a thread
+ * stuck on one long task does not hold up the tasks queued behind it, and
+ * short tasks fill the threads that long ones leave idle.  A task may submit
+ * more tasks while it runs; they go on its own thread's deque.
+ *
+ * Tasks are meant to be coarse (a chunk of a trajectory, not a frame), so the
+ * deques are guarded by a mutex each rather than being lock-free, and idle
+ * threads sleep on a condition variable instead of spinning.
+ */
+
+#ifndef TASKPOOL_H_
+#define TASKPOOL_H_
+
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <pthread.h>
+
+class TaskPool;
+
+
+class Task{
+public:
+    virtual ~Task() {}
+
+    /**
+     * @brief Does the work, on one of the pool's threads
+     * @param pool - the pool, to submit further tasks to
+     */
+    virtual void run(TaskPool &pool) = 0;
+};
+
+
+class TaskPool{
+public:
+    /**
+     * @brief Starts the threads, which wait for tasks
+     * @param nthreads - the number of threads, or 0 for one per core
+     */
+    TaskPool(int nthreads = 0);
+
+    /**
+     * @brief Waits for the tasks submitted so far and stops the threads
+     */
+    ~TaskPool();
+
+    /**
+     * @brief Queues a task, which the pool deletes once it has run.  From a task, it goes on the deque of the
+     * thread running that task; from elsewhere, on the deques of the threads in turn.
+     */
+    void submit(Task *task);
+
+    /**
+     * @brief Waits until every task submitted, including those submitted by tasks, has run
+     */
+    void wait();
+
+    int nthreads() const { return workers_.size(); }
+
+    /**
+     * @brief Prints the tasks each thread ran and stole, and the time it spent running them and idle
+     */
+    void print_stats(std::ostream &out) const;
+
+private:
+    TaskPool(const TaskPool &);
+    TaskPool &operator=(const TaskPool &);
+
+    struct Worker{
+        TaskPool *pool;
+        int index;
+        pthread_t thread;
+        pthread_mutex_t lock;       // guards tasks
+        std::deque<Task *> tasks;
+        long ran, stolen;
+        double busy, idle;          // seconds
+    };
+
+    static void *worker_main(void *arg);
+    void work(Worker &w);
+    Task *find_task(Worker &w);
+
+    std::vector<Worker *> workers_;
+    pthread_mutex_t lock_;          // guards the counters below
+    pthread_cond_t wake_;           // signalled when a task is queued, or on shutdown
+    pthread_cond_t done_;           // signalled when the last outstanding task has run
+    long queued_;                   // tasks in the deques
+    long outstanding_;              // tasks submitted and not yet run to completion
+    bool shutdown_;
+    int next_;                      // the deque the next task from outside goes on
+};
+
+#endif /* TASKPOOL_H_ */
@@ -0,0 +1,212 @@
+/*
+ * nihspectra.cpp
+ *
+ * The C interface of libnihspectra.so: a thin layer over SpectrumAnalyzer
+ * that checks its arguments and keeps C++ exceptions from crossing into the
+ * caller.
+ */
+
+#include <string.h>
+#include <new>
+
+#include "nihspectra.h"
+#include "SpectrumAnalyzer.h"
+
+
+// the public observable numbers are the analyzer's
+typedef char observable_order_check[((int) NIHSPECTRA_NOBS == (int) NOBS
+                                     && (int) NIHSPECTRA_HDMPAR == (int) OBS_HDMPAR
+                                     && (int) NIHSPECTRA_RHODELQ2 == (int) OBS_RHODELQ2) ? 1 : -1];
+
+
+struct nihspectra{
+    nihspectra(const AnalyzerConfig &config) : analyzer(config), cached_frames(-1) {}
+
+    /**
+     * @brief The spectra of the frames pushed so far, recomputed only after new frames arrive
+     */
+    const SpectrumResult &result()
+    {
+        if(cached_frames != analyzer.nframes()){
+            cached = analyzer.snapshot();
+            cached_frames = analyzer.nframes();
+        }
+        return cached;
+    }
+
+    SpectrumAnalyzer analyzer;
+    SpectrumResult cached;
+    int cached_frames;
+};
+
+
+static bool valid_coords(const nihspectra_coords *c)
+{
+    return c && c->x && c->y && c->z
+        && (c->type == NIHSPECTRA_FLOAT32 || c->type == NIHSPECTRA_FLOAT64);
+}
+
+
+extern "C" {
+
+void nihspectra_config_init(nihspectra_config *cfg)
+{
+    AnalyzerConfig defaults;
+    cfg->abi_version = NIHSPECTRA_ABI_VERSION;
+    cfg->ngrid = 0;
+    cfg->cutang = defaults.cutang;
+    cfg->calctilt = defaults.calctilt;
+    cfg->t0in = defaults.t0in;
+    cfg->phi0in = defaults.phi0in;
+    cfg->tilt = defaults.tilt;
+    cfg->area = defaults.area;
+    cfg->area_tail = defaults.area_tail;
+    cfg->accum = defaults.accum;
+    cfg->lx_ref = defaults.lx_ref;
+    cfg->ly_ref = defaults.ly_ref;
+    cfg->nthreads = defaults.nthreads;
+    cfg->assign = defaults.assign;
+}
+
+
+nihspectra *nihspectra_create(const nihspectra_config *cfg)
+{
+    if(!cfg || cfg->abi_version != NIHSPECTRA_ABI_VERSION){return NULL;}
+    if(cfg->ngrid < 2 || cfg->ngrid % 2){return NULL;}
+    if(cfg->accum < ACCUM_FLOAT || cfg->accum > ACCUM_DOUBLE){return NULL;}
+    if(cfg->assign < ASSIGN_NGP || cfg->assign > ASSIGN_TSC){return NULL;}
+
+    AnalyzerConfig config;
+    config.ngrid = cfg->ngrid;
+    config.cutang = cfg->cutang;
+    config.calctilt = cfg->calctilt;
+    config.t0in = cfg->t0in;
+    config.phi0in = cfg->phi0in;
+    config.tilt = cfg->tilt;
+    config.area = cfg->area;
+    config.area_tail = cfg->area_tail;
+    config.accum = (AccumulatorPolicy) cfg->accum;
+    config.lx_ref = cfg->lx_ref;
+    config.ly_ref = cfg->ly_ref;
+    config.nthreads = cfg->nthreads;
+    config.assign = (Assignment) cfg->assign;
+
+    try{
+        return new nihspectra(config);
+    }
+    catch(...){
+        return NULL;
+    }
+}
+
+
+void nihspectra_destroy(nihspectra *h)
+{
+    delete h;
+}
+
+
+int nihspectra_push_frame(nihspectra *h, const nihspectra_coords *head,
+                          const nihspectra_coords *tail, size_t nlipids, const double box[9])
+{
+    if(!h || !valid_coords(head) || !valid_coords(tail) || !box || nlipids == 0){return NIHSPECTRA_EINVAL;}
+    for(int i=0; i<3; i++){
+        for(int j=0; j<3; j++){
+            if(i != j && box[3*i+j] != 0){return NIHSPECTRA_EUNSUPPORTED;}
+        }
+        if(!(box[4*i] > 0)){return NIHSPECTRA_EINVAL;}
+    }
+
+    Coordinates c[2];
+    const nihspectra_coords *in[2] = {head, tail};
+    for(int g=0; g<2; g++){
+        c[g].x = in[g]->x;
+        c[g].y = in[g]->y;
+        c[g].z = in[g]->z;
+        c[g].stride = in[g]->stride;
+        c[g].type = in[g]->type == NIHSPECTRA_FLOAT64 ? COORD_DOUBLE : COORD_FLOAT;
+    }
+    Box b;
+    b.lx = box[0];
+    b.ly = box[4];
+    b.lz = box[8];
+
+    try{
+        h->analyzer.push_frame(c[0], c[1], nlipids, b);
+    }
+    catch(const std::bad_alloc &){
+        return NIHSPECTRA_ENOMEM;
+    }
+    return NIHSPECTRA_OK;
+}
+
+
+int nihspectra_num_frames(const nihspectra *h)
+{
+    return h ? h->analyzer.nframes() : NIHSPECTRA_EINVAL;
+}
+
+
+int nihspectra_num_bins(const nihspectra *h)
+{
+    return h ? h->analyzer.num_uniq_Ny() : NIHSPECTRA_EINVAL;
+}
+
+
+int nihspectra_get_q(nihspectra *h, float *q, size_t n)
+{
+    if(!h || !q || n < (size_t) h->analyzer.num_uniq_Ny()){return NIHSPECTRA_EINVAL;}
+    if(h->analyzer.nframes() == 0){return NIHSPECTRA_ENODATA;}
+    try{
+        const SpectrumResult &res = h->result();
+        memcpy(q, &res.q_Ny[0], res.uniq_Ny*sizeof(float));
+    }
+    catch(const std::bad_alloc &){
+        return NIHSPECTRA_ENOMEM;
+    }
+    return NIHSPECTRA_OK;
+}
+
+
+int nihspectra_get_spectrum(nihspectra *h, int observable, float *spectrum, double *err, size_t n)
+{
+    if(!h || !spectrum || observable < 0 || observable >= NOBS){return NIHSPECTRA_EINVAL;}
+    if(n < (size_t) h->analyzer.num_uniq_Ny()){return NIHSPECTRA_EINVAL;}
+    if(h->analyzer.nframes() == 0){return NIHSPECTRA_ENODATA;}
+    try{
+        const SpectrumResult &res = h->result();
+        memcpy(spectrum, &res.spectra[observable][0], res.uniq_Ny*sizeof(float));
+        if(err){memcpy(err, &res.errors[observable][0], res.uniq_Ny*sizeof(double));}
+    }
+    catch(const std::bad_alloc &){
+        return NIHSPECTRA_ENOMEM;
+    }
+    return NIHSPECTRA_OK;
+}
+
+
+int nihspectra_find_observable(const char *name)
+{
+    return name ? find_observable(name) : -1;
+}
+
+
+const char *nihspectra_observable_name(int observable)
+{
+    return (observable >= 0 && observable < NOBS) ? obs_names[observable] : NULL;
+}
+
+
+const char *nihspectra_strerror(int code)
+{
+    switch(code){
+    case NIHSPECTRA_OK: return "success";
+    case NIHSPECTRA_EINVAL: return "invalid argument";
+    case NIHSPECTRA_EUNSUPPORTED: return "unsupported input";
+    case NIHSPECTRA_ENOMEM: return "out of memory";
+    case NIHSPECTRA_ENODATA: return "no frames analyzed yet";
+    }
+    return "unknown error";
+}
+
+} // extern "C"
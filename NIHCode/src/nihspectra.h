@@ -0,0 +1,149 @@
+/*
+ * nihspectra.h
+ *
+ * C interface to the spectrum analysis, built as libnihspectra.so, so that
+ * an MD engine (or any C, Fortran or Python caller) can analyze its frames
+ * while the simulation runs instead of writing a trajectory.
+ *
+ * The coordinates are taken from the caller's arrays, in single or double
+ * precision and with any stride, and each frame is gathered from them into
+ * an internal float buffer before it is analyzed, so the arrays may change
+ * as soon as nihspectra_push_frame returns.  The results are copied into
+ * buffers the caller owns; no pointer into the library's memory is ever
+ * handed out.  A handle is not thread safe, but separate handles may be
+ * created, used and destroyed from separate threads; handles of the same grid
+ * share one set of FFTW plans.
+ *
+ * A typical in-situ use, with GROMACS-style rvec arrays:
+ *
+ *     nihspectra_config cfg;
+ *     nihspectra_config_init(&cfg);
+ *     cfg.ngrid = 16;
+ *     nihspectra *h = nihspectra_create(&cfg);
+ *     ...every few steps...
+ *         nihspectra_coords hd = {&x_head[0][0], &x_head[0][1], &x_head[0][2], sizeof(rvec), NIHSPECTRA_FLOAT32};
+ *         nihspectra_coords tl = {&x_tail[0][0], &x_tail[0][1], &x_tail[0][2], sizeof(rvec), NIHSPECTRA_FLOAT32};
+ *         nihspectra_push_frame(h, &hd, &tl, nlipids, box);
+ *     ...
+ *     int n = nihspectra_num_bins(h);
+ *     nihspectra_get_q(h, q, n);
+ *     nihspectra_get_spectrum(h, nihspectra_find_observable("hq2"), hq2, err, n);
+ *     nihspectra_destroy(h);
+ *
+ * All lengths are in the units of the coordinates (Angstrom for the
+ * trajectories this code was written for); the spectra are scaled as printed
+ * by the NIHCode program.  Functions returning int give NIHSPECTRA_OK or one
+ * of the negative error codes below, unless documented otherwise.
+ */
+
+#ifndef NIHSPECTRA_H_
+#define NIHSPECTRA_H_
+
+#include <stddef.h>
+
+#if defined(__GNUC__)
+#define NIHSPECTRA_API __attribute__((visibility("default")))
+#else
+#define NIHSPECTRA_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* bumped whenever a struct below changes layout; recorded by nihspectra_config_init and checked by nihspectra_create */
+#define NIHSPECTRA_ABI_VERSION 2
+
+enum{
+    NIHSPECTRA_OK = 0,
+    NIHSPECTRA_EINVAL = -1,      /* bad argument, e.g. an unknown observable or too small a buffer */
+    NIHSPECTRA_EUNSUPPORTED = -2,/* a triclinic box */
+    NIHSPECTRA_ENOMEM = -3,
+    NIHSPECTRA_ENODATA = -4      /* no frame has been pushed yet */
+};
+
+enum{ NIHSPECTRA_FLOAT32 = 0, NIHSPECTRA_FLOAT64 = 1 };
+
+/* the observables, in the order printed by NIHCode */
+enum{
+    NIHSPECTRA_HQ2, NIHSPECTRA_TQ2,
+    NIHSPECTRA_T1XQ2, NIHSPECTRA_T1YQ2, NIHSPECTRA_DPQ2, NIHSPECTRA_DMQ2,
+    NIHSPECTRA_DPPARQ2, NIHSPECTRA_DPPERQ2, NIHSPECTRA_DMPARQ2, NIHSPECTRA_DMPERQ2,
+    NIHSPECTRA_HDMPAR, NIHSPECTRA_TDPPAR, NIHSPECTRA_UMPARQ2, NIHSPECTRA_UMPERQ2,
+    NIHSPECTRA_UPPARQ2, NIHSPECTRA_UPPERQ2, NIHSPECTRA_DUM_PAR, NIHSPECTRA_DUP_PAR,
+    NIHSPECTRA_RHOSIGQ2, NIHSPECTRA_RHODELQ2,
+    NIHSPECTRA_NOBS
+};
+
+typedef struct nihspectra nihspectra;
+
+/*
+ * Analysis settings; fill with nihspectra_config_init and then change what is needed.  The meaning of
+ * each field is that of the NIHCode option named next to it.
+ */
+typedef struct{
+    int abi_version;   /* set by nihspectra_config_init */
+    int ngrid;         /* -g, even */
+    float cutang;      /* cosine of the largest angle between a director and z, -c */
+    float calctilt;    /* 1 for the tilt, 0 for the surface normal */
+    float t0in;        /* -t */
+    float phi0in;      /* -p */
+    int tilt;          /* 1 to compute the tilt and director spectra */
+    int area;          /* 1 to compute the number density spectra */
+    int area_tail;     /* -A; with area=1, the density is measured at the tails */
+    int accum;         /* 0 float, 1 Kahan, 2 double sums over frames, as -A */
+    float lx_ref;      /* box length used to unwrap the tails and for the q values; 0 for each frame's own */
+    float ly_ref;
+    int nthreads;      /* threads used by each FFT; 1 keeps all work on the calling thread */
+    int assign;        /* 0 nearest grid point, 1 cloud in cell, 2 triangular shaped cloud, as -M */
+} nihspectra_config;
+
+/*
+ * The coordinates of one group (heads or tails) of every lipid: component c of lipid i is read from
+ * (const char *) c + i*stride.  Interleaved xyz, separate x, y and z arrays, or every k-th atom of
+ * a larger array can all be described without the caller rearranging them first.
+ */
+typedef struct{
+    const void *x, *y, *z;
+    ptrdiff_t stride;  /* bytes between consecutive lipids */
+    int type;          /* NIHSPECTRA_FLOAT32 or NIHSPECTRA_FLOAT64 */
+} nihspectra_coords;
+
+NIHSPECTRA_API void nihspectra_config_init(nihspectra_config *cfg);
+
+/* returns NULL if the configuration is invalid, was made for another ABI version, or memory runs out */
+NIHSPECTRA_API nihspectra *nihspectra_create(const nihspectra_config *cfg);
+NIHSPECTRA_API void nihspectra_destroy(nihspectra *h);
+
+/*
+ * Analyzes one frame.  box holds the three box vectors a, b, c row by row (box[3*i+j] is component j of
+ * vector i); only rectangular boxes are supported.
+ */
+NIHSPECTRA_API int nihspectra_push_frame(nihspectra *h, const nihspectra_coords *head,
+                                         const nihspectra_coords *tail, size_t nlipids, const double box[9]);
+
+NIHSPECTRA_API int nihspectra_num_frames(const nihspectra *h);
+
+/* the number of q bins of every spectrum (including the Nyquist frequency) */
+NIHSPECTRA_API int nihspectra_num_bins(const nihspectra *h);
+
+/* |q| of each bin, in inverse length; n is the size of the buffer */
+NIHSPECTRA_API int nihspectra_get_q(nihspectra *h, float *q, size_t n);
+
+/*
+ * The spectrum of one observable averaged over the frames pushed so far, and its block averaged standard
+ * error; err may be NULL.  Observables that are switched off by tilt or area read as zeros.
+ */
+NIHSPECTRA_API int nihspectra_get_spectrum(nihspectra *h, int observable, float *spectrum, double *err, size_t n);
+
+/* the observable with the given printed name, e.g. "hq2" or "Im(hdmpar)", or -1 */
+NIHSPECTRA_API int nihspectra_find_observable(const char *name);
+NIHSPECTRA_API const char *nihspectra_observable_name(int observable);
+
+NIHSPECTRA_API const char *nihspectra_strerror(int code);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NIHSPECTRA_H_ */
@@ -0,0 +1,470 @@
+/*
+ * nihbatch.cpp
+ *
+ * Runs the analysis of many trajectories, each with several configurations,
+ * in one process.  The manifest lists the trajectories and the
+ * configurations, and every trajectory is analyzed with every configuration:
+ *
+ *   # name      where the frames are                 which frames (optional)
+ *   trajectory  rep01  dir=/data/rep01                 begin=1001 stride=2
+ *   trajectory  rep02  traj=/data/rep02.nihq           frames=50000
+ *   # name      analysis settings
+ *   config      g8     grid=8
+ *   config      g12n   grid=12 normal thickness=18.31 phi=0.0159 accum=kahan
+ *   config      g6t    grid=6 assign=tsc
+ *
+ * dir= is a directory holding LipidX.out, boxsizeX.out etc. and traj= a
+ * quantized trajectory written by nihquant; frames, lipids, begin, end and
+ * stride, and grid, thickness, phi, normal, accum and assign, mean what the NIHCode
+ * options of the same names do.
+ *
+ * Each job (a trajectory with a configuration) is split into chunks of the
+ * analyzed frames, and the chunks of all jobs are run on a work-stealing
+ * TaskPool, so that the chunks of small jobs fill the threads that large ones
+ * leave idle.  Every chunk reads its frames through its own source, seeking
+ * to its first frame, and the chunks of a job are merged in order as they
+ * finish (see SpectrumAnalyzer::merge).  The analyzers of a grid size share
+ * one set of FFTW plans, and the FFTW wisdom can be kept between runs.  The
+ * results of each job are written as NIHCode --qdata writes them, to
+ * <outdir>/<trajectory>_<config>.dat and the error bars to err<...>.dat.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "FrameSource.h"
+#include "SpectrumAnalyzer.h"
+#include "QData.h"
+#include "TaskPool.h"
+
+using namespace std;
+
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER; // one job's report at a time
+
+
+void print_usage(char **argv)
+{
+    cout << endl;
+    cout << "  Usage:-" << endl << endl;
+    cout << "\t" << argv[0] << " -m|--manifest file [-j|--threads nthreads] [-c|--chunk nframes] [-o|--outdir dir]"
+         << " [-w|--wisdom wisdomfile]" << endl;
+    cout << endl;
+    cout << "  Where:-" << endl;
+    cout << "\tfile      = the trajectories and configurations to analyze (required); every trajectory is analyzed" << endl;
+    cout << "\t            with every configuration.  One per line, # starting a comment:" << endl;
+    cout << "\t              trajectory name dir=directory|traj=file [frames=n] [lipids=n] [begin=n] [end=n] [stride=n]" << endl;
+    cout << "\t              config name grid=n [thickness=t] [phi=p] [normal] [accum=policy] [assign=scheme]" << endl;
+    cout << "\tnthreads  = threads running the jobs (default is one per core)." << endl;
+    cout << "\tnframes   = analyzed frames in each chunk a job is split into, rounded up to a power of 2 so that the block" << endl;
+    cout << "\t            averaged error bars are those of a single pass up to blocks of that length (default is 4096)." << endl;
+    cout << "\tdir       = directory the results are written to (default is the working directory)." << endl;
+    cout << "\twisdomfile= FFTW wisdom loaded before planning, if the file exists, and saved at the end." << endl;
+    cout << endl;
+    exit(1);
+}
+
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+
+/*
+ * A trajectory line of the manifest, and what is known about it once it has been opened.
+ */
+struct Trajectory{
+    Trajectory() : frames(0), nl(0), begin(1), end(0), stride(1), average(false), nanalyzed(0) {}
+
+    string name, dir, file;
+    int frames, nl, begin, end, stride;
+    Box ref;            // the box of the q values
+    bool average;       // whether ref is the average over the trajectory
+    long nanalyzed;     // the frames analyzed
+
+    FrameSource *open() const
+    {
+        if(!file.empty())
+            return new QuantizedFrameSource(file, frames);
+        return new TextFrameSource(frames, nl, false, NULL, dir);
+    }
+};
+
+
+/*
+ * A config line of the manifest.
+ */
+struct Config{
+    Config() : ngrid(0), calctilt(1.0), t0in(17.97264862), phi0in(0.01588405482), accum(ACCUM_DOUBLE), assign(ASSIGN_NGP) {}
+
+    string name;
+    int ngrid;
+    float calctilt, t0in, phi0in;
+    AccumulatorPolicy accum;
+    Assignment assign;
+};
+
+
+/*
+ * A trajectory analyzed with a configuration.  The chunks are merged into total in order: a chunk that
+ * finishes before those ahead of it waits in parts.
+ */
+struct Job{
+    Job(const Trajectory &t, const Config &c, long chunk)
+        : traj(t), conf(c), nchunks((t.nanalyzed + chunk - 1)/chunk), chunk(chunk), parts(nchunks, (SpectrumAnalyzer *) NULL),
+          merged(0), total(NULL), cpu(0), failed(false)
+    {
+        pthread_mutex_init(&lock, NULL);
+        config.ngrid = c.ngrid;
+        config.calctilt = c.calctilt;
+        config.t0in = c.t0in;
+        config.phi0in = c.phi0in;
+        config.accum = c.accum;
+        config.assign = c.assign;
+        config.lx_ref = (t.average ? t.ref.lx : 0);
+        config.ly_ref = (t.average ? t.ref.ly : 0);
+    }
+    ~Job() { pthread_mutex_destroy(&lock); }
+
+    const Trajectory &traj;
+    const Config &conf;
+    AnalyzerConfig config;
+    string out;
+    long nchunks, chunk;
+
+    pthread_mutex_t lock;       // guards the members below
+    vector<SpectrumAnalyzer *> parts;
+    long merged;                // the chunks merged into total so far
+    SpectrumAnalyzer *total;
+    double cpu;                 // seconds spent in the chunks
+    bool failed;
+};
+
+
+/**
+ * @brief Writes the results of a job whose chunks have all been merged
+ */
+static void finish(Job &job)
+{
+    SpectrumResult res = job.total->finalize();
+    string dir, base = job.out;
+    size_t slash = job.out.rfind('/');
+    if(slash != string::npos){
+        dir = job.out.substr(0, slash+1);
+        base = job.out.substr(slash+1);
+    }
+    bool analyzed = !job.failed; // every frame read and every chunk merged
+    bool ok = (analyzed && write_qdata(res, job.out, false) && write_qdata(res, dir + "err" + base, true));
+    job.failed = !ok;
+
+    pthread_mutex_lock(&output_lock);
+    cout << job.traj.name << "_" << job.conf.name << ": " << res.nframes << " frames of " << job.traj.nl
+         << " lipids on a " << job.config.ngrid << "x" << job.config.ngrid << " grid in " << job.nchunks
+         << " chunk(s), " << job.cpu << " s";
+    if(ok)
+        cout << " -> " << job.out << endl;
+    else
+        cout << "; FAILED, " << (analyzed ? "could not write the results" : "frames missing") << endl;
+    pthread_mutex_unlock(&output_lock);
+
+    delete job.total;
+    job.total = NULL;
+}
+
+
+/*
+ * The analysis of one chunk of a job's frames.
+ */
+class ChunkTask : public Task{
+public:
+    ChunkTask(Job &job, long index) : job_(job), index_(index) {}
+
+    /**
+     * @brief A guess of the work, for running the largest chunks first: parsing the lipids plus the FFTs
+     */
+    double cost() const
+    {
+        const Trajectory &t = job_.traj;
+        long n = min(job_.chunk, t.nanalyzed - index_*job_.chunk);
+        double g = job_.config.ngrid;
+        return n*(6.0*t.nl + 20*g*g*log(g));
+    }
+
+    void run(TaskPool &)
+    {
+        double t0 = now();
+        const Trajectory &t = job_.traj;
+        FrameSource *source = t.open();
+        SpectrumAnalyzer *analyzer = new SpectrumAnalyzer(job_.config);
+
+        long first = index_*job_.chunk, last = min(first + job_.chunk, t.nanalyzed);
+        long frame = 0; // the frame next() reads
+        bool ok = true;
+        for(long a=first; ok && a<last; a++){
+            long want = t.begin-1 + a*t.stride;
+            while(ok && frame < want){
+                if(source->seek(want))
+                    frame = want;
+                else if(source->skip())
+                    frame++;
+                else
+                    ok = false;
+            }
+            if(ok && (ok = source->next())){
+                frame++;
+                analyzer->push_frame(source->head(), source->tail(), t.nl, source->box());
+            }
+        }
+        delete source;
+
+        pthread_mutex_lock(&job_.lock);
+        job_.cpu += now() - t0;
+        job_.failed = job_.failed || !ok;
+        job_.parts[index_] = analyzer;
+        while(job_.merged < job_.nchunks && job_.parts[job_.merged]){
+            SpectrumAnalyzer *part = job_.parts[job_.merged];
+            job_.parts[job_.merged] = NULL;
+            if(!job_.total)
+                job_.total = part;
+            else{
+                job_.failed = !job_.total->merge(*part) || job_.failed;
+                delete part;
+            }
+            job_.merged++;
+        }
+        bool done = (job_.merged == job_.nchunks);
+        pthread_mutex_unlock(&job_.lock);
+
+        if(done)
+            finish(job_);
+    }
+
+private:
+    Job &job_;
+    long index_;
+};
+
+
+static bool by_cost(const ChunkTask *a, const ChunkTask *b)
+{
+    return a->cost() < b->cost();
+}
+
+
+/**
+ * @brief Splits a manifest line into its keyword, name and key=value settings; exits on a malformed line
+ */
+static void parse_line(const string &line, int lineno, string &keyword, string &name, vector<pair<string, string> > &settings)
+{
+    istringstream in(line);
+    in >> keyword >> name;
+    string word;
+    while(in >> word){
+        size_t eq = word.find('=');
+        settings.push_back(make_pair(word.substr(0, eq), (eq == string::npos ? string() : word.substr(eq+1))));
+    }
+    if(name.empty() || name.find('/') != string::npos){
+        cout << endl << "Line " << lineno << " of the manifest has no name, or one with a /" << endl;
+        exit(1);
+    }
+}
+
+
+static void bad_setting(int lineno, const string &key)
+{
+    cout << endl << "Unknown or malformed setting " << key << " on line " << lineno << " of the manifest" << endl;
+    exit(1);
+}
+
+
+static void read_manifest(const string &path, vector<Trajectory> &trajs, vector<Config> &configs)
+{
+    ifstream in(path.c_str());
+    if(!in){
+        cout << endl << "Could not open the manifest " << path << endl;
+        exit(1);
+    }
+    string line;
+    for(int lineno=1; getline(in, line); lineno++){
+        size_t hash = line.find('#');
+        if(hash != string::npos)
+            line.erase(hash);
+        if(line.find_first_not_of(" \t\r") == string::npos)
+            continue;
+
+        string keyword, name;
+        vector<pair<string, string> > settings;
+        parse_line(line, lineno, keyword, name, settings);
+        if(keyword == "trajectory"){
+            Trajectory t;
+            t.name = name;
+            for(size_t s=0; s<settings.size(); s++){
+                const string &key = settings[s].first, &value = settings[s].second;
+                if(value.empty()) bad_setting(lineno, key);
+                else if(key == "dir") t.dir = value;
+                else if(key == "traj") t.file = value;
+                else if(key == "frames") t.frames = strtol(value.c_str(), NULL, 0);
+                else if(key == "lipids") t.nl = strtol(value.c_str(), NULL, 0);
+                else if(key == "begin") t.begin = strtol(value.c_str(), NULL, 0);
+                else if(key == "end") t.end = strtol(value.c_str(), NULL, 0);
+                else if(key == "stride") t.stride = strtol(value.c_str(), NULL, 0);
+                else bad_setting(lineno, key);
+            }
+            if(t.dir.empty() == t.file.empty() || t.frames < 0 || t.nl < 0 || t.begin < 1 || t.stride < 1
+               || (t.end > 0 && t.end < t.begin)){
+                cout << endl << "Trajectory " << name << " needs one of dir= or traj=, and 1 <= begin <= end, stride >= 1" << endl;
+                exit(1);
+            }
+            trajs.push_back(t);
+        }
+        else if(keyword == "config"){
+            Config c;
+            c.name = name;
+            for(size_t s=0; s<settings.size(); s++){
+                const string &key = settings[s].first, &value = settings[s].second;
+                if(key == "normal" && value.empty()) c.calctilt = 0.0;
+                else if(value.empty()) bad_setting(lineno, key);
+                else if(key == "grid") c.ngrid = strtol(value.c_str(), NULL, 0);
+                else if(key == "thickness") c.t0in = strtof(value.c_str(), NULL);
+                else if(key == "phi") c.phi0in = strtof(value.c_str(), NULL);
+                else if(key == "accum"){
+                    if(!parse_accumulator(value, c.accum)) bad_setting(lineno, key);
+                }
+                else if(key == "assign"){
+                    if(!parse_assignment(value, c.assign)) bad_setting(lineno, key);
+                }
+                else bad_setting(lineno, key);
+            }
+            if(c.ngrid <= 0 || c.ngrid % 2){
+                cout << endl << "Configuration " << name << " needs an even grid=" << endl;
+                exit(1);
+            }
+            configs.push_back(c);
+        }
+        else{
+            cout << endl << "Line " << lineno << " of the manifest is neither a trajectory nor a config" << endl;
+            exit(1);
+        }
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    string manifest, outdir, wisdom;
+    int nthreads = 0;
+    long chunk = 4096;
+
+    static struct option long_options[] =
+    {
+        {"manifest", required_argument, 0, 'm'},
+        {"threads",  required_argument, 0, 'j'},
+        {"chunk",    required_argument, 0, 'c'},
+        {"outdir",   required_argument, 0, 'o'},
+        {"wisdom",   required_argument, 0, 'w'},
+        {"help",     no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+    while(1){
+        int option_index = 0;
+        int c = getopt_long_only(argc, argv, "hm:j:c:o:w:", long_options, &option_index);
+        if(c == -1)
+            break;
+        switch(c){
+        case 'm': manifest = optarg; break;
+        case 'j': nthreads = strtol(optarg, NULL, 0); break;
+        case 'c': chunk = strtol(optarg, NULL, 0); break;
+        case 'o': outdir = optarg; break;
+        case 'w': wisdom = optarg; break;
+        default: print_usage(argv);
+        }
+    }
+    if(manifest.empty() || nthreads < 0 || chunk < 1)
+        print_usage(argv);
+    long pow2 = 1;
+    while(pow2 < chunk) pow2 <<= 1;
+    chunk = pow2;
+
+    vector<Trajectory> trajs;
+    vector<Config> configs;
+    read_manifest(manifest, trajs, configs);
+    if(trajs.empty() || configs.empty()){
+        cout << endl << "The manifest needs at least one trajectory and one config" << endl;
+        exit(1);
+    }
+    if(!outdir.empty()){
+        mkdir(outdir.c_str(), 0755);
+        outdir += "/";
+    }
+
+    // open every trajectory once up front, for its size, its box and, by seeking, the frame indices the chunks
+    // then share instead of each building them
+    for(size_t t=0; t<trajs.size(); t++){
+        Trajectory &traj = trajs[t];
+        FrameSource *source = traj.open();
+        traj.nl = source->nlipids();
+        long total = source->nframes();
+        if(traj.end > 0 && traj.end < total)
+            total = traj.end;
+        traj.average = source->reference_box(traj.ref, traj.begin-1, total, traj.stride);
+        traj.nanalyzed = (total >= traj.begin ? (total - traj.begin)/traj.stride + 1 : 0);
+        source->seek(traj.begin-1);
+        delete source;
+        if(traj.nanalyzed <= 0 || traj.ref.lx <= 0){
+            cout << endl << "Trajectory " << traj.name << " has no frames to analyze" << endl;
+            exit(1);
+        }
+        cout << "Trajectory " << traj.name << ": " << traj.nanalyzed << " frames of " << traj.nl << " lipids" << endl;
+    }
+
+    if(!wisdom.empty() && SpectrumAnalyzer::import_wisdom(wisdom))
+        cout << "FFTW wisdom loaded from " << wisdom << endl;
+
+    vector<Job *> jobs;
+    vector<ChunkTask *> tasks;
+    for(size_t t=0; t<trajs.size(); t++){
+        for(size_t c=0; c<configs.size(); c++){
+            Job *job = new Job(trajs[t], configs[c], chunk);
+            job->out = outdir + trajs[t].name + "_" + configs[c].name + ".dat";
+            jobs.push_back(job);
+            for(long k=0; k<job->nchunks; k++)
+                tasks.push_back(new ChunkTask(*job, k));
+        }
+    }
+
+    // the pool hands each thread's newest task out first and thieves take the oldest, so in increasing cost
+    // each thread starts on its largest chunks and the small ones are left to fill the gaps at the end
+    stable_sort(tasks.begin(), tasks.end(), by_cost);
+    double t0 = now();
+    TaskPool pool(nthreads);
+    cout << jobs.size() << " job(s) in " << tasks.size() << " chunk(s) on " << pool.nthreads() << " thread(s)" << endl;
+    for(size_t k=0; k<tasks.size(); k++)
+        pool.submit(tasks[k]);
+    pool.wait();
+    cout << "All jobs done in " << now() - t0 << " s" << endl;
+    pool.print_stats(cout);
+
+    if(!wisdom.empty() && !SpectrumAnalyzer::export_wisdom(wisdom))
+        cout << "Could not save the FFTW wisdom to " << wisdom << endl;
+
+    int failed = 0;
+    for(size_t j=0; j<jobs.size(); j++){
+        failed += jobs[j]->failed;
+        delete jobs[j];
+    }
+    if(failed)
+        cout << failed << " job(s) failed" << endl;
+    return (failed ? 1 : 0);
+}
@@ -0,0 +1,548 @@
+/*
+ * nihbench.cpp
+ *
+ * Times the kernels of the per-frame analysis one at a time, on synthetic
+ * frames (see SyntheticMembrane) over a range of grid sizes and lipid counts:
+ *
+ *   parse_text   reading a frame of the text trajectories        (lipids only)
+ *   parse_quant  reading a frame of a quantized trajectory       (lipids only)
+ *   wrap         PBC wrapping and the directors                  (lipids only)
+ *   leaflets     the monolayers and the stray lipids             (lipids only)
+ *   bin          the lipids into patches
+ *   fill_empty   empty patches from their neighbors
+ *   normals      the surface normals by spectral derivatives     (grid only)
+ *   tilt         the tilt and director fields
+ *   r2c          the r2c FFTs of every field of a frame          (grid only)
+ *   full_arrays  the full arrays of all of them                  (grid only)
+ *   fullArray    one call of fullArray()                         (grid only)
+ *   decompose    the parallel and perpendicular parts            (grid only)
+ *   power        the power spectra of the frame                  (grid only)
+ *   accumulate   the sums over frames                            (grid only)
+ *   qav          one call of qav()                               (grid only)
+ *
+ * The kernels that depend only on the lipids run with the first grid, and
+ * those that depend only on the grid with the last lipid count.  Each
+ * kernel runs a few times to warm up, then until it has taken the minimum
+ * time; each run is timed on its own, after the untimed steps that restore
+ * its input.  The process is pinned to one CPU, and FFTW is given a single
+ * thread.
+ *
+ * The results are written as JSON, one result per line, which --baseline
+ * compares with the results of an earlier run: a kernel whose median time
+ * grew by more than the tolerance is reported as a regression, and the exit
+ * status is then 1.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <getopt.h>
+
+#include "FrameSource.h"
+#include "QuantizedTrajectory.h"
+#include "SpectrumAnalyzer.h"
+#include "SyntheticMembrane.h"
+
+using namespace std;
+
+
+void print_usage(char **argv)
+{
+    cout << endl;
+    cout << "  Usage:-" << endl << endl;
+    cout << "\t" << argv[0] << " [-g|--grids grids] [-l|--lipids lipids] [-k|--kernels kernels] [-t|--time time]" << endl;
+    cout << "\t\t[-w|--warmup warmup] [-C|--cpu cpu] [-o|--out file] [-b|--baseline file [-T|--tol tol]]" << endl;
+    cout << endl;
+    cout << "  Where:-" << endl;
+    cout << "\tgrids   = comma separated grid sizes (default is 16,32,64,128,256,512)." << endl;
+    cout << "\tlipids  = comma separated lipid counts (default is 1000,10000,100000,1000000)." << endl;
+    cout << "\tkernels = comma separated kernels to time (default is all of them; see the source for the list)." << endl;
+    cout << "\ttime    = seconds each kernel is timed for at each size, at least 5 runs (default is 0.2)." << endl;
+    cout << "\twarmup  = untimed runs before that (default is 3)." << endl;
+    cout << "\tcpu     = CPU to pin the process to, or -1 not to pin it (default is 0)." << endl;
+    cout << "\tfile    = JSON file to write the results to (--out), or the results of an earlier run to compare" << endl;
+    cout << "\t          with (--baseline)." << endl;
+    cout << "\ttol     = slowdown of the median time beyond which a kernel is reported as a regression, as a" << endl;
+    cout << "\t          fraction (default is 0.1)." << endl;
+    cout << endl;
+    exit(1);
+}
+
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+
+/*
+ * One synthetic frame at one grid size and lipid count, analyzed once so that every kernel finds its input
+ * in the workspace.
+ */
+struct BenchFrame{
+    BenchFrame(int ngrid, int nl);
+    ~BenchFrame();
+
+    int ngrid, nl;
+    vector<float> head, tail;
+    Box box;
+    SpectrumAnalyzer *analyzer;
+    FrameWorkspace *w;
+    vector<float> qav_out;
+
+    void load() { analyzer->load(*w, Coordinates(&head[0]), Coordinates(&tail[0]), nl, box); }
+};
+
+
+BenchFrame::BenchFrame(int ngrid_, int nl_) : ngrid(ngrid_), nl(nl_), head(3*(size_t) nl_), tail(3*(size_t) nl_)
+{
+    SynthConfig synth;
+    synth.nl = nl;
+    synth.frames = 1;
+    synth.ngrid = min(ngrid, 64); // the fine grid of the fields grows as its square
+    SyntheticMembrane membrane(synth);
+    membrane.frame(&head[0], &tail[0], box);
+
+    AnalyzerConfig config;
+    config.ngrid = ngrid;
+    analyzer = new SpectrumAnalyzer(config);
+    w = new FrameWorkspace(ngrid);
+    load();
+    analyzer->preprocess(*w);
+    analyzer->bin(*w);
+    analyzer->transform(*w);
+    analyzer->accumulate(*w);
+    qav_out.resize(analyzer->num_uniq());
+}
+
+
+BenchFrame::~BenchFrame()
+{
+    delete w;
+    delete analyzer;
+}
+
+
+/*
+ * The same frames written to disk, for the parsers.
+ */
+struct BenchFiles{
+    BenchFiles(const BenchFrame &frame, int frames);
+    ~BenchFiles();
+
+    string dir, quant;
+    int frames;
+};
+
+
+BenchFiles::BenchFiles(const BenchFrame &frame, int frames_) : frames(frames_)
+{
+    char tmpl[] = "/tmp/nihbenchXXXXXX";
+    if(!mkdtemp(tmpl)){
+        cout << "Could not create a directory for the trajectories" << endl;
+        exit(1);
+    }
+    dir = tmpl;
+    quant = dir + "/frames.nihq";
+    TextTrajectoryWriter *text = new TextTrajectoryWriter(dir);
+    QuantizedWriter writer(quant, frame.nl);
+    for(int f=0; f<frames; f++){
+        text->write(&frame.head[0], &frame.tail[0], frame.nl, frame.box);
+        writer.write(Coordinates(&frame.head[0]), Coordinates(&frame.tail[0]), frame.box);
+    }
+    delete text;
+    writer.close();
+}
+
+
+BenchFiles::~BenchFiles()
+{
+    const char *files[] = {"LipidX.out", "LipidY.out", "LipidZ.out", "boxsizeX.out", "boxsizeY.out", "boxsizeZ.out",
+                           "frames.nihq"};
+    for(int i=0; i<7; i++)
+        unlink((dir + "/" + files[i]).c_str());
+    rmdir(dir.c_str());
+}
+
+
+enum Depends{ DEP_LIPIDS, DEP_GRID, DEP_BOTH };
+
+
+/*
+ * A kernel: prepare() restores its input, untimed, and run() is what is timed.
+ */
+class Kernel{
+public:
+    Kernel(const char *name, Depends depends) : name_(name), depends_(depends) {}
+    virtual ~Kernel() {}
+
+    virtual void setup(BenchFrame &f, BenchFiles *files) { f_ = &f; files_ = files; }
+    virtual void prepare() {}
+    virtual void run() = 0;
+    virtual void teardown() {}
+
+    const char *name() const { return name_; }
+    Depends depends() const { return depends_; }
+
+protected:
+    const char *name_;
+    Depends depends_;
+    BenchFrame *f_;
+    BenchFiles *files_;
+};
+
+
+// a frame source that is opened again, untimed, once it has read every frame
+class ParseKernel : public Kernel{
+public:
+    ParseKernel(const char *name, bool text) : Kernel(name, DEP_LIPIDS), text_(text), source_(NULL) {}
+
+    void prepare()
+    {
+        if(source_ && left_ > 0)
+            return;
+        delete source_;
+        if(text_)
+            source_ = new TextFrameSource(files_->frames, f_->nl, false, NULL, files_->dir);
+        else
+            source_ = new QuantizedFrameSource(files_->quant, files_->frames);
+        left_ = files_->frames;
+    }
+    void run()
+    {
+        source_->next();
+        left_--;
+    }
+    void teardown()
+    {
+        delete source_;
+        source_ = NULL;
+    }
+
+private:
+    bool text_;
+    FrameSource *source_;
+    int left_;
+};
+
+
+#define STAGE_KERNEL(Class, label, dep, before, timed) \
+class Class : public Kernel{ \
+public: \
+    Class() : Kernel(label, dep) {} \
+    void prepare() { SpectrumAnalyzer &a = *f_->analyzer; FrameWorkspace &w = *f_->w; (void) a; (void) w; before; } \
+    void run() { SpectrumAnalyzer &a = *f_->analyzer; FrameWorkspace &w = *f_->w; timed; } \
+};
+
+// the kernels that change their own input get it back from the ones before them
+STAGE_KERNEL(WrapKernel, "wrap", DEP_LIPIDS, f_->load(), a.wrap(w))
+STAGE_KERNEL(LeafletsKernel, "leaflets", DEP_LIPIDS, f_->load(); a.wrap(w), a.leaflets(w))
+STAGE_KERNEL(BinKernel, "bin", DEP_BOTH, , a.bin_lipids(w))
+STAGE_KERNEL(FillEmptyKernel, "fill_empty", DEP_BOTH, a.bin_lipids(w), a.fill_empty(w))
+STAGE_KERNEL(NormalsKernel, "normals", DEP_GRID, , a.normals(w))
+STAGE_KERNEL(TiltKernel, "tilt", DEP_BOTH, , a.tilt_fields(w))
+STAGE_KERNEL(R2cKernel, "r2c", DEP_GRID, , a.forward_transforms(w))
+STAGE_KERNEL(FullArraysKernel, "full_arrays", DEP_GRID, a.forward_transforms(w), a.full_arrays(w))
+STAGE_KERNEL(FullArrayKernel, "fullArray", DEP_GRID, a.forward_transforms(w),
+             a.fullArray(w.hqR, w.hqI, w.hqS, sqrt(w.box.lx*w.box.ly)))
+STAGE_KERNEL(DecomposeKernel, "decompose", DEP_GRID, , a.decompose(w))
+STAGE_KERNEL(PowerKernel, "power", DEP_GRID, , a.power(w))
+STAGE_KERNEL(AccumulateKernel, "accumulate", DEP_GRID, , a.accumulate(w))
+STAGE_KERNEL(QavKernel, "qav", DEP_GRID, fill(f_->qav_out.begin(), f_->qav_out.end(), 0.0f),
+             a.qav(w.fq2[OBS_HQ2], &f_->qav_out[0], 1))
+
+
+struct Result{
+    string kernel;
+    int ngrid, nl;
+    long reps;
+    double min, median, mean, stddev, p90; // ns
+};
+
+
+/**
+ * @brief Warms a kernel up and times it
+ */
+static Result measure(Kernel &k, int ngrid, int nl, double min_time, int warmup)
+{
+    for(int i=0; i<warmup; i++){
+        k.prepare();
+        k.run();
+    }
+    vector<double> t;
+    double total = 0;
+    while((total < min_time || t.size() < 5) && t.size() < 100000){
+        k.prepare();
+        double start = now();
+        k.run();
+        double dt = now() - start;
+        t.push_back(1e9*dt);
+        total += dt;
+    }
+    k.teardown();
+
+    Result r;
+    r.kernel = k.name();
+    r.ngrid = ngrid;
+    r.nl = nl;
+    r.reps = t.size();
+    double sum = 0, sum2 = 0;
+    for(size_t i=0; i<t.size(); i++){
+        sum += t[i];
+        sum2 += t[i]*t[i];
+    }
+    r.mean = sum/t.size();
+    r.stddev = sqrt(max(0.0, sum2/t.size() - r.mean*r.mean));
+    sort(t.begin(), t.end());
+    r.min = t[0];
+    r.median = t[t.size()/2];
+    r.p90 = t[(size_t) (0.9*(t.size()-1))];
+    return r;
+}
+
+
+static void print_result(const Result &r)
+{
+    printf("%-12s %6d %8d %7ld %14.0f %14.0f %12.1f%%\n", r.kernel.c_str(), r.ngrid, r.nl, r.reps, r.min, r.median,
+           100*r.stddev/r.mean);
+    fflush(stdout);
+}
+
+
+static bool write_json(const vector<Result> &results, const string &path, int cpu, double min_time)
+{
+    FILE *fp = fopen(path.c_str(), "w");
+    if(!fp)
+        return false;
+    fprintf(fp, "{\n  \"benchmark\": \"nihbench\",\n  \"cpu\": %d,\n  \"min_time\": %g,\n  \"results\": [\n", cpu, min_time);
+    for(size_t i=0; i<results.size(); i++){
+        const Result &r = results[i];
+        fprintf(fp, "    {\"kernel\": \"%s\", \"ngrid\": %d, \"nl\": %d, \"reps\": %ld, \"min_ns\": %.0f, \"median_ns\": %.0f, "
+                "\"mean_ns\": %.0f, \"stddev_ns\": %.0f, \"p90_ns\": %.0f}%s\n", r.kernel.c_str(), r.ngrid, r.nl, r.reps,
+                r.min, r.median, r.mean, r.stddev, r.p90, (i+1 < results.size() ? "," : ""));
+    }
+    fprintf(fp, "  ]\n}\n");
+    return fclose(fp) == 0;
+}
+
+
+/**
+ * @brief Reads the results written by write_json(), one per line; exits if the file cannot be read
+ */
+static vector<Result> read_json(const string &path)
+{
+    ifstream in(path.c_str());
+    if(!in){
+        cout << "Could not open the baseline " << path << endl;
+        exit(1);
+    }
+    vector<Result> results;
+    string line;
+    while(getline(in, line)){
+        char name[64];
+        Result r;
+        if(sscanf(line.c_str(), " {\"kernel\": \"%63[^\"]\", \"ngrid\": %d, \"nl\": %d, \"reps\": %ld, \"min_ns\": %lf, "
+                  "\"median_ns\": %lf, \"mean_ns\": %lf, \"stddev_ns\": %lf, \"p90_ns\": %lf", name, &r.ngrid, &r.nl,
+                  &r.reps, &r.min, &r.median, &r.mean, &r.stddev, &r.p90) == 9){
+            r.kernel = name;
+            results.push_back(r);
+        }
+    }
+    return results;
+}
+
+
+/**
+ * @brief Prints the change of each kernel's median time since the baseline
+ * @return the number of regressions
+ */
+static int compare(const vector<Result> &results, const vector<Result> &baseline, double tol)
+{
+    map<string, const Result *> old;
+    for(size_t i=0; i<baseline.size(); i++){
+        ostringstream key;
+        key << baseline[i].kernel << " " << baseline[i].ngrid << " " << baseline[i].nl;
+        old[key.str()] = &baseline[i];
+    }
+    int regressions = 0;
+    cout << endl << "Compared with the baseline (median times):" << endl;
+    printf("%-12s %6s %8s %14s %14s %8s\n", "kernel", "ngrid", "nl", "before ns", "after ns", "change");
+    for(size_t i=0; i<results.size(); i++){
+        const Result &r = results[i];
+        ostringstream key;
+        key << r.kernel << " " << r.ngrid << " " << r.nl;
+        map<string, const Result *>::const_iterator it = old.find(key.str());
+        if(it == old.end())
+            continue;
+        double change = r.median/it->second->median - 1;
+        bool slower = change > tol;
+        regressions += slower;
+        printf("%-12s %6d %8d %14.0f %14.0f %+7.1f%%%s\n", r.kernel.c_str(), r.ngrid, r.nl, it->second->median,
+               r.median, 100*change, (slower ? "  REGRESSION" : ""));
+    }
+    return regressions;
+}
+
+
+/**
+ * @brief Splits a comma separated list of ints; exits on anything that is not a positive int
+ */
+static vector<int> parse_list(const char *s, char **argv)
+{
+    vector<int> out;
+    stringstream in(s);
+    string item;
+    while(getline(in, item, ',')){
+        char *end;
+        long v = strtol(item.c_str(), &end, 0);
+        if(*end || v <= 0)
+            print_usage(argv);
+        out.push_back(v);
+    }
+    return out;
+}
+
+
+int main(int argc, char **argv)
+{
+    vector<int> grids, lipids;
+    string kernel_list, outfile, baseline;
+    double min_time = 0.2, tol = 0.1;
+    int warmup = 3, cpu = 0;
+
+    static struct option long_options[] =
+    {
+        {"grids",    required_argument, 0, 'g'},
+        {"lipids",   required_argument, 0, 'l'},
+        {"kernels",  required_argument, 0, 'k'},
+        {"time",     required_argument, 0, 't'},
+        {"warmup",   required_argument, 0, 'w'},
+        {"cpu",      required_argument, 0, 'C'},
+        {"out",      required_argument, 0, 'o'},
+        {"baseline", required_argument, 0, 'b'},
+        {"tol",      required_argument, 0, 'T'},
+        {"help",     no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+    while(1){
+        int option_index = 0;
+        int c = getopt_long_only(argc, argv, "hg:l:k:t:w:C:o:b:T:", long_options, &option_index);
+        if(c == -1)
+            break;
+        switch(c){
+        case 'g': grids = parse_list(optarg, argv); break;
+        case 'l': lipids = parse_list(optarg, argv); break;
+        case 'k': kernel_list = optarg; break;
+        case 't': min_time = strtod(optarg, NULL); break;
+        case 'w': warmup = strtol(optarg, NULL, 0); break;
+        case 'C': cpu = strtol(optarg, NULL, 0); break;
+        case 'o': outfile = optarg; break;
+        case 'b': baseline = optarg; break;
+        case 'T': tol = strtod(optarg, NULL); break;
+        default: print_usage(argv);
+        }
+    }
+    if(grids.empty()){
+        int g[] = {16, 32, 64, 128, 256, 512};
+        grids.assign(g, g+6);
+    }
+    if(lipids.empty()){
+        int l[] = {1000, 10000, 100000, 1000000};
+        lipids.assign(l, l+4);
+    }
+    for(size_t i=0; i<grids.size(); i++){
+        if(grids[i] % 2)
+            print_usage(argv);
+    }
+    if(!(min_time > 0) || warmup < 0 || !(tol > 0))
+        print_usage(argv);
+
+    vector<Kernel *> kernels;
+    kernels.push_back(new ParseKernel("parse_text", true));
+    kernels.push_back(new ParseKernel("parse_quant", false));
+    kernels.push_back(new WrapKernel);
+    kernels.push_back(new LeafletsKernel);
+    kernels.push_back(new BinKernel);
+    kernels.push_back(new FillEmptyKernel);
+    kernels.push_back(new NormalsKernel);
+    kernels.push_back(new TiltKernel);
+    kernels.push_back(new R2cKernel);
+    kernels.push_back(new FullArraysKernel);
+    kernels.push_back(new FullArrayKernel);
+    kernels.push_back(new DecomposeKernel);
+    kernels.push_back(new PowerKernel);
+    kernels.push_back(new AccumulateKernel);
+    kernels.push_back(new QavKernel);
+    if(!kernel_list.empty()){
+        string list = "," + kernel_list + ",";
+        vector<Kernel *> chosen;
+        for(size_t i=0; i<kernels.size(); i++){
+            if(list.find(string(",") + kernels[i]->name() + ",") != string::npos)
+                chosen.push_back(kernels[i]);
+            else
+                delete kernels[i];
+        }
+        kernels.swap(chosen);
+        if(kernels.empty())
+            print_usage(argv);
+    }
+
+    if(cpu >= 0){
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if(sched_setaffinity(0, sizeof(set), &set) != 0)
+            cout << "Could not pin the process to CPU " << cpu << "; timing unpinned" << endl;
+    }
+
+    vector<Result> results;
+    printf("%-12s %6s %8s %7s %14s %14s %13s\n", "kernel", "ngrid", "nl", "reps", "min ns", "median ns", "stddev");
+    for(size_t l=0; l<lipids.size(); l++){
+        for(size_t g=0; g<grids.size(); g++){
+            bool first_grid = (g == 0), last_lipids = (l+1 == lipids.size());
+            BenchFrame frame(grids[g], lipids[l]);
+            BenchFiles *files = NULL;
+            for(size_t k=0; k<kernels.size(); k++){
+                Kernel &kernel = *kernels[k];
+                if((kernel.depends() == DEP_LIPIDS && !first_grid) || (kernel.depends() == DEP_GRID && !last_lipids))
+                    continue;
+                if(!files && dynamic_cast<ParseKernel *>(&kernel))
+                    files = new BenchFiles(frame, max(1, min(8, 200000/lipids[l])));
+                kernel.setup(frame, files);
+                Result r = measure(kernel, (kernel.depends() == DEP_LIPIDS ? 0 : grids[g]),
+                                   (kernel.depends() == DEP_GRID ? 0 : lipids[l]), min_time, warmup);
+                results.push_back(r);
+                print_result(r);
+            }
+            delete files;
+        }
+    }
+    for(size_t k=0; k<kernels.size(); k++)
+        delete kernels[k];
+
+    if(!outfile.empty() && !write_json(results, outfile, cpu, min_time)){
+        cout << "Could not write " << outfile << endl;
+        exit(1);
+    }
+    if(!baseline.empty()){
+        int regressions = compare(results, read_json(baseline), tol);
+        if(regressions){
+            cout << regressions << " kernels are more than " << 100*tol << "% slower than the baseline" << endl;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,195 @@
+/*
+ * nihquant.cpp
+ *
+ * Converts the text trajectories (LipidX.out, boxsizeX.out, ...) into a
+ * QuantizedTrajectory, which NIHCode reads with --traj.  With --verify the
+ * conversion is checked afterwards: every decoded coordinate must be within
+ * half the precision of the text, and the spectra computed from both must
+ * agree to a small fraction of their statistical error bars.
+ */
+
+#include <iostream>
+#include <stdlib.h>
+#include <math.h>
+#include <float.h>
+#include <getopt.h>
+
+#include "FrameSource.h"
+#include "QuantizedTrajectory.h"
+#include "SpectrumAnalyzer.h"
+
+using namespace std;
+
+
+void print_usage(char **argv)
+{
+    cout << endl;
+    cout << "  Usage:-" << endl << endl;
+    cout << "\t" << argv[0] << " -o|--out file [-p|--precision precision] [-f|--frames nframes] [-l|--lipids nlipids]" << endl;
+    cout << "\t\t[-V|--verify -g|--grid ngrid [-t|--tol tol]]" << endl;
+    cout << endl;
+    cout << "  Where:-" << endl;
+    cout << "\tfile      = quantized trajectory to write (required)." << endl;
+    cout << "\tprecision = spacing of the stored coordinates in Angstrom (default is " << default_precision << ")." << endl;
+    cout << "\tnframes   = number of frames to convert (default is every frame in the box files)." << endl;
+    cout << "\tnlipids   = number of lipids per frame (default is worked out from the text files)." << endl;
+    cout << "\tverify    = flag to compare the written file with the text files afterwards, coordinates and spectra." << endl;
+    cout << "\tngrid     = grid the spectra are compared on (required with --verify, even int)." << endl;
+    cout << "\ttol       = largest difference between the two spectra allowed by --verify, as a fraction of the" << endl;
+    cout << "\t            block averaged error bar of each q bin (default is 0.1)." << endl;
+    cout << endl;
+    exit(1);
+}
+
+
+/**
+ * @brief The largest difference between the coordinates of two sources, and whether it is within the
+ * rounding to the precision (allowing for the float representation of either)
+ */
+static bool compare_coordinates(const Coordinates &a, const Coordinates &b, int nl, float precision, double &max_err)
+{
+    bool ok = true;
+    const void *ca[3] = {a.x, a.y, a.z}, *cb[3] = {b.x, b.y, b.z};
+    for(int c=0; c<3; c++){
+        for(int i=0; i<nl; i++){
+            float va = *(const float *) ((const char *) ca[c] + i*a.stride);
+            float vb = *(const float *) ((const char *) cb[c] + i*b.stride);
+            double err = fabs((double) va - vb);
+            max_err = max(max_err, err);
+            ok = ok && err <= 0.5*precision + 4*FLT_EPSILON*fabs(va);
+        }
+    }
+    return ok;
+}
+
+
+/**
+ * @brief Reads two sources of the same trajectory side by side, comparing their coordinates and spectra
+ * @return 0 if they agree, 1 if not
+ */
+static int verify(const string &outfile, int frames, int nl, int ngrid, double tol)
+{
+    TextFrameSource text(frames, nl);
+    QuantizedFrameSource quant(outfile, frames);
+    SpectrumAnalyzer *analyzer[2];
+    Box box[2];
+    FrameSource *source[2] = {&text, &quant};
+    for(int s=0; s<2; s++){
+        AnalyzerConfig config;
+        config.ngrid = ngrid;
+        bool average = source[s]->reference_box(box[s]);
+        config.lx_ref = (average ? box[s].lx : 0);
+        config.ly_ref = (average ? box[s].ly : 0);
+        analyzer[s] = new SpectrumAnalyzer(config);
+    }
+
+    double max_err = 0;
+    int bad_frames = 0, nframes = 0;
+    while(text.next()){
+        if(!quant.next()){
+            cout << outfile << " has fewer frames than the text files" << endl;
+            return 1;
+        }
+        bool ok = compare_coordinates(text.head(), quant.head(), nl, quant.precision(), max_err)
+                  && compare_coordinates(text.tail(), quant.tail(), nl, quant.precision(), max_err);
+        Box bt = text.box(), bq = quant.box();
+        ok = ok && bt.lx == bq.lx && bt.ly == bq.ly && bt.lz == bq.lz;
+        bad_frames += !ok;
+        for(int s=0; s<2; s++)
+            analyzer[s]->push_frame(source[s]->head(), source[s]->tail(), nl, source[s]->box());
+        nframes++;
+    }
+    cout << "Coordinates: largest difference " << max_err << " A over " << nframes << " frames; "
+         << bad_frames << " frame(s) beyond half the precision of " << quant.precision() << " A" << endl;
+
+    SpectrumResult res[2] = {analyzer[0]->finalize(), analyzer[1]->finalize()};
+    double worst = 0, worst_rel = 0;
+    int worst_obs = 0, worst_bin = 0;
+    for(int obs=0; obs<NOBS; obs++){
+        for(size_t k=0; k<res[0].spectra[obs].size(); k++){
+            double a = res[0].spectra[obs][k], b = res[1].spectra[obs][k], err = res[0].errors[obs][k];
+            double diff = fabs(a - b);
+            if(diff == 0)
+                continue;
+            double rel = (err > 0 ? diff/err : HUGE_VAL);
+            if(rel > worst){
+                worst = rel;
+                worst_obs = obs;
+                worst_bin = k;
+            }
+            if(a != 0)
+                worst_rel = max(worst_rel, diff/fabs(a));
+        }
+    }
+    cout << "Spectra: largest difference " << worst << " error bars (" << obs_names[worst_obs] << ", q bin " << worst_bin
+         << "), largest relative difference " << worst_rel << endl;
+    delete analyzer[0];
+    delete analyzer[1];
+
+    bool ok = (bad_frames == 0 && worst <= tol);
+    cout << (ok ? "Verified" : "NOT verified") << " within " << tol << " error bars" << endl;
+    return (ok ? 0 : 1);
+}
+
+
+int main(int argc, char **argv)
+{
+    string outfile;
+    float precision = default_precision;
+    int frames = 0, nl = 0, ngrid = 0, check = 0;
+    double tol = 0.1;
+
+    static struct option long_options[] =
+    {
+        {"out",       required_argument, 0, 'o'},
+        {"precision", required_argument, 0, 'p'},
+        {"frames",    required_argument, 0, 'f'},
+        {"lipids",    required_argument, 0, 'l'},
+        {"verify",    no_argument,       0, 'V'},
+        {"grid",      required_argument, 0, 'g'},
+        {"tol",       required_argument, 0, 't'},
+        {"help",      no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+    while(1){
+        int option_index = 0;
+        int c = getopt_long_only(argc, argv, "ho:p:f:l:Vg:t:", long_options, &option_index);
+        if(c == -1)
+            break;
+        switch(c){
+        case 'o': outfile = optarg; break;
+        case 'p': precision = strtof(optarg, NULL); break;
+        case 'f': frames = strtol(optarg, NULL, 0); break;
+        case 'l': nl = strtol(optarg, NULL, 0); break;
+        case 'V': check = 1; break;
+        case 'g': ngrid = strtol(optarg, NULL, 0); break;
+        case 't': tol = strtod(optarg, NULL); break;
+        default: print_usage(argv);
+        }
+    }
+    if(outfile.empty() || !(precision > 0) || frames < 0 || nl < 0 || (check && (ngrid <= 0 || ngrid % 2)))
+        print_usage(argv);
+
+    TextFrameSource *source = new TextFrameSource(frames, nl);
+    nl = source->nlipids();
+    frames = source->nframes();
+    QuantizedWriter writer(outfile, nl, precision);
+    long long numbers = 0;
+    while(source->next()){
+        writer.write(source->head(), source->tail(), source->box());
+        numbers += 6*nl;
+    }
+    bool failed = source->failed();
+    delete source;
+    writer.close();
+    if(failed){
+        cout << "Stopped at a frame that could not be read; " << outfile << " holds only the frames before it" << endl;
+        return 1;
+    }
+    cout << writer.nframes() << " frames of " << nl << " lipids written to " << outfile << ": "
+         << (double) writer.bytes()/numbers << " bytes per coordinate at a precision of " << precision << " A" << endl;
+
+    if(check)
+        return verify(outfile, writer.nframes(), nl, ngrid, tol);
+    return 0;
+}
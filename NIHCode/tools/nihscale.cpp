@@ -0,0 +1,502 @@
+/*
+ * nihscale.cpp
+ *
+ * Runs the whole analysis on synthetic trajectories (see SyntheticMembrane)
+ * over every combination of a list of thread counts, grid sizes and lipid
+ * counts, and reports for each run the frames and lipids analyzed per second,
+ * the peak resident memory, the time per frame spent in each stage, and how
+ * well it scales:
+ *
+ *   strong  the speedup over the serial run of the same grid and lipids,
+ *           divided by the threads
+ *   weak    the lipids per second over those of the serial run of the same
+ *           grid with 1/threads of the lipids, divided by the threads; the
+ *           serial rate is interpolated (log-log) between the lipid counts of
+ *           the sweep, and is left out outside them
+ *
+ * One thread analyzes the frames serially; more run the FramePipeline with
+ * that many threads shared between its preprocess, bin and transform stages
+ * in proportion to the time each took in the serial run, at least one each
+ * (the reader thread and the main thread, which accumulates, are not
+ * counted).  Each stage's time is the time its threads spent working, summed
+ * over them, per frame.
+ *
+ * Each trajectory is generated once per lipid count, as a QuantizedTrajectory
+ * in a temporary directory, and removed once its runs are done.  Each run is
+ * a child process of its own, so that its peak memory is its own.
+ */
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "FramePipeline.h"
+#include "FrameSource.h"
+#include "QuantizedTrajectory.h"
+#include "SpectrumAnalyzer.h"
+#include "SyntheticMembrane.h"
+
+using namespace std;
+
+static const char *stage_names[] = {"read", "preprocess", "bin", "transform", "accumulate"};
+static const int NSTAGES = FramePipeline::NSTAGES;
+
+
+void print_usage(char **argv)
+{
+    cout << endl;
+    cout << "  Usage:-" << endl << endl;
+    cout << "\t" << argv[0] << " [-n|--threads threads] [-g|--grids grids] [-l|--lipids lipids] [-f|--frames nframes]" << endl;
+    cout << "\t\t[-D|--queue-depth depth] [-d|--dir dir] [-o|--out file]" << endl;
+    cout << endl;
+    cout << "  Where:-" << endl;
+    cout << "\tthreads = comma separated thread counts; the serial run is added if 1 is not among them (default" << endl;
+    cout << "\t          is 1 and 3, 6, 12, ... up to the number of CPUs).  The pipeline needs one thread per stage, so" << endl;
+    cout << "\t          2 runs with 3." << endl;
+    cout << "\tgrids   = comma separated grid sizes (default is 16,64,256)." << endl;
+    cout << "\tlipids  = comma separated lipid counts (default is 1000,10000,100000,1000000)." << endl;
+    cout << "\tnframes = frames of each trajectory, all analyzed by every run (default is 20)." << endl;
+    cout << "\tdepth   = frames held between two stages of the pipeline (default is 4)." << endl;
+    cout << "\tdir     = directory the trajectories are generated in (default is /tmp)." << endl;
+    cout << "\tfile    = JSON file to write the results to." << endl;
+    cout << endl;
+    exit(1);
+}
+
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+
+struct Run{
+    int ngrid, nl, threads;
+    int split[NSTAGES]; // the threads of each stage
+    long frames;
+    double wall;        // s
+    double busy[NSTAGES]; // s, summed over the threads of the stage
+    long peak_rss;      // kB
+    bool ok;
+
+    double frames_per_s() const { return frames/wall; }
+    double lipids_per_s() const { return (double) frames*nl/wall; }
+    int used_threads() const { return (threads == 1 ? 1 : split[1] + split[2] + split[3]); }
+};
+
+
+class CountingSink : public PipelineSink{
+public:
+    bool frame_done(long) { return true; }
+};
+
+
+/**
+ * @brief Analyzes every frame of a trajectory, in this process
+ */
+static void analyze(const string &path, int frames, Run &run, int depth)
+{
+    QuantizedFrameSource source(path, frames);
+    AnalyzerConfig config;
+    config.ngrid = run.ngrid;
+    SpectrumAnalyzer analyzer(config);
+    memset(run.busy, 0, sizeof(run.busy));
+
+    if(run.threads == 1){
+        // the stages one after the other, as FramePipeline runs them serially, timed one by one
+        FrameWorkspace w(run.ngrid);
+        double start = now();
+        run.frames = 0;
+        while(true){
+            double t0 = now();
+            if(!source.next())
+                break;
+            analyzer.load(w, source.head(), source.tail(), source.nlipids(), source.box());
+            double t1 = now();
+            analyzer.preprocess(w);
+            double t2 = now();
+            analyzer.bin(w);
+            double t3 = now();
+            analyzer.transform(w);
+            double t4 = now();
+            analyzer.accumulate(w);
+            double t5 = now();
+            run.busy[0] += t1 - t0;
+            run.busy[1] += t2 - t1;
+            run.busy[2] += t3 - t2;
+            run.busy[3] += t4 - t3;
+            run.busy[4] += t5 - t4;
+            run.frames++;
+        }
+        run.wall = now() - start;
+        return;
+    }
+
+    PipelineConfig pc;
+    pc.preprocess_threads = run.split[FramePipeline::STAGE_PREPROCESS];
+    pc.bin_threads = run.split[FramePipeline::STAGE_BIN];
+    pc.transform_threads = run.split[FramePipeline::STAGE_TRANSFORM];
+    pc.depth = depth;
+    FramePipeline pipeline(analyzer, source, pc);
+    CountingSink sink;
+    double start = now();
+    run.frames = pipeline.run(0, 0, 1, sink);
+    run.wall = now() - start;
+    for(int s=0; s<NSTAGES; s++)
+        run.busy[s] = pipeline.busy((FramePipeline::Stage) s);
+}
+
+
+/**
+ * @brief Runs analyze() in a child process and collects its results and peak memory
+ */
+static void measure(const string &path, int frames, Run &run, int depth)
+{
+    int fd[2];
+    if(pipe(fd) != 0){
+        cout << "Could not create a pipe" << endl;
+        exit(1);
+    }
+    fflush(stdout);
+    cout.flush();
+    pid_t pid = fork();
+    if(pid < 0){
+        cout << "Could not fork" << endl;
+        exit(1);
+    }
+    if(pid == 0){
+        close(fd[0]);
+        analyze(path, frames, run, depth);
+        ssize_t n = write(fd[1], &run, sizeof(run));
+        _exit(n == (ssize_t) sizeof(run) ? 0 : 1);
+    }
+    close(fd[1]);
+    Run out;
+    ssize_t n = 0;
+    while(n < (ssize_t) sizeof(out)){
+        ssize_t r = read(fd[0], (char *) &out + n, sizeof(out) - n);
+        if(r <= 0)
+            break;
+        n += r;
+    }
+    close(fd[0]);
+    int status;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+    run.ok = (n == (ssize_t) sizeof(out) && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    if(run.ok){
+        run.frames = out.frames;
+        run.wall = out.wall;
+        memcpy(run.busy, out.busy, sizeof(run.busy));
+    }
+    run.peak_rss = usage.ru_maxrss;
+}
+
+
+/**
+ * @brief Writes a trajectory of nl lipids, in a child process so that the generator's memory is not counted
+ * against the runs
+ */
+static void generate(const string &path, int nl, int frames)
+{
+    fflush(stdout);
+    cout.flush();
+    pid_t pid = fork();
+    if(pid < 0){
+        cout << "Could not fork" << endl;
+        exit(1);
+    }
+    if(pid == 0){
+        SynthConfig synth;
+        synth.nl = nl;
+        synth.frames = frames;
+        synth.ngrid = 32; // the same trajectory is analyzed on every grid
+        SyntheticMembrane membrane(synth);
+        QuantizedWriter writer(path, nl);
+        vector<float> head(3*(size_t) nl), tail(3*(size_t) nl);
+        for(int f=0; f<frames; f++){
+            Box box;
+            membrane.frame(&head[0], &tail[0], box);
+            writer.write(Coordinates(&head[0]), Coordinates(&tail[0]), box);
+        }
+        writer.close();
+        _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0){
+        cout << "Could not generate " << path << endl;
+        exit(1);
+    }
+}
+
+
+/**
+ * @brief Shares the threads of a run between the preprocess, bin and transform stages, at least one each,
+ * handing each further thread to the stage with the most serial time per thread
+ */
+static void split_threads(Run &run, const Run &serial)
+{
+    for(int s=0; s<NSTAGES; s++)
+        run.split[s] = 1;
+    for(int t=3; t<run.threads; t++){
+        int best = FramePipeline::STAGE_PREPROCESS;
+        for(int s=FramePipeline::STAGE_BIN; s<=FramePipeline::STAGE_TRANSFORM; s++){
+            if(serial.busy[s]/run.split[s] > serial.busy[best]/run.split[best])
+                best = s;
+        }
+        run.split[best]++;
+    }
+}
+
+
+/**
+ * @brief The lipids per second of the serial runs of a grid at nl lipids, interpolated log-log between the
+ * lipid counts of the sweep
+ * @return 0 if nl is outside them
+ */
+static double serial_rate(const vector<Run> &runs, int ngrid, double nl)
+{
+    const Run *below = NULL, *above = NULL;
+    for(size_t i=0; i<runs.size(); i++){
+        const Run &r = runs[i];
+        if(r.threads != 1 || r.ngrid != ngrid || !r.ok)
+            continue;
+        if(r.nl <= nl && (!below || r.nl > below->nl))
+            below = &r;
+        if(r.nl >= nl && (!above || r.nl < above->nl))
+            above = &r;
+    }
+    if(!below || !above)
+        return 0;
+    if(below->nl == above->nl)
+        return below->lipids_per_s();
+    double f = log(nl/below->nl)/log((double) above->nl/below->nl);
+    return exp((1-f)*log(below->lipids_per_s()) + f*log(above->lipids_per_s()));
+}
+
+
+static double strong_efficiency(const vector<Run> &runs, const Run &run)
+{
+    for(size_t i=0; i<runs.size(); i++){
+        const Run &r = runs[i];
+        if(r.threads == 1 && r.ngrid == run.ngrid && r.nl == run.nl && r.ok)
+            return run.frames_per_s()/(r.frames_per_s()*run.used_threads());
+    }
+    return 0;
+}
+
+
+static double weak_efficiency(const vector<Run> &runs, const Run &run)
+{
+    double rate = serial_rate(runs, run.ngrid, (double) run.nl/run.used_threads());
+    return (rate > 0 ? run.lipids_per_s()/(rate*run.used_threads()) : 0);
+}
+
+
+static void print_table(const vector<Run> &runs)
+{
+    printf("\n%6s %8s %7s %7s %10s %12s %9s  %-44s %7s %7s\n", "ngrid", "nl", "threads", "split", "frames/s", "lipids/s",
+           "RSS(MB)", "ms/frame: read  preprocess  bin  transform  accum", "strong", "weak");
+    for(size_t i=0; i<runs.size(); i++){
+        const Run &r = runs[i];
+        char split[32];
+        if(r.threads == 1)
+            snprintf(split, sizeof(split), "serial");
+        else
+            snprintf(split, sizeof(split), "%d,%d,%d", r.split[1], r.split[2], r.split[3]);
+        if(!r.ok){
+            printf("%6d %8d %7d %7s   failed\n", r.ngrid, r.nl, r.threads, split);
+            continue;
+        }
+        char stages[80];
+        int n = 0;
+        for(int s=0; s<NSTAGES; s++)
+            n += snprintf(stages + n, sizeof(stages) - n, " %8.3f", 1e3*r.busy[s]/r.frames);
+        double es = strong_efficiency(runs, r), ew = weak_efficiency(runs, r);
+        char strong[16], weak[16];
+        snprintf(strong, sizeof(strong), (es > 0 ? "%.2f" : "-"), es);
+        snprintf(weak, sizeof(weak), (ew > 0 ? "%.2f" : "-"), ew);
+        printf("%6d %8d %7d %7s %10.2f %12.4g %9.1f %-46s %7s %7s\n", r.ngrid, r.nl, r.threads, split,
+               r.frames_per_s(), r.lipids_per_s(), r.peak_rss/1024.0, stages, strong, weak);
+    }
+}
+
+
+static bool write_json(const vector<Run> &runs, const string &path, int frames)
+{
+    FILE *fp = fopen(path.c_str(), "w");
+    if(!fp)
+        return false;
+    fprintf(fp, "{\n  \"benchmark\": \"nihscale\",\n  \"cpus\": %ld,\n  \"frames\": %d,\n  \"runs\": [\n",
+            sysconf(_SC_NPROCESSORS_ONLN), frames);
+    for(size_t i=0; i<runs.size(); i++){
+        const Run &r = runs[i];
+        fprintf(fp, "    {\"ngrid\": %d, \"nl\": %d, \"threads\": %d, \"split\": [%d, %d, %d], \"ok\": %s", r.ngrid, r.nl,
+                r.threads, r.split[1], r.split[2], r.split[3], (r.ok ? "true" : "false"));
+        if(r.ok){
+            fprintf(fp, ", \"frames\": %ld, \"wall_s\": %.6f, \"frames_per_s\": %.6g, \"lipids_per_s\": %.6g, "
+                    "\"peak_rss_kb\": %ld, \"stage_s_per_frame\": {", r.frames, r.wall, r.frames_per_s(),
+                    r.lipids_per_s(), r.peak_rss);
+            for(int s=0; s<NSTAGES; s++)
+                fprintf(fp, "%s\"%s\": %.6g", (s ? ", " : ""), stage_names[s], r.busy[s]/r.frames);
+            fprintf(fp, "}");
+            double es = strong_efficiency(runs, r), ew = weak_efficiency(runs, r);
+            if(es > 0)
+                fprintf(fp, ", \"strong_efficiency\": %.4f", es);
+            else
+                fprintf(fp, ", \"strong_efficiency\": null");
+            if(ew > 0)
+                fprintf(fp, ", \"weak_efficiency\": %.4f", ew);
+            else
+                fprintf(fp, ", \"weak_efficiency\": null");
+        }
+        fprintf(fp, "}%s\n", (i+1 < runs.size() ? "," : ""));
+    }
+    fprintf(fp, "  ]\n}\n");
+    return fclose(fp) == 0;
+}
+
+
+/**
+ * @brief Splits a comma separated list of ints; exits on anything that is not a positive int
+ */
+static vector<int> parse_list(const char *s, char **argv)
+{
+    vector<int> out;
+    stringstream in(s);
+    string item;
+    while(getline(in, item, ',')){
+        char *end;
+        long v = strtol(item.c_str(), &end, 0);
+        if(*end || v <= 0)
+            print_usage(argv);
+        out.push_back(v);
+    }
+    return out;
+}
+
+
+int main(int argc, char **argv)
+{
+    vector<int> threads, grids, lipids;
+    int frames = 20, depth = 4;
+    string dir = "/tmp", outfile;
+
+    static struct option long_options[] =
+    {
+        {"threads",     required_argument, 0, 'n'},
+        {"grids",       required_argument, 0, 'g'},
+        {"lipids",      required_argument, 0, 'l'},
+        {"frames",      required_argument, 0, 'f'},
+        {"queue-depth", required_argument, 0, 'D'},
+        {"dir",         required_argument, 0, 'd'},
+        {"out",         required_argument, 0, 'o'},
+        {"help",        no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+    while(1){
+        int option_index = 0;
+        int c = getopt_long_only(argc, argv, "hn:g:l:f:D:d:o:", long_options, &option_index);
+        if(c == -1)
+            break;
+        switch(c){
+        case 'n': threads = parse_list(optarg, argv); break;
+        case 'g': grids = parse_list(optarg, argv); break;
+        case 'l': lipids = parse_list(optarg, argv); break;
+        case 'f': frames = strtol(optarg, NULL, 0); break;
+        case 'D': depth = strtol(optarg, NULL, 0); break;
+        case 'd': dir = optarg; break;
+        case 'o': outfile = optarg; break;
+        default: print_usage(argv);
+        }
+    }
+    if(threads.empty()){
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads.push_back(3);
+        for(int t=6; t<=cpus; t*=2)
+            threads.push_back(t);
+    }
+    if(grids.empty()){
+        int g[] = {16, 64, 256};
+        grids.assign(g, g+3);
+    }
+    if(lipids.empty()){
+        int l[] = {1000, 10000, 100000, 1000000};
+        lipids.assign(l, l+4);
+    }
+    for(size_t i=0; i<grids.size(); i++){
+        if(grids[i] < 4 || grids[i] % 2)
+            print_usage(argv);
+    }
+    for(size_t i=0; i<lipids.size(); i++){
+        if(lipids[i] < 2)
+            print_usage(argv);
+    }
+    if(frames <= 0 || depth < 1)
+        print_usage(argv);
+    // the serial run first, which the others are split and compared by
+    threads.erase(remove(threads.begin(), threads.end(), 1), threads.end());
+    threads.insert(threads.begin(), 1);
+    for(size_t i=1; i<threads.size(); i++)
+        threads[i] = max(threads[i], 3);
+    sort(threads.begin(), threads.end());
+    threads.erase(unique(threads.begin(), threads.end()), threads.end());
+
+    string tmpl = dir + "/nihscaleXXXXXX";
+    vector<char> tmp(tmpl.begin(), tmpl.end());
+    tmp.push_back(0);
+    if(!mkdtemp(&tmp[0])){
+        cout << "Could not create a directory in " << dir << endl;
+        exit(1);
+    }
+    string tmpdir = &tmp[0];
+
+    vector<Run> runs;
+    for(size_t l=0; l<lipids.size(); l++){
+        ostringstream name;
+        name << tmpdir << "/synth" << lipids[l] << ".nihq";
+        string path = name.str();
+        cout << "Generating " << frames << " frames of " << lipids[l] << " lipids" << endl;
+        generate(path, lipids[l], frames);
+        for(size_t g=0; g<grids.size(); g++){
+            size_t serial = runs.size();
+            for(size_t t=0; t<threads.size(); t++){
+                Run run;
+                memset(&run, 0, sizeof(run));
+                run.ngrid = grids[g];
+                run.nl = lipids[l];
+                run.threads = threads[t];
+                if(threads[t] > 1)
+                    split_threads(run, runs[serial]);
+                cout << "  ngrid " << run.ngrid << ", " << run.threads << (run.threads == 1 ? " thread" : " threads")
+                     << endl;
+                measure(path, frames, run, depth);
+                runs.push_back(run);
+            }
+        }
+        unlink(path.c_str());
+    }
+    rmdir(tmpdir.c_str());
+
+    print_table(runs);
+    if(!outfile.empty() && !write_json(runs, outfile, frames)){
+        cout << "Could not write " << outfile << endl;
+        exit(1);
+    }
+    return 0;
+}
@@ -0,0 +1,271 @@
+/*
+ * nihspectra_demo.c
+ *
+ * A C caller of libnihspectra.so, and the check that the library finds the
+ * same spectra as the NIHCode program.  It reads a text trajectory (e.g. a
+ * synthetic membrane written by nihsynth --out) frame by frame, and pushes
+ * each frame twice: into one handle as float views straight into the
+ * component arrays of the Lipid*.out files, where heads and tails alternate,
+ * and into another as double views of interleaved x y z records, as an MD
+ * engine would hold them.  The spectra of both are then compared with the q
+ * data file NIHCode -q wrote for the same frames and grid, and the exit
+ * status is 1 if any value differs by more than the tolerance.
+ *
+ * make check-nihspectra runs nihsynth, NIHCode and this program in turn.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "nihspectra.h"
+
+#define NCOLS 8 /* the spectra of the q data file, after its q column */
+
+static const char *col_names[NCOLS] = {"umparq2", "umperq2", "hq2", "tq2", "dpparq2", "dpperq2", "dmparq2", "dmperq2"};
+
+
+static void print_usage(char **argv)
+{
+    printf("\n");
+    printf("  Usage:-\n\n");
+    printf("\t%s dir ngrid qdata [tol]\n\n", argv[0]);
+    printf("  Where:-\n");
+    printf("\tdir   = directory holding LipidX.out, LipidY.out, LipidZ.out and boxsizeX.out etc.\n");
+    printf("\tngrid = grid the q data file was made on (even int).\n");
+    printf("\tqdata = q data file NIHCode -q wrote for every frame of dir on that grid, with its defaults.\n");
+    printf("\ttol   = largest relative difference allowed in any value (default is 1e-4).\n");
+    printf("\n");
+    exit(1);
+}
+
+
+static FILE *open_file(const char *dir, const char *name)
+{
+    char path[4096];
+    FILE *fp;
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    fp = fopen(path, "r");
+    if(!fp){
+        printf("Could not open %s\n", path);
+        exit(1);
+    }
+    return fp;
+}
+
+
+/**
+ * @brief Reads the next n numbers of a file, one per line; exits if there are fewer.
+ */
+static void read_numbers(FILE *fp, const char *name, float *out, long n)
+{
+    char line[256];
+    long i;
+    for(i=0; i<n; i++){
+        if(!fgets(line, sizeof(line), fp)){
+            printf("%s ended early\n", name);
+            exit(1);
+        }
+        out[i] = strtof(line, NULL);
+    }
+}
+
+
+/**
+ * @brief The number of lines of a file.
+ */
+static long count_lines(FILE *fp)
+{
+    char buf[65536];
+    long n = 0;
+    size_t got, i;
+    while((got = fread(buf, 1, sizeof(buf), fp)) > 0){
+        for(i=0; i<got; i++)
+            n += (buf[i] == '\n');
+    }
+    rewind(fp);
+    return n;
+}
+
+
+/**
+ * @brief Compares the spectra of one handle with the q data file, matching the bins by q.
+ * @return the number of values further apart than tol
+ */
+static int compare(nihspectra *h, const char *label, float (*rows)[NCOLS+1], int nrows, double tol)
+{
+    int nbins = nihspectra_num_bins(h);
+    float *q = malloc(nbins*sizeof(float));
+    float *spectra[NCOLS];
+    double worst = 0;
+    int bad = 0, i, j, c;
+
+    nihspectra_get_q(h, q, nbins);
+    for(c=0; c<NCOLS; c++){
+        spectra[c] = malloc(nbins*sizeof(float));
+        nihspectra_get_spectrum(h, nihspectra_find_observable(col_names[c]), spectra[c], NULL, nbins);
+    }
+    if(nbins != nrows){
+        printf("%s: %d q bins, but the q data file has %d\n", label, nbins, nrows);
+        bad++;
+    }
+
+    for(i=0; i<nbins; i++){
+        /* the file is sorted by q and printed as 10*q in 1/nm */
+        int best = 0;
+        for(j=1; j<nrows; j++){
+            if(fabs(rows[j][0] - 10*q[i]) < fabs(rows[best][0] - 10*q[i]))
+                best = j;
+        }
+        if(fabs(rows[best][0] - 10*q[i]) > tol*fabs(rows[best][0]) + 1e-8){
+            printf("%s: no bin of the q data file at 10*q = %.8f\n", label, 10*q[i]);
+            bad++;
+            continue;
+        }
+        for(c=0; c<NCOLS; c++){
+            double ref = rows[best][c+1], diff = fabs(spectra[c][i] - ref);
+            /* the file holds 8 decimals */
+            if(diff > tol*fabs(ref) + 1e-8){
+                if(bad < 20)
+                    printf("%s: %s at 10*q = %.8f is %.8f, NIHCode has %.8f\n", label, col_names[c], 10*q[i], spectra[c][i], ref);
+                bad++;
+            }
+            if(ref != 0 && diff/fabs(ref) > worst)
+                worst = diff/fabs(ref);
+        }
+    }
+    printf("%s: %d frames, %d bins, largest relative difference %g, %d mismatches\n",
+           label, nihspectra_num_frames(h), nbins, worst, bad);
+
+    for(c=0; c<NCOLS; c++)
+        free(spectra[c]);
+    free(q);
+    return bad;
+}
+
+
+int main(int argc, char **argv)
+{
+    const char *dir, *qfile;
+    int ngrid, nrows = 0, cap = 64, bad = 0, err = NIHSPECTRA_OK;
+    double tol = 1e-4;
+    FILE *lipid[3], *boxf[3], *fp;
+    const char *lipid_names[3] = {"LipidX.out", "LipidY.out", "LipidZ.out"};
+    const char *box_names[3] = {"boxsizeX.out", "boxsizeY.out", "boxsizeZ.out"};
+    float *boxes[3], *xyz[3], lx_av = 0, ly_av = 0;
+    float (*rows)[NCOLS+1];
+    double (*records)[3];
+    long frames, nl, f, i;
+    int c;
+    char line[1024];
+    nihspectra_config cfg;
+    nihspectra *hf, *hd;
+
+    if(argc < 4 || argc > 5)
+        print_usage(argv);
+    dir = argv[1];
+    ngrid = atoi(argv[2]);
+    qfile = argv[3];
+    if(argc == 5)
+        tol = atof(argv[4]);
+    if(ngrid < 2 || ngrid % 2 || !(tol > 0))
+        print_usage(argv);
+
+    /* the boxes first, for the average box NIHCode takes the q values from */
+    for(c=0; c<3; c++){
+        boxf[c] = open_file(dir, box_names[c]);
+        lipid[c] = open_file(dir, lipid_names[c]);
+    }
+    frames = count_lines(boxf[0]);
+    nl = (frames > 0 ? count_lines(lipid[0])/(2*frames) : 0);
+    if(nl <= 0){
+        printf("%s holds no frames\n", dir);
+        return 1;
+    }
+    for(c=0; c<3; c++){
+        boxes[c] = malloc(frames*sizeof(float));
+        read_numbers(boxf[c], box_names[c], boxes[c], frames);
+        fclose(boxf[c]);
+        xyz[c] = malloc(2*nl*sizeof(float));
+    }
+    for(f=0; f<frames; f++){
+        lx_av += boxes[0][f];
+        ly_av += boxes[1][f];
+    }
+    records = malloc(2*nl*sizeof(*records));
+
+    nihspectra_config_init(&cfg);
+    cfg.ngrid = ngrid;
+    cfg.lx_ref = lx_av/frames;
+    cfg.ly_ref = ly_av/frames;
+    hf = nihspectra_create(&cfg);
+    hd = nihspectra_create(&cfg);
+    if(!hf || !hd){
+        printf("Could not create the analyses\n");
+        return 1;
+    }
+
+    for(f=0; f<frames && err == NIHSPECTRA_OK; f++){
+        double box[9] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+        for(c=0; c<3; c++){
+            read_numbers(lipid[c], lipid_names[c], xyz[c], 2*nl);
+            box[4*c] = boxes[c][f];
+        }
+
+        /* heads at the even entries of each component array, tails at the odd */
+        {
+            nihspectra_coords head = {xyz[0], xyz[1], xyz[2], 2*sizeof(float), NIHSPECTRA_FLOAT32};
+            nihspectra_coords tail = {xyz[0]+1, xyz[1]+1, xyz[2]+1, 2*sizeof(float), NIHSPECTRA_FLOAT32};
+            err = nihspectra_push_frame(hf, &head, &tail, nl, box);
+        }
+
+        /* x y z records of head and tail in turn, in double precision */
+        for(i=0; i<2*nl; i++){
+            for(c=0; c<3; c++)
+                records[i][c] = xyz[c][i];
+        }
+        if(err == NIHSPECTRA_OK){
+            nihspectra_coords head = {&records[0][0], &records[0][1], &records[0][2], 2*sizeof(*records), NIHSPECTRA_FLOAT64};
+            nihspectra_coords tail = {&records[1][0], &records[1][1], &records[1][2], 2*sizeof(*records), NIHSPECTRA_FLOAT64};
+            err = nihspectra_push_frame(hd, &head, &tail, nl, box);
+        }
+    }
+    if(err != NIHSPECTRA_OK){
+        printf("Frame %ld: %s\n", f, nihspectra_strerror(err));
+        return 1;
+    }
+
+    /* the q data file, after its header line */
+    fp = fopen(qfile, "r");
+    if(!fp || !fgets(line, sizeof(line), fp)){
+        printf("Could not read %s\n", qfile);
+        return 1;
+    }
+    rows = malloc(cap*sizeof(*rows));
+    while(fgets(line, sizeof(line), fp)){
+        char *p = line;
+        if(nrows == cap){
+            cap *= 2;
+            rows = realloc(rows, cap*sizeof(*rows));
+        }
+        for(c=0; c<NCOLS+1; c++)
+            rows[nrows][c] = strtof(p, &p);
+        nrows++;
+    }
+    fclose(fp);
+
+    bad += compare(hf, "float", rows, nrows, tol);
+    bad += compare(hd, "double", rows, nrows, tol);
+
+    nihspectra_destroy(hf);
+    nihspectra_destroy(hd);
+    for(c=0; c<3; c++){
+        fclose(lipid[c]);
+        free(boxes[c]);
+        free(xyz[c]);
+    }
+    free(records);
+    free(rows);
+    return (bad ? 1 : 0);
+}
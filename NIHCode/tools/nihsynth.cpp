@@ -0,0 +1,199 @@
+/*
+ * nihsynth.cpp
+ *
+ * Writes a synthetic membrane trajectory whose spectra are known, as text
+ * files (LipidX.out, boxsizeX.out, ...) and/or a QuantizedTrajectory, for
+ * validating NIHCode and benchmarking it at sizes that are hard to simulate.
+ *
+ * The fields, how the lipids are placed on them, their spectra, and how far
+ * NIHCode's measurement of those is expected to deviate are described in
+ * SyntheticMembrane.h; --analytic writes the spectra to first order in the
+ * q data format.  The frames are written as they are made.
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <math.h>
+#include <getopt.h>
+
+#include "QData.h"
+#include "QuantizedTrajectory.h"
+#include "SyntheticMembrane.h"
+
+using namespace std;
+
+
+void print_usage(char **argv)
+{
+    cout << endl;
+    cout << "  Usage:-" << endl << endl;
+    cout << "\t" << argv[0] << " -l|--lipids nlipids -f|--frames nframes -g|--grid ngrid" << endl;
+    cout << "\t\t[-o|--out dir] [-q|--quant file [-p|--precision precision]] [-a|--analytic file]" << endl;
+    cout << "\t\t[-k|--kappa kappa] [-S|--tension sigma] [-T|--tilt-modulus ktilt] [-K|--thickness-modulus kthick]" << endl;
+    cout << "\t\t[-A|--area area] [-t|--thickness t0] [-L|--length length] [-b|--box-fluct bfluct]" << endl;
+    cout << "\t\t[-c|--corr tau] [-D|--diffusion step] [-F|--flip pflip] [-s|--seed seed]" << endl;
+    cout << endl;
+    cout << "  Where:-" << endl;
+    cout << "\tnlipids   = number of lipids, split between the two monolayers (required)." << endl;
+    cout << "\tnframes   = number of frames (required)." << endl;
+    cout << "\tngrid     = grid the spectra are meant to be analyzed on; the fields have the modes it resolves" << endl;
+    cout << "\t            (required, even int)." << endl;
+    cout << "\tdir       = directory to write LipidX.out, LipidY.out, LipidZ.out and boxsizeX.out etc. into." << endl;
+    cout << "\tfile      = quantized trajectory to write (--quant), or q data file of the input spectra (--analytic)." << endl;
+    cout << "\t            At least one of dir and the quantized trajectory is required." << endl;
+    cout << "\tprecision = spacing of the stored coordinates of the quantized trajectory in Angstrom (default is "
+         << default_precision << ")." << endl;
+    cout << "\tkappa     = bending modulus in kT (default is 10)." << endl;
+    cout << "\tsigma     = tension in kT/nm^2 (default is 0)." << endl;
+    cout << "\tktilt     = tilt modulus in kT/nm^2 (default is 10)." << endl;
+    cout << "\tkthick    = thickness modulus in kT/nm^4 (default is 50)." << endl;
+    cout << "\tarea      = area per lipid in A^2 (default is 63)." << endl;
+    cout << "\tt0        = monolayer thickness, head to midplane, in A (default is 18)." << endl;
+    cout << "\tlength    = distance from head to tail in A (default is 15)." << endl;
+    cout << "\tbfluct    = relative rms fluctuation of the box length (default is 0.005)." << endl;
+    cout << "\ttau       = correlation time of the fields and the box in frames (default is 0, independent frames)." << endl;
+    cout << "\tstep      = rms step of each lipid in x and in y per frame, in A (default is 1)." << endl;
+    cout << "\tpflip     = probability per frame that a lipid moves to the other monolayer (default is 1e-4)." << endl;
+    cout << "\tseed      = seed of the random numbers; the same seed gives the same trajectory (default is 1)." << endl;
+    cout << endl;
+    exit(1);
+}
+
+
+/**
+ * @brief Writes the input spectra as the q data file NIHCode would, for the bins of a grid of ngrid and the
+ * average box
+ */
+static bool write_analytic(const SynthConfig &config, const string &path)
+{
+    int n = config.ngrid/2;
+    double lx = config.box_length();
+    SpectrumResult res;
+    res.nframes = config.frames;
+    res.ngrid = config.ngrid;
+    res.uniq = (config.ngrid+4)*(config.ngrid+2)/8;
+    res.uniq_Ny = config.ngrid*(config.ngrid+2)/8;
+    res.lx_av = res.ly_av = lx;
+    for(int k=0; k<NOBS; k++)
+        res.spectra[k].assign(res.uniq_Ny, 0);
+
+    // the bins in the analyzer's order: |nx| <= |ny| < ngrid/2
+    int c = 0;
+    double mm = config.tilt_spectrum()*1e-2;
+    for(int a1=0; a1<n; a1++){
+        for(int a2=a1; a2<n; a2++, c++){
+            double q = 2*M_PI*sqrt((double) a1*a1 + a2*a2)/lx;
+            res.q_Ny.push_back(q);
+            if(c == 0)
+                continue; // there is no q=0 mode
+            double hh = config.height_spectrum(q)*1e-4;
+            res.spectra[OBS_HQ2][c] = hh;
+            res.spectra[OBS_TQ2][c] = config.thickness_spectrum(q)*1e-4;
+            res.spectra[OBS_UMPARQ2][c] = q*q*1e2*hh + mm;
+            res.spectra[OBS_UMPERQ2][c] = mm;
+            res.spectra[OBS_DPPARQ2][c] = mm;
+            res.spectra[OBS_DPPERQ2][c] = mm;
+            res.spectra[OBS_DMPARQ2][c] = mm;
+            res.spectra[OBS_DMPERQ2][c] = mm;
+        }
+    }
+    return write_qdata(res, path, false);
+}
+
+
+int main(int argc, char **argv)
+{
+    SynthConfig config;
+    string outdir, quantfile, analyticfile;
+    float precision = default_precision;
+
+    static struct option long_options[] =
+    {
+        {"lipids",            required_argument, 0, 'l'},
+        {"frames",            required_argument, 0, 'f'},
+        {"grid",              required_argument, 0, 'g'},
+        {"out",               required_argument, 0, 'o'},
+        {"quant",             required_argument, 0, 'q'},
+        {"precision",         required_argument, 0, 'p'},
+        {"analytic",          required_argument, 0, 'a'},
+        {"kappa",             required_argument, 0, 'k'},
+        {"tension",           required_argument, 0, 'S'},
+        {"tilt-modulus",      required_argument, 0, 'T'},
+        {"thickness-modulus", required_argument, 0, 'K'},
+        {"area",              required_argument, 0, 'A'},
+        {"thickness",         required_argument, 0, 't'},
+        {"length",            required_argument, 0, 'L'},
+        {"box-fluct",         required_argument, 0, 'b'},
+        {"corr",              required_argument, 0, 'c'},
+        {"diffusion",         required_argument, 0, 'D'},
+        {"flip",              required_argument, 0, 'F'},
+        {"seed",              required_argument, 0, 's'},
+        {"help",              no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+    while(1){
+        int option_index = 0;
+        int c = getopt_long_only(argc, argv, "hl:f:g:o:q:p:a:k:S:T:K:A:t:L:b:c:D:F:s:", long_options, &option_index);
+        if(c == -1)
+            break;
+        switch(c){
+        case 'l': config.nl = strtol(optarg, NULL, 0); break;
+        case 'f': config.frames = strtol(optarg, NULL, 0); break;
+        case 'g': config.ngrid = strtol(optarg, NULL, 0); break;
+        case 'o': outdir = optarg; break;
+        case 'q': quantfile = optarg; break;
+        case 'p': precision = strtof(optarg, NULL); break;
+        case 'a': analyticfile = optarg; break;
+        case 'k': config.kappa = strtod(optarg, NULL); break;
+        case 'S': config.sigma = strtod(optarg, NULL); break;
+        case 'T': config.ktilt = strtod(optarg, NULL); break;
+        case 'K': config.kthick = strtod(optarg, NULL); break;
+        case 'A': config.area = strtod(optarg, NULL); break;
+        case 't': config.t0 = strtod(optarg, NULL); break;
+        case 'L': config.length = strtod(optarg, NULL); break;
+        case 'b': config.box_fluct = strtod(optarg, NULL); break;
+        case 'c': config.tau = strtod(optarg, NULL); break;
+        case 'D': config.step = strtod(optarg, NULL); break;
+        case 'F': config.flip = strtod(optarg, NULL); break;
+        case 's': config.seed = strtoul(optarg, NULL, 0); break;
+        default: print_usage(argv);
+        }
+    }
+    if(config.nl < 2 || config.frames <= 0 || config.ngrid < 4 || config.ngrid % 2 || !(precision > 0)
+       || (outdir.empty() && quantfile.empty()) || !(config.kappa > 0) || config.sigma < 0 || !(config.ktilt > 0)
+       || !(config.kthick > 0) || !(config.area > 0) || !(config.length > 0) || config.box_fluct < 0
+       || config.tau < 0 || config.step < 0 || config.flip < 0 || config.flip > 1)
+        print_usage(argv);
+
+    if(!analyticfile.empty() && !write_analytic(config, analyticfile)){
+        cout << "Could not write " << analyticfile << endl;
+        exit(1);
+    }
+
+    SyntheticMembrane membrane(config);
+    TextTrajectoryWriter *text = (outdir.empty() ? NULL : new TextTrajectoryWriter(outdir));
+    QuantizedWriter *quant = (quantfile.empty() ? NULL : new QuantizedWriter(quantfile, config.nl, precision));
+    vector<float> head(3*(size_t) config.nl), tail(3*(size_t) config.nl);
+    for(int f=0; f<config.frames; f++){
+        Box box;
+        membrane.frame(&head[0], &tail[0], box);
+        if(text)
+            text->write(&head[0], &tail[0], config.nl, box);
+        if(quant)
+            quant->write(Coordinates(&head[0]), Coordinates(&tail[0]), box);
+    }
+
+    cout << config.frames << " frames of " << config.nl << " lipids in a box of " << config.box_length() << " A";
+    if(text)
+        cout << ", " << text->bytes() << " bytes of text in " << outdir;
+    if(quant){
+        quant->close();
+        cout << ", " << quant->bytes() << " bytes in " << quantfile;
+    }
+    cout << endl;
+    delete text;
+    delete quant;
+    return 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * ringfeed.cpp
+ *
+ * Publishes the text trajectories (LipidX.out, boxsizeX.out, ...) frame by
+ * frame into a shared memory ring, as a running simulation would, so that
+ * NIHCode --shm can be tried and timed without one.  It also serves as the
+ * example of the producer side of FrameRing for MD engine plugins: acquire a
+ * slot, write the box, heads and tails into it, publish, and close the ring
+ * at the end.
+ */
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "FrameSource.h"
+#include "FrameRing.h"
+
+using namespace std;
+
+
+void print_usage(char **argv)
+{
+    cout << endl;
+    cout << "  Usage:-" << endl << endl;
+    cout << "\t" << argv[0] << " --shm name -f|--frames nframes -l|--lipids nlipids [-n|--slots nslots]" << endl;
+    cout << endl;
+    cout << "  Where:-" << endl;
+    cout << "\tname      = shared memory ring to create, e.g. /nihcode (required)." << endl;
+    cout << "\tnframes   = number of frames to publish (required, int)." << endl;
+    cout << "\tnlipids   = number of lipids per frame (required, int)." << endl;
+    cout << "\tnslots    = frames the ring holds before waiting for the reader (default is 8)." << endl;
+    cout << endl;
+    exit(1);
+}
+
+
+/**
+ * @brief Copies one group of coordinates into a slot, as x y z of each lipid
+ */
+static void put(const Coordinates &c, int nl, float *out)
+{
+    for(int i=0; i<nl; i++){
+        out[3*i+0] = *(const float *) ((const char *) c.x + i*c.stride);
+        out[3*i+1] = *(const float *) ((const char *) c.y + i*c.stride);
+        out[3*i+2] = *(const float *) ((const char *) c.z + i*c.stride);
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    string shmname;
+    int frames = 0, nl = 0, nslots = 8;
+
+    static struct option long_options[] =
+    {
+        {"shm",    required_argument, 0, 'm'},
+        {"frames", required_argument, 0, 'f'},
+        {"lipids", required_argument, 0, 'l'},
+        {"slots",  required_argument, 0, 'n'},
+        {"help",   no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+    while(1){
+        int option_index = 0;
+        int c = getopt_long_only(argc, argv, "hm:f:l:n:", long_options, &option_index);
+        if(c == -1)
+            break;
+        switch(c){
+        case 'm': shmname = optarg; break;
+        case 'f': frames = strtol(optarg, NULL, 0); break;
+        case 'l': nl = strtol(optarg, NULL, 0); break;
+        case 'n': nslots = strtol(optarg, NULL, 0); break;
+        default: print_usage(argv);
+        }
+    }
+    if(shmname.empty() || frames <= 0 || nl <= 0 || nslots <= 0)
+        print_usage(argv);
+
+    TextFrameSource source(frames, nl);
+    FrameRing *ring = FrameRing::create(shmname, nl, nslots);
+    if(!ring)
+        exit(1);
+    cout << "Publishing " << frames << " frames of " << nl << " lipids on " << shmname
+         << " (" << ring->nslots() << " slots)" << endl;
+
+    int published = 0;
+    while(source.next()){
+        float *slot = ring->acquire();
+        if(!slot)
+            break;
+        Box b = source.box();
+        float *box = FrameRing::box(slot);
+        box[0] = b.lx;
+        box[1] = b.ly;
+        box[2] = b.lz;
+        put(source.head(), nl, ring->head(slot));
+        put(source.tail(), nl, ring->tail(slot));
+        ring->publish();
+        published++;
+    }
+    ring->close();
+    ring->drain();
+    cout << published << " frames published" << endl;
+
+    delete ring;
+    if(source.failed()){
+        cout << "Stopped at a frame that could not be read" << endl;
+        return 1;
+    }
+    return 0;
+}